@@ -2,13 +2,23 @@
 #include "eventloop.hh"
 #include "helpers.hh"
 #include "network_interface.hh"
+#include "qdisc.hh"
 #include "router.hh"
 #include "socket.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <pthread.h>
 #include <random>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 
@@ -34,12 +44,21 @@ struct Ethernet_over_UDP : public NetworkInterface::OutputPort
 {
   UDPSocket socket_ {};
   Address physical_dest_;
+  string header_ {};
+  vector<Ref<string>> pieces_ {};
 
   explicit Ethernet_over_UDP( const Address& physical_dest ) : physical_dest_( physical_dest ) {}
 
   void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& x ) override
   {
-    socket_.send( serialize( x ), physical_dest_ );
+    // the Ethernet header, then the frame's own pieces (borrowed), in one sendmsg(); the list and the header's
+    // buffer are kept for the next frame
+    Serializer serializer { std::move( header_ ) };
+    x.serialize( serializer );
+    serializer.finish( pieces_ );
+    socket_.send( span { pieces_ }, physical_dest_ );
+    header_ = pieces_.front().release();
+    pieces_.clear();
   }
 };
 
@@ -49,18 +68,31 @@ void print_usage( const string_view argv0 )
        << "      <config> = interface:<name>:<virtual interface addr>:<physical local port>:<physical peer "
           "addr:port>\n"
        << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name> (directly attached)\n"
-       << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name>:<next-hop addr>\n\n";
+       << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name>:<next-hop addr>\n"
+       << "   with further equal-cost paths appended as +<interface_name>[:<next-hop addr>]\n"
+       << "   or <config> = qdisc:<interface_name>:<fifo|red|fq_codel>:<rate in kbit/s> (egress queue)\n"
+       << "   or <config> = acl:<interface_name>:<permit|deny>:<src addr>/<len>:<dst addr>/<len>"
+          "[:<tcp|udp|icmp|any>[:<dst port>[-<port>]]]\n"
+       << "   or <config> = acl:<interface_name>:<permit|deny> (for datagrams that match no rule)\n"
+       << "   or <config> = nat:<interface_name> (masquerade datagrams leaving through it behind its address)\n"
+       << "   or <config> = flows:<interface_name> (track its top flows, exported with the metrics)\n"
+       << "   or <config> = metrics:<file> (write the traffic counters there every second, for Prometheus)\n"
+       << "   or <config> = parallel (forward on a receive thread per interface and the Router's TX workers)\n\n"
+       << "While running, routes can be changed by writing lines to stdin:\n"
+       << "      route:... (as above) to add a route, or replace the one with the same prefix\n"
+       << "      withdraw:<prefix addr>:<prefix len> to remove a route\n"
+       << "SIGINT or SIGTERM stops the router.\n\n";
 }
 
-// Split a colon-delimited string into pieces
-void split_config( const string_view str, vector<string>& ret )
+// Split a colon-delimited (or otherwise delimited) string into pieces
+void split_config( const string_view str, vector<string>& ret, const char delimiter = ':' )
 {
   ret.clear();
 
   unsigned int field_start = 0; // start of next token
   for ( unsigned int i = 0; i < str.size(); i++ ) {
     const char ch = str[i];
-    if ( ch == ':' ) {
+    if ( ch == delimiter ) {
       ret.emplace_back( str.substr( field_start, i - field_start ) );
       field_start = i + 1;
     }
@@ -69,18 +101,112 @@ void split_config( const string_view str, vector<string>& ret )
   ret.emplace_back( str.substr( field_start ) );
 }
 
+// Add a route from a "route:..." config (false if it could not be parsed)
+bool apply_route_config( const string_view config,
+                         Router& router,
+                         const unordered_map<string, size_t>& iface_name_to_idx )
+{
+  // Equal-cost paths after the first are appended as "+<interface_name>[:<next-hop addr>]"
+  vector<string> pieces;
+  split_config( config, pieces, '+' );
+  vector<string> fields;
+  split_config( pieces.front(), fields );
+  if ( fields.at( 0 ) != "route" or ( fields.size() != 4 and fields.size() != 5 ) ) {
+    return false;
+  }
+
+  // Collect fields of the config item (adding a route)
+  const auto& [prefix_addr, prefix_len] = tie( fields[1], fields[2] );
+  const uint32_t prefix = Address { prefix_addr }.ipv4_numeric();
+  const auto length = static_cast<uint8_t>( stoi( prefix_len ) );
+
+  vector<Router::Path> paths;
+  const auto add_path = [&]( const string& iface_name, optional<Address> next_hop ) {
+    if ( not iface_name_to_idx.contains( iface_name ) ) {
+      throw runtime_error( "interface not found: " + iface_name );
+    }
+    paths.push_back( { move( next_hop ), iface_name_to_idx.at( iface_name ) } );
+  };
+
+  add_path( fields[3], fields.size() == 5 ? optional<Address> { fields[4] } : nullopt );
+  for ( const string& piece : pieces | views::drop( 1 ) ) {
+    split_config( piece, fields );
+    if ( fields.size() != 1 and fields.size() != 2 ) {
+      return false;
+    }
+    add_path( fields[0], fields.size() == 2 ? optional<Address> { fields[1] } : nullopt );
+  }
+
+  if ( paths.size() == 1 ) {
+    router.add_route( prefix, length, paths.front().next_hop, paths.front().interface_num );
+  } else {
+    router.add_multipath_route( prefix, length, paths );
+  }
+  return true;
+}
+
+// Parse the rule of an "acl:<interface_name>:<action>:..." config (empty if it could not be parsed)
+optional<AclRule> parse_acl_rule( const vector<string>& fields )
+{
+  if ( fields.size() < 5 or fields.size() > 7 or ( fields[2] != "permit" and fields[2] != "deny" ) ) {
+    return {};
+  }
+  AclRule rule;
+  rule.action = fields[2] == "permit" ? AclRule::Action::Permit : AclRule::Action::Deny;
+
+  const auto prefix = [&]( const string& field, uint32_t& address, uint8_t& length ) {
+    const size_t slash = field.find( '/' );
+    if ( slash == string::npos ) {
+      return false;
+    }
+    address = Address { field.substr( 0, slash ) }.ipv4_numeric();
+    length = static_cast<uint8_t>( stoi( field.substr( slash + 1 ) ) );
+    return true;
+  };
+  if ( not prefix( fields[3], rule.src_prefix, rule.src_length )
+       or not prefix( fields[4], rule.dst_prefix, rule.dst_length ) ) {
+    return {};
+  }
+
+  if ( fields.size() >= 6 ) {
+    const string& proto = fields[5];
+    if ( proto == "tcp" ) {
+      rule.proto = IPv4Header::PROTO_TCP;
+    } else if ( proto == "udp" ) {
+      rule.proto = IPv4Header::PROTO_UDP;
+    } else if ( proto == "icmp" ) {
+      rule.proto = IPv4Header::PROTO_ICMP;
+    } else if ( proto != "any" ) {
+      return {};
+    }
+  }
+  if ( fields.size() == 7 ) {
+    const string& ports = fields[6];
+    const size_t dash = ports.find( '-' );
+    rule.dst_port_min = static_cast<uint16_t>( stoi( ports.substr( 0, dash ) ) );
+    rule.dst_port_max
+      = dash == string::npos ? rule.dst_port_min : static_cast<uint16_t>( stoi( ports.substr( dash + 1 ) ) );
+  }
+  return rule;
+}
+
 // Process configurations from the command line (adding interfaces and routes to the Router).
 void apply_configs( const span<char*>& args,
                     Router& router,
                     vector<shared_ptr<Ethernet_over_UDP>>& ports,
-                    vector<shared_ptr<NetworkInterface>>& interfaces )
+                    vector<shared_ptr<NetworkInterface>>& interfaces,
+                    unordered_map<string, size_t>& iface_name_to_idx,
+                    bool& parallel,
+                    string& metrics_file )
 {
   if ( args.size() < 2 ) {
     print_usage( args[0] );
     throw runtime_error( "empty router configuration" );
   }
 
-  unordered_map<string, size_t> iface_name_to_idx;
+  // each interface's ACL rules (in order) and default action, set once all the configs are read
+  map<size_t, pair<vector<AclRule>, AclRule::Action>> acls;
+
   vector<string> fields;
   for ( const string_view config : args | views::drop( 1 ) ) { // ignore argv[0] (the name of the program)
     split_config( config, fields );
@@ -107,36 +233,96 @@ void apply_configs( const span<char*>& args,
 
       interfaces.push_back( make_shared<NetworkInterface>(
         name, ports.back(), random_router_ethernet_address(), Address { virtual_addr } ) );
+      // ARP runs at 5x speed to avoid having to wait 30 seconds in real life if router reboots or a new node
+      // joins the network (the egress queue's rate and delays stay in real time)
+      interfaces.back()->set_arp_time_scale( 5 );
 
       router.add_interface( interfaces.back() );
     } else if ( fields.at( 0 ) == "route" ) {
       // Add a new route to the router
-
-      if ( fields.size() != 4 and fields.size() != 5 ) {
+      if ( not apply_route_config( config, router, iface_name_to_idx ) ) {
         print_usage( args[0] );
         throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
       }
-
-      // Collect fields of the config item (adding a route)
-      const auto& [prefix_addr, prefix_len, iface_name] = tie( fields[1], fields[2], fields[3] );
-
-      optional<Address> next_hop;
-
-      if ( fields.size() == 5 ) {
-        next_hop.emplace( fields[4] );
+    } else if ( fields.at( 0 ) == "qdisc" ) {
+      // Queue an interface's outgoing frames, and send them at a limited rate
+      if ( fields.size() != 4 ) {
+        print_usage( args[0] );
+        throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
       }
-
-      if ( not iface_name_to_idx.contains( iface_name ) ) {
-        throw runtime_error( "interface not found: " + iface_name );
+      const auto& [name, discipline, rate_kbps] = tie( fields[1], fields[2], fields[3] );
+      if ( not iface_name_to_idx.contains( name ) ) {
+        throw runtime_error( "interface not found: " + name );
       }
 
-      router.add_route(
-        Address { prefix_addr }.ipv4_numeric(), stoi( prefix_len ), next_hop, iface_name_to_idx.at( iface_name ) );
+      unique_ptr<Qdisc> qdisc;
+      if ( discipline == "fifo" ) {
+        qdisc = make_unique<FIFOQdisc>( 1000 );
+      } else if ( discipline == "red" ) {
+        qdisc = make_unique<REDQdisc>( 1000, 30, 90 );
+      } else if ( discipline == "fq_codel" ) {
+        qdisc = make_unique<FQCoDelQdisc>();
+      } else {
+        throw runtime_error( "unknown queueing discipline: " + discipline );
+      }
+      interfaces.at( iface_name_to_idx.at( name ) )->set_egress_queue( move( qdisc ), stoull( rate_kbps ) * 125 );
+    } else if ( fields.at( 0 ) == "acl" and fields.size() >= 3 ) {
+      // Add a rule to an interface's ingress ACL, or set the ACL's default action
+      if ( not iface_name_to_idx.contains( fields[1] ) ) {
+        throw runtime_error( "interface not found: " + fields[1] );
+      }
+      auto& [rules, default_action] = acls[iface_name_to_idx.at( fields[1] )];
+      if ( fields.size() == 3 and ( fields[2] == "permit" or fields[2] == "deny" ) ) {
+        default_action = fields[2] == "permit" ? AclRule::Action::Permit : AclRule::Action::Deny;
+      } else if ( const auto rule = parse_acl_rule( fields ) ) {
+        rules.push_back( *rule );
+      } else {
+        print_usage( args[0] );
+        throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
+      }
+    } else if ( fields.size() == 2 and fields.at( 0 ) == "nat" ) {
+      // Source NAT on an (outside) interface
+      if ( not iface_name_to_idx.contains( fields[1] ) ) {
+        throw runtime_error( "interface not found: " + fields[1] );
+      }
+      router.enable_nat( iface_name_to_idx.at( fields[1] ) );
+    } else if ( fields.size() == 2 and fields.at( 0 ) == "flows" ) {
+      // Count the datagrams arriving on an interface by flow
+      if ( not iface_name_to_idx.contains( fields[1] ) ) {
+        throw runtime_error( "interface not found: " + fields[1] );
+      }
+      interfaces.at( iface_name_to_idx.at( fields[1] ) )->set_flow_sampler( make_unique<FlowSampler>() );
+    } else if ( fields.size() == 1 and fields.at( 0 ) == "parallel" ) {
+      parallel = true;
+    } else if ( fields.size() == 2 and fields.at( 0 ) == "metrics" ) {
+      metrics_file = fields[1];
     } else {
       print_usage( args[0] );
       throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
     }
   }
+
+  for ( auto& [interface_num, acl] : acls ) {
+    router.set_acl( interface_num, move( acl.first ), acl.second );
+  }
+}
+
+// Apply a route change read from stdin while the router is running
+void apply_route_update( const string_view line,
+                         Router& router,
+                         const unordered_map<string, size_t>& iface_name_to_idx )
+{
+  vector<string> fields;
+  split_config( line, fields );
+
+  if ( fields.at( 0 ) == "route" and apply_route_config( line, router, iface_name_to_idx ) ) {
+    cerr << "DEBUG: route " << fields[1] << "/" << fields[2] << " installed\n";
+  } else if ( fields.at( 0 ) == "withdraw" and fields.size() == 3 ) {
+    const bool removed = router.remove_route( Address { fields[1] }.ipv4_numeric(), stoi( fields[2] ) );
+    cerr << "DEBUG: route " << fields[1] << "/" << fields[2] << ( removed ? " withdrawn\n" : " not found\n" );
+  } else {
+    throw runtime_error( "could not parse route update \"" + string( line ) + "\"" );
+  }
 }
 
 // millisecond-granularity timestamp
@@ -147,17 +333,62 @@ inline uint64_t timestamp_ms()
   return chrono::steady_clock::now().time_since_epoch().count() / 1000000;
 }
 
+// Receive a user datagram on an interface's socket and parse it as an Ethernet frame (false if this fails)
+bool receive_frame( Ethernet_over_UDP& port, vector<string>& incoming_datagram, EthernetFrame& frame )
+{
+  // Prepare a vector of strings so the IP datagram can land exactly in the payload of the EthernetHeader
+  incoming_datagram.resize( 2 );
+  incoming_datagram.at( 0 ).resize( EthernetHeader::LENGTH );
+  Address incoming_address;
+
+  // Receive the user datagram
+  port.socket_.recv( incoming_address, incoming_datagram );
+
+  // Parse the user datagram's payload as an Ethernet frame, or return if this fails.
+  if ( not parse( frame, move( incoming_datagram ) ) ) {
+    cerr << "Could not parse user datagram payload from physical address " << incoming_address.to_string()
+         << " as an Ethernet frame \n";
+    return false;
+  }
+
+  cerr << "DEBUG: " << summary( frame ) << "\n";
+  return true;
+}
+
+// Write a snapshot of the Router's counters, replacing the file at once so that a reader never sees half of it
+void write_metrics( Router& router, const string& path )
+{
+  const string temporary = path + ".tmp";
+  {
+    ofstream out { temporary };
+    router.write_metrics( out );
+    if ( not out ) {
+      cerr << "Could not write metrics to " << temporary << "\n";
+      return;
+    }
+  }
+  if ( rename( temporary.c_str(), path.c_str() ) != 0 ) {
+    cerr << "Could not rename " << temporary << " to " << path << "\n";
+  }
+}
+
 void program_body( const span<char*>& args )
 {
   Router router;
   vector<shared_ptr<Ethernet_over_UDP>> ports;
   vector<shared_ptr<NetworkInterface>> interfaces;
+  unordered_map<string, size_t> iface_name_to_idx;
+  bool parallel = false;
+  string metrics_file;
 
-  apply_configs( args, router, ports, interfaces );
+  apply_configs( args, router, ports, interfaces, iface_name_to_idx, parallel, metrics_file );
 
   if ( ports.size() != interfaces.size() ) {
     throw runtime_error( "internal error: #ports != #interfaces" );
   }
+  if ( parallel and ranges::any_of( interfaces, []( const auto& iface ) { return iface->flow_sampler(); } ) ) {
+    throw runtime_error( "flows: needs the interfaces to see the datagrams, which they do not in parallel mode" );
+  }
 
   EventLoop event_loop;
   const auto category_id = event_loop.add_category( "incoming user datagram" );
@@ -166,47 +397,128 @@ void program_body( const span<char*>& args )
   // interpreting them as EthernetFrames, then hand them off to the NetworkInterfaces,
   // attached to the Router
   vector<string> incoming_datagram {};
-  for ( size_t i = 0; i < ports.size(); ++i ) {
-    Ethernet_over_UDP& port = *ports[i];
-    NetworkInterface& iface = *interfaces[i];
-    event_loop.add_rule( category_id, port.socket_, Direction::In, [&] {
-      // Prepare a vector of strings so the IP datagram can land exactly in the payload of the EthernetHeader
-      incoming_datagram.resize( 2 );
-      incoming_datagram.at( 0 ).resize( EthernetHeader::LENGTH );
-      Address incoming_address;
-
-      // Receive the user datagram
-      port.socket_.recv( incoming_address, incoming_datagram );
-
-      // Parse the user datagram's payload as an Ethernet frame, or return if this fails.
-      EthernetFrame frame;
-      if ( not parse( frame, move( incoming_datagram ) ) ) {
-        cerr << "Could not parse user datagram payload from physical address " << incoming_address.to_string()
-             << " as an Ethernet frame \n";
-        return;
-      }
-
-      cerr << "DEBUG: " << summary( frame ) << "\n";
-
-      // Give the Ethernet frame to the (student-written) NetworkInterface.
-      iface.recv_frame( move( frame ) );
-    } );
+  // SIGINT and SIGTERM stop the router cleanly: they are blocked in every thread, and one thread waits for them
+  atomic<bool> running { true };
+  sigset_t stop_signals {};
+  sigemptyset( &stop_signals );
+  sigaddset( &stop_signals, SIGINT );
+  sigaddset( &stop_signals, SIGTERM );
+  if ( pthread_sigmask( SIG_BLOCK, &stop_signals, nullptr ) != 0 ) {
+    throw runtime_error( "pthread_sigmask failed" );
+  }
+  thread signal_thread { [&] {
+    int signal_number = 0;
+    sigwait( &stop_signals, &signal_number );
+    running = false;
+  } };
+
+  vector<thread> rx_threads;
+  atomic<size_t> rx_running { 0 }; // RX threads whose socket is still open
+  if ( parallel ) {
+    // each interface's socket is read by its own thread, which forwards through the Router's parallel mode
+    // (the Router's TX workers own the NetworkInterfaces, and send and tick them)
+    router.start_parallel();
+    rx_running = ports.size();
+    for ( size_t i = 0; i < ports.size(); ++i ) {
+      rx_threads.emplace_back( [&router, &running, &rx_running, &port = *ports[i], i] {
+        EventLoop rx_loop;
+        vector<string> rx_datagram {};
+        rx_loop.add_rule( "incoming user datagram", port.socket_, Direction::In, [&] {
+          EthernetFrame frame;
+          if ( receive_frame( port, rx_datagram, frame ) ) {
+            router.receive_frame( i, move( frame ) );
+          }
+        } );
+        while ( running and rx_loop.wait_next_event( 100 ) != EventLoop::Result::Exit ) {}
+        rx_running--;
+      } );
+    }
+  } else {
+    for ( size_t i = 0; i < ports.size(); ++i ) {
+      Ethernet_over_UDP& port = *ports[i];
+      NetworkInterface& iface = *interfaces[i];
+      event_loop.add_rule( category_id, port.socket_, Direction::In, [&] {
+        EthernetFrame frame;
+        if ( receive_frame( port, incoming_datagram, frame ) ) {
+          // Give the Ethernet frame to the (student-written) NetworkInterface.
+          iface.recv_frame( move( frame ) );
+        }
+      } );
+    }
   }
 
+  // route updates, one per line, from stdin (a bad line is reported and skipped)
+  FileDescriptor input { STDIN_FILENO };
+  input.set_blocking( false );
+  string pending_updates;
+  event_loop.add_rule(
+    "route update from stdin",
+    input,
+    Direction::In,
+    [&] {
+      string data;
+      data.resize( 4096 );
+      input.read( data );
+      pending_updates += data;
+      for ( size_t newline = pending_updates.find( '\n' ); newline != string::npos;
+            newline = pending_updates.find( '\n' ) ) {
+        const string line = pending_updates.substr( 0, newline );
+        pending_updates.erase( 0, newline + 1 );
+        if ( line.empty() ) {
+          continue;
+        }
+        try {
+          apply_route_update( line, router, iface_name_to_idx );
+        } catch ( const exception& e ) {
+          cerr << "Route update failed: " << e.what() << "\n";
+        }
+      }
+    },
+    [&] { return not input.eof(); } );
+
   size_t last_tick = timestamp_ms();
-  while ( event_loop.wait_next_event( 100 ) != EventLoop::Result::Exit ) {
+  size_t last_metrics = last_tick;
+  // In parallel mode the event loop may have nothing left to wait for (once stdin is closed), but the router
+  // still needs its ticks and metrics: keep going, at the same pace, until stopped or every RX thread is done.
+  while ( running ) {
+    if ( event_loop.wait_next_event( 100 ) == EventLoop::Result::Exit ) {
+      if ( not parallel or rx_running == 0 ) {
+        break;
+      }
+      this_thread::sleep_for( chrono::milliseconds { 100 } );
+    }
+    if ( not metrics_file.empty() and timestamp_ms() >= last_metrics + 1000 ) {
+      write_metrics( router, metrics_file );
+      last_metrics = timestamp_ms();
+    }
     const size_t new_tick = timestamp_ms();
     if ( new_tick > last_tick ) {
       const size_t ms_since_last_tick = new_tick - last_tick;
-      for ( auto& iface : interfaces ) {
-        iface->tick( ms_since_last_tick * 5 ); // run at 5x speed to avoid having to wait 30 seconds in real life
-                                               // if router reboots or a new node joins the network
+      if ( not parallel ) { // the TX workers tick their own interfaces
+        for ( auto& iface : interfaces ) {
+          iface->tick( ms_since_last_tick );
+        }
       }
+      router.tick( ms_since_last_tick ); // the ICMP rate limit and NAT timeouts are in real time
     }
     last_tick = new_tick;
 
+    if ( parallel ) {
+      continue; // the main thread only applies route updates
+    }
     router.route();
   }
+
+  if ( running.exchange( false ) ) {
+    pthread_kill( signal_thread.native_handle(), SIGTERM ); // nobody sent a signal: wake the thread waiting for one
+  }
+  signal_thread.join();
+  for ( auto& rx_thread : rx_threads ) {
+    rx_thread.join();
+  }
+  if ( parallel ) {
+    router.stop_parallel();
+  }
 }
 } // namespace
 
@@ -45,6 +45,7 @@ ttest(recv_reorder)
 ttest(recv_reorder_more)
 ttest(recv_close)
 ttest(recv_special)
+ttest(recv_paws)
 
 ttest(send_connect)
 ttest(send_transmit)
@@ -53,10 +54,34 @@ ttest(send_ack)
 ttest(send_close)
 ttest(send_retx)
 ttest(send_extra)
+ttest(send_timestamps)
+
+ttest(tcp_options_roundtrip)
+ttest(tcp_demux)
+ttest(tcp_listen_backlog)
+ttest(tcp_sharded_runtime)
 
 ttest(net_interface)
 
 ttest(router)
+ttest(prefix_trie)
+ttest(dir24_8_table)
+ttest(small_route_table)
+ttest(route_cache)
+ttest(router_updates)
+ttest(router_ecmp)
+ttest(router_icmp)
+ttest(router_parallel)
+ttest(ipv4_checksum)
+ttest(qdisc)
+ttest(ip_fragmentation)
+ttest(packet_classifier)
+ttest(router_counters)
+ttest(nat)
+ttest(flow_sampler)
+ttest(zero_copy_send)
+ttest(arp_pending)
+ttest(arp_refresh)
 
 ttest(no_skip)
 
@@ -94,3 +119,17 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(tcp_options_speed_test)
+stest(tcp_demux_speed_test)
+stest(tcp_listen_speed_test)
+stest(tcp_sharded_speed_test)
+stest(route_lookup_speed_test)
+stest(router_speed_test)
+stest(router_parallel_speed_test)
+stest(ipv4_checksum_speed_test)
+stest(qdisc_speed_test)
+stest(packet_classifier_speed_test)
+stest(router_counters_speed_test)
+stest(nat_speed_test)
+stest(flow_sampler_speed_test)
+stest(arp_cache_speed_test)
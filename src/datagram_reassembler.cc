@@ -0,0 +1,96 @@
+#include "datagram_reassembler.hh"
+#include "helpers.hh"
+
+#include <limits>
+#include <string>
+
+using namespace std;
+
+optional<InternetDatagram> DatagramReassembler::add( InternetDatagram dgram )
+{
+  // 不是分片, 原样返回
+  if ( not dgram.header.mf and dgram.header.offset == 0 ) {
+    return dgram;
+  }
+
+  // 除最后一个分片外, 分片的负载长度必须是8的倍数; 重组后的数据报也不能超过最大长度
+  constexpr uint64_t max_length = numeric_limits<uint16_t>::max();
+  string data = concat( dgram.payload );
+  const uint64_t first_index = uint64_t { dgram.header.offset } * 8;
+  if ( ( dgram.header.mf and data.size() % 8 != 0 )
+       or uint64_t { dgram.header.hlen } * 4 + first_index + data.size() > max_length ) {
+    return {};
+  }
+
+  const Key key { dgram.header.src, dgram.header.dst, dgram.header.id, dgram.header.proto };
+  auto it = pending_.find( key );
+  if ( it == pending_.end() ) {
+    Pending fresh { Reassembler { ByteStream { max_length } }, {}, next_serial_, now_ + timeout_, 0 };
+    it = pending_.try_emplace( key, move( fresh ) ).first;
+    order_.emplace_back( key, next_serial_++ );
+  }
+  Pending& pending = it->second;
+  if ( first_index == 0 ) {
+    pending.first_header = dgram.header;
+  }
+
+  // Reassembler负责合并重叠和重复的分片; 最后一个分片(MF为0)标出负载的结尾
+  pending.payload.insert( first_index, move( data ), not dgram.header.mf );
+  bytes_held_ -= pending.bytes;
+  pending.bytes = pending.payload.count_bytes_pending() + pending.payload.reader().bytes_buffered();
+  bytes_held_ += pending.bytes;
+
+  // 负载从头到尾都齐了(这意味着偏移为0的分片也到了): 用第一个分片的首部拼出完整的数据报
+  if ( pending.payload.writer().is_closed() ) {
+    Reader& reader = pending.payload.reader();
+    string payload;
+    read( reader, reader.bytes_buffered(), payload );
+
+    InternetDatagram whole { pending.first_header, {} };
+    whole.header.mf = false;
+    whole.header.offset = 0;
+    whole.header.len = static_cast<uint16_t>( whole.header.hlen * 4 + payload.size() );
+    whole.header.compute_checksum();
+    whole.payload.emplace_back( move( payload ) );
+    discard( it );
+    return whole;
+  }
+
+  expire_and_evict();
+  return {};
+}
+
+void DatagramReassembler::tick( uint64_t ms_since_last_tick )
+{
+  now_ += ms_since_last_tick;
+  expire_and_evict();
+}
+
+void DatagramReassembler::discard( map<Key, Pending>::iterator it )
+{
+  bytes_held_ -= it->second.bytes;
+  pending_.erase( it );
+}
+
+// 从最早创建的数据报开始, 丢弃超时的, 以及超出内存上限时最老的
+void DatagramReassembler::expire_and_evict()
+{
+  while ( not order_.empty() ) {
+    const auto& [key, serial] = order_.front();
+    const auto it = pending_.find( key );
+    if ( it == pending_.end() or it->second.serial != serial ) {
+      order_.pop_front(); // 这个数据报已经重组完成(或被丢弃)了
+      continue;
+    }
+
+    if ( it->second.expires <= now_ ) {
+      timeouts_++;
+    } else if ( bytes_held_ > memory_limit_ ) {
+      evictions_++;
+    } else {
+      return;
+    }
+    discard( it );
+    order_.pop_front();
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+#include "reassembler.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <tuple>
+
+// Reassembles IPv4 datagrams from their fragments ([RFC 791](\ref rfc::rfc791), section 3.2).
+//
+// Fragments are matched by (source, destination, identification, protocol), and each datagram's payload is
+// put back together by a Reassembler, which already merges overlapping and duplicated pieces. A datagram
+// whose fragments have not all arrived within `timeout` is abandoned, and so are the oldest ones if the
+// fragments held exceed `memory_limit` bytes.
+class DatagramReassembler
+{
+public:
+  static constexpr uint64_t DEFAULT_TIMEOUT = 30'000;          // ms, as in Linux (ipfrag_time)
+  static constexpr size_t DEFAULT_MEMORY_LIMIT = 4 * 1024 * 1024; // bytes, as in Linux (ipfrag_high_thresh)
+
+  explicit DatagramReassembler( uint64_t timeout = DEFAULT_TIMEOUT, size_t memory_limit = DEFAULT_MEMORY_LIMIT )
+    : timeout_( timeout ), memory_limit_( memory_limit )
+  {}
+
+  // Add a received datagram. A whole datagram is returned as it is; a fragment is held, and once the last
+  // missing fragment arrives, the reassembled datagram is returned.
+  std::optional<InternetDatagram> add( InternetDatagram dgram );
+
+  // Called periodically when time elapses
+  void tick( uint64_t ms_since_last_tick );
+
+  size_t datagrams_pending() const { return pending_.size(); }
+  size_t bytes_held() const { return bytes_held_; }
+  uint64_t timeouts() const { return timeouts_; }
+  uint64_t evictions() const { return evictions_; }
+
+private:
+  // (源地址, 目的地址, 标识, 协议)
+  using Key = std::tuple<uint32_t, uint32_t, uint16_t, uint8_t>;
+
+  // 一个正在重组的数据报
+  struct Pending
+  {
+    Reassembler payload;
+    IPv4Header first_header; // 偏移为0的分片的首部, 重组后的首部以它为准
+    uint64_t serial;         // 创建顺序, 用来识别 order_ 里过时的条目
+    uint64_t expires;
+    size_t bytes;
+  };
+
+  void discard( std::map<Key, Pending>::iterator it );
+  void expire_and_evict();
+
+  uint64_t timeout_;
+  size_t memory_limit_;
+  uint64_t now_ {};
+  uint64_t next_serial_ {};
+  size_t bytes_held_ {};
+  uint64_t timeouts_ {};
+  uint64_t evictions_ {};
+
+  std::map<Key, Pending> pending_ {};
+  std::deque<std::pair<Key, uint64_t>> order_ {}; // 按创建顺序(也就是超时顺序)排列的 (key, serial)
+};
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <string>
+#include <stdexcept>
 
 #include "address.hh"
 #include "arp_message.hh"
@@ -7,6 +10,7 @@
 #include "ethernet_frame.hh"
 #include "ethernet_header.hh"
 #include "exception.hh"
+#include "flow_hash.hh"
 #include "helpers.hh"
 #include "ipv4_datagram.hh"
 #include "network_interface.hh"
@@ -35,36 +39,152 @@ NetworkInterface::NetworkInterface( string_view name,
 void NetworkInterface::send_datagram( InternetDatagram dgram, const Address& next_hop )
 {
   // debug( "unimplemented send_datagram called" );
+  // 超过MTU且允许分片的数据报, 切成不超过MTU的分片分别发送(除最后一片外, 分片负载长度是8字节的倍数).
+  // 带选项的数据报和DF一样整个发送: 后续分片只应带上复制位为1的选项, 而IPv4Header并不保存选项
+  const size_t header_length = dgram.header.hlen * 4;
+  const bool has_options = header_length > IPv4Header::LENGTH;
+  if ( not dgram.header.df and not has_options and dgram.header.len > mtu_ and mtu_ >= header_length + 8 ) {
+    const size_t chunk = ( mtu_ - header_length ) / 8 * 8;
+    const string payload = concat( dgram.payload );
+    for ( size_t start = 0; start < payload.size(); start += chunk ) {
+      InternetDatagram fragment { dgram.header, {} };
+      fragment.payload.emplace_back( payload.substr( start, chunk ) );
+      fragment.header.offset = static_cast<uint16_t>( dgram.header.offset + start / 8 );
+      fragment.header.mf = dgram.header.mf or start + chunk < payload.size(); // 原本就是分片的话, 保留它的MF
+      fragment.header.len = static_cast<uint16_t>( header_length + fragment.payload.front()->size() );
+      fragment.header.compute_checksum();
+      send_datagram( move( fragment ), next_hop );
+    }
+    return;
+  }
+
   // ARP缓存中已有对应IP到MAC的映射
   uint32_t next_ip = next_hop.ipv4_numeric();
-  if ( arp_cache_.contains( next_ip ) ) {
-    EthernetFrame frame;
-    frame.header.dst = arp_cache_[next_ip].mac;
-    frame.header.src = ethernet_address_;
-    frame.header.type = EthernetHeader::TYPE_IPv4;
-    frame.payload = serialize( dgram ); // 直接封装整个IPv4数据报
-    transmit( frame );
+  if ( ArpEntry* entry = arp_cache_.find( next_ip ) ) {
+    // 快过期的映射照常使用, 同时单播ARP请求让邻居续期(每隔一段时间一次), 不必等它过期后再广播请求
+    const EthernetAddress mac = entry->mac;
+    const bool refresh = entry->remaining_ttl <= ARP_REFRESH_BEFORE
+                         and ( entry->probed_at_ttl == 0
+                               or entry->probed_at_ttl - entry->remaining_ttl >= ARP_PROBE_INTERVAL );
+    if ( refresh ) {
+      entry->probed_at_ttl = entry->remaining_ttl;
+    }
+    const uint32_t flow = qdisc_ ? FlowKey::of( dgram ).hash( 0 ) : 0;
+    transmit( frame_for( move( dgram ), mac ), flow );
+    if ( refresh ) {
+      send_arp_request( next_ip, mac );
+    }
   } else {
     // ARP缓存中没有对应的IP到MAC, 映射就先把数据帧缓存起来, 然后发送ARP请求帧
-    arp_waiting_datagrams_[next_ip].push_back( dgram );
-    // 五秒前是否发送过ARP请求帧(限流)
-    if ( arp_waiting_requests_.contains( next_ip ) == 0 ) {
-      ARPMessage arp_request; // 构造ARP请求
-      arp_request.opcode = ARPMessage::OPCODE_REQUEST;
-      arp_request.sender_ip_address = ip_address_.ipv4_numeric();
-      arp_request.sender_ethernet_address = ethernet_address_;
-      arp_request.target_ip_address = next_hop.ipv4_numeric();
-
-      EthernetFrame frame;                   // 构造以太网帧
-      frame.header.dst = ETHERNET_BROADCAST; // 广播请求
-      frame.header.src = ethernet_address_;
-      frame.header.type = EthernetHeader::TYPE_ARP;
-      frame.payload = serialize( arp_request );
-      transmit( frame );
-      // 设置五秒ARP请求间隔(限流)
-      arp_waiting_requests_[next_ip] = 5000;
+    queue_for_arp( next_ip, move( dgram ) );
+  }
+}
+
+namespace {
+// 连续 attempts 个请求没有答复之后, 下一个请求要等多久(每次加倍, 有上限)
+size_t request_wait( size_t attempts )
+{
+  size_t wait = NetworkInterface::ARP_REQUEST_TIMEOUT;
+  for ( size_t i = 0; i < attempts and wait < NetworkInterface::ARP_MAX_BACKOFF; i++ ) {
+    wait *= 2;
+  }
+  return min( wait, NetworkInterface::ARP_MAX_BACKOFF );
+}
+} // namespace
+
+// 数据报排进下一跳的队列(这个邻居排满了就先丢它最老的一个), 没有请求在等答复就发一个,
+// 然后从所有邻居里最老的数据报丢起, 直到总字节数回到限额以内
+void NetworkInterface::queue_for_arp( uint32_t next_ip, InternetDatagram&& dgram )
+{
+  PendingNeighbour& neighbour = arp_pending_[next_ip];
+  if ( neighbour.datagrams.size() >= arp_pending_per_neighbour_ ) {
+    release_pending( neighbour );
+    arp_pending_drops_.neighbour_full++;
+  }
+  arp_pending_bytes_ += dgram.header.len;
+  arp_pending_count_++;
+  neighbour.datagrams.emplace_back( arp_pending_seq_, move( dgram ) );
+  arp_pending_order_.emplace_back( next_ip, arp_pending_seq_++ );
+
+  // 请求还在等答复就不再发(限流)
+  if ( not neighbour.requesting ) {
+    neighbour.requesting = true;
+    neighbour.timer = request_wait( neighbour.attempts );
+    send_arp_request( next_ip );
+  }
+
+  while ( arp_pending_bytes_ > arp_pending_limit_ and drop_oldest_pending() ) {
+    arp_pending_drops_.memory_full++;
+  }
+
+  // 早已发出或丢掉的数据报在顺序表里留下的条目太多了, 就清理一遍
+  if ( arp_pending_order_.size() > 2 * arp_pending_count_ + 64 ) {
+    erase_if( arp_pending_order_, [&]( const pair<uint32_t, uint64_t>& entry ) {
+      const auto it = arp_pending_.find( entry.first );
+      return it == arp_pending_.end() or it->second.datagrams.empty()
+             or it->second.datagrams.front().first > entry.second;
+    } );
+  }
+}
+
+// 丢掉邻居队首(最老)的数据报
+void NetworkInterface::release_pending( PendingNeighbour& neighbour )
+{
+  arp_pending_bytes_ -= neighbour.datagrams.front().second.header.len;
+  arp_pending_count_--;
+  neighbour.datagrams.pop_front();
+}
+
+// 丢掉所有邻居中最老的一个数据报; 没有可丢的就返回 false
+bool NetworkInterface::drop_oldest_pending()
+{
+  while ( not arp_pending_order_.empty() ) {
+    const auto [ip, seq] = arp_pending_order_.front();
+    arp_pending_order_.pop_front();
+    // 最老的数据报一定排在它邻居的队首; 对不上说明它已经发出或丢掉了
+    const auto it = arp_pending_.find( ip );
+    if ( it != arp_pending_.end() and not it->second.datagrams.empty()
+         and it->second.datagrams.front().first == seq ) {
+      release_pending( it->second );
+      return true;
     }
   }
+  return false;
+}
+
+void NetworkInterface::set_arp_pending_limits( size_t per_neighbour, size_t total_bytes )
+{
+  if ( per_neighbour == 0 ) {
+    throw runtime_error( "NetworkInterface: each neighbour needs room for a pending datagram" );
+  }
+  arp_pending_per_neighbour_ = per_neighbour;
+  arp_pending_limit_ = total_bytes;
+  for ( auto& [ip, neighbour] : arp_pending_ ) {
+    while ( neighbour.datagrams.size() > arp_pending_per_neighbour_ ) {
+      release_pending( neighbour );
+      arp_pending_drops_.neighbour_full++;
+    }
+  }
+  while ( arp_pending_bytes_ > arp_pending_limit_ and drop_oldest_pending() ) {
+    arp_pending_drops_.memory_full++;
+  }
+}
+
+// 发ARP请求询问 next_ip 的MAC地址: 默认广播, 续期时直接发给已知的MAC
+void NetworkInterface::send_arp_request( uint32_t next_ip, const EthernetAddress& dst )
+{
+  ARPMessage arp_request; // 构造ARP请求
+  arp_request.opcode = ARPMessage::OPCODE_REQUEST;
+  arp_request.sender_ip_address = ip_address_.ipv4_numeric();
+  arp_request.sender_ethernet_address = ethernet_address_;
+  arp_request.target_ip_address = next_ip;
+
+  EthernetFrame frame; // 构造以太网帧
+  frame.header.dst = dst;
+  frame.header.src = ethernet_address_;
+  frame.header.type = EthernetHeader::TYPE_ARP;
+  frame.payload = serialize( arp_request );
+  transmit( move( frame ) );
 }
 
 //! \param[in] frame the incoming Ethernet frame
@@ -82,15 +202,17 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
       const uint32_t ip = arp_request.sender_ip_address;
       const EthernetAddress ethernet_address = arp_request.sender_ethernet_address;
       // 无论是ARP请求还是ARP响应, 只要是发给我们的或者广播的, 都可以"顺便"学习
-      arp_cache_[ip] = { ethernet_address, 30000 };
+      arp_cache_[ip] = { ethernet_address, ARP_CACHE_TTL };
 
       // 学习过后, 检查有没有可以发送的帧
-      if ( arp_waiting_datagrams_.contains( ip ) ) {
-        for ( const auto& dgram : arp_waiting_datagrams_[ip] ) {
-          send_datagram( dgram, Address::from_ipv4_numeric( ip ) );
+      // (邻居答复了, 退避也就重新开始)
+      if ( auto waiting = arp_pending_.extract( ip ) ) {
+        auto& datagrams = waiting.mapped().datagrams;
+        while ( not datagrams.empty() ) {
+          InternetDatagram dgram = move( datagrams.front().second );
+          release_pending( waiting.mapped() );
+          send_datagram( move( dgram ), Address::from_ipv4_numeric( ip ) );
         }
-        arp_waiting_requests_.erase( ip );
-        arp_waiting_datagrams_.erase( ip );
       }
       // 处理请求本接口MAC地址的ARP请求帧
       if ( arp_request.opcode == ARPMessage::OPCODE_REQUEST
@@ -108,41 +230,157 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
         reply_frame.header.dst = arp_request.sender_ethernet_address;
         reply_frame.header.type = EthernetHeader::TYPE_ARP;
         reply_frame.payload = serialize( arp_reply );
-        transmit( reply_frame );
+        transmit( move( reply_frame ) );
       }
     }
   } else if ( frame.header.type == EthernetHeader::TYPE_IPv4 ) {
     // 处理属于本接口的IP数据帧
     InternetDatagram datagram;
-    if ( parse( datagram, frame.payload ) ) {
-      datagrams_received_.push( datagram );
+    if ( not parse( datagram, frame.payload ) ) {
+      return;
+    }
+    if ( sampler_ ) {
+      sampler_->add( datagram );
+    }
+    // 发给本接口的分片先重组; 路过的分片(比如路由器转发的)原样交上去
+    if ( datagram.header.dst != ip_address_.ipv4_numeric() ) {
+      datagrams_received_.push( move( datagram ) );
+    } else if ( auto whole = reassembler_.add( move( datagram ) ) ) {
+      datagrams_received_.push( move( *whole ) );
     }
   }
 }
 
+// 封装整个IPv4数据报: 只有头部要序列化(写进回收的缓冲区), 负载的各段原样移进帧里,
+// 这样帧在出口队列里排队时仍然拥有它们
+EthernetFrame NetworkInterface::frame_for( InternetDatagram&& dgram, const EthernetAddress& dst )
+{
+  EthernetFrame frame;
+  frame.header.dst = dst;
+  frame.header.src = ethernet_address_;
+  frame.header.type = EthernetHeader::TYPE_IPv4;
+  if ( not spare_payloads_.empty() ) {
+    frame.payload = move( spare_payloads_.back() );
+    spare_payloads_.pop_back();
+  }
+  Serializer serializer { spare_headers_.empty() ? string {} : move( spare_headers_.back() ) };
+  if ( not spare_headers_.empty() ) {
+    spare_headers_.pop_back();
+  }
+  dgram.header.serialize( serializer );
+  serializer.finish( frame.payload );
+  ranges::move( dgram.payload, back_inserter( frame.payload ) );
+  return frame;
+}
+
+// 发送完的帧: 留下它的头部缓冲区(第一段)和负载列表
+void NetworkInterface::recycle( EthernetFrame&& frame )
+{
+  if ( frame.payload.empty() ) {
+    return;
+  }
+  if ( spare_headers_.size() < SPARE_BUFFERS and frame.payload.front().is_owned()
+       and frame.payload.front()->capacity() <= 64 ) {
+    spare_headers_.push_back( frame.payload.front().release() );
+  }
+  if ( spare_payloads_.size() < SPARE_BUFFERS ) {
+    frame.payload.clear();
+    spare_payloads_.push_back( move( frame.payload ) );
+  }
+}
+
+void NetworkInterface::transmit( EthernetFrame frame, uint32_t flow )
+{
+  if ( not qdisc_ ) {
+    port_->transmit( *this, frame );
+    recycle( move( frame ) );
+    return;
+  }
+  // 排队的帧必须拥有自己的负载
+  for ( auto& piece : frame.payload ) {
+    if ( piece.is_borrowed() ) {
+      piece = Ref<string> { string { piece.get() } };
+    }
+  }
+  qdisc_->enqueue( move( frame ), flow, now_ );
+  drain_egress_queue();
+}
+
+void NetworkInterface::set_egress_queue( unique_ptr<Qdisc> qdisc, uint64_t bytes_per_second )
+{
+  if ( qdisc and bytes_per_second == 0 ) {
+    throw runtime_error( "NetworkInterface: an egress queue needs a rate" );
+  }
+  qdisc_ = move( qdisc );
+  egress_rate_ = bytes_per_second;
+  const uint64_t burst = max<uint64_t>( bytes_per_second / 1000, 2 * ( mtu_ + EthernetHeader::LENGTH ) );
+  egress_burst_ = static_cast<int64_t>( burst * 1000 );
+  egress_credit_ = egress_burst_;
+}
+
+// 额度为正就发送下一帧, 并按它的长度扣除额度
+void NetworkInterface::drain_egress_queue()
+{
+  while ( egress_credit_ > 0 ) {
+    auto frame = qdisc_->dequeue( now_ );
+    if ( not frame ) {
+      return;
+    }
+    egress_credit_ -= static_cast<int64_t>( Qdisc::frame_size( *frame ) * 1000 );
+    port_->transmit( *this, *frame );
+    recycle( move( *frame ) );
+  }
+}
+
+void NetworkInterface::set_arp_time_scale( size_t factor )
+{
+  if ( factor == 0 ) {
+    throw runtime_error( "NetworkInterface: ARP's clock needs to run" );
+  }
+  arp_time_scale_ = factor;
+}
+
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
+  reassembler_.tick( ms_since_last_tick );
+
+  // 出口队列的时钟前进, 补充发送额度(最多一个突发的量), 然后尽量发送
+  if ( qdisc_ ) {
+    now_ += ms_since_last_tick;
+    const uint64_t room = static_cast<uint64_t>( egress_burst_ - egress_credit_ );
+    egress_credit_ = ms_since_last_tick > room / egress_rate_
+                       ? egress_burst_
+                       : egress_credit_ + static_cast<int64_t>( egress_rate_ * ms_since_last_tick );
+    drain_egress_queue();
+  }
+
   // debug( "unimplemented tick({}) called", ms_since_last_tick );
   // 检查ARP缓存的映射条目是否超时, 清理过期的 ARP 缓存
-  for ( auto it = arp_cache_.begin(); it != arp_cache_.end(); ) {
-    if ( ms_since_last_tick >= it->second.remaining_ttl ) {
-      it = arp_cache_.erase( it );
-    } else {
-      it->second.remaining_ttl -= ms_since_last_tick;
-      ++it;
-    }
-  }
+  // (先统一扣减再删除: 删除时后面的条目会前移, 边遍历边扣减可能把同一条目扣两次)
+  const size_t arp_ms = ms_since_last_tick * arp_time_scale_;
+  arp_cache_.for_each(
+    [&]( uint32_t, ArpEntry& entry ) { entry.remaining_ttl -= min( entry.remaining_ttl, arp_ms ); } );
+  arp_cache_.erase_if( []( uint32_t, const ArpEntry& entry ) { return entry.remaining_ttl == 0; } );
 
-  // 检查是否有ARP请求条目已经超过了5s的限时
-  for ( auto it = arp_waiting_requests_.begin(); it != arp_waiting_requests_.end(); ) {
-    if ( ms_since_last_tick >= it->second ) {
-      arp_waiting_datagrams_.erase( it->first ); // 移除这个ARP请求对应所有数据, 防止待发送队列无限积压
-      // 移除请求限时
-      it = arp_waiting_requests_.erase( it );
-    } else {
-      it->second -= ms_since_last_tick;
+  // 请求超时没有答复: 这个邻居等待的数据报全部丢弃(防止待发送队列无限积压), 下一个请求等得更久.
+  // 失败次数要记住和下一轮一样长的时间, 这段时间里没有数据报再发给它, 就忘掉它
+  for ( auto it = arp_pending_.begin(); it != arp_pending_.end(); ) {
+    PendingNeighbour& neighbour = it->second;
+    if ( arp_ms < neighbour.timer ) {
+      neighbour.timer -= arp_ms;
       ++it;
+    } else if ( neighbour.requesting ) {
+      arp_pending_drops_.unresolved += neighbour.datagrams.size();
+      while ( not neighbour.datagrams.empty() ) {
+        release_pending( neighbour );
+      }
+      neighbour.requesting = false;
+      neighbour.attempts++;
+      neighbour.timer = request_wait( neighbour.attempts );
+      ++it;
+    } else {
+      it = arp_pending_.erase( it );
     }
   }
 }
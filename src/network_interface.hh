@@ -1,14 +1,20 @@
 #pragma once
 
 #include "address.hh"
+#include "datagram_reassembler.hh"
 #include "ethernet_frame.hh"
+#include "flat_hash_map.hh"
+#include "flow_sampler.hh"
 #include "ipv4_datagram.hh"
+#include "qdisc.hh"
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <map>
 #include <memory>
 #include <queue>
+#include <utility>
 #include <vector>
 
 // A "network interface" that connects IP (the internet layer, or network layer)
@@ -37,6 +43,9 @@ class NetworkInterface
 {
 public:
   // An abstraction for the physical output port where the NetworkInterface sends Ethernet frames
+  // The frame's payload is a list of pieces: for a datagram, its header and then its payload's own pieces,
+  // which are never copied on the way. They are only valid during the call, so a port should send them with
+  // one gathering write (as DatagramSocket::send does), and copy only what it keeps.
   class OutputPort
   {
   public:
@@ -54,10 +63,12 @@ public:
   // Sends an Internet datagram, encapsulated in an Ethernet frame (if it knows the Ethernet destination
   // address). Will need to use [ARP](\ref rfc::rfc826) to look up the Ethernet destination address for the next
   // hop. Sending is accomplished by calling `transmit()` (a member variable) on the frame.
+  // A datagram larger than the MTU is sent in fragments, unless its DF flag is set or it carries IP options.
   void send_datagram( InternetDatagram dgram, const Address& next_hop );
 
   // Receives an Ethernet frame and responds appropriately.
-  // If type is IPv4, pushes the datagram to the datagrams_in queue.
+  // If type is IPv4, pushes the datagram to the datagrams_in queue (fragments of datagrams addressed to this
+  // interface are reassembled first; fragments passing through, e.g. a router, are pushed as they are).
   // If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // If type is ARP reply, learn a mapping from the "sender" fields.
   void recv_frame( EthernetFrame frame );
@@ -65,11 +76,62 @@ public:
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  // Run ARP's timers (cache entries, and requests awaiting replies) `factor` times faster than tick()'s clock,
+  // e.g. so that a network of routers settles quickly. The egress queue and reassembly keep tick()'s time.
+  void set_arp_time_scale( size_t factor );
+
+  // The largest datagram (header included, in bytes) that the link carries
+  static constexpr size_t DEFAULT_MTU = 1500;
+  size_t mtu() const { return mtu_; }
+  void set_mtu( size_t mtu ) { mtu_ = mtu; }
+
+  // Queue outgoing frames in `qdisc`, and send them at no more than `bytes_per_second` as tick() lets time
+  // pass (in bursts of up to 1 ms of the rate, or two full-sized frames). Without a queue, frames are
+  // sent at once.
+  void set_egress_queue( std::unique_ptr<Qdisc> qdisc, uint64_t bytes_per_second );
+  const Qdisc* egress_queue() const { return qdisc_.get(); }
+
+  // Count every IPv4 datagram that recv_frame() takes in (each fragment on its own) against its flow in
+  // `sampler`, to report the top talkers. Without a sampler, nothing is counted.
+  void set_flow_sampler( std::unique_ptr<FlowSampler> sampler ) { sampler_ = std::move( sampler ); }
+  const FlowSampler* flow_sampler() const { return sampler_.get(); }
+  FlowSampler* flow_sampler() { return sampler_.get(); }
+
+  // Datagrams waiting for ARP to find their next hop are held up to a limit per neighbour (in datagrams) and
+  // over all neighbours (in bytes); past either, the oldest are dropped first. A request that goes unanswered
+  // for ARP_REQUEST_TIMEOUT drops its neighbour's datagrams, and the next one is sent on the next datagram but
+  // waited for twice as long (up to ARP_MAX_BACKOFF), so a neighbour that is gone costs little under load.
+  static constexpr size_t DEFAULT_ARP_PENDING_PER_NEIGHBOUR = 64;
+  static constexpr size_t DEFAULT_ARP_PENDING_BYTES = 1 << 20;
+  static constexpr size_t ARP_REQUEST_TIMEOUT = 5000;
+  static constexpr size_t ARP_MAX_BACKOFF = 60000;
+  void set_arp_pending_limits( size_t per_neighbour, size_t total_bytes );
+
+  struct ArpPendingDrops
+  {
+    uint64_t neighbour_full {}; // its neighbour already had the most datagrams waiting
+    uint64_t memory_full {};    // all the neighbours together had the most bytes waiting
+    uint64_t unresolved {};     // its neighbour did not answer in time
+  };
+  const ArpPendingDrops& arp_pending_drops() const { return arp_pending_drops_; }
+  size_t arp_pending_datagrams() const { return arp_pending_count_; }
+  size_t arp_pending_bytes() const { return arp_pending_bytes_; }
+
+  // An ARP cache entry lasts ARP_CACHE_TTL. A datagram sent with ARP_REFRESH_BEFORE or less left still goes
+  // to the cached address, and a unicast ARP request asks the neighbour to renew the entry (again after each
+  // ARP_PROBE_INTERVAL while it stays in use), so a busy next hop does not stall when its entry would expire.
+  static constexpr size_t ARP_CACHE_TTL = 30000;
+  static constexpr size_t ARP_REFRESH_BEFORE = 3000;
+  static constexpr size_t ARP_PROBE_INTERVAL = 1000;
+
   // Accessors
   const std::string& name() const { return name_; }
+  const EthernetAddress& ethernet_address() const { return ethernet_address_; }
+  const Address& ip_address() const { return ip_address_; }
   const OutputPort& output() const { return *port_; }
   OutputPort& output() { return *port_; }
   std::queue<InternetDatagram>& datagrams_received() { return datagrams_received_; }
+  const DatagramReassembler& reassembler() const { return reassembler_; }
 
 private:
   // Human-readable name of the interface
@@ -77,7 +139,15 @@ private:
 
   // The physical output port (+ a helper function `transmit` that uses it to send an Ethernet frame)
   std::shared_ptr<OutputPort> port_;
-  void transmit( const EthernetFrame& frame ) const { port_->transmit( *this, frame ); }
+  // (or queue it, if there is an egress queue; `flow` is the FlowKey hash of an IPv4 frame's datagram)
+  void transmit( EthernetFrame frame, uint32_t flow = 0 );
+
+  // 发送过的帧留下的头部缓冲区和负载列表, 下一帧接着用, 免得每帧都分配内存
+  static constexpr size_t SPARE_BUFFERS = 64;
+  std::vector<std::string> spare_headers_ {};
+  std::vector<std::vector<Ref<std::string>>> spare_payloads_ {};
+  EthernetFrame frame_for( InternetDatagram&& dgram, const EthernetAddress& dst );
+  void recycle( EthernetFrame&& frame );
 
   // Ethernet (known as hardware, network-access-layer, or link-layer) address of the interface
   EthernetAddress ethernet_address_;
@@ -85,24 +155,65 @@ private:
   // IP (known as internet-layer or network-layer) address of the interface
   Address ip_address_;
 
+  // 链路的MTU
+  size_t mtu_ { DEFAULT_MTU };
+
+  // 出口队列, 以及限速: 每毫秒积累 egress_rate_ 毫字节的发送额度, 额度为正时就可以发送下一帧(允许透支)
+  std::unique_ptr<Qdisc> qdisc_ {};
+  uint64_t egress_rate_ {};
+  int64_t egress_credit_ {};
+  int64_t egress_burst_ {};
+  uint64_t now_ {}; // 毫秒, 出口队列的时钟
+  void drain_egress_queue();
+
   // Datagrams that have been received
   std::queue<InternetDatagram> datagrams_received_ {};
 
+  // 发给本接口的分片在这里重组
+  DatagramReassembler reassembler_ {};
+
+  // 收到的数据报按流统计(可选)
+  std::unique_ptr<FlowSampler> sampler_ {};
+
   // 要记录 IP地址 -> MAC地址, 还要记录映射时间, 所以另外设置一个数据结构来存储
   struct ArpEntry
   {
-    EthernetAddress mac;
-    size_t remaining_ttl;
+    EthernetAddress mac {};
+    size_t remaining_ttl {};
+    size_t probed_at_ttl {}; // 上一次单播请求续期时的 remaining_ttl(0: 还没有请求过)
     ArpEntry() = default;
     ArpEntry( EthernetAddress mac_, size_t ttl_ ) : mac( mac_ ), remaining_ttl( ttl_ ) {};
   };
 
-  // ARP缓存表
-  std::map<uint32_t, ArpEntry> arp_cache_ {};
+  // ARP的计时器比 tick() 的时钟快多少倍
+  size_t arp_time_scale_ { 1 };
 
-  // 请求限流计时器
-  std::map<uint32_t, size_t> arp_waiting_requests_ {};
+  // ARP缓存表: 每发一个数据报都要查一次, 用开放寻址的哈希表(一个大网段上可能有上万个邻居)
+  FlatHashMap<uint32_t, ArpEntry> arp_cache_ {};
 
-  // 等待发送的数据报
-  std::map<uint32_t, std::vector<InternetDatagram>> arp_waiting_datagrams_ {};
+  // 等待ARP解析的邻居: 等待发送的数据报(带全局序号, 按到达顺序), 以及请求的重发退避.
+  // 请求未答复时 timer 是这一轮还能等多久; 超时后数据报丢弃, timer 变成失败次数还要记住多久
+  struct PendingNeighbour
+  {
+    std::deque<std::pair<uint64_t, InternetDatagram>> datagrams {};
+    size_t timer {};
+    size_t attempts {}; // 连续没有答复的请求数
+    bool requesting {};
+  };
+  std::map<uint32_t, PendingNeighbour> arp_pending_ {};
+
+  // 所有等待的数据报按到达顺序排成的 (下一跳, 序号), 超出总字节数时从最老的开始丢.
+  // 已经发出或丢掉的留在里面, 取到时跳过, 过多时清理
+  std::deque<std::pair<uint32_t, uint64_t>> arp_pending_order_ {};
+  uint64_t arp_pending_seq_ {};
+  size_t arp_pending_count_ {};
+  size_t arp_pending_bytes_ {};
+  size_t arp_pending_per_neighbour_ { DEFAULT_ARP_PENDING_PER_NEIGHBOUR };
+  size_t arp_pending_limit_ { DEFAULT_ARP_PENDING_BYTES };
+  ArpPendingDrops arp_pending_drops_ {};
+
+  void send_arp_request( uint32_t next_ip, const EthernetAddress& dst = ETHERNET_BROADCAST );
+  void queue_for_arp( uint32_t next_ip, InternetDatagram&& dgram );
+  void release_pending( PendingNeighbour& neighbour );
+  bool drop_oldest_pending();
 };
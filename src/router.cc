@@ -1,16 +1,53 @@
 #include "router.hh"
 #include "address.hh"
 #include "debug.hh"
+#include "flow_hash.hh"
+#include "helpers.hh"
+#include "icmp_message.hh"
 #include "ipv4_datagram.hh"
 #include "network_interface.hh"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using namespace std;
 
+namespace {
+// 不为这些数据报发送ICMP差错报文(RFC 1812 4.3.2.7): ICMP差错报文本身、非首个分片,
+// 以及源地址不是单播地址或目的地址是广播/组播的数据报
+bool deserves_icmp_error( const InternetDatagram& dgram )
+{
+  const auto is_unicast = []( uint32_t address ) {
+    return address != 0 and address < 0xe0000000 and ( address >> 24U ) != 127; // 非0, 非D/E类, 非环回
+  };
+  return is_unicast( dgram.header.src ) and is_unicast( dgram.header.dst ) and dgram.header.offset == 0
+         and not ICMPMessage::carries_error( dgram );
+}
+
+// 要为经NAT入向转换的数据报发ICMP差错报文时, 先把它换回到达时的样子: 差错报文引用的应是发送方发出的首部
+template<typename Nat>
+void restore_for_icmp( Nat* nat, const bool translated, InternetDatagram& dgram )
+{
+  if ( translated ) {
+    const scoped_lock lock { nat->mutex };
+    nat->table.restore_inbound( dgram );
+  }
+}
+} // namespace
+
 // route_prefix: The "up-to-32-bit" IPv4 address prefix to match the datagram's destination address against
 // prefix_length: For this route to be applicable, how many high-order (most-significant) bits of
 //    the route_prefix will need to match the corresponding bits of the datagram's destination address?
@@ -27,48 +64,642 @@ void Router::add_route( const uint32_t route_prefix,
   //      << " on interface " << interface_num << "\n";
   // debug( "unimplemented add_route() called" );
 
-  // 路由条目存入路由表
-  routing_table_.push_back( { route_prefix, prefix_length, next_hop, interface_num } );
+  add_multipath_route( route_prefix, prefix_length, { { next_hop, interface_num } } );
+}
+
+void Router::add_multipath_route( const uint32_t route_prefix,
+                                  const uint8_t prefix_length,
+                                  const vector<Path>& paths )
+{
+  // 两份副本都要更新; 路由表版本随之变化, route() 据此清空路由缓存
+  routing_table_.modify( [&]( RoutingTable& table ) { table.add( route_prefix, prefix_length, paths ); } );
+}
+
+bool Router::remove_route( const uint32_t route_prefix, const uint8_t prefix_length )
+{
+  return routing_table_.modify(
+    [&]( RoutingTable& table ) { return table.remove( route_prefix, prefix_length ); } );
+}
+
+bool Router::replace_route( const uint32_t route_prefix,
+                            const uint8_t prefix_length,
+                            const optional<Address> next_hop,
+                            const size_t interface_num )
+{
+  return routing_table_.modify( [&]( RoutingTable& table ) {
+    return table.replace( route_prefix, prefix_length, { { next_hop, interface_num } } );
+  } );
+}
+
+void Router::compile_forwarding_table()
+{
+  routing_table_.modify( []( RoutingTable& table ) { table.compile_forwarding_table(); } );
+}
+
+void Router::set_batch_size( const size_t batch_size )
+{
+  if ( batch_size == 0 or batch_size > MAX_BATCH ) {
+    throw runtime_error( "Router batch size must be between 1 and " + to_string( MAX_BATCH ) );
+  }
+  batch_size_ = batch_size;
+}
+
+void Router::set_acl( const size_t interface_num, vector<AclRule> rules, const AclRule::Action default_action )
+{
+  if ( interface_num >= interfaces_.size() ) {
+    throw runtime_error( "Router::set_acl(): no interface " + to_string( interface_num ) );
+  }
+  // 分类器只建一次, 两份副本各复制一份
+  const PacketClassifier classifier { move( rules ), default_action };
+  acls_.modify( [&]( vector<PacketClassifier>& acls ) {
+    acls.resize( max( acls.size(), interface_num + 1 ) );
+    acls[interface_num] = classifier;
+  } );
+}
+
+void Router::enable_nat( const size_t interface_num, const NatTimeouts timeouts )
+{
+  if ( interface_num >= interfaces_.size() ) {
+    throw runtime_error( "Router::enable_nat(): no interface " + to_string( interface_num ) );
+  }
+  // 并行模式下RX线程不加锁地读 nats_, 不能再改
+  if ( parallel_running_ ) {
+    throw runtime_error( "Router::enable_nat() called while forwarding in parallel" );
+  }
+  nats_.resize( max( nats_.size(), interface_num + 1 ) );
+  nats_[interface_num]
+    = make_unique<Nat>( NatTable { interfaces_[interface_num]->ip_address().ipv4_numeric(), timeouts } );
+}
+
+size_t Router::nat_mappings( const size_t interface_num )
+{
+  if ( interface_num >= nats_.size() or not nats_[interface_num] ) {
+    return 0;
+  }
+  Nat& nat = *nats_[interface_num];
+  const scoped_lock lock { nat.mutex };
+  return nat.table.size();
+}
+
+void Router::tick( const size_t ms_since_last_tick )
+{
+  lane_.icmp_limiter.tick( ms_since_last_tick );
+  for ( auto& nat : nats_ ) {
+    if ( nat ) {
+      const scoped_lock lock { nat->mutex };
+      nat->table.tick( ms_since_last_tick );
+    }
+  }
+}
+
+void Router::set_icmp_rate_limit( const size_t per_second, const size_t burst )
+{
+  icmp_rate_ = per_second;
+  icmp_burst_ = burst;
+  lane_.icmp_limiter = { per_second, burst };
+}
+
+void Router::match_batch( Lane& lane,
+                          const RoutingTable& table,
+                          span<const uint32_t> dst_ips,
+                          span<uint32_t> indexes )
+{
+  // 路由表换了版本, 缓存的结果都可能过时
+  if ( table.version() != lane.cached_version ) {
+    lane.route_cache.invalidate();
+    lane.cached_version = table.version();
+  }
+
+  // 先查缓存, 记下未命中的地址及其位置
+  array<uint32_t, MAX_BATCH> miss_dst {};
+  array<size_t, MAX_BATCH> miss_position {};
+  size_t miss_count = 0;
+  for ( size_t i = 0; i < dst_ips.size(); i++ ) {
+    if ( const optional<uint32_t> cached = lane.route_cache.find( dst_ips[i] ) ) {
+      indexes[i] = *cached;
+    } else {
+      miss_dst[miss_count] = dst_ips[i];
+      miss_position[miss_count++] = i;
+    }
+  }
+  if ( miss_count == 0 ) {
+    return;
+  }
+
+  // 未命中的整批查表, 结果放回原位置并填入缓存(没有路由也缓存)
+  array<uint32_t, MAX_BATCH> miss_indexes {};
+  table.lookup_batch( span( miss_dst ).first( miss_count ), miss_indexes );
+  for ( size_t j = 0; j < miss_count; j++ ) {
+    indexes[miss_position[j]] = miss_indexes[j];
+    lane.route_cache.insert( miss_dst[j], miss_indexes[j] );
+  }
+}
+
+template<typename Emit>
+void Router::forward_batch( Lane& lane, const size_t ingress, span<InternetDatagram> batch, Emit&& emit )
+{
+  // 处理这一批期间持有路由表和ACL的一份副本, 更新只会改另一份
+  const auto table = routing_table_.read( lane.reader );
+  const auto acls = acls_.read( lane.acl_reader );
+  const PacketClassifier* acl = ingress < acls->size() ? &( *acls )[ingress] : nullptr;
+  // 并行模式下各RX线程共用NAT表, 只在转换时持有它的锁
+  Nat* const inbound_nat = ingress < nats_.size() ? nats_[ingress].get() : nullptr;
+
+  array<uint32_t, MAX_BATCH> dst {};      // 要查路由的目的IP地址
+  array<size_t, MAX_BATCH> position {};   // 以及它们在 batch 中的位置
+  array<uint32_t, MAX_BATCH> routes {};
+  array<bool, MAX_BATCH> translated {};   // 经过NAT入向转换的
+  size_t count = 0;
+  for ( size_t i = 0; i < batch.size(); i++ ) {
+    lane.count( ingress, RX_PACKETS );
+    lane.count( ingress, RX_BYTES, batch[i].header.len );
+    // 入接口ACL拒绝的数据报直接丢弃(不发ICMP差错报文, 也不看TTL)
+    if ( acl != nullptr and acl->classify( batch[i] ) == AclRule::Action::Deny ) {
+      lane.count( ingress, ACL_DROPS );
+      continue;
+    }
+    // 发给NAT接口地址的回复, 先把目的地址和端口换回内部主机的, 再查路由(不属于任何映射的照常处理)
+    if ( inbound_nat != nullptr ) {
+      const scoped_lock lock { inbound_nat->mutex };
+      translated[i] = inbound_nat->table.translate_inbound( batch[i] );
+    }
+    if ( batch[i].header.ttl <= 1 ) {
+      lane.count( ingress, TTL_DROPS );
+      restore_for_icmp( inbound_nat, translated[i], batch[i] );
+      // TTL耗尽, 丢弃并告知源主机(traceroute 靠的就是这个)
+      send_icmp_error( lane,
+                       *table,
+                       ingress,
+                       batch[i],
+                       ICMPMessage::TYPE_TIME_EXCEEDED,
+                       ICMPMessage::CODE_TTL_EXCEEDED,
+                       emit );
+      continue;
+    }
+    dst[count] = batch[i].header.dst;
+    position[count++] = i;
+  }
+
+  // 整批做最长前缀匹配, 没有匹配的路由就丢弃
+  match_batch( lane, *table, span( dst ).first( count ), routes );
+  for ( size_t j = 0; j < count; j++ ) {
+    InternetDatagram& datagram = batch[position[j]];
+    if ( routes[j] == NO_ROUTE ) {
+      lane.count( ingress, NO_ROUTE_DROPS );
+      restore_for_icmp( inbound_nat, translated[position[j]], datagram );
+      send_icmp_error( lane,
+                       *table,
+                       ingress,
+                       datagram,
+                       ICMPMessage::TYPE_DESTINATION_UNREACHABLE,
+                       ICMPMessage::CODE_NET_UNREACHABLE,
+                       emit );
+      continue;
+    }
+    const RoutingTable::Entry& best_match = table->entry( routes[j] );
+    // 等价多路径: 同一条流(五元组相同)总是选中同一条路径, 不会乱序
+    const Path& path = best_match.paths.size() == 1
+                         ? best_match.paths.front()
+                         : best_match.paths[FlowKey::pick( FlowKey::of( datagram ).hash( ecmp_seed_ ),
+                                                           best_match.paths.size() )];
+    // 超过出接口MTU又不许分片的数据报, 丢弃并告知源主机该MTU(路径MTU发现)
+    const size_t mtu = interfaces_[path.interface_num]->mtu();
+    if ( datagram.header.df and datagram.header.len > mtu ) {
+      lane.count( ingress, MTU_DROPS );
+      restore_for_icmp( inbound_nat, translated[position[j]], datagram );
+      send_icmp_error( lane,
+                       *table,
+                       ingress,
+                       datagram,
+                       ICMPMessage::TYPE_DESTINATION_UNREACHABLE,
+                       ICMPMessage::CODE_FRAGMENTATION_NEEDED,
+                       emit,
+                       static_cast<uint16_t>( min( mtu, size_t { UINT16_MAX } ) ) );
+      continue;
+    }
+    // 从其他接口经NAT接口发出的数据报, 源地址和端口换成NAT接口的; 无法转换的丢弃
+    Nat* const outbound_nat = path.interface_num < nats_.size() and path.interface_num != ingress
+                                ? nats_[path.interface_num].get()
+                                : nullptr;
+    if ( outbound_nat != nullptr ) {
+      const scoped_lock lock { outbound_nat->mutex };
+      if ( not outbound_nat->table.translate_outbound( datagram ) ) {
+        lane.count( ingress, NAT_DROPS );
+        continue;
+      }
+    }
+    lane.count_route( routes[j], best_match, datagram.header.len );
+    datagram.header.decrement_ttl(); // 只按改动的TTL增量更新首部检验和, 不必重算整个首部
+    // 路径中next_hop有值, 数据报要经过本路由器间接转发
+    // 路径中next_hop没有值, 目的ip与某接口直连, 直接交付
+    const uint32_t next_hop = path.next_hop ? path.next_hop->ipv4_numeric() : dst[j];
+    emit( path.interface_num, std::move( datagram ), next_hop );
+  }
 }
 
 // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
 void Router::route()
 {
   // debug( "unimplemented route() called" );
+  if ( parallel_running_ ) {
+    throw runtime_error( "Router::route() called while forwarding in parallel" );
+  }
+  const auto send = [this]( size_t interface_num, InternetDatagram&& dgram, uint32_t next_hop ) {
+    lane_.count( interface_num, TX_PACKETS );
+    lane_.count( interface_num, TX_BYTES, dgram.header.len );
+    interfaces_[interface_num]->send_datagram( std::move( dgram ), Address::from_ipv4_numeric( next_hop ) );
+  };
+
   // 检查路由器的所有接口
-  for ( auto& interface_ptr : interfaces_ ) {
-    // 检查接口中的数据报
-    auto& datagrams_in_queue = interface_ptr->datagrams_received();
+  for ( size_t ingress = 0; ingress < interfaces_.size(); ingress++ ) {
+    // 检查接口中的数据报, 每次取出一批
+    auto& datagrams_in_queue = interfaces_[ingress]->datagrams_received();
     while ( !datagrams_in_queue.empty() ) {
-      InternetDatagram datagram = std::move( datagrams_in_queue.front() );
-      datagrams_in_queue.pop();
-      if ( datagram.header.ttl <= 1 ) {
-        continue; // TTL耗尽, 丢弃(也许会有发送ICMP数据报的逻辑, 但是实验手册提示并不是所有路由器都会发送ICMP数据包)
+      size_t count = 0;
+      while ( count < batch_size_ && !datagrams_in_queue.empty() ) {
+        batch_[count++] = std::move( datagrams_in_queue.front() );
+        datagrams_in_queue.pop();
       }
-      datagram.header.ttl--;
-      datagram.header.compute_checksum();                  // 重新计算首部检验和
-      uint32_t dst_ip = datagram.header.dst;               // 目的IP地址
-      std::optional<RouteEntry> best_match = std::nullopt; // 最长前缀匹配结果
-
-      for ( const auto& entry : routing_table_ ) {
-        // 从路由表结构中获取掩码(为0时应该是对应默认路由)
-        uint32_t mask = ( entry.prefix_length == 0 ) ? 0 : 0xffffffffU << ( 32 - entry.prefix_length );
-
-        uint32_t dst_prefix = dst_ip & mask;
-        uint32_t entry_prefix = entry.route_prefix & mask;
-        if ( dst_prefix == entry_prefix ) {
-          // 第一次匹配成功或者更精确的前缀(最长前缀)
-          if ( !best_match.has_value() || best_match->prefix_length < entry.prefix_length ) {
-            best_match = entry;
-          }
-        }
+      forward_batch( lane_, ingress, span( batch_ ).first( count ), send );
+    }
+  }
+}
+
+template<typename Emit>
+void Router::send_icmp_error( Lane& lane,
+                              const RoutingTable& table,
+                              const size_t ingress,
+                              const InternetDatagram& original,
+                              const uint8_t type,
+                              const uint8_t code,
+                              Emit&& emit,
+                              const uint16_t next_hop_mtu )
+{
+  if ( not deserves_icmp_error( original ) or not lane.icmp_limiter.consume() ) {
+    return;
+  }
+  const uint32_t sender = original.header.src;
+  InternetDatagram reply = ICMPMessage::error( type, code, original, next_hop_mtu )
+                             .to_datagram( interfaces_[ingress]->ip_address().ipv4_numeric(), sender );
+
+  // 从到达的接口发回: 到源主机的路由若经过这个接口, 就交给它的下一跳, 否则认为源主机与该接口直连
+  uint32_t route_back = NO_ROUTE;
+  table.lookup_batch( span( &sender, 1 ), span( &route_back, 1 ) );
+  uint32_t next_hop = sender;
+  if ( route_back != NO_ROUTE ) {
+    for ( const Path& path : table.entry( route_back ).paths ) {
+      if ( path.interface_num == ingress ) {
+        next_hop = path.next_hop ? path.next_hop->ipv4_numeric() : sender;
+        break;
       }
-      // 路由表项中next_hop有值, 数据报要经过本路由器间接转发
-      // 路由表项中next_hop没有值, 目的ip与某接口直连, 直接交付
-      if ( best_match.has_value() ) {
-        const Address dst_address = best_match->next_hop.value_or( Address::from_ipv4_numeric( dst_ip ) );
-        interface( best_match->interface_num )->send_datagram( datagram, dst_address );
+    }
+  }
+  emit( ingress, std::move( reply ), next_hop );
+}
+
+Router::RxLane::RxLane( Lane lane_, const size_t interface_count, const size_t ring_capacity )
+  : lane( std::move( lane_ ) ), to_egress(), to_self( ring_capacity )
+{
+  for ( size_t i = 0; i < interface_count; i++ ) {
+    to_egress.push_back( make_unique<SPSCQueue<Outgoing>>( ring_capacity ) );
+  }
+}
+
+Router::~Router()
+{
+  stop_parallel();
+}
+
+void Router::start_parallel( const size_t ring_capacity )
+{
+  if ( parallel_running_ ) {
+    throw runtime_error( "Router::start_parallel() called while already running" );
+  }
+  // 每个接口一个RX通道(各自的读者编号、路由缓存和ICMP限速器), 到每个出接口各一个环形队列
+  if ( rx_lanes_.size() != interfaces_.size()
+       or ( not rx_lanes_.empty() and rx_lanes_.front()->to_self.capacity() < ring_capacity ) ) {
+    for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+      // 重新创建时沿用原来的读者编号和计数器
+      const bool reused = i < rx_lanes_.size();
+      Lane lane { reused ? rx_lanes_[i]->lane.reader : routing_table_.register_reader(),
+                  reused ? rx_lanes_[i]->lane.acl_reader : acls_.register_reader(),
+                  RouteCache { lane_.route_cache.sets() },
+                  0,
+                  TokenBucket { icmp_rate_, icmp_burst_ },
+                  reused ? std::move( rx_lanes_[i]->lane.interface_counters ) : make_unique<CounterBlock>(),
+                  reused ? std::move( rx_lanes_[i]->lane.route_counters ) : make_unique<CounterBlock>() };
+      auto rx_lane = make_unique<RxLane>( std::move( lane ), interfaces_.size(), ring_capacity );
+      if ( i < rx_lanes_.size() ) {
+        rx_lanes_[i] = std::move( rx_lane );
+      } else {
+        rx_lanes_.push_back( std::move( rx_lane ) );
       }
     }
   }
+
+  while ( tx_counters_.size() < interfaces_.size() ) {
+    tx_counters_.push_back( make_unique<CounterBlock>() );
+  }
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    publish_arp_pending( *interfaces_[i], *tx_counters_[i] );
+  }
+
+  parallel_running_ = true;
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    tx_workers_.emplace_back( [this, i] { run_tx_worker( i ); } );
+  }
+}
+
+void Router::stop_parallel()
+{
+  parallel_running_ = false;
+  for ( auto& worker : tx_workers_ ) {
+    worker.join();
+  }
+  tx_workers_.clear();
+
+  // 丢弃环形队列中剩下的数据报和帧
+  for ( auto& rx_lane : rx_lanes_ ) {
+    for ( auto& ring : rx_lane->to_egress ) {
+      while ( ring->pop() ) {}
+    }
+    while ( rx_lane->to_self.pop() ) {}
+  }
+}
+
+void Router::receive_frame( const size_t interface_num, EthernetFrame frame )
+{
+  RxLane& rx = *rx_lanes_.at( interface_num );
+
+  // ICMP限速器按真实时间补充令牌
+  const auto now = chrono::steady_clock::now();
+  const auto elapsed = chrono::duration_cast<chrono::milliseconds>( now - rx.last_tick );
+  if ( elapsed.count() > 0 ) {
+    rx.last_tick += elapsed;
+    rx.lane.icmp_limiter.tick( elapsed.count() );
+    rx.reassembler.tick( elapsed.count() );
+  }
+
+  // 放入发往 interface 的环形队列, 队列满了就丢弃
+  const auto push = [&]( auto& ring, auto&& item, size_t interface ) {
+    if ( ring.push( std::forward<decltype( item )>( item ) ) ) {
+      return true;
+    }
+    rx.lane.count( interface, RING_DROPS );
+    return false;
+  };
+
+  // 发给本接口(或广播)的IPv4数据报在本线程转发; 其他帧(ARP等)交给拥有这个接口的TX线程
+  const NetworkInterface& iface = *interfaces_[interface_num];
+  if ( frame.header.type != EthernetHeader::TYPE_IPv4 ) {
+    push( rx.to_self, std::move( frame ), interface_num );
+    return;
+  }
+  if ( frame.header.dst != iface.ethernet_address() and frame.header.dst != ETHERNET_BROADCAST ) {
+    return;
+  }
+  InternetDatagram dgram;
+  if ( not parse( dgram, std::move( frame.payload ) ) ) {
+    return;
+  }
+  // 和 NetworkInterface::recv_frame 一样, 发给本接口的分片先重组(NAT要看完整数据报的端口)
+  if ( dgram.header.dst == iface.ip_address().ipv4_numeric() ) {
+    optional<InternetDatagram> whole = rx.reassembler.add( std::move( dgram ) );
+    if ( not whole ) {
+      return;
+    }
+    dgram = std::move( *whole );
+  }
+  forward_batch(
+    rx.lane, interface_num, span( &dgram, 1 ), [&]( size_t egress, InternetDatagram&& out, uint32_t next_hop ) {
+      const uint16_t length = out.header.len;
+      if ( push( *rx.to_egress[egress], Outgoing { std::move( out ), next_hop }, egress ) ) {
+        rx.lane.count( egress, TX_PACKETS );
+        rx.lane.count( egress, TX_BYTES, length );
+      }
+    } );
+}
+
+void Router::Lane::count_route( const uint32_t index, const RoutingTable::Entry& entry, const uint64_t bytes )
+{
+  const size_t base = size_t { index } * ROUTE_COUNTERS;
+  if ( base + ROUTE_COUNTERS > CounterBlock::CAPACITY ) {
+    return; // 路由太多, 后面的不计数
+  }
+  // 这个下标上次计数的是一条已经删除的路由: 先清零, 再换上新路由的 id
+  if ( route_counters->get( base ) != entry.id ) {
+    route_counters->set( base + 1, 0 );
+    route_counters->set( base + 2, 0 );
+    route_counters->set( base, entry.id );
+  }
+  route_counters->add( base + 1 );
+  route_counters->add( base + 2, bytes );
+}
+
+uint64_t Router::total( const InterfaceCounter counter, const size_t interface_num ) const
+{
+  const size_t index = interface_num * INTERFACE_COUNTERS + counter;
+  uint64_t sum = lane_.interface_counters->get( index );
+  for ( const auto& rx_lane : rx_lanes_ ) {
+    sum += rx_lane->lane.interface_counters->get( index );
+  }
+  return sum;
+}
+
+Router::InterfaceStats Router::interface_stats( const size_t interface_num ) const
+{
+  return { total( RX_PACKETS, interface_num ),     total( RX_BYTES, interface_num ),
+           total( TX_PACKETS, interface_num ),     total( TX_BYTES, interface_num ),
+           total( ACL_DROPS, interface_num ),      total( TTL_DROPS, interface_num ),
+           total( NO_ROUTE_DROPS, interface_num ), total( MTU_DROPS, interface_num ),
+           total( NAT_DROPS, interface_num ),      total( RING_DROPS, interface_num ) };
+}
+
+uint64_t Router::acl_drops() const
+{
+  uint64_t drops = 0;
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    drops += total( ACL_DROPS, i );
+  }
+  return drops;
+}
+
+uint64_t Router::ring_drops() const
+{
+  uint64_t drops = 0;
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    drops += total( RING_DROPS, i );
+  }
+  return drops;
+}
+
+vector<Router::RouteStats> Router::route_stats()
+{
+  const scoped_lock lock { stats_mutex_ };
+  const auto table = routing_table_.read( stats_reader_ );
+
+  vector<const Lane*> lanes { &lane_ };
+  for ( const auto& rx_lane : rx_lanes_ ) {
+    lanes.push_back( &rx_lane->lane );
+  }
+
+  vector<RouteStats> stats;
+  stats.reserve( table->size() );
+  table->for_each( [&]( uint32_t index, const RoutingTable::Entry& entry ) {
+    RouteStats route { entry.route_prefix, entry.prefix_length, 0, 0 };
+    const size_t base = size_t { index } * ROUTE_COUNTERS;
+    for ( const Lane* lane : lanes ) {
+      // 只算这条路由自己的计数, 不算之前占用这个下标的路由的
+      if ( lane->route_counters->get( base ) == entry.id ) {
+        route.packets += lane->route_counters->get( base + 1 );
+        route.bytes += lane->route_counters->get( base + 2 );
+      }
+    }
+    stats.push_back( route );
+  } );
+  return stats;
+}
+
+void Router::write_metrics( ostream& out )
+{
+  const auto family = [&]( const string& name, const string& type, const string& help ) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+  };
+  const auto per_interface = [&]( const string& name, const string& help, auto field ) {
+    family( name, "counter", help );
+    for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+      out << name << "{interface=\"" << interfaces_[i]->name() << "\"} " << interface_stats( i ).*field << "\n";
+    }
+  };
+  per_interface( "router_rx_packets_total", "Datagrams received.", &InterfaceStats::rx_packets );
+  per_interface( "router_rx_bytes_total", "Bytes of datagrams received.", &InterfaceStats::rx_bytes );
+  per_interface( "router_tx_packets_total", "Datagrams sent.", &InterfaceStats::tx_packets );
+  per_interface( "router_tx_bytes_total", "Bytes of datagrams sent.", &InterfaceStats::tx_bytes );
+
+  family( "router_drops_total", "counter", "Datagrams dropped on arrival, by reason." );
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    const InterfaceStats stats = interface_stats( i );
+    for ( const auto& [reason, count] : { pair { "acl", stats.acl_drops },
+                                          pair { "ttl", stats.ttl_drops },
+                                          pair { "no_route", stats.no_route_drops },
+                                          pair { "mtu", stats.mtu_drops },
+                                          pair { "nat", stats.nat_drops },
+                                          pair { "ring_full", stats.ring_drops } } ) {
+      out << "router_drops_total{interface=\"" << interfaces_[i]->name() << "\",reason=\"" << reason << "\"} "
+          << count << "\n";
+    }
+  }
+
+  family( "router_nat_mappings", "gauge", "Translations held by each interface's NAT." );
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    if ( i < nats_.size() and nats_[i] ) {
+      out << "router_nat_mappings{interface=\"" << interfaces_[i]->name() << "\"} " << nat_mappings( i ) << "\n";
+    }
+  }
+
+  // 并行模式下接口归TX线程所有, 只能读它发布的统计(最多晚1毫秒); 否则直接读接口的
+  const auto arp_pending = [&]( size_t i ) {
+    if ( parallel_running_ ) {
+      const CounterBlock& published = *tx_counters_[i];
+      return pair { NetworkInterface::ArpPendingDrops { published.get( ARP_NEIGHBOUR_FULL_DROPS ),
+                                                        published.get( ARP_MEMORY_FULL_DROPS ),
+                                                        published.get( ARP_UNRESOLVED_DROPS ) },
+                    published.get( ARP_PENDING_BYTES ) };
+    }
+    return pair { interfaces_[i]->arp_pending_drops(), uint64_t { interfaces_[i]->arp_pending_bytes() } };
+  };
+  family( "router_arp_pending_drops_total", "counter", "Datagrams dropped while waiting for ARP, by reason." );
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    const NetworkInterface::ArpPendingDrops drops = arp_pending( i ).first;
+    for ( const auto& [reason, count] : { pair { "neighbour_full", drops.neighbour_full },
+                                          pair { "memory_full", drops.memory_full },
+                                          pair { "unresolved", drops.unresolved } } ) {
+      out << "router_arp_pending_drops_total{interface=\"" << interfaces_[i]->name() << "\",reason=\"" << reason
+          << "\"} " << count << "\n";
+    }
+  }
+  family( "router_arp_pending_bytes", "gauge", "Bytes of datagrams waiting for ARP." );
+  for ( size_t i = 0; i < interfaces_.size(); i++ ) {
+    out << "router_arp_pending_bytes{interface=\"" << interfaces_[i]->name() << "\"} " << arp_pending( i ).second
+        << "\n";
+  }
+
+  family( "router_flow_bytes", "gauge", "Bytes received from the heaviest flows (upper bounds), by interface." );
+  for ( const auto& iface : interfaces_ ) {
+    if ( const FlowSampler* sampler = iface->flow_sampler() ) {
+      for ( const auto& flow : sampler->top() ) {
+        out << "router_flow_bytes{interface=\"" << iface->name() << "\",src=\""
+            << Address::from_ipv4_numeric( flow.key.src ).ip() << "\",dst=\""
+            << Address::from_ipv4_numeric( flow.key.dst ).ip() << "\",proto=\"" << +flow.key.proto
+            << "\",src_port=\"" << flow.key.src_port << "\",dst_port=\"" << flow.key.dst_port << "\"} "
+            << flow.bytes << "\n";
+      }
+    }
+  }
+
+  const vector<RouteStats> routes = route_stats();
+  const auto route_label = []( const RouteStats& route ) {
+    return "{prefix=\"" + Address::from_ipv4_numeric( route.route_prefix ).ip() + "/"
+           + to_string( route.prefix_length ) + "\"} ";
+  };
+  family( "router_route_packets_total", "counter", "Datagrams forwarded by each route." );
+  for ( const auto& route : routes ) {
+    out << "router_route_packets_total" << route_label( route ) << route.packets << "\n";
+  }
+  family( "router_route_bytes_total", "counter", "Bytes of datagrams forwarded by each route." );
+  for ( const auto& route : routes ) {
+    out << "router_route_bytes_total" << route_label( route ) << route.bytes << "\n";
+  }
+}
+
+void Router::run_tx_worker( const size_t interface_num )
+{
+  constexpr size_t BATCH = 64;
+  NetworkInterface& iface = *interfaces_[interface_num];
+  auto last_tick = chrono::steady_clock::now();
+
+  while ( parallel_running_.load( memory_order_relaxed ) ) {
+    size_t handled = 0;
+
+    // 本接口收到的ARP等帧
+    while ( auto frame = rx_lanes_[interface_num]->to_self.pop() ) {
+      iface.recv_frame( std::move( *frame ) );
+      handled++;
+    }
+
+    // 轮流从各入接口的环形队列取出数据报发送, 每个队列每轮最多取一批
+    for ( auto& rx_lane : rx_lanes_ ) {
+      auto& ring = *rx_lane->to_egress[interface_num];
+      for ( size_t i = 0; i < BATCH; i++ ) {
+        auto outgoing = ring.pop();
+        if ( not outgoing ) {
+          break;
+        }
+        auto& [dgram, next_hop] = *outgoing;
+        iface.send_datagram( std::move( dgram ), Address::from_ipv4_numeric( next_hop ) );
+        handled++;
+      }
+    }
+
+    const auto now = chrono::steady_clock::now();
+    const auto elapsed = chrono::duration_cast<chrono::milliseconds>( now - last_tick );
+    if ( elapsed.count() > 0 ) {
+      last_tick += elapsed;
+      iface.tick( elapsed.count() );
+      publish_arp_pending( iface, *tx_counters_[interface_num] );
+    }
+
+    if ( handled == 0 ) {
+      this_thread::yield();
+    }
+  }
+}
+
+void Router::publish_arp_pending( const NetworkInterface& iface, CounterBlock& counters )
+{
+  const NetworkInterface::ArpPendingDrops& drops = iface.arp_pending_drops();
+  counters.set( ARP_NEIGHBOUR_FULL_DROPS, drops.neighbour_full );
+  counters.set( ARP_MEMORY_FULL_DROPS, drops.memory_full );
+  counters.set( ARP_UNRESOLVED_DROPS, drops.unresolved );
+  counters.set( ARP_PENDING_BYTES, iface.arp_pending_bytes() );
 }
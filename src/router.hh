@@ -1,10 +1,29 @@
 #pragma once
 
+#include "counter_block.hh"
+#include "datagram_reassembler.hh"
 #include "exception.hh"
+#include "left_right.hh"
+#include "nat_table.hh"
 #include "network_interface.hh"
+#include "packet_classifier.hh"
+#include "route_cache.hh"
+#include "routing_table.hh"
+#include "spsc_queue.hh"
+#include "token_bucket.hh"
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <ostream>
+#include <random>
+#include <span>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // \brief A router that has multiple network interfaces and
@@ -24,27 +43,286 @@ public:
   // Access an interface by index
   std::shared_ptr<NetworkInterface> interface( const size_t N ) { return interfaces_.at( N ); }
 
-  // Add a route (a forwarding rule)
+  // Add a route (a forwarding rule), or replace the one with the same prefix
   void add_route( uint32_t route_prefix,
                   uint8_t prefix_length,
                   std::optional<Address> next_hop,
                   size_t interface_num );
 
+  // One of several equal-cost ways to reach a destination: a next hop (empty if directly attached) and the
+  // interface it is on
+  using Path = RoutingTable::Path;
+
+  // Add an equal-cost multipath route (or replace the route with the same prefix). route() spreads the
+  // datagrams that match it over the paths by a hash of their 5-tuple (addresses, protocol and ports), so
+  // each flow stays on one path and its datagrams are not reordered.
+  void add_multipath_route( uint32_t route_prefix, uint8_t prefix_length, const std::vector<Path>& paths );
+
+  // Withdraw a route. Returns whether it existed.
+  bool remove_route( uint32_t route_prefix, uint8_t prefix_length );
+
+  // Change where an existing route leads. Returns false (and adds nothing) if there is no such route.
+  bool replace_route( uint32_t route_prefix,
+                      uint8_t prefix_length,
+                      std::optional<Address> next_hop,
+                      size_t interface_num );
+
+  // The route changes above may be made from another thread (a control plane) while route() runs: the
+  // routes are kept twice, route() reads one copy while an update is applied to the other, and the copies
+  // then trade places. route() never waits for an update; an update waits for route() to finish the batch
+  // it is working on.
+
   // Route packets between the interfaces
   void route();
 
+  // Set the access-control list for datagrams arriving on interface `interface_num`. route() classifies each
+  // of them by its 5-tuple (addresses, protocol and ports) before looking up its route: the first rule that
+  // matches decides, `default_action` applies if none does, and denied datagrams are dropped without an ICMP
+  // error. An interface without an ACL permits everything. Like the routes, ACLs may be changed while route()
+  // runs.
+  void set_acl( size_t interface_num,
+                std::vector<AclRule> rules,
+                AclRule::Action default_action = AclRule::Action::Permit );
+
+  // Source NAT ("masquerading") on interface `interface_num`: datagrams that route() sends out of it (from the
+  // other interfaces) leave with its address as their source, and the replies to them, addressed to it, are
+  // translated back before their route is looked up (see NatTable). Datagrams that cannot be translated (not
+  // TCP, UDP or ICMP echo, or fragments) are dropped. Enable NAT before forwarding starts (it throws in
+  // parallel mode); there, the RX threads share each NAT's translations under that NAT's own lock.
+  void enable_nat( size_t interface_num, NatTimeouts timeouts = {} );
+
+  // How many translations interface `interface_num`'s NAT holds (0 if it has none)
+  size_t nat_mappings( size_t interface_num );
+
+  // route() answers the datagrams it has to drop with ICMP errors, sent back out of the interface the
+  // datagram arrived on: Time Exceeded when the TTL runs out, Net Unreachable when no route matches, and
+  // Fragmentation Needed when a datagram with DF set is too big for the outgoing link's MTU. So that a flood of
+  // such datagrams cannot make the router flood the network in turn, it sends at most `per_second` of them
+  // (with bursts of up to `burst`), and never one about an ICMP error or a broadcast.
+  static constexpr size_t DEFAULT_ICMP_RATE = 1000;
+  static constexpr size_t DEFAULT_ICMP_BURST = 50;
+  void set_icmp_rate_limit( size_t per_second, size_t burst );
+
+  // Called periodically when time elapses (in parallel mode too: the NAT's translations time out)
+  void tick( size_t ms_since_last_tick );
+
+  // Compile the routing table into a DIR-24-8 forwarding table (64 MiB per copy), so that each lookup takes
+  // one or two memory reads. From then on, route changes also update the compiled table.
+  void compile_forwarding_table();
+
+  // route() takes up to this many datagrams at a time from an interface's queue, and looks up their
+  // destinations together so that the lookups' cache misses overlap
+  static constexpr size_t MAX_BATCH = 64;
+  void set_batch_size( size_t batch_size );
+
+  // route() remembers recent destinations in a two-way cache in front of the lookup (emptied whenever
+  // the routes change). `sets` is rounded up to a power of two; 0 turns the cache off. The cache belongs
+  // to the thread that calls route().
+  static constexpr size_t DEFAULT_ROUTE_CACHE_SETS = 1024;
+  void set_route_cache_size( size_t sets ) { lane_.route_cache.resize( sets ); }
+  const RouteCache& route_cache() const { return lane_.route_cache; }
+
+  // Parallel forwarding. Instead of one thread calling route(), each interface gets a receiving (RX) thread
+  // of its own, which hands every frame that arrives on the interface to receive_frame(). The RX thread
+  // parses the frame, looks up its route (in the same shared routing table; route changes work as above) and
+  // puts the datagram on a lock-free ring towards the outgoing interface. start_parallel() starts one
+  // transmitting (TX) worker per interface, which drains the rings towards it into its NetworkInterface.
+  //
+  // Each NetworkInterface is only ever used by its TX worker (which also receives its ARP frames, and ticks
+  // its timers), so the interfaces need no locks, and neither do the rings (one ring per pair of interfaces,
+  // each with one producer and one consumer). Every RX thread has its own route cache and ICMP rate limit, and
+  // reassembles the fragments addressed to its interface, as the NetworkInterface would.
+  static constexpr size_t DEFAULT_RING_CAPACITY = 1024;
+  void start_parallel( size_t ring_capacity = DEFAULT_RING_CAPACITY );
+
+  // Stop the TX workers (call once the RX threads have stopped calling receive_frame()). Datagrams still on
+  // the rings are dropped.
+  void stop_parallel();
+
+  // Called on interface `interface_num`'s RX thread (only) for each frame received while running in parallel
+  void receive_frame( size_t interface_num, EthernetFrame frame );
+
+  // Traffic counters. Every thread that forwards (the caller of route(), and each RX thread) counts into
+  // blocks of its own, on cache lines of their own, without atomic read-modify-writes; reading a counter adds
+  // up the threads' blocks. They may be read from any thread while datagrams are forwarded.
+  struct InterfaceStats
+  {
+    uint64_t rx_packets; // datagrams that arrived on the interface
+    uint64_t rx_bytes;
+    uint64_t tx_packets; // datagrams sent out of it (including ICMP errors)
+    uint64_t tx_bytes;
+    uint64_t acl_drops;      // arrivals denied by its ACL
+    uint64_t ttl_drops;      // arrivals whose TTL ran out
+    uint64_t no_route_drops; // arrivals that matched no route
+    uint64_t mtu_drops;      // arrivals too big for the outgoing link, with DF set
+    uint64_t nat_drops;      // arrivals for a NAT interface that could not be translated
+    uint64_t ring_drops;     // frames and datagrams for it that found a ring full (parallel mode)
+  };
+  InterfaceStats interface_stats( size_t interface_num ) const;
+
+  // How many datagrams, and bytes, each route has forwarded (since it was added)
+  struct RouteStats
+  {
+    uint32_t route_prefix;
+    uint8_t prefix_length;
+    uint64_t packets;
+    uint64_t bytes;
+  };
+  std::vector<RouteStats> route_stats();
+
+  // Datagrams dropped because an ACL denied them, or a ring was full (summed over the interfaces)
+  uint64_t acl_drops() const;
+  uint64_t ring_drops() const;
+
+  // Write all the counters in the Prometheus text exposition format (and the top flows of interfaces that have
+  // a flow sampler; in parallel mode datagrams do not pass through the interfaces, so these stay empty)
+  void write_metrics( std::ostream& out );
+
+  Router() = default;
+  ~Router();
+  Router( const Router& other ) = delete;
+  Router& operator=( const Router& other ) = delete;
+  Router( Router&& other ) = delete;
+  Router& operator=( Router&& other ) = delete;
+
 private:
   // The router's collection of network interfaces
   std::vector<std::shared_ptr<NetworkInterface>> interfaces_ {};
 
-  // 路由表项结构
-  struct RouteEntry
+  // 路由表的两份副本(left-right): 转发线程读其中一份, 更新先改另一份, 交换后再改回来
+  LeftRight<RoutingTable> routing_table_ {};
+
+  static constexpr uint32_t NO_ROUTE = RoutingTable::NO_ROUTE;
+
+  // 各入接口的ACL(下标为接口编号), 和路由表一样保存两份副本
+  LeftRight<std::vector<PacketClassifier>> acls_ {};
+
+  // 各接口的NAT(下标为接口编号, 没有NAT的为空). 并行模式开始后不再增减, 读这个数组不用加锁;
+  // 各RX线程共用的转换表由各自的锁保护, 只在转换时持有
+  struct Nat
   {
-    uint32_t route_prefix;
-    uint8_t prefix_length;
-    std::optional<Address> next_hop;
-    size_t interface_num;
+    NatTable table;
+    std::mutex mutex {};
+  };
+  std::vector<std::unique_ptr<Nat>> nats_ {};
+
+  // 计数器. 每个接口占 INTERFACE_COUNTERS 个, 按 InterfaceStats 的字段顺序;
+  // 每条路由占 ROUTE_COUNTERS 个: 路由的 id, 以及它转发的数据报数和字节数.
+  // 路由下标会被复用, 所以记下 id: id 对不上说明计数属于已经删除的路由
+  enum InterfaceCounter : size_t
+  {
+    RX_PACKETS,
+    RX_BYTES,
+    TX_PACKETS,
+    TX_BYTES,
+    ACL_DROPS,
+    TTL_DROPS,
+    NO_ROUTE_DROPS,
+    MTU_DROPS,
+    NAT_DROPS,
+    RING_DROPS,
+    INTERFACE_COUNTERS
+  };
+  static constexpr size_t ROUTE_COUNTERS = 3;
+
+  // route_stats() 读路由表用的读者编号(加锁, 一次只有一个线程用)
+  size_t stats_reader_ { routing_table_.register_reader() };
+  std::mutex stats_mutex_ {};
+
+  // 一个转发线程(route() 的调用者, 或并行模式下的一个RX线程)独有的状态
+  struct Lane
+  {
+    size_t reader;     // 路由表的读者编号
+    size_t acl_reader; // ACL的读者编号
+
+    // 目的地址 -> 路由表下标(或 NO_ROUTE)的缓存, 路由表版本变化时整体失效
+    RouteCache route_cache;
+    uint64_t cached_version {};
+
+    // ICMP差错报文的限速器
+    TokenBucket icmp_limiter;
+
+    // 本线程的接口计数器和路由计数器
+    std::unique_ptr<CounterBlock> interface_counters;
+    std::unique_ptr<CounterBlock> route_counters;
+
+    void count( size_t interface_num, InterfaceCounter counter, uint64_t n = 1 )
+    {
+      interface_counters->add( interface_num * INTERFACE_COUNTERS + counter, n );
+    }
+    void count_route( uint32_t index, const RoutingTable::Entry& entry, uint64_t bytes );
   };
-  // 路由表
-  std::vector<RouteEntry> routing_table_ {};
+  size_t icmp_rate_ { DEFAULT_ICMP_RATE };
+  size_t icmp_burst_ { DEFAULT_ICMP_BURST };
+  Lane lane_ { routing_table_.register_reader(),
+               acls_.register_reader(),
+               RouteCache { DEFAULT_ROUTE_CACHE_SETS },
+               0,
+               TokenBucket { DEFAULT_ICMP_RATE, DEFAULT_ICMP_BURST },
+               std::make_unique<CounterBlock>(),
+               std::make_unique<CounterBlock>() }; // route() 用的
+
+  // 所有转发线程的计数器之和
+  uint64_t total( InterfaceCounter counter, size_t interface_num ) const;
+
+  // 转发一批从 ingress 收到的数据报: 过ACL, 查路由(或生成ICMP差错报文), 然后对每个要发出的数据报调用
+  // emit( 出接口编号, 数据报, 下一跳 )
+  template<typename Emit>
+  void forward_batch( Lane& lane, size_t ingress, std::span<InternetDatagram> batch, Emit&& emit );
+
+  // 批量最长前缀匹配, indexes[i] 是 dst_ips[i] 匹配的路由下标(没有则为 NO_ROUTE)
+  // 先查路由缓存, 只把未命中的地址交给路由表查找
+  static void match_batch( Lane& lane,
+                           const RoutingTable& table,
+                           std::span<const uint32_t> dst_ips,
+                           std::span<uint32_t> indexes );
+
+  // 等价多路径路由按流的五元组哈希选路; 种子因路由器而异, 避免多级路由器按同样的方式分流
+  uint32_t ecmp_seed_ { std::random_device {}() };
+
+  // 为无法转发的数据报 original 生成ICMP差错报文, 经 emit 从它到达的接口 ingress 发回源主机
+  template<typename Emit>
+  void send_icmp_error( Lane& lane,
+                        const RoutingTable& table,
+                        size_t ingress,
+                        const InternetDatagram& original,
+                        uint8_t type,
+                        uint8_t code,
+                        Emit&& emit,
+                        uint16_t next_hop_mtu = 0 );
+
+  // 并行模式: 每个接口一个RX线程(调用 receive_frame)和一个TX工作线程
+  using Outgoing = std::pair<InternetDatagram, uint32_t>; // 数据报及其下一跳
+  struct RxLane
+  {
+    RxLane( Lane lane_, size_t interface_count, size_t ring_capacity );
+
+    Lane lane;
+    std::vector<std::unique_ptr<SPSCQueue<Outgoing>>> to_egress; // 下标为出接口编号
+    SPSCQueue<EthernetFrame> to_self;                            // 交给本接口TX线程处理的帧(ARP等)
+    DatagramReassembler reassembler {};                          // 发给本接口的分片在这里重组
+    std::chrono::steady_clock::time_point last_tick { std::chrono::steady_clock::now() };
+  };
+  // 下标为入接口编号; 读者编号不能归还, 所以重新启动时复用原来的
+  std::vector<std::unique_ptr<RxLane>> rx_lanes_ {};
+  std::vector<std::thread> tx_workers_ {};
+  std::atomic<bool> parallel_running_ { false };
+
+  // TX线程拥有接口期间, 由它把接口的ARP等待队列统计发布到这里(下标为接口编号), 供 write_metrics 读
+  enum TxCounter : size_t
+  {
+    ARP_NEIGHBOUR_FULL_DROPS,
+    ARP_MEMORY_FULL_DROPS,
+    ARP_UNRESOLVED_DROPS,
+    ARP_PENDING_BYTES,
+    TX_COUNTERS
+  };
+  std::vector<std::unique_ptr<CounterBlock>> tx_counters_ {};
+
+  void run_tx_worker( size_t interface_num );
+  static void publish_arp_pending( const NetworkInterface& iface, CounterBlock& counters );
+
+  // 批处理大小, 以及复用的批处理缓冲区(避免每批都分配内存)
+  size_t batch_size_ { 32 };
+  std::array<InternetDatagram, MAX_BATCH> batch_ {};
 };
@@ -0,0 +1,158 @@
+#include "routing_table.hh"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+void RoutingTable::check_length( const uint8_t prefix_length )
+{
+  if ( prefix_length > PrefixTrie<size_t>::MAX_LENGTH ) {
+    throw runtime_error( "route prefix length " + to_string( prefix_length ) + " is longer than 32" );
+  }
+}
+
+bool RoutingTable::add( const uint32_t route_prefix, const uint8_t prefix_length, const vector<Path>& paths )
+{
+  // 相同前缀的路由直接覆盖旧条目
+  if ( replace( route_prefix, prefix_length, paths ) ) {
+    return false;
+  }
+  if ( forwarding_table_ and free_.empty() and entries_.size() >= DIR24_8Table::MAX_VALUE ) {
+    throw runtime_error( "routing table is too large for a DIR-24-8 forwarding table" );
+  }
+
+  // 否则存入路由表(优先复用空位), 并把下标插入前缀树
+  uint32_t index {};
+  if ( free_.empty() ) {
+    index = static_cast<uint32_t>( entries_.size() );
+    entries_.push_back( { route_prefix, prefix_length, paths, next_id_++ } );
+    in_use_.push_back( true );
+  } else {
+    index = free_.back();
+    free_.pop_back();
+    entries_[index] = { route_prefix, prefix_length, paths, next_id_++ };
+    in_use_[index] = true;
+  }
+  route_trie_.insert( route_prefix, prefix_length, index );
+  if ( size() <= SmallRouteTable::CAPACITY ) {
+    small_table_.insert( route_prefix, prefix_length, index );
+  }
+  // 已经编译了转发表, 就增量更新(只改写新前缀覆盖的表项)
+  if ( forwarding_table_ ) {
+    forwarding_table_->insert( route_prefix, prefix_length, index );
+  }
+  version_++;
+  return true;
+}
+
+bool RoutingTable::replace( const uint32_t route_prefix, const uint8_t prefix_length, const vector<Path>& paths )
+{
+  check_length( prefix_length );
+  if ( paths.empty() ) {
+    throw runtime_error( "a route needs at least one path" );
+  }
+  const size_t* existing = route_trie_.find( route_prefix, prefix_length );
+  if ( existing == nullptr ) {
+    return false;
+  }
+  // 下标不变, 查找结构都不用改
+  entries_[*existing].paths = paths;
+  version_++;
+  return true;
+}
+
+bool RoutingTable::remove( const uint32_t route_prefix, const uint8_t prefix_length )
+{
+  check_length( prefix_length );
+  const size_t* existing = route_trie_.find( route_prefix, prefix_length );
+  if ( existing == nullptr ) {
+    return false;
+  }
+  const auto index = static_cast<uint32_t>( *existing );
+  route_trie_.erase( route_prefix, prefix_length );
+  in_use_[index] = false;
+  free_.push_back( index );
+
+  // 路由少到放得下时, 小表才有效: 刚好降到容量以内就重建一次
+  if ( size() + 1 <= SmallRouteTable::CAPACITY ) {
+    small_table_.erase( route_prefix, prefix_length );
+  } else if ( size() == SmallRouteTable::CAPACITY ) {
+    small_table_.clear();
+    for ( uint32_t i = 0; i < entries_.size(); i++ ) {
+      if ( in_use_[i] ) {
+        small_table_.insert( entries_[i].route_prefix, entries_[i].prefix_length, i );
+      }
+    }
+  }
+
+  // 转发表不记得被覆盖的路由: 把这个前缀的表项交给覆盖它的最长前缀(没有则清空)
+  if ( forwarding_table_ ) {
+    const size_t* covering = prefix_length == 0
+                               ? nullptr
+                               : route_trie_.lookup( route_prefix, static_cast<uint8_t>( prefix_length - 1 ) );
+    if ( covering ) {
+      forwarding_table_->erase(
+        route_prefix, prefix_length, entries_[*covering].prefix_length, static_cast<uint32_t>( *covering ) );
+    } else {
+      forwarding_table_->erase( route_prefix, prefix_length );
+    }
+  }
+  version_++;
+  return true;
+}
+
+void RoutingTable::compile_forwarding_table()
+{
+  if ( entries_.size() >= DIR24_8Table::MAX_VALUE ) {
+    throw runtime_error( "routing table is too large for a DIR-24-8 forwarding table" );
+  }
+  auto table = make_unique<DIR24_8Table>();
+  // 表项记录了前缀长度, 插入顺序不影响结果; 但先插入短前缀, 长前缀只需覆盖一次
+  vector<uint32_t> order;
+  for ( uint32_t i = 0; i < entries_.size(); i++ ) {
+    if ( in_use_[i] ) {
+      order.push_back( i );
+    }
+  }
+  ranges::stable_sort( order, {}, [&]( uint32_t i ) { return entries_[i].prefix_length; } );
+  for ( const uint32_t i : order ) {
+    table->insert( entries_[i].route_prefix, entries_[i].prefix_length, i );
+  }
+  forwarding_table_ = move( table );
+  version_++;
+}
+
+void RoutingTable::lookup_batch( span<const uint32_t> dst_ips, span<uint32_t> indexes ) const
+{
+  // 有编译好的转发表就查转发表(一到两次访存); 路由很少时用SIMD一次比较多条路由;
+  // 否则在前缀树上查找(最多33次比较)
+  // 转发表和前缀树都是批量查找: 先为整批地址预取表项, 让各个查找的缓存缺失互相重叠
+  if ( forwarding_table_ ) {
+    array<optional<uint32_t>, PrefixTrie<size_t>::MAX_BATCH> found {};
+    for ( size_t start = 0; start < dst_ips.size(); start += found.size() ) {
+      const auto chunk = dst_ips.subspan( start, min( found.size(), dst_ips.size() - start ) );
+      forwarding_table_->lookup_batch( chunk, found );
+      for ( size_t i = 0; i < chunk.size(); i++ ) {
+        indexes[start + i] = found[i].value_or( NO_ROUTE );
+      }
+    }
+    return;
+  }
+  if ( size() <= SmallRouteTable::CAPACITY ) {
+    for ( size_t i = 0; i < dst_ips.size(); i++ ) {
+      indexes[i] = small_table_.lookup( dst_ips[i] ).value_or( NO_ROUTE );
+    }
+    return;
+  }
+  array<const size_t*, PrefixTrie<size_t>::MAX_BATCH> found {};
+  for ( size_t start = 0; start < dst_ips.size(); start += found.size() ) {
+    const auto chunk = dst_ips.subspan( start, min( found.size(), dst_ips.size() - start ) );
+    route_trie_.lookup_batch( chunk, found );
+    for ( size_t i = 0; i < chunk.size(); i++ ) {
+      indexes[start + i] = found[i] ? static_cast<uint32_t>( *found[i] ) : NO_ROUTE;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "address.hh"
+#include "dir24_8_table.hh"
+#include "prefix_trie.hh"
+#include "small_route_table.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+// \brief The Router's routes, and the structures that do longest-prefix matching over them.
+//
+// Routes are identified by their index, which stays the same for as long as the route exists (the index
+// of a removed route is reused by a later one). Every change to the routes bumps version(), so anything
+// that remembers lookup results (like the Router's route cache) can tell when they may be stale.
+class RoutingTable
+{
+public:
+  // One way to reach a route's destination: the next hop (empty if the network is directly attached), and the
+  // interface that leads to it
+  struct Path
+  {
+    std::optional<Address> next_hop;
+    size_t interface_num;
+  };
+
+  struct Entry
+  {
+    uint32_t route_prefix;
+    uint8_t prefix_length;
+    std::vector<Path> paths; // more than one for an equal-cost multipath route
+    uint64_t id;             // unique to this route, unlike its index (which a later route may reuse)
+  };
+
+  static constexpr uint32_t NO_ROUTE = UINT32_MAX;
+
+  // Add a route, or replace the one with the same prefix. Returns true if the prefix is new.
+  bool add( uint32_t route_prefix, uint8_t prefix_length, const std::vector<Path>& paths );
+
+  // Change where an existing route leads. Returns false (and adds nothing) if there is no such route.
+  bool replace( uint32_t route_prefix, uint8_t prefix_length, const std::vector<Path>& paths );
+
+  // Withdraw a route. Returns whether it existed.
+  bool remove( uint32_t route_prefix, uint8_t prefix_length );
+
+  // Also maintain a DIR-24-8 forwarding table (64 MiB), and use it for lookups
+  void compile_forwarding_table();
+
+  // indexes[i] is the index of the route that dst_ips[i] matches, or NO_ROUTE
+  void lookup_batch( std::span<const uint32_t> dst_ips, std::span<uint32_t> indexes ) const;
+
+  const Entry& entry( uint32_t index ) const { return entries_[index]; }
+
+  // Call `f( index, entry )` for every route, in order of index
+  template<typename F>
+  void for_each( F&& f ) const
+  {
+    for ( uint32_t index = 0; index < entries_.size(); index++ ) {
+      if ( in_use_[index] ) {
+        f( index, entries_[index] );
+      }
+    }
+  }
+
+  size_t size() const { return route_trie_.size(); }
+  uint64_t version() const { return version_; }
+
+private:
+  // 路由表项, 下标即路由的编号; 删除的路由留下空位, 编号记入 free_ 以便复用
+  std::vector<Entry> entries_ {};
+  std::vector<bool> in_use_ {};
+  std::vector<uint32_t> free_ {};
+
+  // 路由前缀 -> 路由表下标的路径压缩前缀树, 用于最长前缀匹配
+  PrefixTrie<size_t> route_trie_ {};
+
+  // 路由不超过 SmallRouteTable::CAPACITY 条时, 用SIMD整表比较代替前缀树
+  SmallRouteTable small_table_ {};
+
+  // 编译后的DIR-24-8转发表(可选), 值同样是路由表下标
+  std::unique_ptr<DIR24_8Table> forwarding_table_ {};
+
+  uint64_t version_ {};
+  uint64_t next_id_ { 1 };
+
+  static void check_length( uint8_t prefix_length );
+};
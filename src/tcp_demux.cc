@@ -0,0 +1,307 @@
+#include "tcp_demux.hh"
+
+#include "helpers.hh"
+#include "ipv4_header.hh"
+#include "random.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace {
+// The raw 32-bit value of a Wrap32, from which SYN cookies are built
+class Wrap32Raw : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+} // namespace
+
+string TCPFourTuple::to_string() const
+{
+  string ret = inet_ntoa( { htobe32( local_ip ) } );
+  ret += ":" + std::to_string( local_port ) + " <-> ";
+  ret += inet_ntoa( { htobe32( remote_ip ) } );
+  ret += ":" + std::to_string( remote_port );
+  return ret;
+}
+
+TCPDemultiplexer::TCPDemultiplexer( const TCPConfig& cfg, TransmitFunction transmit )
+  : cfg_( cfg )
+  , transmit_( move( transmit ) )
+  , isn_generator_( get_random_engine() )
+  , cookie_secret_( ( uint64_t { isn_generator_() } << 32U ) ^ isn_generator_() )
+{}
+
+void TCPDemultiplexer::listen( uint16_t port, const ListenOptions& options )
+{
+  if ( Listener* existing = find_listener( port ) ) {
+    existing->options = options;
+    return;
+  }
+  listeners_.push_back( { .port = port, .options = options } );
+}
+
+TCPDemultiplexer::Listener* TCPDemultiplexer::find_listener( uint16_t port )
+{
+  const auto it = ranges::find( listeners_, port, &Listener::port );
+  return it == listeners_.end() ? nullptr : &*it;
+}
+
+const TCPDemultiplexer::ListenerCounters& TCPDemultiplexer::counters( uint16_t port ) const
+{
+  const auto it = ranges::find( listeners_, port, &Listener::port );
+  if ( it == listeners_.end() ) {
+    throw runtime_error( "TCPDemultiplexer: not listening on port " + std::to_string( port ) );
+  }
+  return it->counters;
+}
+
+TCPDemultiplexer::Connection& TCPDemultiplexer::add_connection( const TCPFourTuple& tuple,
+                                                               bool passive,
+                                                               Wrap32 isn )
+{
+  TCPConfig cfg = cfg_;
+  cfg.isn = isn;
+
+  auto [slot, inserted] = connections_.try_emplace( tuple );
+  if ( not inserted ) {
+    throw runtime_error( "TCPDemultiplexer: connection already exists: " + tuple.to_string() );
+  }
+  *slot = make_unique<Connection>(
+    Connection { .peer = TCPPeer { cfg }, .passive = passive, .transmit = make_transmit( tuple ) } );
+  if ( passive ) {
+    find_listener( tuple.local_port )->half_open++;
+  }
+  return **slot;
+}
+
+void TCPDemultiplexer::forget( const TCPFourTuple& tuple, const Connection& connection )
+{
+  if ( connection.passive and not connection.established ) {
+    if ( Listener* listener = find_listener( tuple.local_port ) ) {
+      listener->half_open--;
+    }
+  }
+}
+
+TCPPeer::TransmitFunction TCPDemultiplexer::make_transmit( const TCPFourTuple& tuple ) const
+{
+  return [this, tuple]( const TCPMessage& msg ) {
+    transmit_( TCPOverIPv4Adapter::wrap_tcp_in_ip(
+      msg, tuple.local_ip, tuple.local_port, tuple.remote_ip, tuple.remote_port ) );
+  };
+}
+
+TCPPeer& TCPDemultiplexer::connect( const TCPFourTuple& tuple )
+{
+  // every connection gets its own initial sequence number
+  Connection& connection = add_connection( tuple, false, Wrap32 { static_cast<uint32_t>( isn_generator_() ) } );
+  connection.peer.push( connection.transmit );
+  return connection.peer;
+}
+
+void TCPDemultiplexer::receive( InternetDatagram dgram )
+{
+  if ( dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return;
+  }
+
+  TCPSegment seg;
+  if ( not parse( seg, move( dgram.payload ), dgram.header.pseudo_checksum() ) ) {
+    return;
+  }
+
+  const TCPFourTuple tuple { .local_ip = dgram.header.dst,
+                             .remote_ip = dgram.header.src,
+                             .local_port = seg.udinfo.dst_port,
+                             .remote_port = seg.udinfo.src_port };
+
+  if ( auto* existing = connections_.find( tuple ) ) {
+    Connection& connection = **existing;
+    if ( connection.passive and not connection.established ) {
+      // Like Linux, drop the segment that would complete the handshake if there is no room to queue the
+      // connection for accept(). The connection stays half-open, and the client's retransmission gets
+      // another chance once the application has caught up.
+      Listener* listener = find_listener( tuple.local_port );
+      if ( listener and listener->accept_queue.size() >= listener->options.accept_backlog
+           and seg.message.receiver->ackno.has_value() ) {
+        listener->counters.accept_queue_overflows++;
+        return;
+      }
+    }
+    connection.peer.receive( move( seg.message ), connection.transmit );
+    check_established( tuple, connection );
+    return;
+  }
+
+  // No connection: only a listening port may open one. (A full TCP would answer anything else with a RST.)
+  if ( Listener* listener = find_listener( tuple.local_port ) ) {
+    receive_on_listener( *listener, tuple, move( seg.message ) );
+  }
+}
+
+void TCPDemultiplexer::receive_on_listener( Listener& listener, const TCPFourTuple& tuple, TCPMessage&& msg )
+{
+  const TCPSenderMessage& sender = msg.sender.get();
+  const TCPReceiverMessage& receiver = msg.receiver.get();
+  if ( sender.RST ) {
+    return;
+  }
+
+  if ( sender.SYN and not receiver.ackno.has_value() ) {
+    listener.counters.syns_received++;
+
+    if ( listener.half_open < listener.options.syn_backlog ) {
+      Connection& connection
+        = add_connection( tuple, true, Wrap32 { static_cast<uint32_t>( isn_generator_() ) } );
+      connection.peer.receive( move( msg ), connection.transmit );
+      return;
+    }
+
+    if ( not listener.options.syn_cookies ) {
+      listener.counters.syns_dropped++;
+      return;
+    }
+
+    // The SYN queue is full: answer with a cookie and keep no state. Our TSval starts from zero,
+    // as it will in the TCPPeer created if the cookie comes back.
+    const TCPSenderMessage syn_ack { .seqno = syn_cookie( tuple, sender.seqno, clock_ms_ / COOKIE_PERIOD_MS ),
+                                     .SYN = true,
+                                     .tsval = sender.tsval.has_value() ? optional<uint32_t> { 0 } : nullopt };
+    const auto window_size = static_cast<uint16_t>( min<uint64_t>( cfg_.recv_capacity, UINT16_MAX ) );
+    const TCPReceiverMessage ack { .ackno = sender.seqno + 1, .window_size = window_size, .tsecr = sender.tsval };
+    make_transmit( tuple )( { .sender = borrow( syn_ack ), .receiver = borrow( ack ) } );
+    listener.counters.syn_cookies_sent++;
+    return;
+  }
+
+  // An ACK with no connection: it may complete a handshake that was answered with a cookie
+  if ( sender.SYN or not receiver.ackno.has_value() ) {
+    return;
+  }
+  const Wrap32 client_isn = sender.seqno + UINT32_MAX; // seqno - 1
+  const Wrap32 cookie = receiver.ackno.value() + UINT32_MAX;
+  if ( not listener.options.syn_cookies or not check_syn_cookie( tuple, client_isn, cookie ) ) {
+    listener.counters.syn_cookies_rejected++;
+    return;
+  }
+  if ( listener.accept_queue.size() >= listener.options.accept_backlog ) {
+    listener.counters.accept_queue_overflows++;
+    return;
+  }
+
+  // Recreate the state the SYN would have created: replay the client's SYN (its SYN-ACK, which the
+  // client already has, is discarded), then deliver the ACK itself.
+  Connection& connection = add_connection( tuple, true, cookie );
+  connection.peer.receive( { .sender = TCPSenderMessage { .seqno = client_isn, .SYN = true, .tsval = sender.tsval },
+                             .receiver = TCPReceiverMessage { .window_size = receiver.window_size } },
+                           []( const TCPMessage& ) {} );
+  connection.peer.receive( move( msg ), connection.transmit );
+  check_established( tuple, connection );
+  listener.counters.syn_cookies_accepted++;
+}
+
+// The cookie is a 24-bit keyed hash of the connection, the client's ISN and the time, plus the time itself
+// (modulo 256) in the top 8 bits. (The hash is fast, not cryptographic: a production stack would use SipHash.)
+Wrap32 TCPDemultiplexer::syn_cookie( const TCPFourTuple& tuple, Wrap32 client_isn, uint32_t time ) const
+{
+  const uint64_t h = hash_mix( cookie_secret_ ^ TCPFourTupleHash {}( tuple ) )
+                     ^ hash_mix( ( uint64_t { Wrap32Raw { client_isn }.raw_value() } << 32U ) | ( time & 0xffU ) );
+  return Wrap32 { ( ( time & 0xffU ) << 24U ) | static_cast<uint32_t>( hash_mix( h ) & 0xffffffU ) };
+}
+
+bool TCPDemultiplexer::check_syn_cookie( const TCPFourTuple& tuple, Wrap32 client_isn, Wrap32 cookie ) const
+{
+  const uint32_t now = clock_ms_ / COOKIE_PERIOD_MS;
+  const uint32_t stamped = Wrap32Raw { cookie }.raw_value() >> 24U;
+  const uint32_t age = ( now - stamped ) & 0xffU;
+  return age <= MAX_COOKIE_AGE and syn_cookie( tuple, client_isn, now - age ) == cookie;
+}
+
+void TCPDemultiplexer::check_established( const TCPFourTuple& tuple, Connection& connection )
+{
+  if ( connection.established ) {
+    return;
+  }
+  // the same test as TCPMinnowSocket::listen_and_accept: the peer's SYN has arrived and ours is acknowledged
+  if ( connection.peer.has_ackno() and connection.peer.sender().sequence_numbers_in_flight() == 0 ) {
+    connection.established = true;
+    if ( connection.passive ) {
+      Listener* listener = find_listener( tuple.local_port );
+      listener->half_open--;
+      listener->accept_queue.push( tuple );
+    }
+  }
+}
+
+void TCPDemultiplexer::tick( uint64_t ms_since_last_tick )
+{
+  clock_ms_ += ms_since_last_tick;
+
+  connections_.for_each( [&]( const TCPFourTuple&, unique_ptr<Connection>& connection ) {
+    connection->peer.tick( ms_since_last_tick, connection->transmit );
+  } );
+
+  // forget connections that have finished, or given up after too many retransmissions
+  connections_.erase_if( [&]( const TCPFourTuple& tuple, const unique_ptr<Connection>& connection ) {
+    const bool done = not connection->peer.active()
+                      or connection->peer.sender().consecutive_retransmissions() > TCPConfig::MAX_RETX_ATTEMPTS;
+    if ( done ) {
+      forget( tuple, *connection );
+    }
+    return done;
+  } );
+}
+
+void TCPDemultiplexer::push( const TCPFourTuple& tuple )
+{
+  if ( auto* connection = connections_.find( tuple ) ) {
+    ( *connection )->peer.push( ( *connection )->transmit );
+  }
+}
+
+optional<TCPFourTuple> TCPDemultiplexer::accept()
+{
+  for ( auto& listener : listeners_ ) {
+    while ( not listener.accept_queue.empty() ) {
+      const TCPFourTuple tuple = listener.accept_queue.front();
+      listener.accept_queue.pop();
+      // skip connections that finished before anybody accepted them
+      if ( auto* connection = connections_.find( tuple ) ) {
+        ( *connection )->passive = false;
+        return tuple;
+      }
+    }
+  }
+  return {};
+}
+
+TCPPeer* TCPDemultiplexer::find( const TCPFourTuple& tuple )
+{
+  auto* connection = connections_.find( tuple );
+  return connection ? &( *connection )->peer : nullptr;
+}
+
+TCPDemultiplexerOverTun::TCPDemultiplexerOverTun( TunFD&& tun, const TCPConfig& cfg )
+  : tun_( move( tun ) )
+  , demux_( cfg, [this]( const InternetDatagram& dgram ) { tun_.write( serialize( dgram ) ); } )
+{}
+
+void TCPDemultiplexerOverTun::read()
+{
+  vector<string> strs( 3 );
+  strs[0].resize( IPv4Header::LENGTH );
+  strs[1].resize( TCPSegment::HEADER_LENGTH );
+  tun_.read( strs );
+
+  InternetDatagram dgram;
+  if ( parse( dgram, move( strs ) ) ) {
+    demux_.receive( move( dgram ) );
+  }
+}
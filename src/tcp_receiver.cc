@@ -15,16 +15,30 @@ void TCPReceiver::receive( TCPSenderMessage message )
   // 如果收到SYN信号, 则是连接请求, 设置初始基准序号
   if ( message.SYN ) {
     ISN_ = message.seqno;
+    ts_recent_ = message.tsval;
   }
   if ( !ISN_.has_value() ) {
     return;
   }
 
+  // PAWS: TSval比TS.Recent还旧(按32位环绕比较), 说明是旧连接周期里的重复报文段.
+  // 高速传输时序号空间可能在一个MSL内环绕, 仅靠unwrap无法区分新旧报文段, 所以直接丢弃
+  if ( message.tsval.has_value() && ts_recent_.has_value()
+       && static_cast<int32_t>( message.tsval.value() - ts_recent_.value() ) < 0 ) {
+    return;
+  }
+
   // 已写入字节 +1 作为checkpint (流序号与绝对序号相差1)
   uint64_t checkpoint = writer().bytes_pushed();
   // 计算绝对序号
   uint64_t abs_seqno = message.seqno.unwrap( ISN_.value(), checkpoint );
 
+  // 报文段没有越过我们期待的下一个序号(SEG.SEQ <= Last.ACK.sent)时才更新TS.Recent,
+  // 这样回显的总是最早的未确认报文段的时间戳
+  if ( message.tsval.has_value() && abs_seqno <= writer().bytes_pushed() + 1 ) {
+    ts_recent_ = message.tsval;
+  }
+
   // SYN对应绝对序列号0, 但不会在数据流中, 第一个有效数据字节对应绝对序列号1, 所以对应的流编号是0
   uint64_t stream_idx = abs_seqno + ( message.SYN ? 1 : 0 ) - 1;
   // 插入流重组器中
@@ -51,5 +65,6 @@ TCPReceiverMessage TCPReceiver::send() const
     msg.ackno = Wrap32::wrap( abs_ackno, ISN_.value() );
   }
   msg.RST = writer().has_error();
+  msg.tsecr = ts_recent_;
   return msg;
 }
\ No newline at end of file
@@ -27,5 +27,6 @@ public:
 
 private:
   Reassembler reassembler_;
-  std::optional<Wrap32> ISN_ {}; // 初始序列号ISN, 连接建立阶段收到SYN时设置
+  std::optional<Wrap32> ISN_ {};       // 初始序列号ISN, 连接建立阶段收到SYN时设置
+  std::optional<uint32_t> ts_recent_ {}; // RFC 7323 TS.Recent: 下一个要回显的TSval, 也是PAWS的比较基准
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include "debug.hh"
 #include "tcp_config.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 // How many sequence numbers are outstanding?
@@ -19,6 +21,32 @@ uint64_t TCPSender::consecutive_retransmissions() const
   return consecutive_retransmissions_;
 }
 
+// RTO to use after an ack of new data: the RFC 6298 estimate once we have an RTT sample, else the initial RTO
+uint64_t TCPSender::RTO_ms() const
+{
+  if ( !srtt_.has_value() ) {
+    return initial_RTO_ms_;
+  }
+  // RTO = SRTT + max(G, 4 * RTTVAR), 时钟粒度G为1ms
+  const uint64_t rto = srtt_.value() + max( uint64_t { 1 }, 4 * rttvar_ );
+  return clamp( rto, uint64_t { TCPConfig::TIMEOUT_MIN }, uint64_t { TCPConfig::TIMEOUT_MAX } );
+}
+
+void TCPSender::update_RTT( uint64_t rtt_ms )
+{
+  if ( !srtt_.has_value() ) {
+    // 第一个样本: SRTT = R, RTTVAR = R/2
+    srtt_ = rtt_ms;
+    rttvar_ = rtt_ms / 2;
+    return;
+  }
+  // RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - R|, SRTT = 7/8 * SRTT + 1/8 * R
+  const uint64_t srtt = srtt_.value();
+  const uint64_t delta = srtt > rtt_ms ? srtt - rtt_ms : rtt_ms - srtt;
+  rttvar_ = ( 3 * rttvar_ + delta ) / 4;
+  srtt_ = ( 7 * srtt + rtt_ms ) / 8;
+}
+
 void TCPSender::push( const TransmitFunction& transmit )
 {
   // debug( "unimplemented push() called" );
@@ -35,6 +63,9 @@ void TCPSender::push( const TransmitFunction& transmit )
     TCPSenderMessage msg;
     msg.seqno = Wrap32::wrap( next_seqno_, isn_ );
     msg.RST = reader().has_error();
+    if ( timestamps_ ) {
+      msg.tsval = static_cast<uint32_t>( clock_ms_ );
+    }
     // 还没建立连接, 先建立连接(SYN报文段)
     if ( !SYN ) {
       current_RTO_ms_ = initial_RTO_ms_;
@@ -96,6 +127,9 @@ TCPSenderMessage TCPSender::make_empty_message() const
   TCPSenderMessage msg;
   msg.seqno = Wrap32::wrap( next_seqno_, isn_ );
   msg.RST = reader().has_error();
+  if ( timestamps_ ) {
+    msg.tsval = static_cast<uint32_t>( clock_ms_ );
+  }
   return msg;
 }
 
@@ -140,9 +174,13 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
       }
     }
   }
+  // RTTM: 回显的TSecr就是被确认报文段(包括重传的报文段)的发送时间, 不需要Karn算法排除重传
+  if ( new_data_acked && timestamps_ && msg.tsecr.has_value() ) {
+    update_RTT( static_cast<uint32_t>( clock_ms_ ) - msg.tsecr.value() );
+  }
   // 有数据包被确认, 清空超时设置
   if ( new_data_acked ) {
-    current_RTO_ms_ = initial_RTO_ms_;
+    current_RTO_ms_ = RTO_ms();
     timer_ms_ = 0;
     consecutive_retransmissions_ = 0;
   }
@@ -155,6 +193,7 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
 void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit )
 {
   // debug( "unimplemented tick({}, ...) called", ms_since_last_tick );
+  clock_ms_ += ms_since_last_tick;
   // 没有超时重传计时器被启动
   if ( !timer_running_ ) {
     return;
@@ -163,8 +202,12 @@ void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& trans
   timer_ms_ += ms_since_last_tick;
   // 计时器到时, 要重传
   if ( timer_ms_ >= current_RTO_ms_ ) {
-    // 重传最早的包
-    transmit( outstanding_segments_.front() );
+    // 重传最早的包(时间戳更新为重传时刻, 这样回显的TSecr测量的是这次重传的RTT)
+    auto& seg = outstanding_segments_.front();
+    if ( timestamps_ ) {
+      seg.tsval = static_cast<uint32_t>( clock_ms_ );
+    }
+    transmit( seg );
     // 非零窗口, 就进行指数退避算法(如果是零窗口探测包丢失，不应该翻倍，否则恢复太慢
     if ( window_size_ > 0 ) {
       consecutive_retransmissions_++; // 连续重传计数器加一
@@ -5,13 +5,14 @@
 #include "tcp_sender_message.hh"
 
 #include <functional>
+#include <optional>
 
 class TCPSender
 {
 public:
   /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
-  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms )
-    : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms )
+  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms, bool timestamps = false )
+    : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms ), timestamps_( timestamps )
   {}
 
   /* Generate an empty TCPSenderMessage */
@@ -29,9 +30,13 @@ public:
   /* Time has passed by the given # of milliseconds since the last time the tick() method was called */
   void tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit );
 
+  /* Stop sending RFC 7323 timestamps (e.g. because the peer's SYN didn't carry them) */
+  void disable_timestamps() { timestamps_ = false; }
+
   // Accessors
   uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
   uint64_t consecutive_retransmissions() const; // How many consecutive retransmissions have happened?
+  uint64_t RTO_ms() const;                      // Retransmission timeout to use after an ack of new data
   const Writer& writer() const { return input_.writer(); }
   const Reader& reader() const { return input_.reader(); }
   Writer& writer() { return input_.writer(); }
@@ -58,5 +63,12 @@ private:
   uint64_t timer_ms_ = 0;                    // 计时器运行时间
   bool timer_running_ = false;               // 计时器运行状态
 
+  // RFC 7323 时间戳(RTTM): 用回显的TSecr测量RTT, 包括重传报文段的RTT
+  bool timestamps_;                   // 是否在发送的报文段中携带TSval
+  uint64_t clock_ms_ = 0;             // 发送方时钟(TSval的来源)
+  std::optional<uint64_t> srtt_ {};   // 平滑RTT(RFC 6298), 没有测量样本时为空
+  uint64_t rttvar_ = 0;               // RTT偏差
+  void update_RTT( uint64_t rtt_ms ); // 用一个RTT样本更新SRTT和RTTVAR
+
   std::deque<TCPSenderMessage> outstanding_segments_ {}; // 缓存未被接收方确认的段的队列
 };
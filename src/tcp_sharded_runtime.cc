@@ -0,0 +1,162 @@
+#include "tcp_sharded_runtime.hh"
+
+#include "ipv4_header.hh"
+
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// Read the source and destination ports (the first four bytes of the TCP header) without parsing the segment
+bool peek_ports( const InternetDatagram& dgram, uint16_t& src_port, uint16_t& dst_port )
+{
+  array<uint8_t, 4> bytes {};
+  size_t have = 0;
+  for ( const auto& buffer : dgram.payload ) {
+    for ( size_t i = 0; i < buffer->size() and have < bytes.size(); i++ ) {
+      bytes.at( have++ ) = static_cast<uint8_t>( buffer->at( i ) );
+    }
+    if ( have == bytes.size() ) {
+      src_port = static_cast<uint16_t>( ( bytes[0] << 8U ) | bytes[1] );
+      dst_port = static_cast<uint16_t>( ( bytes[2] << 8U ) | bytes[3] );
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
+TCPShardedRuntime::Shard::Shard( const TCPConfig& cfg,
+                                 TCPDemultiplexer::TransmitFunction transmit,
+                                 size_t queue_capacity )
+  : queue( queue_capacity ), demux( cfg, move( transmit ) )
+{}
+
+TCPShardedRuntime::TCPShardedRuntime( const TCPConfig& cfg,
+                                      size_t worker_count,
+                                      TransmitFunction transmit,
+                                      size_t queue_capacity )
+{
+  if ( worker_count == 0 ) {
+    throw runtime_error( "TCPShardedRuntime needs at least one worker" );
+  }
+  for ( size_t i = 0; i < worker_count; i++ ) {
+    shards_.push_back( make_unique<Shard>(
+      cfg, [transmit, i]( const InternetDatagram& dgram ) { transmit( i, dgram ); }, queue_capacity ) );
+  }
+}
+
+TCPShardedRuntime::~TCPShardedRuntime()
+{
+  stop();
+}
+
+void TCPShardedRuntime::listen( uint16_t port, const TCPDemultiplexer::ListenOptions& options )
+{
+  if ( running_ ) {
+    throw runtime_error( "TCPShardedRuntime::listen() called after start()" );
+  }
+  for ( auto& shard : shards_ ) {
+    shard->demux.listen( port, options );
+  }
+}
+
+void TCPShardedRuntime::start( ServiceFunction service )
+{
+  if ( running_.exchange( true ) ) {
+    throw runtime_error( "TCPShardedRuntime already started" );
+  }
+  for ( size_t i = 0; i < shards_.size(); i++ ) {
+    workers_.emplace_back( [this, i, service] { run_worker( i, service ); } );
+  }
+}
+
+void TCPShardedRuntime::stop()
+{
+  running_ = false;
+  for ( auto& worker : workers_ ) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+// The 4-tuple hash is mixed once more before picking the shard, so the shard index and the
+// bucket in the shard's connection table come from unrelated bits.
+size_t TCPShardedRuntime::shard_of( const TCPFourTuple& tuple ) const
+{
+  return hash_mix( TCPFourTupleHash {}( tuple ) ^ 0x9e3779b97f4a7c15ULL ) % shards_.size();
+}
+
+bool TCPShardedRuntime::dispatch( InternetDatagram&& dgram )
+{
+  TCPFourTuple tuple { .local_ip = dgram.header.dst, .remote_ip = dgram.header.src };
+  if ( dgram.header.proto != IPv4Header::PROTO_TCP
+       or not peek_ports( dgram, tuple.remote_port, tuple.local_port ) ) {
+    return false;
+  }
+
+  Shard& shard = *shards_[shard_of( tuple )];
+  if ( not shard.queue.push( move( dgram ) ) ) {
+    shard.dropped++;
+    return false;
+  }
+  shard.dispatched++;
+  return true;
+}
+
+void TCPShardedRuntime::post( const TCPFourTuple& tuple, Task task )
+{
+  Shard& shard = *shards_[shard_of( tuple )];
+  const lock_guard lock { shard.tasks_mutex };
+  shard.tasks.push_back( move( task ) );
+  shard.has_tasks.store( true, memory_order_release );
+}
+
+void TCPShardedRuntime::run_worker( size_t index, const ServiceFunction& service )
+{
+  constexpr size_t BATCH = 64;
+  Shard& shard = *shards_[index];
+  auto last_tick = steady_clock::now();
+
+  while ( running_.load( memory_order_relaxed ) ) {
+    size_t received = 0;
+    while ( received < BATCH ) {
+      auto dgram = shard.queue.pop();
+      if ( not dgram.has_value() ) {
+        break;
+      }
+      shard.demux.receive( move( *dgram ) );
+      received++;
+    }
+
+    if ( shard.has_tasks.load( memory_order_acquire ) ) {
+      vector<Task> tasks;
+      {
+        const lock_guard lock { shard.tasks_mutex };
+        swap( tasks, shard.tasks );
+        shard.has_tasks.store( false, memory_order_relaxed );
+      }
+      for ( auto& task : tasks ) {
+        task( shard.demux );
+      }
+    }
+
+    const auto now = steady_clock::now();
+    const auto elapsed_ms = duration_cast<milliseconds>( now - last_tick ).count();
+    if ( elapsed_ms > 0 ) {
+      last_tick += milliseconds { elapsed_ms };
+      shard.demux.tick( elapsed_ms );
+      if ( service ) {
+        service( index, shard.demux );
+      }
+    }
+
+    if ( received == 0 ) {
+      this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,162 @@
+#include "arp_message.hh"
+#include "flat_hash_map.hh"
+#include "helpers.hh"
+#include "network_interface.hh"
+#include "random.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// A busy L2 segment: 10k neighbours in 10.0.0.0/16, and traffic to them at random
+constexpr size_t NEIGHBOURS = 10000;
+constexpr size_t LOOKUPS = 2000000;
+constexpr size_t SENDS = 500000;
+constexpr size_t TICKS = 1000;
+
+const EthernetAddress LOCAL_ETHERNET { 2, 0, 0, 0, 0, 1 };
+const Address LOCAL_IP { "10.0.0.1" };
+
+class CountingPort : public NetworkInterface::OutputPort
+{
+public:
+  void transmit( const NetworkInterface&, const EthernetFrame& frame ) override
+  {
+    ( frame.header.type == EthernetHeader::TYPE_IPv4 ? datagrams : others )++;
+  }
+  size_t datagrams {};
+  size_t others {};
+};
+
+EthernetAddress mac_of( uint32_t ip )
+{
+  const auto byte = [&]( unsigned shift ) { return static_cast<uint8_t>( ip >> shift ); };
+  return { 2, 0, 0, byte( 16 ), byte( 8 ), byte( 0 ) };
+}
+
+void report( string_view what, double ns, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 1 ) << ns << " ns\n";
+  debug_output << "        " << what << fixed << setprecision( 1 ) << setw( 8 ) << ns << " ns\n";
+}
+
+double ns_each( steady_clock::time_point start, size_t count )
+{
+  const duration<double, nano> elapsed = steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>( count );
+}
+
+// Nanoseconds per lookup of each neighbour in the trace
+template<typename Lookup>
+double time_lookups( const vector<uint32_t>& trace, Lookup&& lookup )
+{
+  uint64_t sink = 0;
+  const auto start = steady_clock::now();
+  for ( const uint32_t ip : trace ) {
+    sink += lookup( ip ).at( 5 );
+  }
+  const double ns = ns_each( start, trace.size() );
+  if ( sink == 0 ) {
+    throw runtime_error( "lookups found nothing" );
+  }
+  return ns;
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  vector<uint32_t> neighbours;
+  for ( uint32_t i = 0; i < NEIGHBOURS; i++ ) {
+    neighbours.push_back( LOCAL_IP.ipv4_numeric() + 1 + i );
+  }
+  auto rd = get_random_engine();
+  uniform_int_distribution<size_t> any { 0, NEIGHBOURS - 1 };
+  vector<uint32_t> trace;
+  for ( size_t i = 0; i < LOOKUPS; i++ ) {
+    trace.push_back( neighbours[any( rd )] );
+  }
+
+  // the lookup on its own: a balanced tree against a flat hash table
+  map<uint32_t, EthernetAddress> tree;
+  FlatHashMap<uint32_t, EthernetAddress> flat;
+  for ( const uint32_t ip : neighbours ) {
+    tree[ip] = mac_of( ip );
+    flat[ip] = mac_of( ip );
+  }
+  const double tree_ns = time_lookups( trace, [&]( uint32_t ip ) { return tree.find( ip )->second; } );
+  const double flat_ns = time_lookups( trace, [&]( uint32_t ip ) { return *flat.find( ip ); } );
+  report( "lookup, std::map     ", tree_ns, debug_output );
+  report( "lookup, FlatHashMap  ", flat_ns, debug_output );
+
+  // the whole send path, with every neighbour learned from its ARP request
+  const auto port = make_shared<CountingPort>();
+  NetworkInterface iface { "eth0", port, LOCAL_ETHERNET, LOCAL_IP };
+  for ( const uint32_t ip : neighbours ) {
+    ARPMessage request;
+    request.opcode = ARPMessage::OPCODE_REQUEST;
+    request.sender_ethernet_address = mac_of( ip );
+    request.sender_ip_address = ip;
+    request.target_ip_address = LOCAL_IP.ipv4_numeric() - 1; // not us: nothing to answer
+    iface.recv_frame( { { ETHERNET_BROADCAST, mac_of( ip ), EthernetHeader::TYPE_ARP }, serialize( request ) } );
+  }
+
+  InternetDatagram dgram;
+  dgram.header.src = LOCAL_IP.ipv4_numeric();
+  dgram.header.dst = 0xc0000201;
+  dgram.header.proto = IPv4Header::PROTO_UDP;
+  dgram.header.len = IPv4Header::LENGTH + 8;
+  dgram.header.compute_checksum();
+  const auto send_start = steady_clock::now();
+  for ( size_t i = 0; i < SENDS; i++ ) {
+    iface.send_datagram( dgram, Address::from_ipv4_numeric( trace[i] ) );
+  }
+  const double send_ns = ns_each( send_start, SENDS );
+  report( "send_datagram        ", send_ns, debug_output );
+  if ( port->datagrams != SENDS or port->others != 0 ) {
+    throw runtime_error( "a neighbour was not in the ARP cache" );
+  }
+
+  // every tick ages every entry
+  const auto tick_start = steady_clock::now();
+  for ( size_t i = 0; i < TICKS; i++ ) {
+    iface.tick( 1 );
+  }
+  const double tick_ns = ns_each( tick_start, TICKS );
+  report( "tick (10k entries)   ", tick_ns, debug_output );
+
+  if ( flat_ns >= tree_ns ) {
+    throw runtime_error( "the flat hash table was no faster than std::map" );
+  }
+  if ( send_ns > 5000 ) {
+    throw runtime_error( "send_datagram did not meet minimum speed of 200 K datagrams/s" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#include "network_interface_test_harness.hh"
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace {
+const EthernetAddress LOCAL_ETHERNET { 2, 0, 0, 0, 0, 1 };
+const Address LOCAL_IP { "10.0.0.1" };
+constexpr size_t DATAGRAM = 100; // the length of make_datagram's datagrams
+
+// A datagram told apart from the others by its identification
+InternetDatagram datagram( uint16_t id )
+{
+  InternetDatagram dgram = make_datagram( LOCAL_IP.ipv4_numeric(), ip( "198.51.100.7" ) );
+  dgram.header.id = id;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// The neighbour at 10.0.0.`n`, and its Ethernet address
+Address neighbour( uint8_t n )
+{
+  return Address { "10.0.0." + to_string( n ) };
+}
+
+EthernetAddress neighbour_ethernet( uint8_t n )
+{
+  return { 2, 0, 0, 0, 0, n };
+}
+
+// The broadcast ARP request for a neighbour
+EthernetFrame request_for( uint8_t n )
+{
+  const ARPMessage arp = make_arp(
+    ARPMessage::OPCODE_REQUEST, LOCAL_ETHERNET, LOCAL_IP.ipv4_numeric(), {}, neighbour( n ).ipv4_numeric() );
+  return { { ETHERNET_BROADCAST, LOCAL_ETHERNET, EthernetHeader::TYPE_ARP }, serialize( arp ) };
+}
+
+// A neighbour's ARP reply
+EthernetFrame reply_from( uint8_t n )
+{
+  const ARPMessage arp = make_arp( ARPMessage::OPCODE_REPLY,
+                                   neighbour_ethernet( n ),
+                                   neighbour( n ).ipv4_numeric(),
+                                   LOCAL_ETHERNET,
+                                   LOCAL_IP.ipv4_numeric() );
+  return { { LOCAL_ETHERNET, neighbour_ethernet( n ), EthernetHeader::TYPE_ARP }, serialize( arp ) };
+}
+
+// A datagram on its way to a neighbour
+EthernetFrame frame_to( uint8_t n, const InternetDatagram& dgram )
+{
+  return { { neighbour_ethernet( n ), LOCAL_ETHERNET, EthernetHeader::TYPE_IPv4 }, serialize( dgram ) };
+}
+
+// One neighbour holds only so many datagrams: the oldest give way
+void per_neighbour_limit()
+{
+  NetworkInterfaceTestHarness test { "per-neighbour limit", LOCAL_ETHERNET, LOCAL_IP };
+  test.execute( SetArpPendingLimits { 3, NetworkInterface::DEFAULT_ARP_PENDING_BYTES } );
+  for ( uint16_t id = 1; id <= 5; id++ ) {
+    test.execute( SendDatagram { datagram( id ), neighbour( 2 ) } );
+  }
+  test.execute( ExpectFrame { request_for( 2 ) } );
+  test.execute( ExpectNoFrame {} );
+  test.execute( ArpPendingDrops { { .neighbour_full = 2 } } );
+  test.execute( ArpPendingDatagrams { 3 } );
+  test.execute( ArpPendingBytes { 3 * DATAGRAM } );
+
+  // the newest datagrams are sent, in order
+  test.execute( ReceiveFrame { reply_from( 2 ) } );
+  for ( uint16_t id = 3; id <= 5; id++ ) {
+    test.execute( ExpectFrame { frame_to( 2, datagram( id ) ) } );
+  }
+  test.execute( ExpectNoFrame {} );
+  test.execute( ArpPendingDatagrams { 0 } );
+  test.execute( ArpPendingBytes { 0 } );
+}
+
+// All the neighbours together hold only so many bytes: the oldest datagram (of any neighbour) gives way
+void memory_limit()
+{
+  NetworkInterfaceTestHarness test { "memory limit", LOCAL_ETHERNET, LOCAL_IP };
+  test.execute( SetArpPendingLimits { NetworkInterface::DEFAULT_ARP_PENDING_PER_NEIGHBOUR, 3 * DATAGRAM } );
+  test.execute( SendDatagram { datagram( 1 ), neighbour( 2 ) } );
+  test.execute( ExpectFrame { request_for( 2 ) } );
+  test.execute( SendDatagram { datagram( 2 ), neighbour( 3 ) } );
+  test.execute( ExpectFrame { request_for( 3 ) } );
+  test.execute( SendDatagram { datagram( 3 ), neighbour( 2 ) } );
+  test.execute( SendDatagram { datagram( 4 ), neighbour( 3 ) } );
+  test.execute( SendDatagram { datagram( 5 ), neighbour( 3 ) } );
+  test.execute( ExpectNoFrame {} );
+  test.execute( ArpPendingDrops { { .memory_full = 2 } } );
+  test.execute( ArpPendingBytes { 3 * DATAGRAM } );
+
+  // the oldest datagrams were the ones dropped
+  test.execute( ReceiveFrame { reply_from( 2 ) } );
+  test.execute( ExpectFrame { frame_to( 2, datagram( 3 ) ) } );
+  test.execute( ReceiveFrame { reply_from( 3 ) } );
+  test.execute( ExpectFrame { frame_to( 3, datagram( 4 ) ) } );
+  test.execute( ExpectFrame { frame_to( 3, datagram( 5 ) ) } );
+  test.execute( ExpectNoFrame {} );
+
+  // a datagram bigger than the whole budget never waits
+  test.execute( SetArpPendingLimits { 1, DATAGRAM - 1 } );
+  test.execute( SendDatagram { datagram( 6 ), neighbour( 4 ) } );
+  test.execute( ExpectFrame { request_for( 4 ) } );
+  test.execute( ArpPendingDrops { { .memory_full = 3 } } );
+  test.execute( ArpPendingBytes { 0 } );
+}
+
+// A neighbour that is gone, under steady load: its datagrams are dropped when each request times out, and
+// the requests back off
+void backoff()
+{
+  NetworkInterfaceTestHarness test { "backoff", LOCAL_ETHERNET, LOCAL_IP };
+
+  // send a datagram every 100 ms for `ms`, expecting a request only at the `requests` times
+  const auto send_for = [&]( size_t ms, const set<size_t>& requests ) {
+    for ( size_t t = 0; t < ms; t += 100 ) {
+      test.execute( SendDatagram { datagram( 1 ), neighbour( 2 ) } );
+      if ( requests.contains( t ) ) {
+        test.execute( ExpectFrame { request_for( 2 ) } );
+      }
+      test.execute( ExpectNoFrame {} );
+      test.execute( Tick { 100 } );
+    }
+  };
+
+  // requests 5, 10, 20, 40, 60 and 60 seconds apart; each drops what waited for it, and the longer waits fill
+  // the neighbour's queue (64 datagrams)
+  send_for( 200000, { 0, 5000, 15000, 35000, 75000, 135000, 195000 } );
+  test.execute( ArpPendingDrops { { .neighbour_full = 1580, .unresolved = 370 } } );
+  test.execute( ArpPendingDatagrams { 50 } ); // the last five seconds
+
+  // once the neighbour has been quiet for a while, it starts over
+  test.execute( Tick { NetworkInterface::ARP_MAX_BACKOFF } ); // the last request times out
+  test.execute( Tick { NetworkInterface::ARP_MAX_BACKOFF } ); // and nothing more is sent to it
+  test.execute( ExpectNoFrame {} );
+  send_for( 6000, { 0, 5000 } );
+
+  // and as soon as it answers, what is waiting goes out and the backoff starts over too
+  send_for( 5000, {} );
+  test.execute( ReceiveFrame { reply_from( 2 ) } );
+  for ( size_t i = 0; i < 60; i++ ) {
+    test.execute( ExpectFrame { frame_to( 2, datagram( 1 ) ) } );
+  }
+  test.execute( ExpectNoFrame {} );
+  test.execute( Tick { 30000 } );
+  send_for( 6000, { 0, 5000 } );
+}
+
+// A neighbour must have room for at least one datagram
+void zero_limit()
+{
+  NetworkInterface iface { "eth0", make_shared<FramesSent>(), LOCAL_ETHERNET, LOCAL_IP };
+  bool threw = false;
+  try {
+    iface.set_arp_pending_limits( 0, NetworkInterface::DEFAULT_ARP_PENDING_BYTES );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  expect( threw, "a neighbour needs room for a datagram" );
+}
+
+// The router exports the drops
+void router_metrics()
+{
+  Router router;
+  const auto port = make_shared<FramesSent>();
+  router.add_interface( make_shared<NetworkInterface>( "lan", port, LOCAL_ETHERNET, LOCAL_IP ) );
+  router.interface( 0 )->send_datagram( datagram( 1 ), neighbour( 2 ) );
+  router.interface( 0 )->tick( NetworkInterface::ARP_REQUEST_TIMEOUT );
+  router.interface( 0 )->send_datagram( datagram( 2 ), neighbour( 2 ) );
+
+  ostringstream metrics;
+  router.write_metrics( metrics );
+  const string text = metrics.str();
+  const string drops = "router_arp_pending_drops_total{interface=\"lan\",reason=";
+  for ( const string& line : { drops + "\"unresolved\"} 1\n",
+                               drops + "\"memory_full\"} 0\n",
+                               "router_arp_pending_bytes{interface=\"lan\"} " + to_string( DATAGRAM ) + "\n" } ) {
+    expect( text.find( line ) != string::npos, "metrics did not include: " + line + "in:\n" + text );
+  }
+
+  // in parallel mode the interface belongs to its TX worker, which publishes them
+  router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+  router.start_parallel();
+  const InternetDatagram dgram = make_datagram( ip( "198.51.100.7" ), neighbour( 3 ).ipv4_numeric() );
+  const EthernetHeader header { LOCAL_ETHERNET, { 2, 0, 0, 0, 0, 9 }, EthernetHeader::TYPE_IPv4 };
+  router.receive_frame( 0, clone( { header, serialize( dgram ) } ) );
+  const string waiting = "router_arp_pending_bytes{interface=\"lan\"} " + to_string( 2 * DATAGRAM ) + "\n";
+  const auto deadline = chrono::steady_clock::now() + chrono::seconds { 10 };
+  string published;
+  while ( published.find( waiting ) == string::npos and chrono::steady_clock::now() < deadline ) {
+    this_thread::sleep_for( chrono::milliseconds { 1 } );
+    ostringstream parallel_metrics;
+    router.write_metrics( parallel_metrics );
+    published = parallel_metrics.str();
+  }
+  router.stop_parallel();
+  expect( published.find( waiting ) != string::npos, "the TX worker did not publish what is waiting" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    per_neighbour_limit();
+    memory_limit();
+    backoff();
+    zero_limit();
+    router_metrics();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
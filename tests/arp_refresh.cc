@@ -0,0 +1,115 @@
+#include "network_interface_test_harness.hh"
+#include "network_test_helpers.hh"
+
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+const EthernetAddress LOCAL_ETHERNET { 2, 0, 0, 0, 0, 1 };
+const EthernetAddress NEIGHBOUR_ETHERNET { 2, 0, 0, 0, 0, 2 };
+const Address LOCAL_IP { "10.0.0.1" };
+const Address NEIGHBOUR_IP { "10.0.0.2" };
+const InternetDatagram DATAGRAM = make_datagram( LOCAL_IP.ipv4_numeric(), ip( "198.51.100.7" ) );
+
+// An ARP request for the neighbour, sent to `dst`
+EthernetFrame request_to( const EthernetAddress& dst )
+{
+  const ARPMessage arp = make_arp(
+    ARPMessage::OPCODE_REQUEST, LOCAL_ETHERNET, LOCAL_IP.ipv4_numeric(), {}, NEIGHBOUR_IP.ipv4_numeric() );
+  return { { dst, LOCAL_ETHERNET, EthernetHeader::TYPE_ARP }, serialize( arp ) };
+}
+
+EthernetFrame neighbour_reply()
+{
+  const ARPMessage arp = make_arp( ARPMessage::OPCODE_REPLY,
+                                   NEIGHBOUR_ETHERNET,
+                                   NEIGHBOUR_IP.ipv4_numeric(),
+                                   LOCAL_ETHERNET,
+                                   LOCAL_IP.ipv4_numeric() );
+  return { { LOCAL_ETHERNET, NEIGHBOUR_ETHERNET, EthernetHeader::TYPE_ARP }, serialize( arp ) };
+}
+
+// An interface that has just learned the neighbour's Ethernet address
+class RefreshTestHarness : public NetworkInterfaceTestHarness
+{
+public:
+  explicit RefreshTestHarness( string test_name )
+    : NetworkInterfaceTestHarness( move( test_name ), LOCAL_ETHERNET, LOCAL_IP )
+  {
+    execute( ReceiveFrame { neighbour_reply() } );
+    execute( ExpectNoFrame {} );
+  }
+
+  // Send a datagram to the neighbour, expecting it to go to the cached address, followed by a unicast ARP
+  // request for the neighbour if `probe`
+  void send( bool probe )
+  {
+    const EthernetHeader header { NEIGHBOUR_ETHERNET, LOCAL_ETHERNET, EthernetHeader::TYPE_IPv4 };
+    execute( SendDatagram { DATAGRAM, NEIGHBOUR_IP } );
+    execute( ExpectFrame { { header, serialize( DATAGRAM ) } } );
+    if ( probe ) {
+      execute( ExpectFrame { request_to( NEIGHBOUR_ETHERNET ) } );
+    }
+    execute( ExpectNoFrame {} );
+  }
+
+  // Let time pass, expecting nothing to be sent meanwhile
+  void tick( size_t ms )
+  {
+    execute( Tick { ms } );
+    execute( ExpectNoFrame {} );
+  }
+};
+
+// A neighbour in use is asked to renew its entry before the entry expires, and the traffic to it never waits
+void busy_neighbour()
+{
+  RefreshTestHarness test { "busy neighbour" };
+  test.tick( NetworkInterface::ARP_CACHE_TTL - NetworkInterface::ARP_REFRESH_BEFORE - 1 );
+  test.send( false ); // an entry with a while left
+  test.tick( 1 );
+  test.send( true ); // an entry about to expire
+  test.send( false ); // an entry just probed
+  test.tick( NetworkInterface::ARP_PROBE_INTERVAL - 1 );
+  test.send( false ); // an entry probed a moment ago
+  test.tick( 1 );
+  test.send( true ); // an entry whose probe went unanswered
+
+  // the answer renews the entry for as long as a new one
+  test.execute( ReceiveFrame { neighbour_reply() } );
+  test.tick( NetworkInterface::ARP_CACHE_TTL - NetworkInterface::ARP_REFRESH_BEFORE - 1 );
+  test.send( false );
+  test.tick( 1 );
+  test.send( true );
+}
+
+// An entry that is not used is left to expire, and is then resolved again with a broadcast request
+void idle_neighbour()
+{
+  RefreshTestHarness test { "idle neighbour" };
+  test.tick( NetworkInterface::ARP_CACHE_TTL - 1 );
+  test.tick( 1 );
+  test.execute( SendDatagram { DATAGRAM, NEIGHBOUR_IP } );
+  test.execute( ExpectFrame { request_to( ETHERNET_BROADCAST ) } );
+  test.execute( ExpectNoFrame {} );
+}
+} // namespace
+
+int main()
+{
+  try {
+    busy_neighbour();
+    idle_neighbour();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -28,6 +28,15 @@ public:
   {}
 };
 
+// For tests that check an object directly rather than step by step through a TestHarness: throw an
+// ExpectationViolation (as a TestHarness expectation does) unless `condition` holds
+inline void expect( bool condition, const std::string& what )
+{
+  if ( not condition ) {
+    throw ExpectationViolation( what );
+  }
+}
+
 template<class T>
 struct TestStep
 {
@@ -0,0 +1,181 @@
+#include "dir24_8_table.hh"
+#include "prefix_trie.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+};
+
+string address_string( uint32_t address )
+{
+  return to_string( address >> 24U ) + "." + to_string( ( address >> 16U ) & 0xffU ) + "."
+         + to_string( ( address >> 8U ) & 0xffU ) + "." + to_string( address & 0xffU );
+}
+
+// The trie has its own test against a linear scan, so it serves as the reference here
+void check_lookup( const DIR24_8Table& table, const PrefixTrie<size_t>& trie, uint32_t address )
+{
+  const optional<uint32_t> got = table.lookup( address );
+  const size_t* expected = trie.lookup( address );
+  if ( got.has_value() != ( expected != nullptr ) or ( got and *got != *expected ) ) {
+    throw runtime_error( "lookup of " + address_string( address ) + " returned "
+                         + ( got ? to_string( *got ) : "nothing" ) + " instead of "
+                         + ( expected ? to_string( *expected ) : "nothing" ) );
+  }
+}
+
+void longer_prefixes_refine_shorter_ones()
+{
+  DIR24_8Table table;
+  PrefixTrie<size_t> trie;
+  const auto add = [&]( uint32_t prefix, uint8_t length, uint32_t value ) {
+    table.insert( prefix, length, value );
+    trie.insert( prefix, length, value );
+  };
+
+  add( 0x0a010180, 25, 1 ); // 10.1.1.128/25 first: its /24 gets a group before any covering route exists
+  add( 0x0a000000, 8, 2 );  // 10.0.0.0/8 must fill the rest of that group, but not the /25
+  add( 0x0a010100, 24, 3 ); // 10.1.1.0/24 likewise
+  add( 0x0a010181, 32, 4 );
+  add( 0, 0, 5 );
+  if ( table.group_count() != 1 ) {
+    throw runtime_error( "expected exactly one second-level group" );
+  }
+  for ( const uint32_t address :
+        { 0x0a010101U, 0x0a010180U, 0x0a010181U, 0x0a0101ffU, 0x0a020304U, 0x0b000000U } ) {
+    check_lookup( table, trie, address );
+  }
+
+  // replacing a route rewrites exactly the entries it owns
+  add( 0x0a010100, 24, 6 );
+  add( 0x0a010181, 32, 7 );
+  for ( const uint32_t address : { 0x0a010101U, 0x0a010180U, 0x0a010181U, 0x0a0101ffU } ) {
+    check_lookup( table, trie, address );
+  }
+
+  bool threw = false;
+  try {
+    table.insert( 0, 0, DIR24_8Table::MAX_VALUE );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  if ( not threw ) {
+    throw runtime_error( "an out-of-range value should be rejected" );
+  }
+}
+
+void random_table()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<int> any_length { 12, 32 };
+
+  DIR24_8Table table;
+  PrefixTrie<size_t> trie;
+  vector<Route> routes;
+  for ( uint32_t i = 0; i < 3000; i++ ) {
+    // cluster the prefixes under a few /8s so that they nest, and insert them in random order
+    const uint32_t prefix = ( ( any_address( rd ) % 4 ) << 24U ) | ( any_address( rd ) & 0xffffffU );
+    const auto length = static_cast<uint8_t>( any_length( rd ) );
+    table.insert( prefix, length, i );
+    trie.insert( prefix, length, i );
+    routes.push_back( { prefix, length } );
+  }
+
+  vector<uint32_t> addresses;
+  for ( size_t i = 0; i < 20000; i++ ) {
+    addresses.push_back( any_address( rd ) % 0x04000000U );
+    check_lookup( table, trie, addresses.back() );
+  }
+  vector<optional<uint32_t>> results( addresses.size() );
+  table.lookup_batch( addresses, results );
+  for ( size_t i = 0; i < addresses.size(); i++ ) {
+    if ( results[i] != table.lookup( addresses[i] ) ) {
+      throw runtime_error( "lookup_batch disagrees with lookup on " + address_string( addresses[i] ) );
+    }
+  }
+  for ( const auto& route : routes ) {
+    const uint32_t host_bits = any_address( rd ) & ~PrefixTrie<size_t>::mask( route.length );
+    check_lookup( table, trie, route.prefix );
+    check_lookup( table, trie, ( route.prefix & PrefixTrie<size_t>::mask( route.length ) ) | host_bits );
+  }
+}
+// Erase routes in random order, handing their addresses to the covering route as a router would
+void erase_random_routes()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<int> any_length { 12, 32 };
+
+  // the value of each route is its index in `routes`
+  DIR24_8Table table;
+  PrefixTrie<size_t> trie;
+  vector<Route> routes;
+  while ( routes.size() < 2000 ) {
+    const uint32_t prefix = ( ( any_address( rd ) % 2 ) << 24U ) | ( any_address( rd ) & 0xffffffU );
+    const auto length = static_cast<uint8_t>( any_length( rd ) );
+    if ( trie.find( prefix, length ) == nullptr ) {
+      trie.insert( prefix, length, routes.size() );
+      table.insert( prefix, length, static_cast<uint32_t>( routes.size() ) );
+      routes.push_back( { prefix & PrefixTrie<size_t>::mask( length ), length } );
+    }
+  }
+  vector<size_t> order( routes.size() );
+  iota( order.begin(), order.end(), 0 );
+  ranges::shuffle( order, rd );
+
+  for ( size_t i = 0; i < order.size(); i++ ) {
+    const Route& route = routes[order[i]];
+    trie.erase( route.prefix, route.length );
+    const size_t* covering = trie.lookup( route.prefix, static_cast<uint8_t>( route.length - 1 ) );
+    if ( covering ) {
+      table.erase( route.prefix, route.length, routes[*covering].length, static_cast<uint32_t>( *covering ) );
+    } else {
+      table.erase( route.prefix, route.length );
+    }
+
+    const uint32_t host_bits = any_address( rd ) & ~PrefixTrie<size_t>::mask( route.length );
+    check_lookup( table, trie, route.prefix | host_bits );
+    if ( i % 200 == 0 ) {
+      for ( size_t j = 0; j < 2000; j++ ) {
+        check_lookup( table, trie, any_address( rd ) % 0x02000000U );
+      }
+    }
+  }
+
+  // with every route gone, so are the second-level groups
+  if ( table.group_count() != 0 or table.lookup( 0x01020304 ) ) {
+    throw runtime_error( "an emptied table should have no routes and no groups" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    longer_prefixes_refine_shorter_ones();
+    random_table();
+    erase_random_routes();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
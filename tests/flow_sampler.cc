@@ -0,0 +1,163 @@
+#include "flow_sampler.hh"
+#include "network_test_helpers.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+namespace {
+FlowKey flow( uint32_t n )
+{
+  return { ip( "10.0.0.0" ) + n, ip( "192.0.2.1" ), static_cast<uint16_t>( 1024 + n % 60000 ), 443, 6 };
+}
+
+struct KeyLess
+{
+  bool operator()( const FlowKey& a, const FlowKey& b ) const
+  {
+    return tie( a.src, a.dst, a.src_port, a.dst_port, a.proto )
+           < tie( b.src, b.dst, b.src_port, b.dst_port, b.proto );
+  }
+};
+
+// With fewer flows than the table holds, every count is exact
+void few_flows()
+{
+  FlowSampler sampler { 8 };
+  for ( uint32_t n = 0; n < 5; n++ ) {
+    for ( uint32_t i = 0; i <= n; i++ ) {
+      sampler.add( flow( n ), 100 );
+    }
+  }
+  const auto top = sampler.top();
+  expect( top.size() == 5, "five flows were tracked" );
+  for ( uint32_t i = 0; i < 5; i++ ) {
+    const uint32_t n = 4 - i;
+    expect( top[i].key == flow( n ), "the heaviest flows come first" );
+    expect( top[i].bytes == 100 * ( n + 1 ) and top[i].error == 0 and top[i].packets == n + 1,
+            "a flow that never left the table is counted exactly" );
+    expect( sampler.estimate( flow( n ) ) >= 100 * ( n + 1 ), "the sketch never underestimates" );
+  }
+  expect( sampler.total_packets() == 15 and sampler.total_bytes() == 1500, "totals" );
+  expect( sampler.estimate( flow( 99 ) ) <= sampler.total_bytes(), "an unseen flow's estimate is bounded" );
+
+  sampler.clear();
+  expect( sampler.top().empty() and sampler.total_bytes() == 0 and sampler.estimate( flow( 4 ) ) == 0,
+          "clear() forgets everything" );
+}
+
+// Many mice and a few elephants: the elephants all make the table, and every count is within its bounds
+void heavy_hitters()
+{
+  constexpr size_t CAPACITY = 64;
+  constexpr uint32_t MICE = 20000;
+  constexpr uint32_t ELEPHANTS = 5;
+  FlowSampler sampler { CAPACITY };
+  map<FlowKey, uint64_t, KeyLess> truth;
+
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> mouse { ELEPHANTS, ELEPHANTS + MICE - 1 };
+  uniform_int_distribution<uint32_t> size { 40, 1500 };
+  // elephant e sends e + 1 times as often as elephant 0, and together they send half the datagrams
+  vector<uint32_t> schedule;
+  for ( uint32_t e = 0; e < ELEPHANTS; e++ ) {
+    schedule.insert( schedule.end(), e + 1, e );
+  }
+  for ( size_t i = 0; i < 200000; i++ ) {
+    const uint32_t which = i % 2 == 0 ? schedule[i / 2 % schedule.size()] : mouse( rd );
+    const uint64_t bytes = size( rd );
+    sampler.add( flow( which ), bytes );
+    truth[flow( which )] += bytes;
+  }
+
+  const uint64_t total = sampler.total_bytes();
+  const auto top = sampler.top();
+  expect( top.size() == CAPACITY, "the table is full" );
+  for ( const auto& entry : top ) {
+    const uint64_t actual = truth.at( entry.key );
+    expect( entry.bytes >= actual and entry.bytes - entry.error <= actual, "a tracked flow's bounds hold" );
+  }
+  for ( uint32_t e = 0; e < ELEPHANTS; e++ ) {
+    const uint64_t actual = truth.at( flow( e ) );
+    expect( actual > total / CAPACITY, "the elephants are heavy hitters" );
+    expect( ranges::any_of( top, [&]( const auto& entry ) { return entry.key == flow( e ); } ),
+            "every heavy hitter is in the table" );
+    const uint64_t estimate = sampler.estimate( flow( e ) );
+    expect( estimate >= actual and estimate - actual < total / 100, "the sketch is close for an elephant" );
+  }
+  for ( const auto& [key, actual] : truth ) {
+    expect( sampler.estimate( key ) >= actual, "the sketch never underestimates" );
+  }
+}
+
+// The interface counts each IPv4 datagram it receives, whoever it is for, and each fragment on its own
+void network_interface()
+{
+  const EthernetAddress local_ethernet { 2, 0, 0, 0, 0, 1 };
+  const EthernetAddress peer_ethernet { 2, 0, 0, 0, 0, 2 };
+  NetworkInterface iface { "eth0", make_shared<FramesSent>(), local_ethernet, Address { "10.0.0.1" } };
+  expect( iface.flow_sampler() == nullptr, "no sampler by default" );
+  iface.set_flow_sampler( make_unique<FlowSampler>() );
+
+  const auto receive = [&]( uint32_t dst, uint16_t src_port, bool mf ) {
+    InternetDatagram dgram = make_datagram( ip( "10.0.0.2" ), dst, IPv4Header::LENGTH + 100 );
+    dgram.header.mf = mf;
+    dgram.header.compute_checksum();
+    string& payload = dgram.payload.front().get_mut();
+    payload[0] = static_cast<char>( src_port >> 8U );
+    payload[1] = static_cast<char>( src_port & 0xffU );
+    payload[2] = 0;
+    payload[3] = 53;
+    const EthernetHeader header { local_ethernet, peer_ethernet, EthernetHeader::TYPE_IPv4 };
+    iface.recv_frame( clone( { header, serialize( dgram ) } ) );
+  };
+  receive( ip( "198.51.100.7" ), 5000, false );
+  receive( ip( "198.51.100.7" ), 5000, false );
+  receive( ip( "10.0.0.1" ), 6000, true ); // the first fragment of a datagram for the interface itself
+
+  iface.recv_frame( arp_reply_to( iface, peer_ethernet, ip( "10.0.0.2" ) ) );
+
+  const FlowSampler& sampler = *iface.flow_sampler();
+  expect( sampler.total_packets() == 3 and sampler.total_bytes() == 3 * 120, "IPv4 datagrams are counted" );
+  const auto top = sampler.top();
+  expect( top.size() == 2, "two flows" );
+  expect( top[0].key == FlowKey { ip( "10.0.0.2" ), ip( "198.51.100.7" ), 5000, 53, IPv4Header::PROTO_UDP }
+            and top[0].packets == 2 and top[0].bytes == 240,
+          "a forwarded flow is counted by its 5-tuple" );
+  expect( top[1].key == FlowKey { ip( "10.0.0.2" ), ip( "10.0.0.1" ), 0, 0, IPv4Header::PROTO_UDP },
+          "a fragment is counted without ports, before reassembly" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    few_flows();
+    heavy_hitters();
+    network_interface();
+
+    bool threw = false;
+    try {
+      FlowSampler sampler { 0 };
+    } catch ( const invalid_argument& ) {
+      threw = true;
+    }
+    expect( threw, "a sampler needs room for at least one flow" );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+#include "flow_sampler.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t FLOW_COUNT = 100000;
+constexpr size_t PACKET_COUNT = 1000000;
+constexpr size_t ROUNDS = 5;
+
+// One UDP datagram per flow, from 10.0.0.0/8 to 192.0.2.1
+vector<InternetDatagram> make_flows()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> host { 0x0a000001, 0x0afffffe };
+  uniform_int_distribution<uint32_t> length { 40, 1500 };
+  vector<InternetDatagram> flows;
+  for ( size_t i = 0; i < FLOW_COUNT; i++ ) {
+    InternetDatagram dgram;
+    dgram.header.proto = IPv4Header::PROTO_UDP;
+    dgram.header.src = host( rd );
+    dgram.header.dst = 0xc0000201;
+    dgram.header.len = static_cast<uint16_t>( length( rd ) );
+    string segment( 8, 0 );
+    segment[0] = static_cast<char>( i >> 8U );
+    segment[1] = static_cast<char>( i & 0xffU );
+    segment[3] = 53;
+    dgram.payload.emplace_back( std::move( segment ) );
+    flows.push_back( std::move( dgram ) );
+  }
+  return flows;
+}
+
+// Which flow each datagram belongs to: Zipf-distributed (exponent 1), as traffic tends to be
+vector<uint32_t> make_trace()
+{
+  vector<double> weights;
+  for ( size_t rank = 1; rank <= FLOW_COUNT; rank++ ) {
+    weights.push_back( 1.0 / static_cast<double>( rank ) );
+  }
+  discrete_distribution<uint32_t> zipf { weights.begin(), weights.end() };
+  auto rd = get_random_engine();
+  vector<uint32_t> trace;
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    trace.push_back( zipf( rd ) );
+  }
+  return trace;
+}
+
+// Nanoseconds per datagram to run `f` over the trace (a few times over)
+template<typename F>
+double measure( const vector<InternetDatagram>& flows, const vector<uint32_t>& trace, F&& f )
+{
+  duration<double> elapsed {};
+  for ( size_t round = 0; round < ROUNDS; round++ ) {
+    const auto start = steady_clock::now();
+    for ( const uint32_t flow : trace ) {
+      f( flows[flow] );
+    }
+    elapsed += steady_clock::now() - start;
+  }
+  return elapsed.count() * 1e9 / static_cast<double>( ROUNDS * trace.size() );
+}
+
+void report( string_view what, double ns, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 1 ) << ns << " ns per datagram\n";
+  debug_output << "        " << what << fixed << setprecision( 1 ) << setw( 8 ) << ns << " ns per datagram\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const vector<InternetDatagram> flows = make_flows();
+  const vector<uint32_t> trace = make_trace();
+
+  // what any per-flow work costs: finding the 5-tuple and hashing it
+  uint64_t sink = 0;
+  const double hash_ns = measure( flows, trace, [&]( const InternetDatagram& dgram ) {
+    sink += FlowKey::of( dgram ).hash( 0 );
+  } );
+  report( "5-tuple hash only", hash_ns, debug_output );
+
+  FlowSampler sampler;
+  const double sampler_ns = measure( flows, trace, [&]( const InternetDatagram& dgram ) { sampler.add( dgram ); } );
+  report( "FlowSampler::add  ", sampler_ns, debug_output );
+
+  // the heaviest flow should come out on top (or near it, as the counts are upper bounds)
+  vector<uint64_t> bytes( flows.size() );
+  for ( const uint32_t flow : trace ) {
+    bytes[flow] += flows[flow].header.len;
+  }
+  const auto heaviest = static_cast<size_t>( ranges::max_element( bytes ) - bytes.begin() );
+  const auto top = sampler.top();
+  cout << "heaviest flow: " << top.front().bytes << " bytes (within " << top.front().error << ") of "
+       << sampler.total_bytes() << ", actually " << ROUNDS * bytes[heaviest] << " (" << sink % 2 << ")\n";
+  const auto found = ranges::find_if( top | views::take( 3 ), [&]( const FlowSampler::Flow& flow ) {
+    return flow.key == FlowKey::of( flows[heaviest] );
+  } );
+  if ( sampler.total_packets() != ROUNDS * PACKET_COUNT or found == ( top | views::take( 3 ) ).end() ) {
+    throw runtime_error( "FlowSampler did not find the heaviest flow" );
+  }
+
+  // finding the 5-tuple is needed anyway (e.g. to spread flows over paths); the sampler's own cost is the rest
+  if ( sampler_ns - hash_ns > 150 ) {
+    throw runtime_error( "FlowSampler did not meet maximum cost of 150 ns per datagram (beyond the hash)" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+#include "datagram_reassembler.hh"
+#include "network_test_helpers.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+const EthernetAddress LOCAL_ETHERNET { 2, 0, 0, 0, 0, 1 };
+const EthernetAddress PEER_ETHERNET { 2, 0, 0, 0, 0, 2 };
+const Address LOCAL_IP { "10.0.0.1" };
+const Address PEER_IP { "10.0.0.2" };
+const uint32_t LOCAL = LOCAL_IP.ipv4_numeric();
+const uint32_t PEER = PEER_IP.ipv4_numeric();
+
+// An interface whose peer's Ethernet address is known
+struct TestInterface
+{
+  shared_ptr<FramesSent> port = make_shared<FramesSent>();
+  NetworkInterface iface { "eth0", port, LOCAL_ETHERNET, LOCAL_IP };
+
+  explicit TestInterface( size_t mtu = NetworkInterface::DEFAULT_MTU )
+  {
+    iface.set_mtu( mtu );
+    iface.recv_frame( arp_reply_to( iface, PEER_ETHERNET, PEER ) );
+  }
+
+  // The datagrams sent, in order
+  vector<InternetDatagram> sent()
+  {
+    vector<InternetDatagram> datagrams = port->datagrams();
+    expect( datagrams.size() == port->frames.size(), "interface sent a bad datagram" );
+    port->frames.clear();
+    return datagrams;
+  }
+
+  void receive( const InternetDatagram& dgram )
+  {
+    const EthernetHeader header { LOCAL_ETHERNET, PEER_ETHERNET, EthernetHeader::TYPE_IPv4 };
+    iface.recv_frame( clone( { header, serialize( dgram ) } ) );
+  }
+};
+
+void fragments_on_egress()
+{
+  TestInterface t { 576 };
+  const InternetDatagram original = make_datagram( PEER, PEER, 1400 );
+  t.iface.send_datagram( clone( original ), PEER_IP );
+  const auto fragments = t.sent();
+
+  // 1380 payload bytes in 552-byte pieces (the most that fit in 576 bytes, in multiples of 8)
+  expect( fragments.size() == 3, "expected 3 fragments, got " + to_string( fragments.size() ) );
+  const vector<uint16_t> offsets { 0, 69, 138 };
+  const vector<uint16_t> lengths { 572, 572, 296 };
+  string payload;
+  for ( size_t i = 0; i < fragments.size(); i++ ) {
+    const IPv4Header& header = fragments[i].header;
+    expect( header.offset == offsets[i] and header.len == lengths[i] and header.mf == ( i < 2 ),
+            "bad fragment header " + header.to_string() );
+    expect( header.id == original.header.id and header.src == original.header.src and not header.df,
+            "fragment did not keep the original's identity" );
+    payload += concat( fragments[i].payload );
+  }
+  expect( payload == concat( original.payload ), "fragments did not carry the original payload" );
+
+  // a datagram that fits, or may not be fragmented, goes as it is
+  t.iface.send_datagram( make_datagram( PEER, PEER, 576 ), PEER_IP );
+  t.iface.send_datagram( make_datagram( PEER, PEER, 1400, IPv4Header::DEFAULT_TTL, true ), PEER_IP );
+  const auto whole = t.sent();
+  expect( whole.size() == 2 and whole[0].header.len == 576 and whole[1].header.len == 1400,
+          "datagrams that fit, or had DF set, were fragmented" );
+
+  // nor does one with options, which only the first fragment could carry whole
+  InternetDatagram with_options = make_datagram( PEER, PEER, 1400 );
+  with_options.header.hlen = 6;
+  with_options.payload.emplace( with_options.payload.begin(), string( 4, 1 ) ); // four NOP options
+  with_options.header.len += 4;
+  with_options.header.compute_checksum();
+  t.iface.send_datagram( move( with_options ), PEER_IP );
+  const auto unfragmented = t.sent();
+  expect( unfragmented.size() == 1 and unfragmented[0].header.len == 1404 and unfragmented[0].header.hlen == 6
+            and not unfragmented[0].header.mf,
+          "a datagram with IP options was fragmented" );
+
+  // a fragment that is fragmented again keeps its place in the original
+  InternetDatagram middle = make_datagram( PEER, PEER, 1020 );
+  middle.header.offset = 100;
+  middle.header.mf = true;
+  middle.header.compute_checksum();
+  t.iface.send_datagram( move( middle ), PEER_IP );
+  const auto pieces = t.sent();
+  expect( pieces.size() == 2 and pieces[0].header.offset == 100 and pieces[1].header.offset == 169
+            and pieces[0].header.mf and pieces[1].header.mf,
+          "a fragment was not fragmented in place" );
+}
+
+void reassembles_on_ingress()
+{
+  // fragments from an interface with a small MTU, received out of order and with duplicates
+  TestInterface sender { 300 };
+  const InternetDatagram original = make_datagram( PEER, LOCAL, 1400 );
+  sender.iface.send_datagram( clone( original ), PEER_IP );
+  auto fragments = sender.sent();
+  expect( fragments.size() == 5, "expected 5 fragments" ); // 280 bytes of payload in each but the last
+  ranges::reverse( fragments );
+  fragments.insert( fragments.begin() + 3, clone( fragments[1] ) );
+
+  TestInterface t;
+  for ( const auto& fragment : fragments ) {
+    expect( t.iface.datagrams_received().empty(), "a datagram was delivered before all its fragments arrived" );
+    t.receive( fragment );
+  }
+  expect( t.iface.datagrams_received().size() == 1, "the datagram was not reassembled" );
+  const InternetDatagram& whole = t.iface.datagrams_received().front();
+  expect( whole.header.len == 1400 and not whole.header.mf and whole.header.offset == 0
+            and concat( whole.payload ) == concat( original.payload ),
+          "the reassembled datagram differs from the original: " + whole.header.to_string() );
+  InternetDatagram reparsed;
+  expect( parse( reparsed, vector<string> { concat( serialize( whole ) ) } ),
+          "the reassembled datagram's checksum is wrong" );
+  expect( t.iface.reassembler().datagrams_pending() == 0 and t.iface.reassembler().bytes_held() == 0,
+          "the reassembler held on to a finished datagram" );
+
+  // fragments passing through (to another address) are left alone
+  t.iface.datagrams_received().pop();
+  sender.iface.send_datagram( make_datagram( PEER, 0x0a090909, 1400 ), PEER_IP );
+  for ( const auto& fragment : sender.sent() ) {
+    t.receive( fragment );
+  }
+  expect( t.iface.datagrams_received().size() == 5, "fragments passing through were reassembled" );
+}
+
+// The first fragment of a datagram (by default, with 984 bytes of payload)
+InternetDatagram first_fragment( uint16_t id, size_t length = 1004 )
+{
+  InternetDatagram fragment = make_datagram( PEER, LOCAL, length );
+  fragment.header.id = id;
+  fragment.header.mf = true;
+  fragment.header.compute_checksum();
+  return fragment;
+}
+
+void gives_up_on_missing_fragments()
+{
+  DatagramReassembler reassembler { 1000, 2500 }; // room for two first fragments, not three
+  expect( not reassembler.add( first_fragment( 1 ) ), "a first fragment was returned on its own" );
+  reassembler.tick( 999 );
+  expect( reassembler.datagrams_pending() == 1, "a datagram was abandoned before its timeout" );
+  reassembler.tick( 1 );
+  expect( reassembler.datagrams_pending() == 0 and reassembler.timeouts() == 1 and reassembler.bytes_held() == 0,
+          "a datagram was not abandoned after its timeout" );
+
+  // over the memory limit, the oldest datagrams go
+  for ( uint16_t id = 2; id <= 4; id++ ) {
+    (void)reassembler.add( first_fragment( id ) );
+  }
+  expect( reassembler.datagrams_pending() == 2 and reassembler.evictions() == 1
+            and reassembler.bytes_held() <= 2500,
+          "the memory limit was not kept" );
+  InternetDatagram rest = make_datagram( PEER, LOCAL, 100 );
+  rest.header.id = 2;
+  rest.header.offset = 984 / 8;
+  rest.header.compute_checksum();
+  expect( not reassembler.add( clone( rest ) ), "an evicted datagram was completed" );
+
+  // a fragment other than the last must carry a multiple of 8 bytes
+  expect( not reassembler.add( first_fragment( 5, 1001 ) ) and reassembler.datagrams_pending() == 3,
+          "a malformed fragment was kept" );
+  expect( reassembler.add( make_datagram( PEER, 1, 100 ) ).has_value(), "a whole datagram was held" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    fragments_on_egress();
+    reassembles_on_ingress();
+    gives_up_on_missing_fragments();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
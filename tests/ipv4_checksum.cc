@@ -0,0 +1,97 @@
+#include "ipv4_header.hh"
+#include "random.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+IPv4Header random_header( default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> word;
+  IPv4Header header;
+  header.tos = static_cast<uint8_t>( word( rd ) );
+  header.len = static_cast<uint16_t>( word( rd ) );
+  header.id = static_cast<uint16_t>( word( rd ) );
+  header.df = word( rd ) % 2;
+  header.offset = static_cast<uint16_t>( word( rd ) & 0x1fffU );
+  header.ttl = static_cast<uint8_t>( word( rd ) | 1U ); // at least 1
+  header.proto = static_cast<uint8_t>( word( rd ) );
+  header.src = word( rd );
+  header.dst = word( rd );
+  header.compute_checksum();
+  return header;
+}
+
+// The header's checksum must be what compute_checksum() would have made it
+void check_checksum( const IPv4Header& updated, const string& what )
+{
+  IPv4Header recomputed = updated;
+  recomputed.compute_checksum();
+  if ( updated.cksum != recomputed.cksum ) {
+    throw runtime_error( what + ": incremental checksum " + to_string( updated.cksum ) + " != recomputed "
+                         + to_string( recomputed.cksum ) + " for " + updated.to_string() );
+  }
+}
+
+void decrement_matches_recompute()
+{
+  auto rd = get_random_engine();
+  for ( size_t i = 0; i < 100000; i++ ) {
+    IPv4Header header = random_header( rd );
+    header.decrement_ttl();
+    check_checksum( header, "decrement_ttl" );
+  }
+
+  // every TTL down to zero, for a few protocols
+  for ( uint8_t proto : { 0, 1, 6, 17, 255 } ) {
+    IPv4Header header = random_header( rd );
+    header.proto = proto;
+    header.ttl = 255;
+    header.compute_checksum();
+    while ( header.ttl > 0 ) {
+      header.decrement_ttl();
+      check_checksum( header, "TTL " + to_string( header.ttl ) );
+    }
+  }
+}
+
+void update_matches_recompute()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> word;
+  for ( size_t i = 0; i < 100000; i++ ) {
+    IPv4Header header = random_header( rd );
+    // change the identification field, or the high half of the destination address
+    if ( i % 2 == 0 ) {
+      const uint16_t old_id = header.id;
+      header.id = static_cast<uint16_t>( word( rd ) );
+      header.update_checksum( old_id, header.id );
+    } else {
+      const auto old_high = static_cast<uint16_t>( header.dst >> 16U );
+      header.dst = ( word( rd ) & 0xffff0000U ) | ( header.dst & 0xffffU );
+      header.update_checksum( old_high, static_cast<uint16_t>( header.dst >> 16U ) );
+    }
+    check_checksum( header, "update_checksum" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    decrement_matches_recompute();
+    update_matches_recompute();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,341 @@
+#include "checksum.hh"
+#include "icmp_message.hh"
+#include "nat_table.hh"
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr uint8_t TCP = IPv4Header::PROTO_TCP;
+constexpr uint8_t UDP = IPv4Header::PROTO_UDP;
+constexpr uint8_t SYN = 0x02;
+constexpr uint8_t FIN = 0x01;
+constexpr uint8_t ACK = 0x10;
+
+uint16_t get16( const string& bytes, size_t offset )
+{
+  return static_cast<uint16_t>( static_cast<uint8_t>( bytes[offset] ) << 8U
+                                | static_cast<uint8_t>( bytes[offset + 1] ) );
+}
+
+void put16( string& bytes, size_t offset, uint16_t value )
+{
+  bytes[offset] = static_cast<char>( value >> 8U );
+  bytes[offset + 1] = static_cast<char>( value & 0xffU );
+}
+
+// A TCP segment or UDP user datagram with correct checksums, its payload split over two pieces (so that the
+// ports and the checksum straddle them)
+InternetDatagram make_segment( uint8_t proto,
+                                uint32_t src,
+                                uint16_t src_port,
+                                uint32_t dst,
+                                uint16_t dst_port,
+                                uint8_t flags = ACK )
+{
+  string segment( proto == TCP ? 20 : 8, 0 );
+  put16( segment, 0, src_port );
+  put16( segment, 2, dst_port );
+  segment += "hello, world";
+  if ( proto == TCP ) {
+    segment[12] = 0x50; // data offset: 5 words
+    segment[13] = static_cast<char>( flags );
+  } else {
+    put16( segment, 4, static_cast<uint16_t>( segment.size() ) );
+  }
+
+  InternetDatagram dgram;
+  dgram.header.proto = proto;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.len = static_cast<uint16_t>( IPv4Header::LENGTH + segment.size() );
+  dgram.header.compute_checksum();
+  InternetChecksum check { dgram.header.pseudo_checksum() };
+  check.add( segment );
+  put16( segment, proto == TCP ? 16 : 6, check.value() );
+
+  dgram.payload.emplace_back( segment.substr( 0, 3 ) );
+  dgram.payload.emplace_back( segment.substr( 3 ) );
+  return dgram;
+}
+
+uint16_t src_port( const InternetDatagram& dgram )
+{
+  return get16( concat( dgram.payload ), 0 );
+}
+
+uint16_t dst_port( const InternetDatagram& dgram )
+{
+  return get16( concat( dgram.payload ), 2 );
+}
+
+// Whether the IP header's checksum, and the TCP, UDP or ICMP checksum, are right
+bool checksums_ok( const InternetDatagram& dgram )
+{
+  IPv4Header header = dgram.header;
+  header.compute_checksum();
+  const uint32_t pseudo = dgram.header.proto == IPv4Header::PROTO_ICMP ? 0 : dgram.header.pseudo_checksum();
+  InternetChecksum check { pseudo };
+  check.add( dgram.payload );
+  return header.cksum == dgram.header.cksum and check.value() == 0;
+}
+
+InternetDatagram echo( uint8_t type, uint32_t src, uint32_t dst, uint16_t id )
+{
+  ICMPMessage message;
+  message.type = type;
+  message.rest_of_header = uint32_t { id } << 16U | 1; // identifier and sequence number
+  message.payload = "ping";
+  message.compute_checksum();
+  return message.to_datagram( src, dst );
+}
+
+void translates_both_ways()
+{
+  const uint32_t outside = ip( "192.0.2.1" );
+  const uint32_t host = ip( "10.0.0.5" );
+  const uint32_t server = ip( "198.51.100.7" );
+  NatTable nat { outside };
+
+  // the inside port is kept when it is free
+  InternetDatagram out = make_segment( TCP, host, 40000, server, 443, SYN );
+  expect( nat.translate_outbound( out ), "a TCP segment was not translated" );
+  expect( out.header.src == outside and src_port( out ) == 40000, "the source was not the outside address" );
+  expect( out.header.dst == server and dst_port( out ) == 443, "the destination changed" );
+  expect( checksums_ok( out ), "the checksums were wrong after the outbound translation" );
+
+  InternetDatagram reply = make_segment( TCP, server, 443, outside, 40000, SYN | ACK );
+  expect( nat.translate_inbound( reply ), "the reply was not translated" );
+  expect( reply.header.dst == host and dst_port( reply ) == 40000, "the reply did not go back to the host" );
+  expect( checksums_ok( reply ), "the checksums were wrong after the inbound translation" );
+
+  // another host with the same port gets another outside port, whoever it talks to
+  const uint32_t other = ip( "10.0.0.6" );
+  InternetDatagram second = make_segment( TCP, other, 40000, server, 80, SYN );
+  expect( nat.translate_outbound( second ) and src_port( second ) != 40000 and src_port( second ) >= 1024,
+          "a port in use was handed out again" );
+  expect( checksums_ok( second ), "the checksums were wrong with a new port" );
+  expect( nat.outside_port( TCP, other, 40000 ) == src_port( second ), "the mapping was not recorded" );
+  InternetDatagram third = make_segment( TCP, other, 40000, ip( "203.0.113.9" ), 22, SYN );
+  expect( nat.translate_outbound( third ) and src_port( third ) == src_port( second ),
+          "the mapping depended on the destination" );
+
+  // UDP: the same port number is a separate mapping, and a checksum of 0 (none) stays 0
+  InternetDatagram udp = make_segment( UDP, host, 40000, server, 53 );
+  string bytes = concat( udp.payload );
+  put16( bytes, 6, 0 );
+  udp.payload.clear();
+  udp.payload.emplace_back( std::move( bytes ) );
+  expect( nat.translate_outbound( udp ) and src_port( udp ) == 40000 and nat.size() == 3,
+          "UDP shared TCP's mappings" );
+  expect( get16( concat( udp.payload ), 6 ) == 0, "an absent UDP checksum was filled in" );
+
+  // ICMP echo: the identifier is the port
+  InternetDatagram ping = echo( ICMPMessage::TYPE_ECHO_REQUEST, host, server, 7 );
+  expect( nat.translate_outbound( ping ) and ping.header.src == outside and checksums_ok( ping ),
+          "an echo request was not translated" );
+  InternetDatagram pong = echo( ICMPMessage::TYPE_ECHO_REPLY, server, outside, get16( concat( ping.payload ), 4 ) );
+  expect( nat.translate_inbound( pong ) and pong.header.dst == host and get16( concat( pong.payload ), 4 ) == 7
+            and checksums_ok( pong ),
+          "an echo reply was not translated back" );
+
+  // what does not belong to a mapping is left alone
+  InternetDatagram stranger = make_segment( TCP, server, 443, outside, 40001 );
+  expect( not nat.translate_inbound( stranger ) and stranger.header.dst == outside, "a stranger got in" );
+  InternetDatagram fragment = make_segment( UDP, host, 5000, server, 53 );
+  fragment.header.mf = true;
+  expect( not nat.translate_outbound( fragment ), "a fragment was translated" );
+  InternetDatagram unreachable = echo( ICMPMessage::TYPE_DESTINATION_UNREACHABLE, host, server, 9 );
+  expect( not nat.translate_outbound( unreachable ), "an ICMP error from inside was translated" );
+}
+
+// traceroute from inside: Time Exceeded about a translated datagram goes back to the host, quoting the
+// datagram as the host sent it
+void translates_icmp_errors()
+{
+  const uint32_t outside = ip( "192.0.2.1" );
+  const uint32_t host = ip( "10.0.0.5" );
+  const uint32_t server = ip( "198.51.100.7" );
+  NatTable nat { outside };
+  for ( const uint8_t proto : { UDP, TCP } ) {
+    InternetDatagram probe = make_segment( proto, host, 33434, server, 33435 );
+    nat.translate_outbound( probe ); // the NAT keeps the port, so make it look taken:
+    InternetDatagram other = make_segment( proto, ip( "10.0.0.9" ), 33434, server, 33435 );
+    nat.translate_outbound( other );
+    const uint16_t port = src_port( other );
+
+    InternetDatagram error
+      = ICMPMessage::error( ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED, other )
+          .to_datagram( ip( "203.0.113.1" ), outside );
+    expect( nat.translate_inbound( error ) and error.header.dst == ip( "10.0.0.9" ) and checksums_ok( error ),
+            "an ICMP error was not translated back" );
+    ICMPMessage message;
+    expect( parse( message, vector<string> { concat( error.payload ) } ), "the error's checksum was wrong" );
+    IPv4Header quoted;
+    expect( parse( quoted, vector<string> { message.payload } ), "the quoted header's checksum was wrong" );
+    expect( quoted.src == ip( "10.0.0.9" ) and get16( message.payload, IPv4Header::LENGTH ) == 33434
+              and port != 33434,
+            "the quote was not put back" );
+    if ( proto == UDP ) {
+      // the whole UDP header is quoted, checksum and all, and it is right for what the host sent
+      const InternetDatagram sent = make_segment( UDP, ip( "10.0.0.9" ), 33434, server, 33435 );
+      expect( message.payload.substr( IPv4Header::LENGTH ) == concat( sent.payload ).substr( 0, 8 ),
+              "the quoted UDP header was not the host's" );
+    }
+  }
+}
+
+void mappings_time_out()
+{
+  const uint32_t outside = ip( "192.0.2.1" );
+  const uint32_t host = ip( "10.0.0.5" );
+  const uint32_t server = ip( "198.51.100.7" );
+  NatTable nat { outside };
+  InternetDatagram udp = make_segment( UDP, host, 5000, server, 53 );
+  InternetDatagram tcp = make_segment( TCP, host, 5001, server, 80, SYN );
+  InternetDatagram closing = make_segment( TCP, host, 5002, server, 80, SYN );
+  nat.translate_outbound( udp );
+  nat.translate_outbound( tcp );
+  nat.translate_outbound( closing );
+  expect( nat.size() == 3, "three mappings were not made" );
+
+  // used again 200 s later, the UDP mapping lasts until 500 s; the closing connection's until 4 minutes after
+  // its FIN
+  nat.tick( 200 * 1000 );
+  InternetDatagram again = make_segment( UDP, host, 5000, server, 53 );
+  nat.translate_outbound( again );
+  InternetDatagram fin = make_segment( TCP, host, 5002, server, 80, FIN | ACK );
+  nat.translate_outbound( fin );
+  nat.tick( 239 * 1000 );
+  expect( nat.size() == 3, "a mapping lapsed early" );
+  nat.tick( 2 * 1000 );
+  expect( nat.size() == 2 and not nat.outside_port( TCP, host, 5002 ),
+          "the closing connection's mapping did not lapse" );
+  nat.tick( 58 * 1000 );
+  expect( nat.outside_port( UDP, host, 5000 ).has_value(), "the UDP mapping lapsed early" );
+  nat.tick( 2 * 1000 );
+  expect( nat.size() == 1 and not nat.outside_port( UDP, host, 5000 ), "the UDP mapping did not lapse" );
+  expect( nat.outside_port( TCP, host, 5001 ).has_value(), "the established connection's mapping lapsed" );
+
+  // beyond the wheel's reach (17 minutes): the connection lasts 2 hours and 4 minutes since it was last used
+  nat.tick( 7440 * 1000 - 502 * 1000 );
+  expect( nat.size() == 1, "the established connection's mapping lapsed early" );
+  nat.tick( 2000 );
+  expect( nat.size() == 0, "the established connection's mapping did not lapse" );
+
+  // ports are handed out again once free, and not while taken
+  NatTable small { outside, {}, 2000, 2001 };
+  for ( uint16_t port = 1; port <= 3; port++ ) {
+    InternetDatagram dgram = make_segment( UDP, host, port, server, 53 );
+    expect( small.translate_outbound( dgram ) == ( port <= 2 ), "the port range was not respected" );
+  }
+  small.tick( 301 * 1000 );
+  InternetDatagram later = make_segment( UDP, host, 3, server, 53 );
+  expect( small.size() == 0 and small.translate_outbound( later ), "a lapsed mapping's port was not freed" );
+}
+
+void router_masquerades()
+{
+  Router router;
+  const auto lan = make_shared<FramesSent>();
+  const auto wan = make_shared<FramesSent>();
+  const EthernetAddress lan_ethernet { 2, 0, 0, 0, 0, 1 };
+  const EthernetAddress wan_ethernet { 2, 0, 0, 0, 0, 2 };
+  router.add_interface( make_shared<NetworkInterface>( "lan", lan, lan_ethernet, Address { "10.0.0.1" } ) );
+  router.add_interface( make_shared<NetworkInterface>( "wan", wan, wan_ethernet, Address { "192.0.2.1" } ) );
+  router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+  router.add_route( 0, 0, Address { "192.0.2.254" }, 1 );
+  router.enable_nat( 1 );
+
+  const auto receive = [&]( size_t interface, const InternetDatagram& dgram ) {
+    router.interface( interface )->datagrams_received().push( clone( dgram ) );
+    router.route();
+  };
+  // the interfaces send datagrams once ARP has found the next hop, so look at what they queued instead
+  const auto last_sent = [&]( FramesSent& port, size_t interface, uint32_t next_hop ) {
+    const size_t before = port.frames.size();
+    NetworkInterface& iface = *router.interface( interface );
+    iface.recv_frame( arp_reply_to( iface, { 2, 0, 0, 0, 0, 9 }, next_hop ) );
+    expect( port.frames.size() > before, "nothing was sent" );
+    InternetDatagram dgram;
+    expect( parse( dgram, vector<string> { concat( port.frames.back().payload ) } ), "a bad datagram was sent" );
+    return dgram;
+  };
+
+  receive( 0, make_segment( UDP, ip( "10.0.0.5" ), 5353, ip( "198.51.100.7" ), 53 ) );
+  const InternetDatagram out = last_sent( *wan, 1, ip( "192.0.2.254" ) );
+  expect( out.header.src == ip( "192.0.2.1" ) and out.header.ttl == IPv4Header::DEFAULT_TTL - 1
+            and checksums_ok( out ),
+          "the datagram did not leave translated" );
+  expect( router.nat_mappings( 1 ) == 1 and router.nat_mappings( 0 ) == 0, "the mapping was not counted" );
+
+  receive( 1, make_segment( UDP, ip( "198.51.100.7" ), 53, ip( "192.0.2.1" ), src_port( out ) ) );
+  const InternetDatagram back = last_sent( *lan, 0, ip( "10.0.0.5" ) );
+  expect( back.header.dst == ip( "10.0.0.5" ) and dst_port( back ) == 5353 and checksums_ok( back ),
+          "the reply did not come back translated" );
+
+  // an ICMP error about a reply quotes it as it arrived, to the outside address and port
+  InternetDatagram expiring = make_segment( UDP, ip( "198.51.100.7" ), 53, ip( "192.0.2.1" ), src_port( out ) );
+  expiring.header.ttl = 1;
+  expiring.header.compute_checksum();
+  const size_t before_error = wan->frames.size();
+  receive( 1, expiring );
+  InternetDatagram error;
+  expect( wan->frames.size() == before_error + 1
+            and parse( error, vector<string> { concat( wan->frames.back().payload ) } ),
+          "no ICMP error was sent for the expiring reply" );
+  const string message = concat( error.payload );
+  const size_t quote = ICMPMessage::HEADER_LENGTH;
+  IPv4Header quoted;
+  expect( static_cast<uint8_t>( message.at( 0 ) ) == ICMPMessage::TYPE_TIME_EXCEEDED
+            and parse( quoted, vector<string> { message.substr( quote, IPv4Header::LENGTH ) } )
+            and quoted.dst == ip( "192.0.2.1" )
+            and get16( message, quote + IPv4Header::LENGTH + 2 ) == src_port( out ),
+          "the ICMP error did not quote the reply as it arrived" );
+
+  // a later fragment cannot be translated, so it is dropped rather than leak the inside address
+  InternetDatagram fragment = make_segment( UDP, ip( "10.0.0.5" ), 5353, ip( "198.51.100.7" ), 53 );
+  fragment.header.offset = 100;
+  fragment.header.compute_checksum();
+  const size_t sent = wan->frames.size();
+  receive( 0, fragment );
+  expect( wan->frames.size() == sent and router.interface_stats( 0 ).nat_drops == 1,
+          "an untranslatable datagram was not dropped" );
+
+  router.tick( 301 * 1000 );
+  expect( router.nat_mappings( 1 ) == 0, "the router's NAT did not time out" );
+
+  bool threw = false;
+  try {
+    router.enable_nat( 2 );
+  } catch ( const exception& ) {
+    threw = true;
+  }
+  expect( threw, "NAT was enabled on a missing interface" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    translates_both_ways();
+    translates_icmp_errors();
+    mappings_time_out();
+    router_masquerades();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "checksum.hh"
+#include "nat_table.hh"
+#include "random.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t MAPPING_COUNT = 100000; // half TCP, half UDP
+constexpr size_t PACKET_COUNT = 200000;
+constexpr size_t ROUNDS = 5;
+constexpr uint32_t OUTSIDE = 0xc0000201; // 192.0.2.1
+constexpr uint32_t SERVER = 0xc6336407;  // 198.51.100.7
+
+void put16( string& bytes, size_t offset, uint16_t value )
+{
+  bytes[offset] = static_cast<char>( value >> 8U );
+  bytes[offset + 1] = static_cast<char>( value & 0xffU );
+}
+
+// A 64-byte TCP segment or UDP user datagram with correct checksums
+InternetDatagram make_datagram( uint8_t proto, uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port )
+{
+  string segment( 44, 'x' );
+  put16( segment, 0, src_port );
+  put16( segment, 2, dst_port );
+  if ( proto == IPv4Header::PROTO_TCP ) {
+    segment[12] = 0x50;
+    segment[13] = 0x10; // ACK
+    put16( segment, 16, 0 );
+  } else {
+    put16( segment, 4, static_cast<uint16_t>( segment.size() ) );
+    put16( segment, 6, 0 );
+  }
+  InternetDatagram dgram;
+  dgram.header.proto = proto;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.len = static_cast<uint16_t>( IPv4Header::LENGTH + segment.size() );
+  dgram.header.compute_checksum();
+  InternetChecksum check { dgram.header.pseudo_checksum() };
+  check.add( segment );
+  put16( segment, proto == IPv4Header::PROTO_TCP ? 16 : 6, check.value() );
+  dgram.payload.emplace_back( std::move( segment ) );
+  return dgram;
+}
+
+struct Endpoint
+{
+  uint8_t proto;
+  uint32_t address;
+  uint16_t port;
+};
+
+// Translate copies of `packets`, a few times over; the copies are made outside the timing
+template<typename Translate>
+double measure( const vector<InternetDatagram>& packets, Translate&& translate )
+{
+  duration<double> elapsed {};
+  for ( size_t round = 0; round < ROUNDS; round++ ) {
+    vector<InternetDatagram> work = packets;
+    const auto start = steady_clock::now();
+    for ( auto& dgram : work ) {
+      if ( not translate( dgram ) ) {
+        throw runtime_error( "a datagram was not translated" );
+      }
+    }
+    elapsed += steady_clock::now() - start;
+  }
+  return static_cast<double>( ROUNDS * packets.size() ) / elapsed.count();
+}
+
+void report( string_view what, double per_second, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 2 ) << per_second / 1e6 << " M translations/s ("
+       << setprecision( 1 ) << 1e9 / per_second << " ns each)\n";
+  debug_output << "        " << what << fixed << setprecision( 2 ) << setw( 8 ) << per_second / 1e6
+               << " M translations/s\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  // 100k inside endpoints: hosts in 10.0.0.0/16 with random ports, so that many ports collide
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> host { 0x0a000001, 0x0a00fffe };
+  uniform_int_distribution<uint16_t> port { 1024, UINT16_MAX };
+  vector<Endpoint> endpoints;
+  for ( size_t i = 0; i < MAPPING_COUNT; i++ ) {
+    endpoints.push_back(
+      { i % 2 ? IPv4Header::PROTO_UDP : IPv4Header::PROTO_TCP, host( rd ), static_cast<uint16_t>( port( rd ) ) } );
+  }
+
+  NatTable nat { OUTSIDE };
+  const auto creation_start = steady_clock::now();
+  for ( const Endpoint& endpoint : endpoints ) {
+    InternetDatagram dgram = make_datagram( endpoint.proto, endpoint.address, endpoint.port, SERVER, 443 );
+    nat.translate_outbound( dgram );
+  }
+  const double creation = duration_cast<duration<double>>( steady_clock::now() - creation_start ).count();
+  cout << "NatTable: " << nat.size() << " mappings made in " << fixed << setprecision( 3 ) << creation << " s\n";
+  if ( nat.size() < MAPPING_COUNT * 99 / 100 ) { // the same endpoint may come up twice
+    throw runtime_error( "NatTable did not hold 100k mappings" );
+  }
+
+  // traffic on random mappings, both ways
+  uniform_int_distribution<size_t> any { 0, endpoints.size() - 1 };
+  vector<InternetDatagram> outbound;
+  vector<InternetDatagram> inbound;
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    const Endpoint& endpoint = endpoints[any( rd )];
+    outbound.push_back( make_datagram( endpoint.proto, endpoint.address, endpoint.port, SERVER, 443 ) );
+    const uint16_t outside_port = nat.outside_port( endpoint.proto, endpoint.address, endpoint.port ).value();
+    inbound.push_back( make_datagram( endpoint.proto, SERVER, 443, OUTSIDE, outside_port ) );
+  }
+
+  const double out_rate = measure( outbound, [&]( InternetDatagram& dgram ) {
+    return nat.translate_outbound( dgram );
+  } );
+  report( "outbound", out_rate, debug_output );
+  const double in_rate = measure( inbound, [&]( InternetDatagram& dgram ) {
+    return nat.translate_inbound( dgram );
+  } );
+  report( "inbound ", in_rate, debug_output );
+
+  if ( min( out_rate, in_rate ) < 2e6 ) {
+    throw runtime_error( "NatTable did not meet minimum speed of 2 M translations/s" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
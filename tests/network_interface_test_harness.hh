@@ -151,3 +151,65 @@ struct Tick : public Action<InterfaceAndOutput>
 
   explicit Tick( const size_t ms ) : _ms( ms ) {}
 };
+
+struct SetArpPendingLimits : public Action<InterfaceAndOutput>
+{
+  size_t per_neighbour;
+  size_t total_bytes;
+
+  std::string description() const override
+  {
+    return "limit datagrams waiting for ARP to " + std::to_string( per_neighbour ) + " per neighbour and "
+           + std::to_string( total_bytes ) + " bytes in all";
+  }
+  void execute( InterfaceAndOutput& interface ) const override
+  {
+    interface.first.set_arp_pending_limits( per_neighbour, total_bytes );
+  }
+
+  SetArpPendingLimits( size_t n, size_t bytes ) : per_neighbour( n ), total_bytes( bytes ) {}
+};
+
+struct ArpPendingDatagrams : public ExpectNumber<InterfaceAndOutput, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "arp_pending_datagrams"; }
+  size_t value( const InterfaceAndOutput& interface ) const override
+  {
+    return interface.first.arp_pending_datagrams();
+  }
+};
+
+struct ArpPendingBytes : public ExpectNumber<InterfaceAndOutput, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "arp_pending_bytes"; }
+  size_t value( const InterfaceAndOutput& interface ) const override { return interface.first.arp_pending_bytes(); }
+};
+
+struct ArpPendingDrops : public Expectation<InterfaceAndOutput>
+{
+  NetworkInterface::ArpPendingDrops expected;
+
+  std::string description() const override
+  {
+    return "datagrams dropped waiting for ARP: neighbour_full=" + std::to_string( expected.neighbour_full )
+           + " memory_full=" + std::to_string( expected.memory_full )
+           + " unresolved=" + std::to_string( expected.unresolved );
+  }
+  void execute( const InterfaceAndOutput& interface ) const override
+  {
+    const auto& drops = interface.first.arp_pending_drops();
+    if ( drops.neighbour_full != expected.neighbour_full ) {
+      throw ExpectationViolation { "neighbour_full drops", expected.neighbour_full, drops.neighbour_full };
+    }
+    if ( drops.memory_full != expected.memory_full ) {
+      throw ExpectationViolation { "memory_full drops", expected.memory_full, drops.memory_full };
+    }
+    if ( drops.unresolved != expected.unresolved ) {
+      throw ExpectationViolation { "unresolved drops", expected.unresolved, drops.unresolved };
+    }
+  }
+
+  explicit ArpPendingDrops( const NetworkInterface::ArpPendingDrops& e ) : expected( e ) {}
+};
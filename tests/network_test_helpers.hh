@@ -0,0 +1,177 @@
+#pragma once
+
+#include "address.hh"
+#include "arp_message.hh"
+#include "common.hh"
+#include "ethernet_frame.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "network_interface.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Helpers for the tests that drive a NetworkInterface or a Router directly, rather than step by step through a
+// TestHarness
+
+// The numeric form of a dotted-quad address
+inline uint32_t ip( const std::string& str )
+{
+  return Address { str }.ipv4_numeric();
+}
+
+// A UDP datagram `length` bytes long (header included), with a payload of letters that tell its bytes apart
+inline InternetDatagram make_datagram( uint32_t src,
+                                       uint32_t dst,
+                                       size_t length = 100,
+                                       uint8_t ttl = IPv4Header::DEFAULT_TTL,
+                                       bool df = false )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.ttl = ttl;
+  dgram.header.proto = IPv4Header::PROTO_UDP;
+  dgram.header.df = df;
+  std::string payload;
+  for ( size_t i = IPv4Header::LENGTH; i < length; i++ ) {
+    payload.push_back( static_cast<char>( 'a' + i % 26 ) );
+  }
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.len = static_cast<uint16_t>( length );
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// An ARP message (addresses in numeric form)
+inline ARPMessage make_arp( uint16_t opcode,
+                            const EthernetAddress& sender_ethernet_address,
+                            uint32_t sender_ip_address,
+                            const EthernetAddress& target_ethernet_address,
+                            uint32_t target_ip_address )
+{
+  ARPMessage arp;
+  arp.opcode = opcode;
+  arp.sender_ethernet_address = sender_ethernet_address;
+  arp.sender_ip_address = sender_ip_address;
+  arp.target_ethernet_address = target_ethernet_address;
+  arp.target_ip_address = target_ip_address;
+  return arp;
+}
+
+// The frame that brings `iface` a neighbour's ARP reply, from which it learns the neighbour's Ethernet address
+inline EthernetFrame arp_reply_to( const NetworkInterface& iface,
+                                   const EthernetAddress& neighbour_ethernet_address,
+                                   uint32_t neighbour_ip_address )
+{
+  const ARPMessage reply = make_arp( ARPMessage::OPCODE_REPLY,
+                                     neighbour_ethernet_address,
+                                     neighbour_ip_address,
+                                     iface.ethernet_address(),
+                                     iface.ip_address().ipv4_numeric() );
+  return { { iface.ethernet_address(), neighbour_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( reply ) };
+}
+
+// Keeps (a copy of) every frame an interface sends
+class FramesSent : public NetworkInterface::OutputPort
+{
+public:
+  std::vector<EthernetFrame> frames {};
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    frames.push_back( clone( frame ) );
+  }
+
+  // The datagrams (not ARP messages) among them
+  std::vector<InternetDatagram> datagrams() const
+  {
+    std::vector<InternetDatagram> ret;
+    for ( const auto& frame : frames ) {
+      InternetDatagram dgram;
+      if ( frame.header.type == EthernetHeader::TYPE_IPv4 and parse( dgram, frame.payload ) ) {
+        ret.push_back( std::move( dgram ) );
+      }
+    }
+    return ret;
+  }
+};
+
+// Keeps (a copy of) every frame an interface sends from another thread (a Router's TX worker in parallel mode),
+// for the test to take
+class LockedFramesSent : public NetworkInterface::OutputPort
+{
+public:
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    const std::scoped_lock lock { mutex_ };
+    frames_.push_back( clone( frame ) );
+  }
+
+  // The frames sent since the last call
+  std::vector<EthernetFrame> take()
+  {
+    const std::scoped_lock lock { mutex_ };
+    return std::exchange( frames_, {} );
+  }
+
+private:
+  std::mutex mutex_ {};
+  std::vector<EthernetFrame> frames_ {};
+};
+
+// Counts the frames an interface sends (from any thread), for the benchmarks
+class FramesCounted : public NetworkInterface::OutputPort
+{
+public:
+  std::atomic<size_t> frames {};
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& frame [[maybe_unused]] ) override
+  {
+    frames++;
+  }
+};
+
+// The routers of the router tests and benchmarks: interface N ("ethN") has address 10.0.N.1 and Ethernet address
+// 02:00:00:00:00:N, and leads to a gateway at 10.0.N.2 whose Ethernet address is 02:00:00:00:00:(100 + N)
+inline uint32_t gateway_ip( size_t n )
+{
+  return 0x0a000002 + static_cast<uint32_t>( n << 8U );
+}
+
+inline EthernetAddress ethernet_address( size_t n )
+{
+  return { 0x02, 0, 0, 0, 0, static_cast<uint8_t>( n ) };
+}
+
+inline EthernetAddress gateway_ethernet( size_t n )
+{
+  return ethernet_address( 100 + n );
+}
+
+// Add interface N to `router`, sending its frames to `port`
+inline void add_gateway_interface( Router& router, size_t n, std::shared_ptr<NetworkInterface::OutputPort> port )
+{
+  router.add_interface( std::make_shared<NetworkInterface>( "eth" + std::to_string( n ),
+                                                            std::move( port ),
+                                                            ethernet_address( n ),
+                                                            Address::from_ipv4_numeric( gateway_ip( n ) - 1 ) ) );
+}
+
+// Teach interface N its gateway's Ethernet address, so that forwarding never waits on ARP
+inline void learn_gateway( NetworkInterface& iface, size_t n )
+{
+  iface.recv_frame( arp_reply_to( iface, gateway_ethernet( n ), gateway_ip( n ) ) );
+}
+
+// A datagram arriving on interface N from its gateway
+inline EthernetFrame frame_from_gateway( size_t n, const InternetDatagram& dgram )
+{
+  const EthernetHeader header { ethernet_address( n ), gateway_ethernet( n ), EthernetHeader::TYPE_IPv4 };
+  return clone( { header, serialize( dgram ) } );
+}
@@ -0,0 +1,209 @@
+#include "network_test_helpers.hh"
+#include "packet_classifier.hh"
+#include "random.hh"
+#include "router.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+using Action = AclRule::Action;
+
+// The first rule that matches, the slow way
+size_t reference_match( const vector<AclRule>& rules, const FlowKey& key, bool ports )
+{
+  for ( size_t i = 0; i < rules.size(); i++ ) {
+    if ( rules[i].matches( key, ports ) ) {
+      return i;
+    }
+  }
+  return PacketClassifier::NO_MATCH;
+}
+
+// Random rules over a few prefix lengths, protocols and port ranges (so that some of them overlap), checked
+// against the reference with 5-tuples that fall inside some rule and then have a few bits changed
+void matches_like_a_linear_scan()
+{
+  auto rd = get_random_engine();
+  const vector<uint8_t> lengths { 0, 8, 16, 20, 24, 32 };
+  const vector<optional<uint8_t>> protocols { {}, IPv4Header::PROTO_TCP, IPv4Header::PROTO_UDP };
+  uniform_int_distribution<size_t> pick( 0, 1000000 );
+  uniform_int_distribution<uint32_t> address( 0x0a000000, 0x0a00ffff ); // in 10.0.0.0/16, to make overlaps
+  uniform_int_distribution<uint16_t> port;
+
+  for ( size_t round = 0; round < 20; round++ ) {
+    vector<AclRule> rules;
+    for ( size_t i = 0; i < 200; i++ ) {
+      AclRule rule;
+      rule.action = pick( rd ) % 2 ? Action::Permit : Action::Deny;
+      rule.src_length = lengths[pick( rd ) % lengths.size()];
+      rule.dst_length = lengths[pick( rd ) % lengths.size()];
+      rule.src_prefix = address( rd );
+      rule.dst_prefix = address( rd );
+      rule.proto = protocols[pick( rd ) % protocols.size()];
+      switch ( pick( rd ) % 4 ) {
+        case 0: // one port
+          rule.dst_port_min = rule.dst_port_max = static_cast<uint16_t>( port( rd ) % 1024 );
+          break;
+        case 1: // a range
+          rule.dst_port_min = static_cast<uint16_t>( port( rd ) % 2048 );
+          rule.dst_port_max = static_cast<uint16_t>( rule.dst_port_min + port( rd ) % 3000 );
+          rule.src_port_min = 1024;
+          break;
+        default: // any port
+          break;
+      }
+      rules.push_back( rule );
+    }
+    const PacketClassifier classifier { rules, Action::Deny };
+
+    for ( size_t i = 0; i < 5000; i++ ) {
+      const AclRule& target = rules[pick( rd ) % rules.size()];
+      FlowKey key { target.src_prefix,
+                    target.dst_prefix,
+                    static_cast<uint16_t>( target.src_port_min + port( rd ) % 64 ),
+                    static_cast<uint16_t>( target.dst_port_min + port( rd ) % 64 ),
+                    target.proto.value_or( IPv4Header::PROTO_TCP ) };
+      key.src ^= 1U << ( pick( rd ) % 32 );
+      key.dst ^= pick( rd ) % 2 ? 0 : 1U << ( pick( rd ) % 32 );
+      if ( pick( rd ) % 8 == 0 ) {
+        key.proto = IPv4Header::PROTO_ICMP;
+      }
+      const bool ports = key.proto != IPv4Header::PROTO_ICMP;
+      if ( not ports ) {
+        key.src_port = key.dst_port = 0;
+      }
+      const size_t expected = reference_match( rules, key, ports );
+      const size_t got = classifier.match( key, ports );
+      expect( got == expected,
+              "classifier matched rule " + to_string( got ) + " instead of " + to_string( expected ) + " ("
+                + ( expected == PacketClassifier::NO_MATCH ? "none" : rules[expected].to_string() ) + ")" );
+    }
+  }
+}
+
+// A datagram to `dst_port` (from port 12345), with room after the ports for the rest of a TCP header
+InternetDatagram to_port( uint32_t src, uint32_t dst, uint8_t proto, uint16_t dst_port, uint8_t ttl = 64 )
+{
+  InternetDatagram dgram = make_datagram( src, dst, IPv4Header::LENGTH + 20, ttl );
+  dgram.header.proto = proto;
+  dgram.header.compute_checksum();
+  string& payload = dgram.payload.front().get_mut();
+  payload[0] = 0x30; // source port 12345
+  payload[1] = 0x39;
+  payload[2] = static_cast<char>( dst_port >> 8U );
+  payload[3] = static_cast<char>( dst_port & 0xffU );
+  return dgram;
+}
+
+void classifies_datagrams()
+{
+  AclRule ssh { Action::Deny, 0, 0, ip( "10.0.0.0" ), 24, IPv4Header::PROTO_TCP };
+  ssh.dst_port_min = ssh.dst_port_max = 22;
+  const AclRule lan { Action::Permit, ip( "10.0.0.0" ), 8, ip( "10.0.0.0" ), 8 };
+  const PacketClassifier classifier { { ssh, lan }, Action::Deny };
+  expect( classifier.rules().size() == 2 and classifier.tuple_count() == 2, "unexpected classifier shape" );
+
+  const uint32_t server = ip( "10.0.0.5" );
+  expect( classifier.classify( to_port( ip( "10.1.0.1" ), server, IPv4Header::PROTO_TCP, 22 ) )
+            == Action::Deny,
+          "SSH was not denied" );
+  expect( classifier.classify( to_port( ip( "10.1.0.1" ), server, IPv4Header::PROTO_TCP, 80 ) )
+            == Action::Permit,
+          "HTTP from the LAN was not permitted" );
+  expect( classifier.classify( to_port( ip( "10.1.0.1" ), server, IPv4Header::PROTO_UDP, 22 ) )
+            == Action::Permit,
+          "a rule for TCP matched UDP" );
+  expect( classifier.classify( to_port( ip( "192.168.0.1" ), server, IPv4Header::PROTO_TCP, 80 ) )
+            == Action::Deny,
+          "the default action did not apply" );
+
+  // the first fragment carries the ports; the later ones match no rule about ports
+  InternetDatagram first = to_port( ip( "10.1.0.1" ), server, IPv4Header::PROTO_TCP, 22 );
+  first.header.mf = true;
+  expect( classifier.classify( first ) == Action::Deny, "SSH's first fragment was not denied" );
+  InternetDatagram later = to_port( ip( "10.1.0.1" ), server, IPv4Header::PROTO_TCP, 22 );
+  later.header.offset = 100;
+  expect( classifier.classify( later ) == Action::Permit, "a later fragment matched a rule about ports" );
+
+  expect( PacketClassifier {}.classify( later ) == Action::Permit, "an empty classifier did not permit" );
+  AclRule bad = ssh;
+  bad.dst_port_min = 23;
+  bool threw = false;
+  try {
+    const PacketClassifier invalid { { bad } };
+  } catch ( const exception& ) {
+    threw = true;
+  }
+  expect( threw, "a rule with an empty port range was accepted" );
+}
+
+void router_filters_ingress()
+{
+  Router router;
+  const auto lan = make_shared<FramesSent>();
+  const auto wan = make_shared<FramesSent>();
+  const EthernetAddress lan_ethernet { 2, 0, 0, 0, 0, 1 };
+  const EthernetAddress wan_ethernet { 2, 0, 0, 0, 0, 2 };
+  router.add_interface( make_shared<NetworkInterface>( "lan", lan, lan_ethernet, Address { "10.0.0.1" } ) );
+  router.add_interface( make_shared<NetworkInterface>( "wan", wan, wan_ethernet, Address { "192.0.2.1" } ) );
+  router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+  router.add_route( 0, 0, Address { "192.0.2.254" }, 1 );
+
+  // from the WAN, only HTTP to 10.0.0.80 gets in
+  AclRule http { Action::Permit, 0, 0, ip( "10.0.0.80" ), 32, IPv4Header::PROTO_TCP };
+  http.dst_port_min = http.dst_port_max = 80;
+  router.set_acl( 1, { http }, Action::Deny );
+
+  const auto receive = [&]( size_t interface, const InternetDatagram& dgram ) {
+    router.interface( interface )->datagrams_received().push( clone( dgram ) );
+    router.route();
+  };
+  receive( 1, to_port( ip( "198.51.100.7" ), ip( "10.0.0.80" ), IPv4Header::PROTO_TCP, 80 ) );
+  receive( 1, to_port( ip( "198.51.100.7" ), ip( "10.0.0.80" ), IPv4Header::PROTO_TCP, 22 ) );
+  receive( 1, to_port( ip( "198.51.100.7" ), ip( "10.0.0.81" ), IPv4Header::PROTO_TCP, 80 ) );
+  receive( 1, to_port( ip( "198.51.100.7" ), ip( "10.0.0.82" ), IPv4Header::PROTO_TCP, 80, 1 ) );
+  // ARP requests for the one datagram let in; nothing at all back to the WAN (not even Time Exceeded)
+  expect( lan->frames.size() == 1 and wan->frames.empty() and router.acl_drops() == 3,
+          "the WAN's ACL was not applied: " + to_string( lan->frames.size() ) + " frames to the LAN, "
+            + to_string( router.acl_drops() ) + " dropped" );
+
+  // the LAN has no ACL, and the WAN's can be replaced
+  receive( 0, to_port( ip( "10.0.0.9" ), ip( "203.0.113.1" ), IPv4Header::PROTO_UDP, 53 ) );
+  expect( wan->frames.size() == 1, "the LAN's traffic was filtered" );
+  router.set_acl( 1, {} );
+  receive( 1, to_port( ip( "198.51.100.7" ), ip( "10.0.0.81" ), IPv4Header::PROTO_TCP, 22 ) );
+  expect( lan->frames.size() == 2 and router.acl_drops() == 3, "the WAN's ACL was not replaced" );
+
+  bool threw = false;
+  try {
+    router.set_acl( 2, {} );
+  } catch ( const exception& ) {
+    threw = true;
+  }
+  expect( threw, "an ACL was set for a missing interface" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    matches_like_a_linear_scan();
+    classifies_datagrams();
+    router_filters_ingress();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
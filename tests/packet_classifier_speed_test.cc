@@ -0,0 +1,189 @@
+#include "packet_classifier.hh"
+#include "random.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t RULE_COUNT = 10000;
+constexpr size_t LOOKUP_COUNT = 1000000;
+constexpr size_t SCAN_LOOKUP_COUNT = 2000;
+
+// A synthetic firewall rule set, loosely shaped like ClassBench's "fw" seeds: sources are often wildcards,
+// destinations are servers or subnets inside a few hundred /16s, most rules name TCP or UDP, and
+// destination ports are a well-known port, the ephemeral range, or anything
+vector<AclRule> synthetic_rules( default_random_engine& rd )
+{
+  discrete_distribution<int> src_lengths { { 40, 0, 0, 0, 0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 20, 0, 0, 0, 0, 0,
+                                             0, 0, 20, 0, 0, 0, 0, 0, 0, 0, 10 } };
+  discrete_distribution<int> dst_lengths { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 15, 0, 0, 0, 0, 0,
+                                             0, 0, 35, 0, 0, 0, 0, 0, 0, 0, 45 } };
+  const vector<uint16_t> well_known { 20, 21, 22, 23, 25, 53, 80, 110, 123, 143, 443, 993, 3306, 5432, 8080 };
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<uint32_t> network { 0, 299 };
+  uniform_int_distribution<int> percent { 0, 99 };
+
+  vector<AclRule> rules;
+  for ( size_t i = 0; i < RULE_COUNT; i++ ) {
+    AclRule rule;
+    rule.action = percent( rd ) < 70 ? AclRule::Action::Permit : AclRule::Action::Deny;
+    rule.src_length = static_cast<uint8_t>( src_lengths( rd ) );
+    rule.src_prefix = any_address( rd );
+    rule.dst_length = static_cast<uint8_t>( dst_lengths( rd ) );
+    rule.dst_prefix = 0xac100000 + ( network( rd ) << 16U ) + ( any_address( rd ) & 0xffffU );
+
+    const int proto = percent( rd );
+    rule.proto = proto < 60   ? optional<uint8_t> { IPv4Header::PROTO_TCP }
+                 : proto < 85 ? optional<uint8_t> { IPv4Header::PROTO_UDP }
+                              : nullopt;
+    if ( rule.proto.has_value() ) {
+      const int ports = percent( rd );
+      if ( ports < 50 ) {
+        rule.dst_port_min = rule.dst_port_max = well_known[any_address( rd ) % well_known.size()];
+      } else if ( ports < 65 ) {
+        rule.dst_port_min = 1024;
+      }
+      if ( percent( rd ) < 10 ) {
+        rule.src_port_min = 1024;
+      }
+    }
+    rules.push_back( rule );
+  }
+  return rules;
+}
+
+// Mostly 5-tuples inside some rule (with random host bits and ports in range), and some random ones
+vector<FlowKey> synthetic_traffic( const vector<AclRule>& rules, default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> any;
+  uniform_int_distribution<size_t> any_rule { 0, rules.size() - 1 };
+  const auto inside = []( uint32_t prefix, uint8_t length, uint32_t random ) {
+    const uint32_t mask = length == 0 ? 0 : UINT32_MAX << ( 32U - length );
+    return ( prefix & mask ) | ( random & ~mask );
+  };
+  const auto in_range = []( uint16_t min, uint16_t max, uint32_t random ) {
+    return static_cast<uint16_t>( min + random % ( uint32_t { max } - min + 1 ) );
+  };
+
+  vector<FlowKey> keys;
+  for ( size_t i = 0; i < LOOKUP_COUNT; i++ ) {
+    if ( i % 5 == 0 ) {
+      keys.push_back( { any( rd ),
+                        0xac100000 + any( rd ) % ( 300U << 16U ),
+                        static_cast<uint16_t>( any( rd ) ),
+                        static_cast<uint16_t>( any( rd ) ),
+                        any( rd ) % 2 ? IPv4Header::PROTO_TCP : IPv4Header::PROTO_UDP } );
+      continue;
+    }
+    const AclRule& rule = rules[any_rule( rd )];
+    keys.push_back( { inside( rule.src_prefix, rule.src_length, any( rd ) ),
+                      inside( rule.dst_prefix, rule.dst_length, any( rd ) ),
+                      in_range( rule.src_port_min, rule.src_port_max, any( rd ) ),
+                      in_range( rule.dst_port_min, rule.dst_port_max, any( rd ) ),
+                      rule.proto.value_or( any( rd ) % 2 ? IPv4Header::PROTO_TCP : IPv4Header::PROTO_UDP ) } );
+  }
+  return keys;
+}
+
+// What a router without a classifier would do: try each rule in turn
+size_t linear_match( const vector<AclRule>& rules, const FlowKey& key )
+{
+  for ( size_t i = 0; i < rules.size(); i++ ) {
+    if ( rules[i].matches( key, true ) ) {
+      return i;
+    }
+  }
+  return PacketClassifier::NO_MATCH;
+}
+
+template<typename Match>
+double measure( span<const FlowKey> keys, Match&& match, vector<size_t>& results )
+{
+  results.clear();
+  results.reserve( keys.size() );
+  const auto start = steady_clock::now();
+  for ( const FlowKey& key : keys ) {
+    results.push_back( match( key ) );
+  }
+  const auto stop = steady_clock::now();
+  return static_cast<double>( keys.size() ) / duration_cast<duration<double>>( stop - start ).count();
+}
+
+void report( string_view what, double per_second, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 3 ) << per_second / 1e6 << " M classifications/s ("
+       << setprecision( 1 ) << 1e9 / per_second << " ns each)\n";
+  debug_output << "        " << what << fixed << setprecision( 3 ) << setw( 9 ) << per_second / 1e6
+               << " M classifications/s\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  auto rd = get_random_engine();
+  const vector<AclRule> rules = synthetic_rules( rd );
+  const vector<FlowKey> keys = synthetic_traffic( rules, rd );
+
+  const auto build_start = steady_clock::now();
+  const PacketClassifier classifier { rules, AclRule::Action::Deny };
+  const double build_time = duration_cast<duration<double>>( steady_clock::now() - build_start ).count();
+  cout << "PacketClassifier: " << rules.size() << " rules in " << classifier.tuple_count() << " tuples, built in "
+       << fixed << setprecision( 3 ) << build_time << " s\n";
+
+  // the scan reads much of the rule set for every lookup, so it only gets a few
+  vector<size_t> scan_results;
+  const auto scan_keys = span( keys ).first( SCAN_LOOKUP_COUNT );
+  const double scan_rate
+    = measure( scan_keys, [&]( const FlowKey& key ) { return linear_match( rules, key ); }, scan_results );
+  report( "linear scan     ", scan_rate, debug_output );
+
+  vector<size_t> results;
+  const double rate
+    = measure( keys, [&]( const FlowKey& key ) { return classifier.match( key, true ); }, results );
+  report( "tuple space     ", rate, debug_output );
+
+  size_t matched = 0;
+  for ( size_t i = 0; i < keys.size(); i++ ) {
+    if ( i < scan_results.size() and results[i] != scan_results[i] ) {
+      throw runtime_error( "the classifier and the linear scan disagree on a 5-tuple" );
+    }
+    matched += results[i] != PacketClassifier::NO_MATCH;
+  }
+  cout << "                  " << fixed << setprecision( 1 ) << 100.0 * matched / keys.size()
+       << "% of the 5-tuples matched a rule; " << rate / scan_rate << "x the linear scan\n";
+
+  if ( rate < 500e3 ) {
+    throw runtime_error( "PacketClassifier did not meet minimum speed of 500 K classifications/s" );
+  }
+  if ( rate < 10 * scan_rate ) {
+    throw runtime_error( "PacketClassifier was not much faster than a linear scan" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
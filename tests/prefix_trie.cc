@@ -0,0 +1,209 @@
+#include "prefix_trie.hh"
+#include "random.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+  size_t value;
+};
+
+string prefix_string( uint32_t prefix, uint8_t length )
+{
+  return to_string( prefix >> 24U ) + "." + to_string( ( prefix >> 16U ) & 0xffU ) + "."
+         + to_string( ( prefix >> 8U ) & 0xffU ) + "." + to_string( prefix & 0xffU ) + "/" + to_string( length );
+}
+
+// The longest-prefix match, the slow way
+optional<size_t> reference_lookup( const vector<Route>& routes, uint32_t address )
+{
+  optional<size_t> best;
+  int best_length = -1;
+  for ( const auto& route : routes ) {
+    const uint32_t mask = PrefixTrie<size_t>::mask( route.length );
+    if ( ( address & mask ) == ( route.prefix & mask ) and route.length > best_length ) {
+      best = route.value;
+      best_length = route.length;
+    }
+  }
+  return best;
+}
+
+void check_lookup( const PrefixTrie<size_t>& trie, const vector<Route>& routes, uint32_t address )
+{
+  const size_t* got = trie.lookup( address );
+  const optional<size_t> expected = reference_lookup( routes, address );
+  if ( ( got != nullptr ) != expected.has_value() or ( got and *got != *expected ) ) {
+    throw runtime_error( "lookup of " + prefix_string( address, 32 ) + " returned "
+                         + ( got ? to_string( *got ) : "nothing" ) + " instead of "
+                         + ( expected ? to_string( *expected ) : "nothing" ) );
+  }
+}
+
+void nested_prefixes()
+{
+  PrefixTrie<size_t> trie;
+  vector<Route> routes { { 0, 0, 0 },
+                         { 0x0a000000, 8, 1 },
+                         { 0x0a010000, 16, 2 },
+                         { 0x0a010100, 24, 3 },
+                         { 0x0a010180, 25, 4 },
+                         { 0x0a010181, 32, 5 } };
+  // insert out of order, so branches get split both above and below existing nodes
+  for ( const size_t i : { 3, 5, 0, 1, 4, 2 } ) {
+    if ( not trie.insert( routes[i].prefix, routes[i].length, routes[i].value ) ) {
+      throw runtime_error( "insert of a new prefix reported a duplicate" );
+    }
+  }
+  for ( const uint32_t address :
+        { 0x0b000000U, 0x0a020304U, 0x0a010203U, 0x0a010101U, 0x0a0101ffU, 0x0a010181U } ) {
+    check_lookup( trie, routes, address );
+  }
+
+  // host bits past the length are ignored, and re-inserting replaces the value
+  if ( trie.insert( 0x0a01ffff, 16, 7 ) or trie.size() != routes.size() ) {
+    throw runtime_error( "re-inserting 10.1.0.0/16 should replace its value" );
+  }
+  routes[2].value = 7;
+  check_lookup( trie, routes, 0x0a020304 );
+  check_lookup( trie, routes, 0x0a01ff00 );
+
+  // erasing an inner prefix exposes the one that covers it
+  if ( not trie.erase( 0x0a010100, 24 ) or trie.erase( 0x0a010100, 24 ) or trie.find( 0x0a010100, 24 ) ) {
+    throw runtime_error( "erase of 10.1.1.0/24 misbehaved" );
+  }
+  routes.erase( routes.begin() + 3 );
+  check_lookup( trie, routes, 0x0a010101 );
+  check_lookup( trie, routes, 0x0a010181 );
+
+  // a lookup limited to shorter prefixes finds the route that a longer one refines
+  const size_t* covering = trie.lookup( 0x0a010181, 24 );
+  if ( covering == nullptr or *covering != 7 or *trie.lookup( 0x0a010181, 31 ) != 4
+       or *trie.lookup( 0x0a010181, 0 ) != 0 ) {
+    throw runtime_error( "length-limited lookup of 10.1.1.129 misbehaved" );
+  }
+
+  if ( trie.erase( 0x0a000000, 9 ) or trie.erase( 0x0b000000, 8 ) ) {
+    throw runtime_error( "erase of an absent prefix succeeded" );
+  }
+
+  bool threw = false;
+  try {
+    trie.insert( 0, 33, 0 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  if ( not threw ) {
+    throw runtime_error( "a /33 prefix should be rejected" );
+  }
+}
+
+void random_table()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> any_address;
+  // short prefixes cover a lot of the space, long ones make deep nested chains
+  uniform_int_distribution<int> any_length { 0, 32 };
+
+  PrefixTrie<size_t> trie;
+  vector<Route> routes;
+  for ( size_t i = 0; i < 2000; i++ ) {
+    // cluster the prefixes under a few /8s so that they nest
+    const uint32_t prefix = ( ( any_address( rd ) % 4 ) << 24U ) | ( any_address( rd ) & 0xffffffU );
+    const auto length = static_cast<uint8_t>( any_length( rd ) );
+    const uint32_t masked = prefix & PrefixTrie<size_t>::mask( length );
+    const bool added = trie.insert( prefix, length, i );
+    bool duplicate = false;
+    for ( auto& route : routes ) {
+      if ( route.prefix == masked and route.length == length ) {
+        route.value = i;
+        duplicate = true;
+      }
+    }
+    if ( added == duplicate ) {
+      throw runtime_error( "insert of " + prefix_string( masked, length ) + " got the duplicate check wrong" );
+    }
+    if ( not duplicate ) {
+      routes.push_back( { masked, length, i } );
+    }
+  }
+  if ( trie.size() != routes.size() or trie.node_count() >= 2 * routes.size() ) {
+    throw runtime_error( "trie has " + to_string( trie.size() ) + " prefixes in " + to_string( trie.node_count() )
+                         + " nodes, expected " + to_string( routes.size() ) + " prefixes" );
+  }
+
+  const auto check_all = [&] {
+    vector<uint32_t> addresses;
+    for ( size_t i = 0; i < 5000; i++ ) {
+      // half the probes land inside the clustered /8s
+      const uint32_t address = i % 2 ? any_address( rd ) : any_address( rd ) % 0x04000000U;
+      check_lookup( trie, routes, address );
+      addresses.push_back( address );
+    }
+    // the interleaved batch lookup must agree with one-at-a-time lookups
+    vector<const size_t*> results( addresses.size() );
+    trie.lookup_batch( addresses, results );
+    for ( size_t i = 0; i < addresses.size(); i++ ) {
+      if ( results[i] != trie.lookup( addresses[i] ) ) {
+        throw runtime_error( "lookup_batch disagrees with lookup on " + prefix_string( addresses[i], 32 ) );
+      }
+    }
+    for ( const auto& route : routes ) {
+      const size_t* value = trie.find( route.prefix, route.length );
+      if ( not value or *value != route.value ) {
+        throw runtime_error( "find of " + prefix_string( route.prefix, route.length ) + " failed" );
+      }
+      check_lookup( trie, routes, route.prefix );
+    }
+  };
+  check_all();
+
+  // erase every other route, then put some back
+  vector<Route> kept;
+  for ( size_t i = 0; i < routes.size(); i++ ) {
+    if ( i % 2 ) {
+      if ( not trie.erase( routes[i].prefix, routes[i].length ) ) {
+        throw runtime_error( "erase of " + prefix_string( routes[i].prefix, routes[i].length ) + " failed" );
+      }
+    } else {
+      kept.push_back( routes[i] );
+    }
+  }
+  swap( routes, kept );
+  if ( trie.size() != routes.size() or trie.node_count() >= 2 * routes.size() ) {
+    throw runtime_error( "erased nodes were not cleaned up" );
+  }
+  check_all();
+
+  for ( size_t i = 1; i < kept.size(); i += 4 ) {
+    trie.insert( kept[i].prefix, kept[i].length, kept[i].value );
+    routes.push_back( kept[i] );
+  }
+  check_all();
+}
+} // namespace
+
+int main()
+{
+  try {
+    nested_prefixes();
+    random_table();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
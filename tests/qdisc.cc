@@ -0,0 +1,227 @@
+#include "network_test_helpers.hh"
+#include "qdisc.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// A frame of `size` bytes, with its first byte telling the frames apart
+EthernetFrame make_frame( size_t size, char tag = 0 )
+{
+  EthernetFrame frame;
+  frame.payload.emplace_back( string( size - EthernetHeader::LENGTH, tag ) );
+  return frame;
+}
+
+char tag_of( const EthernetFrame& frame )
+{
+  return frame.payload.front()->front();
+}
+
+void fifo_drops_from_the_tail()
+{
+  FIFOQdisc fifo { 3 };
+  for ( char tag = 0; tag < 5; tag++ ) {
+    fifo.enqueue( make_frame( 100, tag ), 0, 0 );
+  }
+  expect( fifo.packets() == 3 and fifo.bytes() == 300 and fifo.drops() == 2, "FIFO did not hold 3 frames" );
+  for ( char tag = 0; tag < 3; tag++ ) {
+    const auto frame = fifo.dequeue( 0 );
+    expect( frame and tag_of( *frame ) == tag, "FIFO sent frames out of order" );
+  }
+  expect( not fifo.dequeue( 0 ) and fifo.bytes() == 0, "FIFO was not empty" );
+}
+
+// Hold a RED queue at `length` frames for a while, returning the fraction of arrivals dropped
+double red_drop_rate( REDQdisc& red, size_t length, uint64_t& now )
+{
+  const uint64_t drops_before = red.drops();
+  constexpr size_t ARRIVALS = 20000;
+  for ( size_t i = 0; i < ARRIVALS; i++ ) {
+    red.enqueue( make_frame( 100 ), 0, now );
+    while ( red.packets() > length ) {
+      (void)red.dequeue( now );
+    }
+    now++;
+  }
+  return static_cast<double>( red.drops() - drops_before ) / ARRIVALS;
+}
+
+void red_drops_early()
+{
+  REDQdisc red { 100, 5, 15, 0.1 };
+  uint64_t now = 0;
+  expect( red_drop_rate( red, 3, now ) == 0, "RED dropped below the minimum threshold" );
+  const double between = red_drop_rate( red, 10, now );
+  expect( between > 0.01 and between < 0.2, "RED dropped " + to_string( between ) + " between the thresholds" );
+  expect( red.average() > 9 and red.average() < 11, "RED's average did not follow the queue" );
+  expect( red_drop_rate( red, 30, now ) > 0.9, "RED did not drop above the maximum threshold" );
+
+  // the average decays while the queue is idle
+  while ( red.dequeue( now ) ) {}
+  now += 10000;
+  expect( red_drop_rate( red, 3, now ) == 0, "RED's average did not decay while idle" );
+}
+
+void fq_codel_isolates_flows()
+{
+  FQCoDelQdisc fq;
+  for ( size_t i = 0; i < 100; i++ ) {
+    fq.enqueue( make_frame( 1514, 'b' ), 0x10000000, 0 ); // a bulk flow's backlog
+  }
+  (void)fq.dequeue( 0 );
+  fq.enqueue( make_frame( 100, 's' ), 0xf0000000, 0 ); // a new, sparse flow
+  const auto next = fq.dequeue( 0 );
+  expect( next and tag_of( *next ) == 's', "fq_codel did not serve a new flow ahead of a backlogged one" );
+
+  // two backlogged flows share the link by bytes: small frames get through in proportion
+  FQCoDelQdisc shared;
+  for ( size_t i = 0; i < 200; i++ ) {
+    shared.enqueue( make_frame( 1514, 'b' ), 0x10000000, 0 );
+    shared.enqueue( make_frame( 100, 's' ), 0xf0000000, 0 );
+  }
+  size_t small = 0;
+  for ( size_t i = 0; i < 50; i++ ) {
+    small += tag_of( shared.dequeue( 0 ).value() ) == 's';
+  }
+  expect( small > 40, "fq_codel did not share the link fairly between flows" );
+}
+
+void codel_drops_a_standing_queue()
+{
+  // a queue that drains as fast as frames arrive, 20 ms behind: too long a wait for CoDel's 5 ms target
+  FQCoDelQdisc standing;
+  uint64_t now = 0;
+  for ( ; now < 20; now++ ) {
+    standing.enqueue( make_frame( 1514 ), 1, now );
+  }
+  for ( ; now < 1000; now++ ) {
+    standing.enqueue( make_frame( 1514 ), 1, now );
+    (void)standing.dequeue( now );
+  }
+  expect( standing.drops() > 0, "CoDel did not drop from a standing queue" );
+  expect( standing.packets() < 20, "CoDel did not shrink a standing queue" );
+
+  // a short queue (2 ms behind) is left alone
+  FQCoDelQdisc short_queue;
+  for ( now = 0; now < 1000; now++ ) {
+    short_queue.enqueue( make_frame( 1514 ), 1, now );
+    if ( now >= 2 ) {
+      (void)short_queue.dequeue( now );
+    }
+  }
+  expect( short_queue.drops() == 0, "CoDel dropped from a queue below its target" );
+
+  // over the limit, frames are dropped from the largest backlog
+  FQCoDelQdisc limited { 10 };
+  for ( size_t i = 0; i < 10; i++ ) {
+    limited.enqueue( make_frame( 1514 ), 1, 0 );
+  }
+  limited.enqueue( make_frame( 100 ), 2, 0 );
+  expect( limited.drops() > 0 and limited.packets() <= 10, "fq_codel exceeded its limit" );
+  size_t small = 0;
+  while ( const auto frame = limited.dequeue( 0 ) ) {
+    small += Qdisc::frame_size( *frame ) == 100;
+  }
+  expect( small == 1, "fq_codel dropped from the wrong flow" );
+}
+
+// Hold a flow's queue `depth` ms deep for `ms` (one 1514-byte frame arriving each ms), returning when CoDel
+// dropped frames
+vector<uint64_t> hold_queue( FQCoDelQdisc& fq, size_t depth, uint64_t ms, uint64_t& now )
+{
+  vector<uint64_t> drop_times;
+  for ( const uint64_t end = now + ms; now < end; now++ ) {
+    const uint64_t drops_before = fq.drops();
+    fq.enqueue( make_frame( 1514 ), 1, now );
+    while ( fq.packets() > depth ) {
+      (void)fq.dequeue( now );
+    }
+    if ( fq.drops() > drops_before ) {
+      drop_times.push_back( now );
+    }
+  }
+  return drop_times;
+}
+
+void codel_resumes_its_drop_rate()
+{
+  FQCoDelQdisc fq;
+  uint64_t now = 0;
+  const auto first_gap = []( const vector<uint64_t>& drop_times ) {
+    expect( drop_times.size() >= 2, "CoDel did not drop from a standing queue" );
+    return drop_times[1] - drop_times[0];
+  };
+
+  // a standing queue: the drops come closer and closer together
+  const auto first = hold_queue( fq, 20, 1000, now );
+  expect( first_gap( first ) == FQCoDelQdisc::DEFAULT_INTERVAL, "CoDel did not start at one drop an interval" );
+
+  // the queue goes away for a moment, then comes back (well within 16 intervals): CoDel picks up near the rate
+  // it had reached rather than starting over
+  expect( hold_queue( fq, 2, 200, now ).empty(), "CoDel dropped from a short queue" );
+  const auto resumed = hold_queue( fq, 20, 1000, now );
+  expect( first_gap( resumed ) < FQCoDelQdisc::DEFAULT_INTERVAL / 2, "CoDel did not resume its drop rate" );
+
+  // after a long enough break, it does start over
+  expect( hold_queue( fq, 2, 20 * FQCoDelQdisc::DEFAULT_INTERVAL, now ).empty(),
+          "CoDel dropped from a short queue" );
+  expect( first_gap( hold_queue( fq, 20, 1000, now ) ) == FQCoDelQdisc::DEFAULT_INTERVAL,
+          "CoDel resumed an old drop rate" );
+}
+
+void interface_sends_at_the_rate()
+{
+  const auto port = make_shared<FramesSent>();
+  NetworkInterface iface { "eth0", port, { 2, 0, 0, 0, 0, 1 }, Address { "10.0.0.1" } };
+  iface.set_arp_time_scale( 5 ); // as fun_router does: the rate is still in real time
+  const auto datagrams_sent = [&] { return port->datagrams().size(); };
+
+  // the next hop's Ethernet address is known, so datagrams go straight out
+  iface.recv_frame( arp_reply_to( iface, { 2, 0, 0, 0, 0, 2 }, ip( "10.0.0.2" ) ) );
+
+  // 100 bytes a millisecond, in bursts of two full-sized frames (3028 bytes)
+  iface.set_egress_queue( make_unique<FIFOQdisc>( 100 ), 100'000 );
+  for ( size_t i = 0; i < 10; i++ ) {
+    iface.send_datagram( make_datagram( ip( "10.0.0.1" ), ip( "10.9.9.9" ), 1000 ), Address { "10.0.0.2" } );
+  }
+  // each 1014-byte frame goes while there is credit left: three of them at once
+  expect( datagrams_sent() == 3 and iface.egress_queue()->packets() == 7, "the burst was not limited" );
+  iface.tick( 10 ); // 1000 bytes more
+  expect( datagrams_sent() == 4, "the interface did not send at its rate" );
+  iface.tick( 100 ); // more than a burst, which is all that can accumulate
+  expect( datagrams_sent() == 7, "the interface did not limit the burst after an idle period" );
+  iface.tick( 1000 );
+  expect( datagrams_sent() == 10 and iface.egress_queue()->packets() == 0, "the queue did not drain" );
+
+  // while ARP's clock ran 5x faster: 6 s on, the next hop's entry (good for 30 s of ARP time) has expired
+  iface.tick( 6000 - 1110 );
+  iface.send_datagram( make_datagram( ip( "10.0.0.1" ), ip( "10.9.9.9" ) ), Address { "10.0.0.2" } );
+  expect( datagrams_sent() == 10 and port->frames.size() == 11, // an ARP request instead
+          "ARP's timers did not run faster than the queue's" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    fifo_drops_from_the_tail();
+    red_drops_early();
+    fq_codel_isolates_flows();
+    codel_drops_a_standing_queue();
+    codel_resumes_its_drop_rate();
+    interface_sends_at_the_rate();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
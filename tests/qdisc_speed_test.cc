@@ -0,0 +1,199 @@
+#include "arp_message.hh"
+#include "helpers.hh"
+#include "network_interface.hh"
+#include "qdisc.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// Incast: every BURST_PERIOD ms, SENDERS hosts answer at once with BURST_FRAMES full-sized frames each, through
+// one 1 Gbit/s egress link, while a "mouse" host sends one small frame every millisecond.
+constexpr uint64_t LINK_RATE = 125'000'000; // bytes/s
+constexpr size_t SENDERS = 32;
+constexpr size_t BURST_FRAMES = 40;
+constexpr uint64_t BURST_PERIOD = 40; // ms
+constexpr uint64_t DURATION = 5000;   // ms
+constexpr size_t FULL_SIZE = 1500;    // datagram bytes
+constexpr size_t MOUSE_SIZE = 100;
+constexpr uint32_t MOUSE = 0x0a030001; // whose flow shares no fq_codel bucket with the senders' flows
+
+const Address LOCAL_IP { "10.0.0.1" };
+const Address NEXT_HOP { "10.0.0.2" };
+
+// Records when each datagram leaves (the sending time travels in the IPv4 id field)
+class DelayPort : public NetworkInterface::OutputPort
+{
+public:
+  explicit DelayPort( const uint64_t& now ) : now_( now ) {}
+
+  void transmit( const NetworkInterface&, const EthernetFrame& frame ) override
+  {
+    if ( frame.header.type != EthernetHeader::TYPE_IPv4 ) {
+      return;
+    }
+    const string& header = frame.payload.front().get();
+    const auto field = [&]( size_t offset, size_t length ) {
+      uint32_t value = 0;
+      for ( size_t i = offset; i < offset + length; i++ ) {
+        value = value << 8U | static_cast<uint8_t>( header[i] );
+      }
+      return value;
+    };
+    const uint64_t delay = static_cast<uint16_t>( now_ - field( 4, 2 ) ); // the id
+    const uint32_t src = field( 12, 4 );
+    ( src == MOUSE ? mouse_delays : delays ).push_back( delay );
+    bytes += Qdisc::frame_size( frame );
+  }
+
+  vector<uint64_t> delays {};
+  vector<uint64_t> mouse_delays {};
+  uint64_t bytes {};
+
+private:
+  const uint64_t& now_;
+};
+
+InternetDatagram make_datagram( uint32_t src, size_t size, uint64_t now )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = 0xc0a80001;
+  dgram.header.proto = IPv4Header::PROTO_UDP;
+  dgram.header.id = static_cast<uint16_t>( now );
+  dgram.header.len = static_cast<uint16_t>( size );
+  dgram.payload.emplace_back( string( size - IPv4Header::LENGTH, 'x' ) );
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+struct Result
+{
+  double utilisation; // of the link, over the whole simulation
+  double delivered;   // fraction of the offered frames
+  double mean_delay;  // ms, of the bursts' frames
+  double p99_delay;   // ms, of the bursts' frames
+  double mouse_p99;   // ms
+  double ns_per_frame; // of wall-clock time, for the whole simulation
+};
+
+double percentile( vector<uint64_t>& delays, double p )
+{
+  if ( delays.empty() ) {
+    return 0;
+  }
+  const auto nth = delays.begin() + static_cast<ptrdiff_t>( p * static_cast<double>( delays.size() - 1 ) );
+  ranges::nth_element( delays, nth );
+  return static_cast<double>( *nth );
+}
+
+Result simulate( unique_ptr<Qdisc> qdisc )
+{
+  uint64_t now = 0;
+  const auto port = make_shared<DelayPort>( now );
+  const EthernetAddress local { 2, 0, 0, 0, 0, 1 };
+  NetworkInterface iface { "eth0", port, local, LOCAL_IP };
+
+  ARPMessage reply;
+  reply.opcode = ARPMessage::OPCODE_REPLY;
+  reply.sender_ethernet_address = { 2, 0, 0, 0, 0, 2 };
+  reply.sender_ip_address = NEXT_HOP.ipv4_numeric();
+  reply.target_ethernet_address = local;
+  reply.target_ip_address = LOCAL_IP.ipv4_numeric();
+  iface.recv_frame( { { local, reply.sender_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( reply ) } );
+  iface.set_egress_queue( move( qdisc ), LINK_RATE );
+
+  size_t offered = 0;
+  const auto start = steady_clock::now();
+  for ( ; now < DURATION; now++ ) {
+    if ( now % BURST_PERIOD == 0 ) {
+      for ( size_t frame = 0; frame < BURST_FRAMES; frame++ ) {
+        for ( size_t sender = 0; sender < SENDERS; sender++ ) {
+          iface.send_datagram( make_datagram( 0x0a020000 + static_cast<uint32_t>( sender ), FULL_SIZE, now ),
+                               NEXT_HOP );
+          offered++;
+        }
+      }
+    }
+    iface.send_datagram( make_datagram( MOUSE, MOUSE_SIZE, now ), NEXT_HOP );
+    offered++;
+    iface.tick( 1 );
+  }
+  const auto stop = steady_clock::now();
+
+  Result result {};
+  const size_t delivered = port->delays.size() + port->mouse_delays.size();
+  result.utilisation = static_cast<double>( port->bytes ) / ( LINK_RATE / 1000.0 * DURATION );
+  result.delivered = static_cast<double>( delivered ) / static_cast<double>( offered );
+  for ( const auto delay : port->delays ) {
+    result.mean_delay += static_cast<double>( delay );
+  }
+  result.mean_delay /= static_cast<double>( max<size_t>( port->delays.size(), 1 ) );
+  result.p99_delay = percentile( port->delays, 0.99 );
+  result.mouse_p99 = percentile( port->mouse_delays, 0.99 );
+  result.ns_per_frame
+    = duration_cast<duration<double, nano>>( stop - start ).count() / static_cast<double>( offered );
+  return result;
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const vector<pair<string_view, function<unique_ptr<Qdisc>()>>> disciplines {
+    { "FIFO    ", [] { return make_unique<FIFOQdisc>( 1000 ); } },
+    { "RED     ", [] { return make_unique<REDQdisc>( 1000, 100, 500 ); } },
+    { "fq_codel", [] { return make_unique<FQCoDelQdisc>(); } },
+  };
+
+  vector<Result> results;
+  for ( const auto& [name, make] : disciplines ) {
+    const Result r = simulate( make() );
+    results.push_back( r );
+    cout << "Incast through " << name << ": " << fixed << setprecision( 1 ) << setw( 5 ) << r.utilisation * 100
+         << "% link use, " << setw( 5 ) << r.delivered * 100 << "% delivered, delay mean " << setw( 5 )
+         << r.mean_delay << " ms p99 " << setw( 5 ) << r.p99_delay << " ms, mouse p99 " << setw( 5 ) << r.mouse_p99
+         << " ms (" << setprecision( 0 ) << r.ns_per_frame << " ns/frame)\n";
+    debug_output << "        Incast " << name << fixed << setprecision( 1 ) << " mouse p99 " << setw( 5 )
+                 << r.mouse_p99 << " ms, " << setprecision( 0 ) << setw( 5 ) << r.ns_per_frame << " ns/frame\n";
+  }
+
+  const Result& fifo = results.front();
+  const Result& fq_codel = results.back();
+  if ( fq_codel.mouse_p99 > 2 or fq_codel.mouse_p99 >= fifo.mouse_p99 ) {
+    throw runtime_error( "fq_codel did not keep the mouse flow's delay low" );
+  }
+  for ( const auto& r : results ) {
+    if ( r.ns_per_frame > 20000 ) {
+      throw runtime_error( "queueing did not meet minimum speed of 50 K frames/s" );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
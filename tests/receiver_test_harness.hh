@@ -72,6 +72,13 @@ struct ExpectAckno : public ExpectNumber<TCPReceiver, std::optional<Wrap32>>
   std::optional<Wrap32> value( const TCPReceiver& rs ) const override { return rs.send().ackno; }
 };
 
+struct ExpectTsecr : public ExpectNumber<TCPReceiver, std::optional<uint32_t>>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "tsecr"; }
+  std::optional<uint32_t> value( const TCPReceiver& rs ) const override { return rs.send().tsecr; }
+};
+
 struct ExpectReset : public ExpectBool<TCPReceiver>
 {
   using ExpectBool::ExpectBool;
@@ -152,6 +159,12 @@ struct SegmentArrives : public Action<TCPReceiver>
     return *this;
   }
 
+  SegmentArrives& with_tsval( uint32_t tsval )
+  {
+    msg_.tsval = tsval;
+    return *this;
+  }
+
   SegmentArrives& without_ackno()
   {
     ackno_expected_ = HasAckno { false };
@@ -0,0 +1,84 @@
+#include "byte_stream_test_harness.hh"
+#include "random.hh"
+#include "receiver_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "TSecr echoes the latest in-order TSval", 4000 };
+      test.execute( ExpectTsecr { nullopt } );
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ).with_tsval( 100 ) );
+      test.execute( ExpectTsecr { 100 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abc" ).with_tsval( 110 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 4 } } );
+      test.execute( ExpectTsecr { 110 } );
+    }
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "out-of-order segment doesn't update TS.Recent", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ).with_tsval( 10 ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ).with_tsval( 30 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 1 } } );
+      test.execute( ExpectTsecr { 10 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ).with_tsval( 40 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ExpectTsecr { 40 } );
+      test.execute( ReadAll { "abcdefgh" } );
+    }
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "PAWS rejects an old duplicate", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ).with_tsval( 1000 ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ).with_tsval( 2000 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 5 } } );
+      // same sequence numbers as the next expected data, but from an earlier trip around the sequence space
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "WXYZ" ).with_tsval( 1500 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 5 } } );
+      test.execute( ExpectTsecr { 2000 } );
+      test.execute( BytesPushed { 4 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ).with_tsval( 2100 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ReadAll { "abcdefgh" } );
+    }
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "PAWS compares timestamps modulo 2^32", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ).with_tsval( UINT32_MAX - 5 ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abc" ).with_tsval( 4 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 4 } } );
+      test.execute( ExpectTsecr { 4 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 4 ).with_data( "def" ).with_tsval( UINT32_MAX ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 4 } } );
+      test.execute( ReadAll { "abc" } );
+    }
+
+    {
+      const uint32_t isn = uniform_int_distribution<uint32_t> { 0, UINT32_MAX }( rd );
+      TCPReceiverTestHarness test { "segments without timestamps are unaffected", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( ExpectTsecr { nullopt } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abc" ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 4 } } );
+      test.execute( ExpectTsecr { nullopt } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
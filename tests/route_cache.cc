@@ -0,0 +1,81 @@
+#include "route_cache.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+void expect( RouteCache& cache, uint32_t address, optional<uint32_t> expected, const string& what )
+{
+  const optional<uint32_t> got = cache.find( address );
+  if ( got != expected ) {
+    throw runtime_error( what + ": expected " + ( expected ? to_string( *expected ) : "a miss" ) + ", got "
+                         + ( got ? to_string( *got ) : "a miss" ) );
+  }
+}
+
+void hits_and_invalidation()
+{
+  RouteCache cache { 64 };
+  expect( cache, 0x0a000001, {}, "empty cache" );
+  cache.insert( 0x0a000001, 7 );
+  cache.insert( 0x0a000002, 8 );
+  expect( cache, 0x0a000001, 7, "first entry" );
+  expect( cache, 0x0a000002, 8, "second entry" );
+  cache.insert( 0x0a000001, 9 );
+  expect( cache, 0x0a000001, 9, "replaced entry" );
+
+  if ( cache.hits() != 3 or cache.misses() != 1 or cache.hit_rate() != 0.75 ) {
+    throw runtime_error( "hit/miss counters are wrong" );
+  }
+
+  cache.invalidate();
+  expect( cache, 0x0a000001, {}, "after invalidate" );
+  expect( cache, 0x0a000002, {}, "after invalidate" );
+  cache.insert( 0x0a000002, 10 );
+  expect( cache, 0x0a000002, 10, "refilled after invalidate" );
+}
+
+void least_recently_used_way_is_evicted()
+{
+  // with one set, every address competes for the same two ways
+  RouteCache cache { 1 };
+  cache.insert( 1, 1 );
+  cache.insert( 2, 2 );
+  expect( cache, 1, 1, "way 0" ); // 1 is now the more recently used
+  cache.insert( 3, 3 );            // so 2 is evicted
+  expect( cache, 1, 1, "kept entry" );
+  expect( cache, 3, 3, "new entry" );
+  expect( cache, 2, {}, "evicted entry" );
+}
+
+void disabled_cache()
+{
+  RouteCache cache;
+  cache.insert( 1, 1 );
+  expect( cache, 1, {}, "disabled cache" );
+  if ( cache.capacity() != 0 ) {
+    throw runtime_error( "disabled cache has capacity" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    hits_and_invalidation();
+    least_recently_used_way_is_evicted();
+    disabled_cache();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
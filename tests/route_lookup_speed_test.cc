@@ -0,0 +1,238 @@
+#include "dir24_8_table.hh"
+#include "prefix_trie.hh"
+#include "random.hh"
+#include "small_route_table.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t TABLE_SIZE = 1000000;
+constexpr size_t LOOKUP_COUNT = 1000000;
+constexpr size_t SCAN_LOOKUP_COUNT = 50;
+
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+};
+
+// A synthetic table shaped like the IPv4 BGP table: mostly /24s, then /22-/23 and /16-/21, a handful of
+// short prefixes, and some more-specifics past /24, all in unicast space (1.0.0.0 - 223.255.255.255)
+vector<Route> synthetic_table( default_random_engine& rd )
+{
+  discrete_distribution<int> lengths { {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 4, 6, 10, 12, // /0 - /15
+    80, 30, 50, 100, 150, 200, 500, 500, 5800,        // /16 - /24
+    5, 5, 5, 5, 5, 5, 5, 10,                          // /25 - /32
+  } };
+  uniform_int_distribution<uint32_t> unicast { 0x01000000, 0xdfffffff };
+
+  vector<Route> table;
+  table.reserve( TABLE_SIZE );
+  for ( size_t i = 0; i < TABLE_SIZE; i++ ) {
+    const auto length = static_cast<uint8_t>( lengths( rd ) );
+    table.push_back( { unicast( rd ) & PrefixTrie<size_t>::mask( length ), length } );
+  }
+  return table;
+}
+
+void report( string_view what, double per_second, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 2 ) << per_second / 1e6 << " M lookups/s (" << setprecision( 1 )
+       << 1e9 / per_second << " ns each)\n";
+  debug_output << "        " << what << fixed << setprecision( 2 ) << setw( 8 ) << per_second / 1e6
+               << " M lookups/s\n";
+}
+
+template<typename Lookup>
+double measure( span<const uint32_t> destinations, Lookup&& lookup, size_t& found )
+{
+  const auto start = steady_clock::now();
+  for ( const uint32_t dst : destinations ) {
+    found += lookup( dst );
+  }
+  const auto stop = steady_clock::now();
+  return static_cast<double>( destinations.size() ) / duration_cast<duration<double>>( stop - start ).count();
+}
+
+// What Router::route() used to do: check every route, keep the longest match
+bool linear_lookup( const vector<Route>& table, uint32_t dst )
+{
+  const Route* best = nullptr;
+  for ( const auto& route : table ) {
+    const uint32_t mask = PrefixTrie<size_t>::mask( route.length );
+    if ( ( dst & mask ) == route.prefix and ( best == nullptr or best->length < route.length ) ) {
+      best = &route;
+    }
+  }
+  return best != nullptr;
+}
+
+double seconds_since( steady_clock::time_point start )
+{
+  return duration_cast<duration<double>>( steady_clock::now() - start ).count();
+}
+
+// An edge router's table: a default route plus a few dozen prefixes inside 10.0.0.0/8
+double small_tables( default_random_engine& rd, fstream& debug_output )
+{
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<int> any_length { 9, 30 };
+  vector<uint32_t> destinations;
+  for ( size_t i = 0; i < LOOKUP_COUNT; i++ ) {
+    destinations.push_back( i % 8 ? 0x0a000000 | ( any_address( rd ) & 0xffffffU ) : any_address( rd ) );
+  }
+
+  double slowest = numeric_limits<double>::max();
+  for ( const size_t count : { size_t { 16 }, SmallRouteTable::CAPACITY } ) {
+    vector<Route> routes { { 0, 0 } };
+    while ( routes.size() < count ) {
+      const auto length = static_cast<uint8_t>( any_length( rd ) );
+      const uint32_t address = 0x0a000000 | ( any_address( rd ) & 0xffffffU );
+      routes.push_back( { address & PrefixTrie<size_t>::mask( length ), length } );
+    }
+    SmallRouteTable small;
+    PrefixTrie<size_t> trie;
+    for ( size_t i = 0; i < routes.size(); i++ ) {
+      small.insert( routes[i].prefix, routes[i].length, static_cast<uint32_t>( i ) );
+      trie.insert( routes[i].prefix, routes[i].length, i );
+    }
+
+    const string size = to_string( count ) + " routes";
+    const auto scan_lookup = [&]( uint32_t dst ) { return linear_lookup( routes, dst ); };
+    const auto trie_lookup = [&]( uint32_t dst ) { return trie.lookup( dst ) != nullptr; };
+    size_t scan_found = 0;
+    report( "linear scan     " + size, measure( destinations, scan_lookup, scan_found ), debug_output );
+    size_t trie_found = 0;
+    report( "PrefixTrie      " + size, measure( destinations, trie_lookup, trie_found ), debug_output );
+    if ( scan_found != destinations.size() or trie_found != destinations.size() ) {
+      throw runtime_error( "lookups missed destinations covered by the default route" );
+    }
+
+    for ( const auto kernel :
+          { SmallRouteTable::Kernel::Scalar, SmallRouteTable::Kernel::SSE41, SmallRouteTable::Kernel::AVX2 } ) {
+      if ( not SmallRouteTable::supported( kernel ) ) {
+        continue;
+      }
+      const auto small_lookup = [&]( uint32_t dst ) { return small.lookup( kernel, dst ).has_value(); };
+      size_t small_found = 0;
+      const double rate = measure( destinations, small_lookup, small_found );
+      string name { SmallRouteTable::name( kernel ) };
+      name.resize( 6, ' ' );
+      report( "SmallRouteTable " + name + " " + size, rate, debug_output );
+      if ( small_found != destinations.size() ) {
+        throw runtime_error( "SmallRouteTable missed destinations covered by the default route" );
+      }
+      slowest = min( slowest, rate );
+    }
+  }
+  return slowest;
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  auto rd = get_random_engine();
+  const vector<Route> table = synthetic_table( rd );
+
+  PrefixTrie<size_t> trie;
+  auto build_start = steady_clock::now();
+  for ( size_t i = 0; i < table.size(); i++ ) {
+    trie.insert( table[i].prefix, table[i].length, i );
+  }
+  cout << "PrefixTrie: " << trie.size() << " distinct prefixes in " << trie.node_count() << " nodes, built in "
+       << fixed << setprecision( 2 ) << seconds_since( build_start ) << " s\n";
+
+  DIR24_8Table dir;
+  build_start = steady_clock::now();
+  for ( size_t i = 0; i < table.size(); i++ ) {
+    dir.insert( table[i].prefix, table[i].length, static_cast<uint32_t>( i ) );
+  }
+  cout << "DIR24_8Table: " << dir.group_count() << " second-level groups, built in " << fixed << setprecision( 2 )
+       << seconds_since( build_start ) << " s\n";
+
+  // Destinations spread uniformly over the address space, and destinations inside announced prefixes
+  // (what a router mostly forwards: traffic towards hosts that exist)
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<size_t> any_route { 0, table.size() - 1 };
+  vector<uint32_t> uniform_destinations;
+  vector<uint32_t> routed_destinations;
+  for ( size_t i = 0; i < LOOKUP_COUNT; i++ ) {
+    uniform_destinations.push_back( any_address( rd ) );
+    const Route& route = table[any_route( rd )];
+    const uint32_t host_bits = any_address( rd ) & ~PrefixTrie<size_t>::mask( route.length );
+    routed_destinations.push_back( route.prefix | host_bits );
+  }
+
+  const auto trie_lookup = [&]( uint32_t dst ) { return trie.lookup( dst ) != nullptr; };
+  const auto dir_lookup = [&]( uint32_t dst ) { return dir.lookup( dst ).has_value(); };
+  const auto scan_lookup = [&]( uint32_t dst ) { return linear_lookup( table, dst ); };
+
+  double slowest = numeric_limits<double>::max();
+  for ( const auto& [name, destinations] : { pair { "uniform", &uniform_destinations },
+                                             pair { "routed ", &routed_destinations } } ) {
+    // the scan reads the whole table for every lookup, so it only gets a few
+    const auto scan_destinations = span( *destinations ).first( SCAN_LOOKUP_COUNT );
+    size_t scan_found = 0;
+    const double scan_rate = measure( scan_destinations, scan_lookup, scan_found );
+    report( "linear scan  "s + name + " destinations", scan_rate, debug_output );
+    size_t expected = 0;
+    measure( scan_destinations, trie_lookup, expected );
+    if ( scan_found != expected ) {
+      throw runtime_error( "linear scan and PrefixTrie disagree on "s + name + " destinations" );
+    }
+
+    size_t trie_found = 0;
+    const double trie_rate = measure( *destinations, trie_lookup, trie_found );
+    report( "PrefixTrie   "s + name + " destinations", trie_rate, debug_output );
+
+    size_t dir_found = 0;
+    const double dir_rate = measure( *destinations, dir_lookup, dir_found );
+    report( "DIR24_8Table "s + name + " destinations", dir_rate, debug_output );
+
+    if ( trie_found != dir_found ) {
+      throw runtime_error( "PrefixTrie and DIR24_8Table disagree on "s + name + " destinations" );
+    }
+    if ( destinations == &routed_destinations and dir_found != routed_destinations.size() ) {
+      throw runtime_error( "DIR24_8Table missed destinations inside announced prefixes" );
+    }
+    slowest = min( { slowest, trie_rate, dir_rate } );
+  }
+
+  slowest = min( slowest, small_tables( rd, debug_output ) );
+
+  if ( slowest < 2e5 ) {
+    throw runtime_error( "route lookups did not meet minimum speed of 200 K lookups/s" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
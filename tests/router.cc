@@ -1,4 +1,6 @@
 #include "router.hh"
+#include "arp_message.hh"
+#include "icmp_message.hh"
 #include "network_interface_test_harness.hh"
 
 #include <algorithm>
@@ -339,10 +341,17 @@ void network_simulator()
 
   cout << green << "\n\nTesting TTL expiration..." << normal << "\n\n";
   {
+    // the router drops the datagram, and tells the sender with an ICMP Time Exceeded from its eth0 address
+    const auto time_exceeded = [&]( const InternetDatagram& dgram ) {
+      return ICMPMessage::error( ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED, dgram )
+        .to_datagram( ip( "10.0.0.1" ), network.host( "applesauce" ).address().ipv4_numeric() );
+    };
     auto dgram_sent = network.host( "applesauce" ).send_to( Address { "1.2.3.4" }, 1 );
+    network.host( "applesauce" ).expect( time_exceeded( dgram_sent ) );
     network.simulate();
 
     dgram_sent = network.host( "applesauce" ).send_to( Address { "1.2.3.4" }, 0 );
+    network.host( "applesauce" ).expect( time_exceeded( dgram_sent ) );
     network.simulate();
   }
 
@@ -397,6 +406,13 @@ void network_simulator()
 
     router.route();
 
+    // the datagram is dropped, and the router asks for the sender's Ethernet address to send it an ICMP
+    // Net Unreachable
+    ARPMessage arp;
+    if ( not parse( arp, frames2->expect_frame().payload ) or arp.opcode != ARPMessage::OPCODE_REQUEST
+         or arp.target_ip_address != ip( "192.168.0.2" ) ) {
+      throw runtime_error( "router did not resolve the sender to tell it there is no route" );
+    }
     if ( ( !frames0->frames.empty() ) or ( !frames1->frames.empty() ) or ( !frames2->frames.empty() ) ) {
       throw runtime_error(
         "router sent an unexpected frame (datagram should have been dropped because there is no matching route)" );
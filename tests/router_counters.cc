@@ -0,0 +1,132 @@
+#include "counter_block.hh"
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+const uint32_t HOST = ip( "10.0.0.2" );
+
+// A reader sees each counter grow, never go back, and end up with every increment
+void counter_block_is_read_while_written()
+{
+  CounterBlock block;
+  constexpr uint64_t INCREMENTS = 200000;
+  atomic<bool> done { false };
+  bool monotonic = true;
+  thread reader { [&] {
+    uint64_t last = 0;
+    while ( not done.load() ) {
+      const uint64_t now = block.get( 5000 ); // in the second chunk
+      monotonic = monotonic and now >= last;
+      last = now;
+    }
+  } };
+  for ( uint64_t i = 0; i < INCREMENTS; i++ ) {
+    block.add( 5000 );
+    block.add( 7, 2 );
+  }
+  done = true;
+  reader.join();
+  expect( monotonic, "a counter went backwards" );
+  expect( block.get( 5000 ) == INCREMENTS and block.get( 7 ) == 2 * INCREMENTS and block.get( 8 ) == 0,
+          "counters lost increments" );
+  expect( block.get( CounterBlock::CAPACITY ) == 0, "a counter out of range was not 0" );
+}
+
+void router_counts_traffic()
+{
+  Router router;
+  const auto lan = make_shared<FramesSent>();
+  const auto wan = make_shared<FramesSent>();
+  const EthernetAddress lan_ethernet { 2, 0, 0, 0, 0, 1 };
+  const EthernetAddress wan_ethernet { 2, 0, 0, 0, 0, 2 };
+  router.add_interface( make_shared<NetworkInterface>( "lan", lan, lan_ethernet, Address { "10.0.0.1" } ) );
+  router.add_interface( make_shared<NetworkInterface>( "wan", wan, wan_ethernet, Address { "192.0.2.1" } ) );
+  router.interface( 1 )->set_mtu( 1000 );
+  router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+  router.add_route( ip( "198.51.100.0" ), 24, Address { "192.0.2.254" }, 1 );
+  router.add_route( ip( "203.0.113.0" ), 24, Address { "192.0.2.254" }, 1 );
+  AclRule deny { AclRule::Action::Deny, 0, 0, ip( "203.0.113.66" ), 32 };
+  router.set_acl( 0, { deny } );
+
+  const auto receive = [&]( const InternetDatagram& dgram ) {
+    router.interface( 0 )->datagrams_received().push( clone( dgram ) );
+    router.route();
+  };
+  for ( size_t i = 0; i < 3; i++ ) {
+    receive( make_datagram( HOST, ip( "198.51.100.7" ), 100 ) );
+  }
+  receive( make_datagram( HOST, ip( "203.0.113.1" ), 500 ) );
+  receive( make_datagram( HOST, ip( "203.0.113.66" ), 100 ) );            // denied
+  receive( make_datagram( HOST, ip( "198.51.100.7" ), 100, 1 ) );         // TTL runs out: Time Exceeded
+  receive( make_datagram( HOST, ip( "8.8.8.8" ), 100 ) );                 // no route: Net Unreachable
+  receive( make_datagram( HOST, ip( "198.51.100.7" ), 1200, 64, true ) ); // too big: Fragmentation Needed
+
+  const Router::InterfaceStats in = router.interface_stats( 0 );
+  const Router::InterfaceStats out = router.interface_stats( 1 );
+  expect( in.rx_packets == 8 and in.rx_bytes == 2300, "the LAN's arrivals were not counted" );
+  expect( in.acl_drops == 1 and in.ttl_drops == 1 and in.no_route_drops == 1 and in.mtu_drops == 1
+            and in.ring_drops == 0,
+          "the LAN's drops were not counted by reason" );
+  expect( out.tx_packets == 4 and out.tx_bytes == 800 and out.rx_packets == 0, "the WAN's traffic was wrong" );
+  expect( in.tx_packets == 3 and router.acl_drops() == 1, "the ICMP errors sent back were not counted" );
+
+  const auto hits = [&]( const string& prefix ) {
+    for ( const auto& route : router.route_stats() ) {
+      if ( route.route_prefix == ip( prefix ) and route.prefix_length == 24 ) {
+        return pair { route.packets, route.bytes };
+      }
+    }
+    throw runtime_error( "no statistics for route " + prefix );
+  };
+  expect( hits( "198.51.100.0" ) == pair<uint64_t, uint64_t> { 3, 300 }, "route hits were not counted" );
+  expect( hits( "203.0.113.0" ) == pair<uint64_t, uint64_t> { 1, 500 }, "route hits were not counted" );
+  expect( hits( "10.0.0.0" ).first == 0, "ICMP errors were counted as route hits" );
+
+  // a new route in a removed route's place starts from zero
+  expect( router.remove_route( ip( "198.51.100.0" ), 24 ), "the route was not removed" );
+  router.add_route( ip( "100.64.0.0" ), 24, Address { "192.0.2.254" }, 1 );
+  expect( router.route_stats().size() == 3, "a removed route still has statistics" );
+  receive( make_datagram( HOST, ip( "100.64.0.9" ), 100 ) );
+  const auto reused = hits( "100.64.0.0" );
+  expect( reused.first == 1 and reused.second == 100, "a new route inherited a removed route's counts" );
+
+  ostringstream metrics;
+  router.write_metrics( metrics );
+  const string text = metrics.str();
+  for ( const string line : { "# TYPE router_rx_packets_total counter\n",
+                              "router_rx_packets_total{interface=\"lan\"} 9\n",
+                              "router_tx_bytes_total{interface=\"wan\"} 900\n",
+                              "router_drops_total{interface=\"lan\",reason=\"acl\"} 1\n",
+                              "router_route_packets_total{prefix=\"203.0.113.0/24\"} 1\n",
+                              "router_route_bytes_total{prefix=\"100.64.0.0/24\"} 100\n" } ) {
+    expect( text.find( line ) != string::npos, "metrics did not include: " + line + "in:\n" + text );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    counter_block_is_read_while_written();
+    router_counts_traffic();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+#include "counter_block.hh"
+#include "random.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t ROUTE_COUNT = 300000;
+constexpr size_t PACKET_COUNT = 5000000;
+constexpr size_t INTERFACE_COUNT = 4;
+constexpr size_t INTERFACE_COUNTERS = 10; // as in Router
+constexpr size_t ROUTE_COUNTERS = 3;
+
+struct Packet
+{
+  uint32_t route;
+  uint16_t bytes;
+  uint8_t ingress;
+  uint8_t egress;
+};
+
+// Packets over uniformly chosen routes, or over a few popular ones and a long tail
+vector<Packet> make_packets( bool zipf, default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> uniform { 0, ROUTE_COUNT - 1 };
+  uniform_int_distribution<uint16_t> bytes { 64, 1500 };
+  uniform_int_distribution<unsigned> interface { 0, INTERFACE_COUNT - 1 };
+  vector<double> weights( ROUTE_COUNT );
+  for ( size_t i = 0; i < ROUTE_COUNT; i++ ) {
+    weights[i] = 1.0 / static_cast<double>( i + 1 );
+  }
+  discrete_distribution<uint32_t> popular { weights.begin(), weights.end() };
+
+  vector<Packet> packets;
+  packets.reserve( PACKET_COUNT );
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    packets.push_back( { zipf ? popular( rd ) : uniform( rd ),
+                         bytes( rd ),
+                         static_cast<uint8_t>( interface( rd ) ),
+                         static_cast<uint8_t>( interface( rd ) ) } );
+  }
+  return packets;
+}
+
+// What Router counts for each packet it forwards: arrival and departure (packets and bytes on each
+// interface), and the route's hits (checking that the slot still belongs to the route)
+template<typename Counters>
+double measure( const vector<Packet>& packets, Counters& interfaces, Counters& routes )
+{
+  const auto start = steady_clock::now();
+  for ( const Packet& packet : packets ) {
+    interfaces.add( packet.ingress * INTERFACE_COUNTERS + 0, 1 );
+    interfaces.add( packet.ingress * INTERFACE_COUNTERS + 1, packet.bytes );
+    const size_t slot = size_t { packet.route } * ROUTE_COUNTERS;
+    if ( routes.get( slot ) != packet.route + 1 ) {
+      routes.set( slot + 1, 0 );
+      routes.set( slot + 2, 0 );
+      routes.set( slot, packet.route + 1 );
+    }
+    routes.add( slot + 1, 1 );
+    routes.add( slot + 2, packet.bytes );
+    interfaces.add( packet.egress * INTERFACE_COUNTERS + 2, 1 );
+    interfaces.add( packet.egress * INTERFACE_COUNTERS + 3, packet.bytes );
+  }
+  const auto stop = steady_clock::now();
+  return duration_cast<duration<double, nano>>( stop - start ).count() / static_cast<double>( packets.size() );
+}
+
+// The same counters as plain integers: the least that counting could cost
+class PlainCounters
+{
+  vector<uint64_t> counters_ = vector<uint64_t>( ROUTE_COUNT * ROUTE_COUNTERS );
+
+public:
+  void add( size_t index, uint64_t n ) { counters_[index] += n; }
+  void set( size_t index, uint64_t value ) { counters_[index] = value; }
+  uint64_t get( size_t index ) const { return counters_[index]; }
+};
+
+// The same counters shared by all threads, so each update is a locked read-modify-write
+class SharedCounters
+{
+  unique_ptr<atomic<uint64_t>[]> counters_ = make_unique<atomic<uint64_t>[]>( ROUTE_COUNT * ROUTE_COUNTERS );
+
+public:
+  void add( size_t index, uint64_t n ) { counters_[index].fetch_add( n ); }
+  void set( size_t index, uint64_t value ) { counters_[index].store( value ); }
+  uint64_t get( size_t index ) const { return counters_[index].load(); }
+};
+
+void report( string_view what, double ns, fstream& debug_output )
+{
+  cout << what << ": " << fixed << setprecision( 2 ) << ns << " ns per packet\n";
+  debug_output << "        " << what << fixed << setprecision( 2 ) << setw( 8 ) << ns << " ns per packet\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  auto rd = get_random_engine();
+  for ( const bool zipf : { false, true } ) {
+    const vector<Packet> packets = make_packets( zipf, rd );
+    cout << ( zipf ? "Zipf-distributed" : "Uniformly distributed" ) << " traffic over " << ROUTE_COUNT
+         << " routes:\n";
+
+    // each kind of counter is measured on a second pass, once its memory has been touched
+    PlainCounters plain_interfaces, plain_routes;
+    measure( packets, plain_interfaces, plain_routes );
+    const double plain = measure( packets, plain_interfaces, plain_routes );
+    report( "  plain integers    ", plain, debug_output );
+
+    SharedCounters shared_interfaces, shared_routes;
+    measure( packets, shared_interfaces, shared_routes );
+    const double shared = measure( packets, shared_interfaces, shared_routes );
+    report( "  shared atomics    ", shared, debug_output );
+
+    CounterBlock interfaces, routes;
+    measure( packets, interfaces, routes );
+    const double blocks = measure( packets, interfaces, routes );
+    report( "  CounterBlock      ", blocks, debug_output );
+
+    if ( interfaces.get( 1 ) != plain_interfaces.get( 1 ) or routes.get( 2 ) != plain_routes.get( 2 ) ) {
+      throw runtime_error( "CounterBlock lost count" );
+    }
+    if ( blocks > shared ) {
+      throw runtime_error( "CounterBlock was slower than shared atomic counters" );
+    }
+    if ( blocks > 2 * plain + 10 ) {
+      throw runtime_error( "CounterBlock cost much more than plain integers" );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+#include "flow_hash.hh"
+#include "network_test_helpers.hh"
+#include "random.hh"
+#include "router.hh"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr size_t PATH_COUNT = 4;
+
+InternetDatagram make_datagram( const FlowKey& flow, vector<string> payload )
+{
+  InternetDatagram dgram;
+  dgram.header.src = flow.src;
+  dgram.header.dst = flow.dst;
+  dgram.header.proto = flow.proto;
+  dgram.header.ttl = 64;
+  size_t length = 0;
+  for ( auto& piece : payload ) {
+    length += piece.size();
+    dgram.payload.emplace_back( move( piece ) );
+  }
+  dgram.header.len = static_cast<uint16_t>( dgram.header.hlen * 4 + length );
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// A UDP datagram of the flow (only the ports of the UDP header matter here)
+InternetDatagram make_datagram( const FlowKey& flow )
+{
+  string ports;
+  for ( const uint16_t port : { flow.src_port, flow.dst_port } ) {
+    ports.push_back( static_cast<char>( port >> 8U ) );
+    ports.push_back( static_cast<char>( port & 0xffU ) );
+  }
+  return make_datagram( flow, { ports + string( 12, 'x' ) } );
+}
+
+void parses_the_five_tuple()
+{
+  const FlowKey udp { 0x0a000001, 0x0a000002, 0x1234, 0x5678, IPv4Header::PROTO_UDP };
+  if ( FlowKey::of( make_datagram( udp ) ) != udp ) {
+    throw runtime_error( "UDP ports were not parsed" );
+  }
+
+  // the ports may be split across the pieces of the payload
+  const FlowKey tcp { 0x0a000001, 0x0a000002, 0x1234, 0x5678, IPv4Header::PROTO_TCP };
+  if ( FlowKey::of( make_datagram( tcp, { "", "\x12", "\x34\x56", "\x78rest of the header" } ) ) != tcp ) {
+    throw runtime_error( "TCP ports split across payload pieces were not parsed" );
+  }
+
+  // other protocols, truncated headers and fragments hash on addresses and protocol alone
+  FlowKey icmp = udp;
+  icmp.proto = 1;
+  icmp.src_port = icmp.dst_port = 0;
+  if ( FlowKey::of( make_datagram( icmp, { "\x12\x34\x56\x78" } ) ) != icmp ) {
+    throw runtime_error( "ports were parsed from an ICMP datagram" );
+  }
+  FlowKey no_ports = udp;
+  no_ports.src_port = no_ports.dst_port = 0;
+  if ( FlowKey::of( make_datagram( udp, { "\x12\x34" } ) ) != no_ports ) {
+    throw runtime_error( "ports were parsed from a truncated UDP header" );
+  }
+  InternetDatagram first_fragment = make_datagram( udp );
+  first_fragment.header.mf = true;
+  if ( FlowKey::of( first_fragment ) != no_ports ) {
+    throw runtime_error( "a fragment's ports were used" );
+  }
+}
+
+// Pearson's chi-squared statistic of `counts` against an even split
+double chi_squared( const vector<size_t>& counts )
+{
+  size_t total = 0;
+  for ( const size_t count : counts ) {
+    total += count;
+  }
+  const double expected = static_cast<double>( total ) / static_cast<double>( counts.size() );
+  double statistic = 0;
+  for ( const size_t count : counts ) {
+    const double difference = static_cast<double>( count ) - expected;
+    statistic += difference * difference / expected;
+  }
+  return statistic;
+}
+
+// A split passes if its statistic is within 6 standard deviations of the mean for a uniform hash
+void check_even( const vector<size_t>& counts, const string& what )
+{
+  const auto degrees = static_cast<double>( counts.size() - 1 );
+  const double statistic = chi_squared( counts );
+  if ( statistic > degrees + 6 * sqrt( 2 * degrees ) ) {
+    throw runtime_error( what + " is uneven over " + to_string( counts.size() )
+                         + " paths: chi-squared = " + to_string( statistic ) );
+  }
+}
+
+void hash_spreads_flows_evenly()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<uint16_t> any_port;
+  const uint32_t seed = any_address( rd );
+
+  for ( size_t paths = 2; paths <= 16; paths++ ) {
+    // random flows
+    vector<size_t> counts( paths );
+    for ( size_t i = 0; i < 50000; i++ ) {
+      const FlowKey flow { any_address( rd ), any_address( rd ), any_port( rd ), any_port( rd ), 6 };
+      counts.at( FlowKey::pick( flow.hash( seed ), paths ) )++;
+    }
+    check_even( counts, "random flows" );
+
+    // flows that differ in one field only, as between two busy hosts or from one client's ephemeral ports
+    vector<size_t> by_port( paths );
+    vector<size_t> by_host( paths );
+    for ( uint32_t i = 0; i < 50000; i++ ) {
+      by_port.at( FlowKey::pick( FlowKey { 0x0a000001, 0x0a000002, static_cast<uint16_t>( 10000 + i ), 443, 6 }
+                                   .hash( seed ),
+                                 paths ) )++;
+      by_host.at( FlowKey::pick( FlowKey { 0x0a000000 + i, 0x0a000002, 0, 0, 1 }.hash( seed ), paths ) )++;
+    }
+    check_even( by_port, "flows from consecutive ports" );
+    check_even( by_host, "flows from consecutive hosts" );
+  }
+
+  // a router with another seed splits the flows independently (no polarisation): the flows that one router
+  // sends down a path are spread evenly again by the next
+  vector<size_t> next_hop_counts( PATH_COUNT );
+  for ( uint32_t i = 0; i < 200000; i++ ) {
+    const FlowKey flow { 0x0a000000 + i, 0x0b000001, static_cast<uint16_t>( i ), 80, 6 };
+    if ( FlowKey::pick( flow.hash( seed ), PATH_COUNT ) == 0 ) {
+      next_hop_counts.at( FlowKey::pick( flow.hash( seed + 1 ), PATH_COUNT ) )++;
+    }
+  }
+  check_even( next_hop_counts, "flows through two routers" );
+}
+
+void router_keeps_flows_on_one_path()
+{
+  Router router;
+  vector<shared_ptr<FramesSent>> ports;
+  vector<Router::Path> paths;
+  for ( size_t i = 0; i <= PATH_COUNT; i++ ) {
+    ports.push_back( make_shared<FramesSent>() );
+    add_gateway_interface( router, i, ports.back() );
+    if ( i > 0 ) { // interface 0 is the ingress
+      learn_gateway( *router.interface( i ), i );
+      paths.push_back( { Address::from_ipv4_numeric( gateway_ip( i ) ), i } );
+    }
+  }
+  router.add_multipath_route( 0, 0, paths );
+
+  // 4000 flows of 5 datagrams each, interleaved
+  constexpr size_t FLOWS = 4000;
+  for ( size_t round = 0; round < 5; round++ ) {
+    for ( uint16_t port = 0; port < FLOWS; port++ ) {
+      const auto src_port = static_cast<uint16_t>( 1024 + port );
+      const FlowKey flow { 0x0a000001, 0x0b000001, src_port, 53, IPv4Header::PROTO_UDP };
+      router.interface( 0 )->datagrams_received().push( make_datagram( flow ) );
+    }
+    router.route();
+  }
+
+  // which interface carried each flow (the test's flows differ only in their source port)
+  map<uint16_t, size_t> flow_to_port;
+  for ( size_t i = 1; i <= PATH_COUNT; i++ ) {
+    for ( const auto& dgram : ports[i]->datagrams() ) {
+      const auto [it, added] = flow_to_port.try_emplace( FlowKey::of( dgram ).src_port, i );
+      if ( it->second != i ) {
+        throw runtime_error( "flow from port " + to_string( it->first ) + " used two paths" );
+      }
+    }
+  }
+  if ( flow_to_port.size() != FLOWS or not ports[0]->datagrams().empty() ) {
+    throw runtime_error( "expected " + to_string( FLOWS ) + " flows on the egress interfaces, saw "
+                         + to_string( flow_to_port.size() ) );
+  }
+  vector<size_t> flows_per_path( PATH_COUNT );
+  for ( const auto& [port, path] : flow_to_port ) {
+    flows_per_path.at( path - 1 )++;
+  }
+  check_even( flows_per_path, "Router's ECMP" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    parses_the_five_tuple();
+    hash_spreads_flows_evenly();
+    router_keeps_flows_on_one_path();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
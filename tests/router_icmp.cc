@@ -0,0 +1,253 @@
+#include "icmp_message.hh"
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+constexpr uint32_t HOST = 0x0a000002;          // 10.0.0.2, on eth0
+constexpr uint32_t LAN_GATEWAY = 0x0a0000fe;   // 10.0.0.254, on eth0, towards 192.168.0.0/16
+constexpr uint32_t EGRESS_GATEWAY = 0x0a010002; // 10.1.0.2, on eth1, towards 172.16.0.0/12
+constexpr size_t EGRESS_MTU = 1000;
+
+EthernetAddress ethernet_address( uint8_t n )
+{
+  return { 0x02, 0, 0, 0, 0, n };
+}
+
+// A router between a LAN on eth0 (10.0.0.0/24) and an uplink on eth1 with a small MTU
+struct TestRouter
+{
+  Router router {};
+  shared_ptr<FramesSent> lan = make_shared<FramesSent>();
+  shared_ptr<FramesSent> uplink = make_shared<FramesSent>();
+
+  TestRouter()
+  {
+    router.add_interface(
+      make_shared<NetworkInterface>( "eth0", lan, ethernet_address( 0 ), Address { "10.0.0.1" } ) );
+    router.add_interface(
+      make_shared<NetworkInterface>( "eth1", uplink, ethernet_address( 1 ), Address { "10.1.0.1" } ) );
+    router.interface( 1 )->set_mtu( EGRESS_MTU );
+    learn( 0, HOST, 10 );
+    learn( 0, LAN_GATEWAY, 11 );
+    learn( 1, EGRESS_GATEWAY, 12 );
+
+    router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+    router.add_route( ip( "192.168.0.0" ), 16, Address::from_ipv4_numeric( LAN_GATEWAY ), 0 );
+    router.add_route( ip( "172.16.0.0" ), 12, Address::from_ipv4_numeric( EGRESS_GATEWAY ), 1 );
+  }
+
+  // Teach interface `n` the Ethernet address of a neighbour
+  void learn( size_t n, uint32_t neighbour, uint8_t ethernet )
+  {
+    NetworkInterface& iface = *router.interface( n );
+    iface.recv_frame( arp_reply_to( iface, ethernet_address( ethernet ), neighbour ) );
+  }
+
+  void receive( const InternetDatagram& dgram )
+  {
+    router.interface( 0 )->datagrams_received().push( clone( dgram ) );
+    router.route();
+  }
+
+  // The ICMP message that the router sent back to the LAN (and its Ethernet destination), if any
+  optional<pair<ICMPMessage, EthernetAddress>> icmp_reply()
+  {
+    if ( lan->frames.empty() ) {
+      return {};
+    }
+    const EthernetFrame frame = move( lan->frames.front() );
+    lan->frames.erase( lan->frames.begin() );
+    InternetDatagram dgram;
+    ICMPMessage msg;
+    if ( frame.header.type != EthernetHeader::TYPE_IPv4 or not parse( dgram, frame.payload )
+         or dgram.header.proto != IPv4Header::PROTO_ICMP or not parse( msg, dgram.payload ) ) {
+      throw runtime_error( "router sent something other than a valid ICMP message to the LAN" );
+    }
+    if ( dgram.header.src != ip( "10.0.0.1" ) ) {
+      throw runtime_error( "ICMP message did not come from the ingress interface's address" );
+    }
+    return pair { msg, frame.header.dst };
+  }
+
+  // Expect an ICMP error about `original`, sent to `ethernet`
+  void expect_error( const InternetDatagram& original,
+                     uint8_t type,
+                     uint8_t code,
+                     const string& what,
+                     uint8_t ethernet = 10 )
+  {
+    const auto reply = icmp_reply();
+    if ( not reply ) {
+      throw runtime_error( what + ": no ICMP error was sent" );
+    }
+    const auto& [msg, dst] = *reply;
+    if ( msg.type != type or msg.code != code ) {
+      throw runtime_error( what + ": expected ICMP type " + to_string( type ) + " code " + to_string( code )
+                           + ", got " + msg.to_string() );
+    }
+    // the original header, as received, and the first 8 bytes of its payload
+    const string quote = concat( serialize( original.header ) ) + concat( original.payload ).substr( 0, 8 );
+    if ( msg.payload != quote ) {
+      throw runtime_error( what + ": ICMP error did not quote the offending datagram" );
+    }
+    if ( dst != ethernet_address( ethernet ) ) {
+      throw runtime_error( what + ": ICMP error went to " + to_string( dst ) );
+    }
+  }
+
+  void expect_nothing_back( const string& what )
+  {
+    if ( const auto reply = icmp_reply() ) {
+      throw runtime_error( what + ": unexpected " + reply->first.to_string() );
+    }
+  }
+};
+
+void errors_go_back_to_the_sender()
+{
+  TestRouter t;
+
+  const auto expired = make_datagram( HOST, ip( "172.16.0.5" ), 100, 1 );
+  t.receive( expired );
+  t.expect_error( expired, ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED, "TTL 1" );
+  const auto dead = make_datagram( HOST, ip( "172.16.0.5" ), 100, 0 );
+  t.receive( dead );
+  t.expect_error( dead, ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED, "TTL 0" );
+
+  const auto nowhere = make_datagram( HOST, ip( "8.8.8.8" ) );
+  t.receive( nowhere );
+  t.expect_error(
+    nowhere, ICMPMessage::TYPE_DESTINATION_UNREACHABLE, ICMPMessage::CODE_NET_UNREACHABLE, "no route" );
+
+  // a sender beyond another router is answered through that router
+  const auto remote = make_datagram( ip( "192.168.7.7" ), ip( "8.8.8.8" ) );
+  t.receive( remote );
+  t.expect_error( remote,
+                  ICMPMessage::TYPE_DESTINATION_UNREACHABLE,
+                  ICMPMessage::CODE_NET_UNREACHABLE,
+                  "no route, from a remote sender",
+                  11 );
+
+  // too big for eth1: dropped with Fragmentation Needed if DF is set, forwarded otherwise
+  const auto too_big = make_datagram( HOST, ip( "172.16.0.5" ), EGRESS_MTU + 1, 64, true );
+  t.receive( too_big );
+  t.expect_error( too_big,
+                  ICMPMessage::TYPE_DESTINATION_UNREACHABLE,
+                  ICMPMessage::CODE_FRAGMENTATION_NEEDED,
+                  "DF datagram over the MTU" );
+  if ( not t.uplink->frames.empty() ) {
+    throw runtime_error( "a DF datagram over the MTU was forwarded" );
+  }
+  t.receive( make_datagram( HOST, ip( "172.16.0.5" ), EGRESS_MTU, 64, true ) );
+  t.receive( make_datagram( HOST, ip( "172.16.0.5" ), EGRESS_MTU + 1, 64 ) );
+  t.expect_nothing_back( "datagrams that fit, or may be fragmented" );
+  if ( t.uplink->frames.size() != 3 ) { // the second in two fragments
+    throw runtime_error( "datagrams that fit the MTU, or may be fragmented, were not forwarded" );
+  }
+
+  // the MTU reported
+  const auto big = make_datagram( HOST, ip( "172.16.0.5" ), 1400, 64, true );
+  t.receive( big );
+  if ( t.icmp_reply().value().first.next_hop_mtu() != EGRESS_MTU ) {
+    throw runtime_error( "Fragmentation Needed did not carry the next-hop MTU" );
+  }
+}
+
+void no_errors_about_errors_or_broadcasts()
+{
+  TestRouter t;
+
+  // an ICMP error that itself expires is dropped quietly, but an expiring echo request is answered
+  const auto error = ICMPMessage::error(
+    ICMPMessage::TYPE_DESTINATION_UNREACHABLE, ICMPMessage::CODE_HOST_UNREACHABLE, make_datagram( 1, 2 ) );
+  InternetDatagram expired_error = error.to_datagram( HOST, ip( "172.16.0.5" ) );
+  expired_error.header.ttl = 1;
+  expired_error.header.compute_checksum();
+  t.receive( expired_error );
+  t.expect_nothing_back( "an ICMP error" );
+
+  ICMPMessage echo;
+  echo.type = ICMPMessage::TYPE_ECHO_REQUEST;
+  echo.payload = "ping";
+  echo.compute_checksum();
+  InternetDatagram expired_echo = echo.to_datagram( HOST, ip( "172.16.0.5" ) );
+  expired_echo.header.ttl = 1;
+  expired_echo.header.compute_checksum();
+  t.receive( expired_echo );
+  t.expect_error(
+    expired_echo, ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED, "an expiring echo request" );
+
+  t.receive( make_datagram( 0, ip( "172.16.0.5" ), 100, 1 ) );
+  t.expect_nothing_back( "a datagram from 0.0.0.0" );
+  t.receive( make_datagram( HOST, ip( "224.0.0.5" ) ) );
+  t.expect_nothing_back( "a multicast datagram" );
+  t.receive( make_datagram( HOST, ip( "255.255.255.255" ) ) );
+  t.expect_nothing_back( "a broadcast datagram" );
+
+  auto fragment = make_datagram( HOST, ip( "172.16.0.5" ), 100, 1 );
+  fragment.header.offset = 100;
+  fragment.header.compute_checksum();
+  t.receive( fragment );
+  t.expect_nothing_back( "a fragment other than the first" );
+}
+
+size_t count_errors( TestRouter& t, size_t datagrams )
+{
+  for ( size_t i = 0; i < datagrams; i++ ) {
+    t.router.interface( 0 )->datagrams_received().push( make_datagram( HOST, ip( "172.16.0.5" ), 100, 1 ) );
+  }
+  t.router.route();
+  size_t errors = 0;
+  while ( t.icmp_reply() ) {
+    errors++;
+  }
+  return errors;
+}
+
+void errors_are_rate_limited()
+{
+  TestRouter t;
+  t.router.set_icmp_rate_limit( 100, 10 ); // one every 10 ms, in bursts of up to 10
+
+  const auto expect_count = [&]( size_t expected, const string& what ) {
+    const size_t errors = count_errors( t, 50 );
+    if ( errors != expected ) {
+      throw runtime_error( what + ": " + to_string( errors ) + " ICMP errors for 50 datagrams, expected "
+                           + to_string( expected ) );
+    }
+  };
+  expect_count( 10, "a burst" );
+  expect_count( 0, "with no time passing" );
+  t.router.tick( 35 );
+  expect_count( 3, "after 35 ms" );
+  t.router.tick( 5 ); // the leftover 5 ms and these make one more
+  expect_count( 1, "after another 5 ms" );
+  t.router.tick( 60'000 );
+  expect_count( 10, "after a minute" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    errors_go_back_to_the_sender();
+    no_errors_about_errors_or_broadcasts();
+    errors_are_rate_limited();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
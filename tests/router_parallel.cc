@@ -0,0 +1,278 @@
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t INTERFACES = 4;
+constexpr size_t PER_THREAD = 3000; // datagrams each RX thread receives
+constexpr size_t RING_CAPACITY = 4096;
+
+uint32_t network( size_t n )
+{
+  return 0xac100000 + static_cast<uint32_t>( n << 16U ); // 172.(16 + n).0.0/16, reached through gateway n
+}
+
+// A router whose interface N leads to network N, and which forwards in parallel
+struct TestRouter
+{
+  Router router {};
+  vector<shared_ptr<LockedFramesSent>> ports {};
+
+  // what the test has taken from each port so far
+  vector<size_t> forwarded = vector<size_t>( INTERFACES );
+  vector<size_t> icmp_errors = vector<size_t>( INTERFACES );
+  vector<size_t> expected_network = vector<size_t>( INTERFACES ); // whose datagrams each interface should send
+
+  TestRouter()
+  {
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      ports.push_back( make_shared<LockedFramesSent>() );
+      add_gateway_interface( router, i, ports.back() );
+      router.add_route( network( i ), 16, Address::from_ipv4_numeric( gateway_ip( i ) ), i );
+      expected_network[i] = i;
+    }
+    router.start_parallel( RING_CAPACITY );
+
+    // the gateways introduce themselves (handled by each interface's TX worker)
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      router.receive_frame( i, arp_reply_to( *router.interface( i ), gateway_ethernet( i ), gateway_ip( i ) ) );
+    }
+  }
+
+  // Check and count the frames the interfaces have sent (on their TX workers) since the last call
+  void collect()
+  {
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      for ( const auto& frame : ports[i]->take() ) {
+        if ( frame.header.type != EthernetHeader::TYPE_IPv4 ) {
+          continue; // an ARP request, sent before the gateway's ARP reply was processed
+        }
+        InternetDatagram dgram;
+        expect( frame.header.dst == gateway_ethernet( i ) and parse( dgram, frame.payload ),
+                "eth" + to_string( i ) + " sent a bad frame: " + summary( frame ) );
+        if ( dgram.header.proto == IPv4Header::PROTO_ICMP ) {
+          icmp_errors[i]++;
+          continue;
+        }
+        expect( ( dgram.header.dst & 0xffff0000U ) == network( expected_network[i] )
+                  and dgram.header.ttl == IPv4Header::DEFAULT_TTL - 1,
+                "eth" + to_string( i ) + " forwarded " + dgram.header.to_string() );
+        forwarded[i]++;
+      }
+    }
+  }
+
+  // Every RX thread receives `count` datagrams, spread over the other interfaces' networks
+  void run_rx_threads( size_t count, size_t only_to = INTERFACES )
+  {
+    vector<thread> rx_threads;
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      rx_threads.emplace_back( [this, i, count, only_to] {
+        for ( size_t n = 0; n < count; n++ ) {
+          const size_t egress = only_to < INTERFACES ? only_to : ( i + 1 + n % ( INTERFACES - 1 ) ) % INTERFACES;
+          const uint32_t dst = network( egress ) | static_cast<uint32_t>( n & 0xffffU );
+          router.receive_frame( i, frame_from_gateway( i, make_datagram( gateway_ip( i ), dst ) ) );
+        }
+      } );
+    }
+    for ( auto& rx_thread : rx_threads ) {
+      rx_thread.join();
+    }
+  }
+
+  // Wait (up to a few seconds) for the TX workers to send `expected` datagrams in all
+  void wait_for( size_t expected, const string& what )
+  {
+    const auto deadline = steady_clock::now() + seconds { 10 };
+    collect();
+    while ( total_forwarded() < expected and steady_clock::now() < deadline ) {
+      this_thread::sleep_for( milliseconds { 1 } );
+      collect();
+    }
+    if ( total_forwarded() != expected ) {
+      throw runtime_error( what + ": forwarded " + to_string( total_forwarded() ) + " datagrams, expected "
+                           + to_string( expected ) + " (" + to_string( router.ring_drops() ) + " ring drops)" );
+    }
+  }
+
+  size_t total_forwarded() const
+  {
+    size_t total = 0;
+    for ( const size_t n : forwarded ) {
+      total += n;
+    }
+    return total;
+  }
+};
+
+void forwards_in_parallel()
+{
+  TestRouter t;
+  t.run_rx_threads( PER_THREAD );
+  t.wait_for( INTERFACES * PER_THREAD, "parallel forwarding" );
+  for ( const size_t n : t.forwarded ) {
+    expect( n == PER_THREAD, "uneven forwarding: an interface sent " + to_string( n ) );
+  }
+
+  // route changes take effect on the RX threads: send 172.19.0.0/16 out of eth2 instead
+  t.expected_network[2] = 3;
+  t.router.replace_route( network( 3 ), 16, Address::from_ipv4_numeric( gateway_ip( 2 ) ), 2 );
+  t.run_rx_threads( 100, 3 );
+  t.wait_for( INTERFACES * PER_THREAD + INTERFACES * 100, "after a route change" );
+  expect( t.forwarded[2] == PER_THREAD + INTERFACES * 100, "datagrams did not follow the replaced route" );
+
+  // an expiring datagram is answered from the interface it arrived on
+  t.router.receive_frame( 1, frame_from_gateway( 1, make_datagram( gateway_ip( 1 ), network( 2 ), 100, 1 ) ) );
+  const auto deadline = steady_clock::now() + seconds { 10 };
+  while ( t.icmp_errors[1] == 0 and steady_clock::now() < deadline ) {
+    this_thread::sleep_for( milliseconds { 1 } );
+    t.collect();
+  }
+
+  t.router.stop_parallel();
+  expect( t.icmp_errors[1] == 1, "no ICMP Time Exceeded came back out of the ingress interface" );
+  expect( t.router.ring_drops() == 0,
+          to_string( t.router.ring_drops() ) + " datagrams were dropped on full rings" );
+
+  // and the router can go back to single-threaded forwarding
+  t.router.interface( 0 )->datagrams_received().push( make_datagram( gateway_ip( 0 ), network( 1 ) | 1 ) );
+  t.router.route();
+  t.collect();
+  expect( t.forwarded[1] == PER_THREAD + 1, "route() did not forward after stop_parallel()" );
+}
+
+// Wait (up to a few seconds) for an interface to send a datagram (on its TX worker)
+InternetDatagram next_datagram( LockedFramesSent& port )
+{
+  const auto deadline = steady_clock::now() + seconds { 10 };
+  while ( steady_clock::now() < deadline ) {
+    for ( const auto& frame : port.take() ) {
+      InternetDatagram dgram;
+      if ( frame.header.type == EthernetHeader::TYPE_IPv4 and parse( dgram, frame.payload ) ) {
+        return dgram;
+      }
+    }
+    this_thread::sleep_for( milliseconds { 1 } );
+  }
+  throw runtime_error( "nothing was sent" );
+}
+
+// A UDP user datagram (without a checksum) with 8 bytes of data
+InternetDatagram make_udp( uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port )
+{
+  string segment;
+  for ( const uint16_t value : { src_port, dst_port, uint16_t { 16 }, uint16_t { 0 } } ) {
+    segment += static_cast<char>( value >> 8U );
+    segment += static_cast<char>( value & 0xffU );
+  }
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.proto = IPv4Header::PROTO_UDP;
+  dgram.payload.emplace_back( segment + "datagram" );
+  dgram.header.len = IPv4Header::LENGTH + 16;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+uint16_t port_at( const InternetDatagram& dgram, size_t offset )
+{
+  const string bytes = concat( dgram.payload );
+  return static_cast<uint16_t>( static_cast<uint8_t>( bytes.at( offset ) ) << 8U
+                                | static_cast<uint8_t>( bytes.at( offset + 1 ) ) );
+}
+
+// The RX threads reassemble the fragments addressed to their interface, as NetworkInterface does: NAT needs
+// the ports, which only the first fragment carries
+void nat_reassembles_in_parallel()
+{
+  Router router;
+  const auto lan = make_shared<LockedFramesSent>();
+  const auto wan = make_shared<LockedFramesSent>();
+  const Address outside { "192.0.2.1" };
+  const Address inside { "10.0.0.1" };
+  router.add_interface( make_shared<NetworkInterface>( "lan", lan, ethernet_address( 0 ), inside ) );
+  router.add_interface( make_shared<NetworkInterface>( "wan", wan, ethernet_address( 1 ), outside ) );
+  router.add_route( Address { "10.0.0.0" }.ipv4_numeric(), 24, {}, 0 );
+  router.add_route( 0, 0, Address { "192.0.2.254" }, 1 );
+  router.enable_nat( 1 );
+  router.start_parallel( RING_CAPACITY );
+  for ( const auto& [i, neighbour] : { pair { 0UL, "10.0.0.5" }, pair { 1UL, "192.0.2.254" } } ) {
+    router.receive_frame( i, arp_reply_to( *router.interface( i ), gateway_ethernet( i ), ip( neighbour ) ) );
+  }
+
+  const uint32_t host = Address { "10.0.0.5" }.ipv4_numeric();
+  const uint32_t server = Address { "198.51.100.7" }.ipv4_numeric();
+  router.receive_frame( 0, frame_from_gateway( 0, make_udp( host, 5353, server, 53 ) ) );
+  const InternetDatagram out = next_datagram( *wan );
+  if ( out.header.src != outside.ipv4_numeric() ) {
+    throw runtime_error( "the datagram did not leave translated: " + out.header.to_string() );
+  }
+
+  // the reply comes back in two fragments, the second without the ports
+  const InternetDatagram reply = make_udp( server, 53, out.header.src, port_at( out, 0 ) );
+  const string bytes = concat( reply.payload );
+  for ( const size_t part : { 0, 1 } ) {
+    InternetDatagram fragment;
+    fragment.header = reply.header;
+    fragment.header.mf = part == 0;
+    fragment.header.offset = part;
+    fragment.header.len = IPv4Header::LENGTH + 8;
+    fragment.header.compute_checksum();
+    fragment.payload.emplace_back( bytes.substr( part * 8, 8 ) );
+    router.receive_frame( 1, frame_from_gateway( 1, fragment ) );
+  }
+  const InternetDatagram back = next_datagram( *lan );
+
+  // the RX threads read the NATs without a lock, so none may be added while they run
+  bool threw = false;
+  try {
+    router.enable_nat( 0 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  router.stop_parallel();
+  if ( not threw ) {
+    throw runtime_error( "NAT was enabled while forwarding in parallel" );
+  }
+  if ( back.header.dst != host or port_at( back, 2 ) != 5353 or back.header.len != reply.header.len ) {
+    throw runtime_error( "the reply did not come back whole and translated: " + back.header.to_string() );
+  }
+}
+
+// A router with no interfaces yet has nothing to start
+void starts_without_interfaces()
+{
+  Router router;
+  router.start_parallel( RING_CAPACITY );
+  router.stop_parallel();
+}
+} // namespace
+
+int main()
+{
+  try {
+    starts_without_interfaces();
+    forwards_in_parallel();
+    nat_reassembles_in_parallel();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t PORT_COUNT = 4;
+constexpr size_t FRAMES_PER_PORT = 100000;
+constexpr size_t BATCH = 32; // frames received on each interface between calls to route()
+
+// A router whose every port is both an ingress and the egress towards 172.16.N.0/24
+struct Setup
+{
+  Router router {};
+  vector<shared_ptr<FramesCounted>> ports {};
+
+  Setup()
+  {
+    for ( size_t i = 0; i < PORT_COUNT; i++ ) {
+      ports.push_back( make_shared<FramesCounted>() );
+      add_gateway_interface( router, i, ports.back() );
+      router.add_route(
+        0xac100000 | static_cast<uint32_t>( i << 8U ), 24, Address::from_ipv4_numeric( gateway_ip( i ) ), i );
+      learn_gateway( *router.interface( i ), i );
+    }
+  }
+
+  size_t forwarded() const
+  {
+    size_t total = 0;
+    for ( const auto& port : ports ) {
+      total += port->frames;
+    }
+    return total;
+  }
+};
+
+// The frames arriving on each port, towards the networks behind the other ports
+vector<vector<EthernetFrame>> make_frames()
+{
+  vector<vector<EthernetFrame>> frames( PORT_COUNT );
+  for ( size_t i = 0; i < PORT_COUNT; i++ ) {
+    for ( size_t n = 0; n < FRAMES_PER_PORT; n++ ) {
+      const size_t egress = ( i + 1 + n % ( PORT_COUNT - 1 ) ) % PORT_COUNT;
+      const uint32_t dst = 0xac100000 | static_cast<uint32_t>( egress << 8U ) | static_cast<uint32_t>( n & 0xffU );
+      const InternetDatagram dgram = make_datagram( gateway_ip( i ), dst, IPv4Header::LENGTH + 64, 64 );
+      frames[i].push_back( frame_from_gateway( i, dgram ) );
+    }
+  }
+  return frames;
+}
+
+// Frames per second forwarded by one thread, receiving on every interface in turn and calling route()
+double single_threaded( vector<vector<EthernetFrame>> frames )
+{
+  Setup setup;
+  const auto start = steady_clock::now();
+  for ( size_t offset = 0; offset < FRAMES_PER_PORT; offset += BATCH ) {
+    for ( size_t i = 0; i < PORT_COUNT; i++ ) {
+      for ( size_t n = offset; n < min( offset + BATCH, FRAMES_PER_PORT ); n++ ) {
+        setup.router.interface( i )->recv_frame( move( frames[i][n] ) );
+      }
+    }
+    setup.router.route();
+  }
+  const auto stop = steady_clock::now();
+
+  if ( setup.forwarded() != PORT_COUNT * FRAMES_PER_PORT ) {
+    throw runtime_error( "single-threaded router forwarded " + to_string( setup.forwarded() ) + " frames" );
+  }
+  return static_cast<double>( setup.forwarded() ) / duration_cast<duration<double>>( stop - start ).count();
+}
+
+// Frames per second forwarded with an RX thread per interface feeding the Router's TX workers
+double parallel( vector<vector<EthernetFrame>> frames, uint64_t& drops )
+{
+  Setup setup;
+  setup.router.start_parallel();
+
+  const auto start = steady_clock::now();
+  vector<thread> rx_threads;
+  for ( size_t i = 0; i < PORT_COUNT; i++ ) {
+    rx_threads.emplace_back( [&, i] {
+      for ( auto& frame : frames[i] ) {
+        setup.router.receive_frame( i, move( frame ) );
+      }
+    } );
+  }
+  for ( auto& rx_thread : rx_threads ) {
+    rx_thread.join();
+  }
+  // datagrams are either sent by a TX worker or dropped on a full ring
+  while ( setup.forwarded() + setup.router.ring_drops() < PORT_COUNT * FRAMES_PER_PORT ) {
+    this_thread::yield();
+  }
+  const auto stop = steady_clock::now();
+  setup.router.stop_parallel();
+
+  drops = setup.router.ring_drops();
+  return static_cast<double>( setup.forwarded() ) / duration_cast<duration<double>>( stop - start ).count();
+}
+
+void program_body()
+{
+  const auto frames = make_frames();
+  const double single_rate = single_threaded( frames );
+  uint64_t drops = 0;
+  const double parallel_rate = parallel( frames, drops );
+  const double scaling = parallel_rate / single_rate;
+
+  cout << "Router on " << PORT_COUNT << " ports, single thread: " << fixed << setprecision( 2 ) << setw( 6 )
+       << single_rate / 1e6 << " Mframes/s\n";
+  cout << "Router on " << PORT_COUNT << " ports, parallel:      " << setw( 6 ) << parallel_rate / 1e6
+       << " Mframes/s (" << setprecision( 2 ) << scaling << "x with " << thread::hardware_concurrency()
+       << " hardware threads, " << drops << " dropped on full rings)\n";
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+  debug_output << "        Router parallel forwarding: " << fixed << setprecision( 2 ) << scaling << "x ("
+               << thread::hardware_concurrency() << " hardware threads)\n";
+
+  // The parallel mode can only scale with the cores that exist; on any machine it should not collapse
+  if ( scaling < 0.2 ) {
+    throw runtime_error( "parallel forwarding was more than 5x slower than a single thread" );
+  }
+  if ( thread::hardware_concurrency() >= 2 * PORT_COUNT and scaling < 1.5 ) {
+    throw runtime_error( "parallel forwarding did not scale with the available cores" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+#include "network_test_helpers.hh"
+#include "prefix_trie.hh"
+#include "random.hh"
+#include "router.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t TABLE_SIZE = 300000;
+constexpr size_t PACKET_COUNT = 100000;
+constexpr size_t EGRESS_COUNT = 3;
+constexpr size_t ZIPF_DESTINATIONS = 100000;
+constexpr size_t ECMP_PATHS = 3;
+constexpr size_t ECMP_FLOWS = 10000;
+
+struct Setup
+{
+  Router router {};
+  vector<shared_ptr<FramesCounted>> ports {};
+  vector<InternetDatagram> packets {};      // towards uniformly chosen routes
+  vector<InternetDatagram> zipf_packets {}; // towards a few popular destinations, and a long tail
+  vector<InternetDatagram> udp_packets {};  // UDP flows towards 240.0.0.0/15, outside the random table
+};
+
+// An 84-byte UDP datagram from the ingress side
+InternetDatagram make_packet( uint32_t dst )
+{
+  return make_datagram( 0x0a000001, dst, IPv4Header::LENGTH + 64, 64 );
+}
+
+void build( Setup& setup )
+{
+  // interface 0 is the ingress, the others lead to one gateway each
+  for ( size_t i = 0; i <= EGRESS_COUNT; i++ ) {
+    setup.ports.push_back( make_shared<FramesCounted>() );
+    add_gateway_interface( setup.router, i, setup.ports.back() );
+    if ( i > 0 ) {
+      learn_gateway( *setup.router.interface( i ), i );
+    }
+  }
+
+  // A BGP-like table (mostly /24s) spread over the gateways, and traffic towards hosts inside it
+  auto rd = get_random_engine();
+  discrete_distribution<int> lengths { { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 4, 6, 10, 12, 80, 30, 50, 100, 150,
+                                         200, 500, 500, 5800, 5, 5, 5, 5, 5, 5, 5, 10 } };
+  uniform_int_distribution<uint32_t> unicast { 0x01000000, 0xdfffffff };
+  vector<pair<uint32_t, uint8_t>> table;
+  for ( size_t i = 0; i < TABLE_SIZE; i++ ) {
+    const auto length = static_cast<uint8_t>( lengths( rd ) );
+    const uint32_t prefix = unicast( rd ) & PrefixTrie<size_t>::mask( length );
+    const size_t egress = 1 + i % EGRESS_COUNT;
+    setup.router.add_route( prefix, length, Address::from_ipv4_numeric( gateway_ip( egress ) ), egress );
+    table.emplace_back( prefix, length );
+  }
+
+  uniform_int_distribution<size_t> any_route { 0, table.size() - 1 };
+  const auto routed_destination = [&] {
+    const auto& [prefix, length] = table[any_route( rd )];
+    return prefix | ( unicast( rd ) & ~PrefixTrie<size_t>::mask( length ) );
+  };
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    setup.packets.push_back( make_packet( routed_destination() ) );
+  }
+
+  // Zipf-distributed popularity (exponent 1) over ZIPF_DESTINATIONS destinations
+  vector<uint32_t> destinations;
+  vector<double> weights;
+  for ( size_t rank = 1; rank <= ZIPF_DESTINATIONS; rank++ ) {
+    destinations.push_back( routed_destination() );
+    weights.push_back( 1.0 / static_cast<double>( rank ) );
+  }
+  discrete_distribution<size_t> zipf { weights.begin(), weights.end() };
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    setup.zipf_packets.push_back( make_packet( destinations[zipf( rd )] ) );
+  }
+
+  // UDP flows (distinct source ports) towards a network that will get one path or several
+  uniform_int_distribution<size_t> any_flow { 0, ECMP_FLOWS - 1 };
+  for ( size_t i = 0; i < PACKET_COUNT; i++ ) {
+    InternetDatagram packet = make_packet( 0xf0000000 | ( unicast( rd ) & 0x1ffffU ) );
+    const auto src_port = static_cast<uint16_t>( 1024 + any_flow( rd ) );
+    string& udp_header = packet.payload.front().get_mut();
+    udp_header[0] = static_cast<char>( src_port >> 8U );
+    udp_header[1] = static_cast<char>( src_port & 0xffU );
+    setup.udp_packets.push_back( move( packet ) );
+  }
+}
+
+// Nanoseconds per forwarded packet
+double forward_all( Setup& setup, const vector<InternetDatagram>& packets, size_t batch_size )
+{
+  setup.router.set_batch_size( batch_size );
+  auto& queue = setup.router.interface( 0 )->datagrams_received();
+  for ( const auto& packet : packets ) {
+    queue.push( packet );
+  }
+
+  size_t before = 0;
+  for ( const auto& port : setup.ports ) {
+    before += port->frames;
+  }
+  const auto start = steady_clock::now();
+  setup.router.route();
+  const auto stop = steady_clock::now();
+
+  size_t after = 0;
+  for ( const auto& port : setup.ports ) {
+    after += port->frames;
+  }
+  if ( after - before != packets.size() ) {
+    throw runtime_error( "router forwarded " + to_string( after - before ) + " of " + to_string( PACKET_COUNT )
+                         + " packets" );
+  }
+  return duration_cast<duration<double, nano>>( stop - start ).count() / static_cast<double>( PACKET_COUNT );
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  Setup setup;
+  build( setup );
+
+  double slowest = 0;
+  for ( const string_view table : { "PrefixTrie  ", "DIR24_8Table" } ) {
+    if ( table == "DIR24_8Table" ) {
+      setup.router.compile_forwarding_table();
+    }
+
+    // the uniform traffic has no locality for the route cache to exploit, so measure the lookups alone
+    setup.router.set_route_cache_size( 0 );
+    for ( const size_t batch_size : { 1, 8, 32, 64 } ) {
+      const double ns = forward_all( setup, setup.packets, batch_size );
+      slowest = max( slowest, ns );
+      cout << "Router with " << table << " (" << TABLE_SIZE / 1000 << "K routes), batch " << setw( 2 ) << batch_size
+           << ": " << fixed << setprecision( 1 ) << setw( 7 ) << ns << " ns/packet\n";
+      debug_output << "        Router " << table << " batch " << setw( 2 ) << batch_size << fixed
+                   << setprecision( 1 ) << setw( 8 ) << ns << " ns/packet\n";
+    }
+
+    for ( const size_t cache_sets : { size_t { 0 }, Router::DEFAULT_ROUTE_CACHE_SETS } ) {
+      setup.router.set_route_cache_size( cache_sets );
+      const double ns = forward_all( setup, setup.zipf_packets, 32 );
+      slowest = max( slowest, ns );
+      const string cache = cache_sets ? "route cache on " : "route cache off";
+      cout << "Router with " << table << " Zipf traffic, " << cache << ": " << fixed << setprecision( 1 )
+           << setw( 7 ) << ns << " ns/packet";
+      if ( cache_sets ) {
+        cout << " (" << setprecision( 1 ) << setup.router.route_cache().hit_rate() * 100 << "% hits)";
+      }
+      cout << "\n";
+      debug_output << "        Router " << table << " Zipf, " << cache << fixed << setprecision( 1 ) << setw( 8 )
+                   << ns << " ns/packet\n";
+    }
+  }
+
+  // the same UDP traffic through a single-path route and an equal-cost multipath one
+  setup.router.set_route_cache_size( Router::DEFAULT_ROUTE_CACHE_SETS );
+  for ( const size_t path_count : { size_t { 1 }, ECMP_PATHS } ) {
+    vector<Router::Path> paths;
+    for ( size_t egress = 1; egress <= path_count; egress++ ) {
+      paths.push_back( { Address::from_ipv4_numeric( gateway_ip( egress ) ), egress } );
+    }
+    setup.router.add_multipath_route( 0xf0000000, 15, paths );
+
+    vector<size_t> before;
+    for ( const auto& port : setup.ports ) {
+      before.push_back( port->frames );
+    }
+    const double ns = forward_all( setup, setup.udp_packets, 32 );
+    slowest = max( slowest, ns );
+    cout << "Router with ECMP over " << path_count << " path" << ( path_count > 1 ? "s" : " " ) << " ("
+         << ECMP_FLOWS / 1000 << "K UDP flows): " << fixed << setprecision( 1 ) << setw( 7 ) << ns
+         << " ns/packet, split";
+    for ( size_t egress = 1; egress <= EGRESS_COUNT; egress++ ) {
+      cout << " " << setprecision( 1 ) << setw( 5 )
+           << 100.0 * static_cast<double>( setup.ports[egress]->frames - before[egress] ) / PACKET_COUNT << "%";
+    }
+    cout << "\n";
+    debug_output << "        Router ECMP over " << path_count << " path(s)" << fixed << setprecision( 1 )
+                 << setw( 8 ) << ns << " ns/packet\n";
+  }
+
+  if ( slowest > 20000 ) {
+    throw runtime_error( "Router did not meet minimum speed of 50 K packets/s" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+#include "network_test_helpers.hh"
+#include "random.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t EGRESS_COUNT = 3;
+constexpr size_t CHURN_UPDATES = 10000;
+constexpr auto CHURN_INTERVAL = microseconds { 100 }; // 10k route changes per second
+
+InternetDatagram make_packet( uint32_t dst )
+{
+  return make_datagram( 0x0a000001, dst, IPv4Header::LENGTH + 5, 64 );
+}
+
+// A router with an ingress interface (0) and EGRESS_COUNT egress interfaces, each leading to a gateway whose
+// Ethernet address is already known
+struct TestRouter
+{
+  Router router {};
+  vector<shared_ptr<FramesSent>> ports {};
+
+  TestRouter()
+  {
+    for ( size_t i = 0; i <= EGRESS_COUNT; i++ ) {
+      ports.push_back( make_shared<FramesSent>() );
+      add_gateway_interface( router, i, ports.back() );
+      if ( i > 0 ) {
+        learn_gateway( *router.interface( i ), i );
+      }
+    }
+  }
+
+  void add( uint32_t prefix, uint8_t length, size_t egress )
+  {
+    router.add_route( prefix, length, Address::from_ipv4_numeric( gateway_ip( egress ) ), egress );
+  }
+
+  bool replace( uint32_t prefix, uint8_t length, size_t egress )
+  {
+    return router.replace_route( prefix, length, Address::from_ipv4_numeric( gateway_ip( egress ) ), egress );
+  }
+
+  // Enough unrelated routes that the router no longer uses its small-table lookup
+  void add_filler_routes()
+  {
+    for ( uint32_t i = 0; i < 100; i++ ) {
+      add( 0xc0a80000 | ( i << 8U ), 24, 1 ); // 192.168.i.0/24
+    }
+  }
+
+  // How many datagrams interface `n` has sent since the last call
+  size_t sent( size_t n )
+  {
+    const size_t count = ports.at( n )->datagrams().size();
+    ports[n]->frames.clear();
+    return count;
+  }
+
+  // The interface that a datagram to `dst` leaves on, if any
+  optional<size_t> egress( uint32_t dst )
+  {
+    router.interface( 0 )->datagrams_received().push( make_packet( dst ) );
+    router.route();
+    for ( size_t i = 0; i < ports.size(); i++ ) {
+      if ( sent( i ) != 0 ) {
+        return i;
+      }
+    }
+    return {};
+  }
+
+  void expect( uint32_t dst, optional<size_t> expected, const string& what )
+  {
+    const optional<size_t> got = egress( dst );
+    if ( got != expected ) {
+      throw runtime_error( what + ": datagram to " + Address::from_ipv4_numeric( dst ).ip() + " left on "
+                           + ( got ? "eth" + to_string( *got ) : "no interface" ) + " instead of "
+                           + ( expected ? "eth" + to_string( *expected ) : "no interface" ) );
+    }
+  }
+};
+
+enum class Lookup
+{
+  Small,
+  Trie,
+  Compiled,
+};
+
+void remove_and_replace( Lookup lookup )
+{
+  TestRouter t;
+  if ( lookup != Lookup::Small ) {
+    t.add_filler_routes();
+  }
+  if ( lookup == Lookup::Compiled ) {
+    t.router.compile_forwarding_table();
+  }
+
+  t.add( 0x0a000000, 8, 1 );  // 10.0.0.0/8
+  t.add( 0x0a010000, 16, 2 ); // 10.1.0.0/16
+  t.add( 0x0a010280, 25, 3 ); // 10.1.2.128/25
+  t.expect( 0x0a010203, 2, "/16" );
+  t.expect( 0x0a0102c8, 3, "/25" );
+  t.expect( 0x0a020001, 1, "/8" );
+
+  // withdrawing a route hands its addresses back to the one it refined
+  if ( not t.router.remove_route( 0x0a010280, 25 ) or t.router.remove_route( 0x0a010280, 25 ) ) {
+    throw runtime_error( "remove_route of 10.1.2.128/25 misbehaved" );
+  }
+  t.expect( 0x0a0102c8, 2, "after removing the /25" );
+  if ( not t.router.remove_route( 0x0a010000, 16 ) ) {
+    throw runtime_error( "remove_route of 10.1.0.0/16 failed" );
+  }
+  t.expect( 0x0a010203, 1, "after removing the /16" );
+
+  // replacing only changes routes that exist
+  if ( not t.replace( 0x0a000000, 8, 3 ) ) {
+    throw runtime_error( "replace_route of 10.0.0.0/8 failed" );
+  }
+  t.expect( 0x0a010203, 3, "after replacing the /8" );
+  if ( t.replace( 0x0a010000, 16, 2 ) ) {
+    throw runtime_error( "replace_route of an absent route succeeded" );
+  }
+  t.expect( 0x0a010203, 3, "after replacing an absent route" );
+
+  t.add( 0x0a010000, 16, 2 );
+  t.expect( 0x0a010203, 2, "after adding the /16 back" );
+  t.router.remove_route( 0x0a000000, 8 );
+  t.router.remove_route( 0x0a010000, 16 );
+  t.expect( 0x0a010203, {}, "after removing everything" );
+
+  // grow past the small table's capacity, then shrink back into it
+  t.add_filler_routes();
+  for ( uint32_t i = 0; i < 50; i++ ) {
+    t.router.remove_route( 0xc0a80000 | ( i << 8U ), 24 );
+  }
+  t.expect( 0xc0a86301, 1, "192.168.99.0/24" );
+  t.expect( 0xc0a80001, {}, "a withdrawn /24" );
+}
+
+// One thread changes routes 10k times a second while another forwards datagrams. Datagrams to 10.0.0.0/8 must
+// always leave on eth1; those to 172.16.0.0/12 on eth2 or eth3, depending on the routes of the moment.
+void churn_while_forwarding( Lookup lookup )
+{
+  TestRouter t;
+  if ( lookup != Lookup::Small ) {
+    t.add_filler_routes();
+  }
+  if ( lookup == Lookup::Compiled ) {
+    t.router.compile_forwarding_table();
+  }
+  t.add( 0x0a000000, 8, 1 );  // 10.0.0.0/8
+  t.add( 0xac100000, 12, 2 ); // 172.16.0.0/12
+
+  atomic<bool> done = false;
+  exception_ptr control_error;
+  steady_clock::duration churn_time {};
+  thread control { [&] {
+    try {
+      auto rd = get_random_engine();
+      uniform_int_distribution<uint32_t> subnet { 0, 0xfff };
+      const auto start = steady_clock::now();
+      for ( size_t i = 0; i < CHURN_UPDATES; i++ ) {
+        if ( i % 16 == 0 ) {
+          t.replace( 0xac100000, 12, 2 + ( i / 16 ) % 2 ); // flip the /12 between eth2 and eth3
+        } else {
+          // withdraw or announce one of the /24s inside 172.16.0.0/12 (towards eth3)
+          const uint32_t prefix = 0xac100000 | ( subnet( rd ) << 8U );
+          if ( not t.router.remove_route( prefix, 24 ) ) {
+            t.add( prefix, 24, 3 );
+          }
+        }
+        this_thread::sleep_until( start + CHURN_INTERVAL * ( i + 1 ) );
+      }
+      churn_time = steady_clock::now() - start;
+    } catch ( ... ) {
+      control_error = current_exception();
+    }
+    done = true;
+  } };
+
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> host { 0, 0xfffff };
+  size_t batches = 0;
+  while ( not done ) {
+    for ( uint32_t i = 0; i < 32; i++ ) {
+      t.router.interface( 0 )->datagrams_received().push( make_packet( 0x0a000000 | host( rd ) ) );
+      t.router.interface( 0 )->datagrams_received().push( make_packet( 0xac100000 | host( rd ) ) );
+    }
+    t.router.route();
+    if ( t.sent( 1 ) != 32 or t.sent( 2 ) + t.sent( 3 ) != 32 ) {
+      done = true;
+      control.join();
+      throw runtime_error( "a datagram was misrouted or dropped while the routes were changing" );
+    }
+    batches++;
+  }
+  control.join();
+  if ( control_error ) {
+    rethrow_exception( control_error );
+  }
+  if ( batches == 0 ) {
+    throw runtime_error( "nothing was forwarded while the routes were changing" );
+  }
+  // the updates are paced to take one second; waiting on the forwarding thread must not slow them much
+  if ( churn_time > CHURN_INTERVAL * CHURN_UPDATES * 2 ) {
+    throw runtime_error( "route updates fell behind: " + to_string( CHURN_UPDATES ) + " took "
+                         + to_string( duration_cast<milliseconds>( churn_time ).count() ) + " ms" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    for ( const Lookup lookup : { Lookup::Small, Lookup::Trie, Lookup::Compiled } ) {
+      remove_and_replace( lookup );
+    }
+    churn_while_forwarding( Lookup::Trie );
+    churn_while_forwarding( Lookup::Compiled );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
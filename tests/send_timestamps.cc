@@ -0,0 +1,98 @@
+#include "random.hh"
+#include "sender_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "TSval carries the sender's clock", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_seqno( isn ).with_tsval( 0 ) );
+      test.execute( Tick { 17 } );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_tsecr( 0 ) );
+      test.execute( Tick { 5 } );
+      test.execute( Push { "abc" } );
+      test.execute( ExpectMessage {}.with_data( "abc" ).with_seqno( isn + 1 ).with_tsval( 22 ) );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+      cfg.rt_timeout = 1000;
+
+      TCPSenderTestHarness test { "RTO follows the RTT measured from TSecr", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_seqno( isn ).with_tsval( 0 ) );
+      test.execute( Tick { 100 } );
+      // RTT = 100 ms: SRTT = 100, RTTVAR = 50, RTO = 100 + 4 * 50 = 300
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_tsecr( 0 ) );
+      test.execute( Push { "abc" } );
+      test.execute( ExpectMessage {}.with_data( "abc" ).with_tsval( 100 ) );
+      test.execute( Tick { 299 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_data( "abc" ).with_tsval( 400 ) );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+      cfg.rt_timeout = 1000;
+
+      TCPSenderTestHarness test { "RTT is measured on a retransmitted segment", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_tsval( 0 ) );
+      test.execute( Tick { 1000 } );
+      test.execute( ExpectMessage {}.with_syn( true ).with_tsval( 1000 ) );
+      test.execute( Tick { 400 } );
+      // the echo identifies the retransmission, so RTT = 400 ms (not 1400): RTO = 400 + 4 * 200 = 1200
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_tsecr( 1000 ) );
+      test.execute( Push { "x" } );
+      test.execute( ExpectMessage {}.with_data( "x" ).with_tsval( 1400 ) );
+      test.execute( Tick { 1199 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_data( "x" ).with_tsval( 2600 ) );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+      cfg.rt_timeout = 1000;
+
+      TCPSenderTestHarness test { "Measured RTO is bounded below", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_tsval( 0 ) );
+      test.execute( Tick { 2 } );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_tsecr( 0 ) );
+      test.execute( Push { "abc" } );
+      test.execute( ExpectMessage {}.with_data( "abc" ).with_tsval( 2 ) );
+      test.execute( Tick { TCPConfig::TIMEOUT_MIN - 1U } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_data( "abc" ) );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -55,7 +55,8 @@ public:
   TCPSenderTestHarness( std::string name, TCPConfig config )
     : TestHarness( move( name ),
                    "initial_RTO_ms=" + to_string( config.rt_timeout ) + " and ISN=" + to_string( config.isn ),
-                   { .sender = TCPSender { ByteStream { config.send_capacity }, config.isn, config.rt_timeout } } )
+                   { .sender = TCPSender {
+                       ByteStream { config.send_capacity }, config.isn, config.rt_timeout, config.timestamps } } )
   {}
 
   template<std::derived_from<TestStep<TCPSender>> T>
@@ -235,6 +236,12 @@ struct Receive : public Action<SenderAndOutput>
     return *this;
   }
 
+  Receive& with_tsecr( uint32_t tsecr )
+  {
+    msg_.tsecr = tsecr;
+    return *this;
+  }
+
   void execute( SenderAndOutput& ss ) const override
   {
     ss.sender.receive( msg_ );
@@ -283,8 +290,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
   std::optional<Wrap32> seqno {};
   std::optional<std::string> data {};
   std::optional<size_t> payload_size {};
+  std::optional<uint32_t> tsval {};
 
-  bool empty() const { return not( syn or fin or rst or seqno or data or payload_size ); }
+  bool empty() const { return not( syn or fin or rst or seqno or data or payload_size or tsval ); }
 
   ExpectMessage& with_syn( bool syn_ )
   {
@@ -318,6 +326,12 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
 
   ExpectMessage& with_seqno( uint32_t seqno_ ) { return with_seqno( Wrap32 { seqno_ } ); }
 
+  ExpectMessage& with_tsval( uint32_t tsval_ )
+  {
+    tsval = tsval_;
+    return *this;
+  }
+
   ExpectMessage& with_payload_size( size_t payload_size_ )
   {
     payload_size = payload_size_;
@@ -361,6 +375,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( rst.has_value() ) {
       o << ( rst.value() ? " +RST" : " -RST" );
     }
+    if ( tsval.has_value() ) {
+      o << " TSval=" << tsval.value();
+    }
     return o.str();
   }
 
@@ -397,6 +414,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( payload_size.has_value() and seg.payload.size() != payload_size.value() ) {
       throw MessageExpectationViolation( seg, "payload size", payload_size.value(), seg.payload.size() );
     }
+    if ( tsval.has_value() and seg.tsval != tsval ) {
+      throw MessageExpectationViolation( seg, "TSval", tsval, seg.tsval );
+    }
     if ( data.has_value() and data.value() != static_cast<std::string>( seg.payload ) ) {
       throw MessageExpectationViolation( seg, "payload", data.value(), static_cast<std::string>( seg.payload ) );
     }
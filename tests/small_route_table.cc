@@ -0,0 +1,125 @@
+#include "prefix_trie.hh"
+#include "random.hh"
+#include "small_route_table.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+using Kernel = SmallRouteTable::Kernel;
+
+string address_string( uint32_t address )
+{
+  return to_string( address >> 24U ) + "." + to_string( ( address >> 16U ) & 0xffU ) + "."
+         + to_string( ( address >> 8U ) & 0xffU ) + "." + to_string( address & 0xffU );
+}
+
+vector<Kernel> supported_kernels()
+{
+  vector<Kernel> kernels;
+  for ( const Kernel kernel : { Kernel::Scalar, Kernel::SSE41, Kernel::AVX2 } ) {
+    if ( SmallRouteTable::supported( kernel ) ) {
+      kernels.push_back( kernel );
+    }
+  }
+  return kernels;
+}
+
+// Every supported kernel must agree with the trie
+void check_lookup( const SmallRouteTable& table, const PrefixTrie<uint32_t>& trie, uint32_t address )
+{
+  const uint32_t* expected = trie.lookup( address );
+  for ( const Kernel kernel : supported_kernels() ) {
+    const optional<uint32_t> got = table.lookup( kernel, address );
+    if ( got.has_value() != ( expected != nullptr ) or ( got and *got != *expected ) ) {
+      throw runtime_error( string { SmallRouteTable::name( kernel ) } + " lookup of " + address_string( address )
+                           + " returned " + ( got ? to_string( *got ) : "nothing" ) + " instead of "
+                           + ( expected ? to_string( *expected ) : "nothing" ) );
+    }
+  }
+}
+
+void fills_up_and_empties()
+{
+  SmallRouteTable table;
+  PrefixTrie<uint32_t> trie;
+  for ( uint32_t i = 0; i < SmallRouteTable::CAPACITY; i++ ) {
+    // 10.i.0.0/16, plus a more specific /24 inside every other one
+    const uint32_t prefix = 0x0a000000 | ( i << 16U ) | ( i % 2 ) << 8U;
+    const auto length = static_cast<uint8_t>( i % 2 ? 24 : 16 );
+    if ( not table.insert( prefix, length, i ) ) {
+      throw runtime_error( "insert into a table that is not full failed" );
+    }
+    trie.insert( prefix, length, i );
+  }
+  if ( not table.full() or table.insert( 0, 0, 99 ) ) {
+    throw runtime_error( "a full table should refuse new prefixes" );
+  }
+  if ( not table.insert( 0x0a000000, 16, 100 ) ) {
+    throw runtime_error( "a full table should still replace existing prefixes" );
+  }
+  trie.insert( 0x0a000000, 16, 100 );
+  for ( uint32_t i = 0; i < SmallRouteTable::CAPACITY; i++ ) {
+    check_lookup( table, trie, 0x0a000000 | ( i << 16U ) | 0x0101U );
+    check_lookup( table, trie, 0x0a000000 | ( i << 16U ) | 0x0201U );
+  }
+
+  // erasing frees a slot, and the default route then fits
+  if ( not table.erase( 0x0a010100, 24 ) or table.erase( 0x0a010100, 24 ) ) {
+    throw runtime_error( "erase of 10.1.1.0/24 misbehaved" );
+  }
+  trie.erase( 0x0a010100, 24 );
+  if ( not table.insert( 0, 0, 99 ) ) {
+    throw runtime_error( "insert after erase failed" );
+  }
+  trie.insert( 0, 0, 99 );
+  for ( const uint32_t address : { 0x0a010101U, 0x0a020101U, 0x0b000000U, 0xffffffffU } ) {
+    check_lookup( table, trie, address );
+  }
+}
+
+void random_tables()
+{
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint32_t> any_address;
+  uniform_int_distribution<int> any_length { 0, 32 };
+
+  for ( size_t round = 0; round < 50; round++ ) {
+    SmallRouteTable table;
+    PrefixTrie<uint32_t> trie;
+    const size_t count = 1 + round % SmallRouteTable::CAPACITY;
+    for ( uint32_t i = 0; i < count; i++ ) {
+      // keep everything inside 10.0.0.0/14 so that the prefixes nest and the probes hit them
+      const uint32_t prefix = 0x0a000000 | ( any_address( rd ) & 0x3ffffU );
+      const auto length = static_cast<uint8_t>( any_length( rd ) );
+      table.insert( prefix, length, i );
+      trie.insert( prefix, length, i );
+    }
+    for ( size_t i = 0; i < 2000; i++ ) {
+      check_lookup( table, trie, i % 4 ? 0x0a000000 | ( any_address( rd ) & 0x3ffffU ) : any_address( rd ) );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    cerr << "SmallRouteTable kernel: " << SmallRouteTable::name( SmallRouteTable::best_kernel() ) << "\n";
+    fills_up_and_empties();
+    random_tables();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include "flat_hash_map.hh"
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_demux.hh"
+#include "tcp_over_ip.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint32_t CLIENT_IP = 0x0a000002; // 10.0.0.2
+constexpr uint16_t SERVER_PORT = 80;
+
+// Put a datagram "on the wire": copy it into freshly parsed (owned) buffers
+InternetDatagram wire( const InternetDatagram& dgram )
+{
+  InternetDatagram ret;
+  if ( not parse( ret, vector<string> { concat( serialize( dgram ) ) } ) ) {
+    throw runtime_error( "datagram did not survive the wire" );
+  }
+  return ret;
+}
+
+// Deliver datagrams in both directions until nothing is in flight
+void run( TCPDemultiplexer& client,
+          vector<InternetDatagram>& to_server,
+          TCPDemultiplexer& server,
+          vector<InternetDatagram>& to_client )
+{
+  while ( not to_server.empty() or not to_client.empty() ) {
+    auto batch = move( to_server );
+    to_server.clear();
+    for ( auto& dgram : batch ) {
+      server.receive( move( dgram ) );
+    }
+    batch = move( to_client );
+    to_client.clear();
+    for ( auto& dgram : batch ) {
+      client.receive( move( dgram ) );
+    }
+  }
+}
+
+void flat_hash_map_matches_unordered_map()
+{
+  auto rd = get_random_engine();
+  FlatHashMap<uint32_t, uint64_t> flat;
+  unordered_map<uint32_t, uint64_t> reference;
+
+  for ( unsigned int i = 0; i < 200000; i++ ) {
+    const uint32_t key = rd() % 5000;
+    switch ( rd() % 3 ) {
+      case 0:
+        flat[key] = i;
+        reference[key] = i;
+        break;
+      case 1:
+        if ( flat.erase( key ) != ( reference.erase( key ) > 0 ) ) {
+          throw runtime_error( "FlatHashMap::erase disagreed with std::unordered_map" );
+        }
+        break;
+      default: {
+        const uint64_t* value = flat.find( key );
+        const auto it = reference.find( key );
+        if ( ( value == nullptr ) != ( it == reference.end() ) or ( value and *value != it->second ) ) {
+          throw runtime_error( "FlatHashMap::find disagreed with std::unordered_map" );
+        }
+      }
+    }
+    if ( flat.size() != reference.size() ) {
+      throw runtime_error( "FlatHashMap::size disagreed with std::unordered_map" );
+    }
+  }
+
+  const size_t removed = flat.erase_if( []( uint32_t key, uint64_t ) { return key % 2 == 0; } );
+  const size_t expected_removed = erase_if( reference, []( const auto& entry ) { return entry.first % 2 == 0; } );
+  if ( removed != expected_removed or flat.size() != reference.size() ) {
+    throw runtime_error( "FlatHashMap::erase_if removed the wrong number of entries" );
+  }
+  for ( const auto& [key, value] : reference ) {
+    if ( flat.find( key ) == nullptr or *flat.find( key ) != value ) {
+      throw runtime_error( "FlatHashMap lost an entry in erase_if" );
+    }
+  }
+}
+
+void many_connections()
+{
+  vector<InternetDatagram> to_server;
+  vector<InternetDatagram> to_client;
+  TCPDemultiplexer server { {}, [&]( const InternetDatagram& d ) { to_client.push_back( wire( d ) ); } };
+  TCPDemultiplexer client { {}, [&]( const InternetDatagram& d ) { to_server.push_back( wire( d ) ); } };
+  constexpr uint16_t count = 500;
+  // every handshake completes before the application calls accept()
+  server.listen( SERVER_PORT, { .syn_backlog = count, .accept_backlog = count } );
+
+  for ( uint16_t i = 0; i < count; i++ ) {
+    client.connect( { .local_ip = CLIENT_IP,
+                      .remote_ip = SERVER_IP,
+                      .local_port = static_cast<uint16_t>( 10000 + i ),
+                      .remote_port = SERVER_PORT } );
+  }
+  run( client, to_server, server, to_client );
+
+  if ( server.connection_count() != count or client.connection_count() != count ) {
+    throw runtime_error( "expected " + to_string( count ) + " connections on each side" );
+  }
+
+  // accept every connection and greet it with its own port number
+  size_t accepted = 0;
+  while ( auto tuple = server.accept() ) {
+    if ( tuple->local_ip != SERVER_IP or tuple->remote_ip != CLIENT_IP or tuple->local_port != SERVER_PORT ) {
+      throw runtime_error( "accepted unexpected connection " + tuple->to_string() );
+    }
+    server.find( *tuple )->outbound_writer().push( "hello " + to_string( tuple->remote_port ) );
+    server.push( *tuple );
+    ++accepted;
+  }
+  if ( accepted != count ) {
+    throw runtime_error( "accepted " + to_string( accepted ) + " connections instead of " + to_string( count ) );
+  }
+  run( client, to_server, server, to_client );
+
+  for ( uint16_t i = 0; i < count; i++ ) {
+    const uint16_t port = 10000 + i;
+    TCPPeer* peer = client.find(
+      { .local_ip = CLIENT_IP, .remote_ip = SERVER_IP, .local_port = port, .remote_port = SERVER_PORT } );
+    if ( not peer ) {
+      throw runtime_error( "client lost connection from port " + to_string( port ) );
+    }
+    string data;
+    read( peer->inbound_reader(), peer->inbound_reader().bytes_buffered(), data );
+    if ( data != "hello " + to_string( port ) ) {
+      throw runtime_error( "connection from port " + to_string( port ) + " received \"" + data + "\"" );
+    }
+  }
+
+  // a SYN to a port nobody listens on, and a stray ACK to the listening port, must not create connections
+  const TCPSenderMessage syn { .seqno = Wrap32 { 12345 }, .SYN = true };
+  const TCPSenderMessage stray { .seqno = Wrap32 { 12345 } };
+  const TCPReceiverMessage no_ack { .window_size = 1000 };
+  const TCPReceiverMessage ack { .ackno = Wrap32 { 54321 }, .window_size = 1000 };
+  to_server.push_back( wire( TCPOverIPv4Adapter::wrap_tcp_in_ip(
+    { .sender = borrow( syn ), .receiver = borrow( no_ack ) }, CLIENT_IP, 9999, SERVER_IP, SERVER_PORT + 1 ) ) );
+  to_server.push_back( wire( TCPOverIPv4Adapter::wrap_tcp_in_ip(
+    { .sender = borrow( stray ), .receiver = borrow( ack ) }, CLIENT_IP, 9998, SERVER_IP, SERVER_PORT ) ) );
+  run( client, to_server, server, to_client );
+  if ( server.connection_count() != count or server.accept().has_value() ) {
+    throw runtime_error( "a segment that is not a SYN to a listening port created a connection" );
+  }
+
+  // close every connection from both sides; after lingering, both tables empty out
+  for ( uint16_t i = 0; i < count; i++ ) {
+    const TCPFourTuple tuple { .local_ip = CLIENT_IP,
+                               .remote_ip = SERVER_IP,
+                               .local_port = static_cast<uint16_t>( 10000 + i ),
+                               .remote_port = SERVER_PORT };
+    client.find( tuple )->outbound_writer().close();
+    client.push( tuple );
+  }
+  run( client, to_server, server, to_client );
+  for ( uint16_t i = 0; i < count; i++ ) {
+    const TCPFourTuple tuple { .local_ip = SERVER_IP,
+                               .remote_ip = CLIENT_IP,
+                               .local_port = SERVER_PORT,
+                               .remote_port = static_cast<uint16_t>( 10000 + i ) };
+    server.find( tuple )->outbound_writer().close();
+    server.push( tuple );
+  }
+  run( client, to_server, server, to_client );
+
+  for ( int i = 0; i < 100; i++ ) {
+    client.tick( TCPConfig::TIMEOUT_DFLT );
+    server.tick( TCPConfig::TIMEOUT_DFLT );
+    run( client, to_server, server, to_client );
+  }
+  if ( server.connection_count() != 0 or client.connection_count() != 0 ) {
+    throw runtime_error( "finished connections were not forgotten (server has "
+                         + to_string( server.connection_count() ) + ", client has "
+                         + to_string( client.connection_count() ) + ")" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    flat_hash_map_matches_unordered_map();
+    many_connections();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
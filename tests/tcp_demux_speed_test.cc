@@ -0,0 +1,184 @@
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_demux.hh"
+#include "tcp_over_ip.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint16_t SERVER_PORT = 80;
+
+// The client side of one connection, as seen by the server
+struct Client
+{
+  TCPFourTuple tuple {};   // from the server's point of view
+  Wrap32 isn { 0 };        // the client's ISN
+  Wrap32 server_isn { 0 }; // the server's ISN, learned from its SYN-ACK
+};
+
+string wrap( const Client& client, const TCPSenderMessage& sender, const TCPReceiverMessage& receiver )
+{
+  const TCPMessage msg { .sender = borrow( sender ), .receiver = borrow( receiver ) };
+  return concat( serialize( TCPOverIPv4Adapter::wrap_tcp_in_ip(
+    msg, client.tuple.remote_ip, client.tuple.remote_port, client.tuple.local_ip, client.tuple.local_port ) ) );
+}
+
+InternetDatagram from_wire( const string& bytes )
+{
+  InternetDatagram dgram;
+  if ( not parse( dgram, vector<string> { bytes } ) ) {
+    throw runtime_error( "could not parse datagram" );
+  }
+  return dgram;
+}
+
+void report( string_view what, string_view unit, double per_second, fstream& debug_output )
+{
+  cout << "TCPDemultiplexer " << what << ": " << fixed << setprecision( 2 ) << per_second / 1e6 << " M" << unit
+       << "/s (" << setprecision( 1 ) << 1e9 / per_second << " ns each)\n";
+  debug_output << "        TCPDemultiplexer " << what << fixed << setprecision( 2 ) << setw( 8 ) << per_second / 1e6
+               << " M" << unit << "/s\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  constexpr size_t connection_count = 20000;
+  auto rd = get_random_engine();
+
+  vector<Client> clients( connection_count );
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    clients[i].tuple = { .local_ip = SERVER_IP,
+                         .remote_ip = 0x0b000000 + static_cast<uint32_t>( i / 1000 ),
+                         .local_port = SERVER_PORT,
+                         .remote_port = static_cast<uint16_t>( 10000 + i % 1000 ) };
+    clients[i].isn = Wrap32 { static_cast<uint32_t>( rd() ) };
+  }
+
+  // The server's most recent reply (only the SYN-ACK's seqno is needed)
+  optional<Wrap32> reply_seqno;
+  TCPDemultiplexer server { {}, [&]( const InternetDatagram& dgram ) {
+                             TCPSegment seg;
+                             const uint32_t pseudo_checksum = dgram.header.pseudo_checksum();
+                             if ( parse( seg, vector<string> { concat( dgram.payload ) }, pseudo_checksum ) ) {
+                               reply_seqno = seg.message.sender->seqno;
+                             }
+                           } };
+  server.listen( SERVER_PORT );
+
+  vector<string> syns;
+  syns.reserve( connection_count );
+  for ( const auto& client : clients ) {
+    syns.push_back( wrap( client, { .seqno = client.isn, .SYN = true }, { .window_size = 65535 } ) );
+  }
+
+  // Connections per second: SYN in, SYN-ACK out, ACK in, accept
+  size_t accepted = 0;
+  const auto handshake_start = steady_clock::now();
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    Client& client = clients[i];
+    server.receive( from_wire( syns[i] ) );
+    client.server_isn = reply_seqno.value();
+    server.receive( from_wire(
+      wrap( client, { .seqno = client.isn + 1 }, { .ackno = client.server_isn + 1, .window_size = 65535 } ) ) );
+    accepted += server.accept().has_value();
+  }
+  const auto handshake_stop = steady_clock::now();
+
+  if ( accepted != connection_count or server.connection_count() != connection_count ) {
+    throw runtime_error( "only " + to_string( accepted ) + " of " + to_string( connection_count )
+                         + " handshakes completed" );
+  }
+  report( "handshakes  ",
+          "conn",
+          connection_count / duration_cast<duration<double>>( handshake_stop - handshake_start ).count(),
+          debug_output );
+
+  // Per-packet lookup cost: the connection table alone, compared with std::unordered_map
+  constexpr size_t lookup_count = 5000000;
+  vector<uint32_t> order( lookup_count );
+  for ( auto& x : order ) {
+    x = rd() % connection_count;
+  }
+
+  size_t found = 0;
+  const auto lookup_start = steady_clock::now();
+  for ( const auto i : order ) {
+    found += server.find( clients[i].tuple ) != nullptr;
+  }
+  const auto lookup_stop = steady_clock::now();
+
+  unordered_map<TCPFourTuple, size_t, TCPFourTupleHash> reference;
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    reference.emplace( clients[i].tuple, i );
+  }
+  const auto reference_start = steady_clock::now();
+  for ( const auto i : order ) {
+    found += reference.contains( clients[i].tuple );
+  }
+  const auto reference_stop = steady_clock::now();
+
+  if ( found != 2 * lookup_count ) {
+    throw runtime_error( "connection lookup failed" );
+  }
+  const double lookups_per_second
+    = lookup_count / duration_cast<duration<double>>( lookup_stop - lookup_start ).count();
+  report( "lookup      ", "pkt", lookups_per_second, debug_output );
+  report( "(unord_map) ",
+          "pkt",
+          lookup_count / duration_cast<duration<double>>( reference_stop - reference_start ).count(),
+          debug_output );
+
+  // Per-packet cost of the whole receive path (parse, lookup, deliver) for pure ACKs to random connections
+  constexpr size_t packet_count = 200000;
+  vector<string> acks;
+  acks.reserve( connection_count );
+  for ( const auto& client : clients ) {
+    acks.push_back(
+      wrap( client, { .seqno = client.isn + 1 }, { .ackno = client.server_isn + 1, .window_size = 65535 } ) );
+  }
+
+  const auto receive_start = steady_clock::now();
+  for ( size_t i = 0; i < packet_count; i++ ) {
+    server.receive( from_wire( acks[order[i]] ) );
+  }
+  const auto receive_stop = steady_clock::now();
+
+  if ( server.connection_count() != connection_count ) {
+    throw runtime_error( "connections were lost while receiving ACKs" );
+  }
+  report( "receive     ",
+          "pkt",
+          packet_count / duration_cast<duration<double>>( receive_stop - receive_start ).count(),
+          debug_output );
+
+  if ( lookups_per_second < 1e6 ) {
+    throw runtime_error( "TCPDemultiplexer lookup did not meet minimum speed of 1 M/s" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#include "common.hh"
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_demux.hh"
+#include "tcp_over_ip.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint32_t CLIENT_IP = 0x0a000002; // 10.0.0.2
+constexpr uint16_t SERVER_PORT = 80;
+
+// A listening TCPDemultiplexer, driven by hand-made segments from many (imaginary) clients
+class Server
+{
+public:
+  explicit Server( const TCPDemultiplexer::ListenOptions& options ) { demux_.listen( SERVER_PORT, options ); }
+
+  static TCPFourTuple tuple( uint16_t client_port )
+  {
+    return { .local_ip = SERVER_IP, .remote_ip = CLIENT_IP, .local_port = SERVER_PORT, .remote_port = client_port };
+  }
+
+  void send( uint16_t client_port,
+             const TCPSenderMessage& sender,
+             const TCPReceiverMessage& receiver = { .window_size = 1000 } )
+  {
+    const TCPMessage msg { .sender = borrow( sender ), .receiver = borrow( receiver ) };
+    const InternetDatagram sent
+      = TCPOverIPv4Adapter::wrap_tcp_in_ip( msg, CLIENT_IP, client_port, SERVER_IP, SERVER_PORT );
+    InternetDatagram dgram;
+    if ( not parse( dgram, vector<string> { concat( serialize( sent ) ) } ) ) {
+      throw runtime_error( "could not build datagram" );
+    }
+    demux_.receive( move( dgram ) );
+  }
+
+  void syn( uint16_t client_port, Wrap32 isn ) { send( client_port, { .seqno = isn, .SYN = true } ); }
+
+  void ack( uint16_t client_port, Wrap32 seqno, Wrap32 ackno, string payload = {} )
+  {
+    send( client_port, { .seqno = seqno, .payload = move( payload ) }, { .ackno = ackno, .window_size = 1000 } );
+  }
+
+  // The server's replies since the last call
+  vector<TCPSegment> replies() { return exchange( replies_, {} ); }
+
+  // The seqno of the one SYN-ACK sent since the last call
+  Wrap32 syn_ack()
+  {
+    auto segs = replies();
+    if ( segs.size() != 1 or not segs.front().message.sender->SYN
+         or not segs.front().message.receiver->ackno.has_value() ) {
+      throw runtime_error( "expected exactly one SYN-ACK, got " + to_string( segs.size() ) + " segments" );
+    }
+    return segs.front().message.sender->seqno;
+  }
+
+  TCPDemultiplexer& demux() { return demux_; }
+  const TCPDemultiplexer::ListenerCounters& counters() const { return demux_.counters( SERVER_PORT ); }
+
+private:
+  vector<TCPSegment> replies_ {};
+  TCPDemultiplexer demux_ { {}, [this]( const InternetDatagram& dgram ) {
+                             TCPSegment seg;
+                             const uint32_t pseudo_checksum = dgram.header.pseudo_checksum();
+                             if ( not parse( seg, vector<string> { concat( dgram.payload ) }, pseudo_checksum ) ) {
+                               throw runtime_error( "server sent an unparseable segment" );
+                             }
+                             replies_.push_back( move( seg ) );
+                           } };
+};
+
+void syn_queue_overflows_into_cookies()
+{
+  Server server { { .syn_backlog = 4, .accept_backlog = 100 } };
+  auto rd = get_random_engine();
+
+  vector<Wrap32> client_isns;
+  vector<Wrap32> server_isns;
+  for ( uint16_t port = 1000; port < 1008; port++ ) {
+    client_isns.emplace_back( static_cast<uint32_t>( rd() ) );
+    server.syn( port, client_isns.back() );
+    server_isns.push_back( server.syn_ack() );
+  }
+  expect( server.demux().connection_count() == 4, "only the SYN queue's four connections should have state" );
+  expect( server.counters().syns_received == 8, "expected 8 SYNs received" );
+  expect( server.counters().syn_cookies_sent == 4, "expected 4 SYN cookies" );
+
+  // complete every handshake; the last four rely on their cookies (the last also carries data)
+  for ( uint16_t i = 0; i < 8; i++ ) {
+    server.ack( 1000 + i, client_isns[i] + 1, server_isns[i] + 1, i == 7 ? "hello" : "" );
+  }
+  expect( server.demux().connection_count() == 8, "every handshake should have completed" );
+  expect( server.counters().syn_cookies_accepted == 4, "expected 4 cookies accepted" );
+
+  size_t accepted = 0;
+  while ( server.demux().accept().has_value() ) {
+    accepted++;
+  }
+  expect( accepted == 8, "expected 8 connections to accept, got " + to_string( accepted ) );
+
+  TCPPeer* last = server.demux().find( Server::tuple( 1007 ) );
+  string data;
+  read( last->inbound_reader(), 100, data );
+  expect( data == "hello", "data on the cookie-completing ACK was not delivered" );
+}
+
+void bad_cookies_are_rejected()
+{
+  Server server { { .syn_backlog = 0 } }; // every SYN is answered with a cookie
+  const Wrap32 client_isn { 5000 };
+
+  server.syn( 2000, client_isn );
+  const Wrap32 cookie = server.syn_ack();
+  expect( server.demux().connection_count() == 0, "a cookie SYN-ACK must not create state" );
+
+  server.ack( 2000, client_isn + 1, cookie + 2 ); // wrong ackno
+  server.ack( 2000, client_isn + 2, cookie + 1 ); // wrong client ISN
+  server.ack( 2001, client_isn + 1, cookie + 1 ); // wrong 4-tuple
+  expect( server.demux().connection_count() == 0, "forged ACKs must not create connections" );
+  expect( server.counters().syn_cookies_rejected == 3, "expected 3 rejected cookies" );
+
+  // cookies stay valid for a while...
+  server.demux().tick( TCPDemultiplexer::COOKIE_PERIOD_MS );
+  server.ack( 2000, client_isn + 1, cookie + 1 );
+  expect( server.demux().connection_count() == 1, "a one-period-old cookie should be accepted" );
+
+  // ...but not forever
+  server.syn( 2002, client_isn );
+  const Wrap32 old_cookie = server.syn_ack();
+  server.demux().tick( ( TCPDemultiplexer::MAX_COOKIE_AGE + 1 ) * TCPDemultiplexer::COOKIE_PERIOD_MS );
+  server.ack( 2002, client_isn + 1, old_cookie + 1 );
+  expect( server.demux().find( Server::tuple( 2002 ) ) == nullptr, "an expired cookie should be rejected" );
+}
+
+void full_syn_queue_without_cookies_drops()
+{
+  Server server { { .syn_backlog = 2, .syn_cookies = false } };
+  for ( uint16_t port = 3000; port < 3004; port++ ) {
+    server.syn( port, Wrap32 { port } );
+  }
+  expect( server.replies().size() == 2, "only two SYNs should have been answered" );
+  expect( server.demux().connection_count() == 2, "expected two half-open connections" );
+  expect( server.counters().syns_dropped == 2, "expected two dropped SYNs" );
+}
+
+void full_accept_queue_holds_back_handshake()
+{
+  Server server { { .syn_backlog = 8, .accept_backlog = 1 } };
+  server.syn( 4000, Wrap32 { 100 } );
+  const Wrap32 first = server.syn_ack();
+  server.syn( 4001, Wrap32 { 200 } );
+  const Wrap32 second = server.syn_ack();
+
+  server.ack( 4000, Wrap32 { 101 }, first + 1 );
+  server.ack( 4001, Wrap32 { 201 }, second + 1 );
+  expect( server.counters().accept_queue_overflows == 1, "the second handshake should have overflowed" );
+
+  expect( server.demux().accept() == Server::tuple( 4000 ), "expected to accept the first connection" );
+  expect( not server.demux().accept().has_value(), "the second connection should still be half-open" );
+
+  // the client's retransmitted ACK completes the handshake once there is room
+  server.ack( 4001, Wrap32 { 201 }, second + 1 );
+  expect( server.demux().accept() == Server::tuple( 4001 ), "expected to accept the second connection" );
+}
+
+void abandoned_half_open_connections_expire()
+{
+  Server server { { .syn_backlog = 2 } };
+  server.syn( 5000, Wrap32 { 1 } );
+  server.syn( 5001, Wrap32 { 2 } );
+  expect( server.demux().connection_count() == 2, "expected two half-open connections" );
+
+  // the SYN-ACKs are retransmitted until the server gives up, which frees up the SYN queue
+  for ( unsigned i = 0; i <= TCPConfig::MAX_RETX_ATTEMPTS; i++ ) {
+    server.demux().tick( uint64_t { TCPConfig::TIMEOUT_DFLT } << i );
+  }
+  expect( server.demux().connection_count() == 0, "abandoned half-open connections should be forgotten" );
+  server.replies();
+  server.syn( 5002, Wrap32 { 3 } );
+  server.syn_ack();
+  expect( server.demux().connection_count() == 1, "the SYN queue should have room again" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    syn_queue_overflows_into_cookies();
+    bad_cookies_are_rejected();
+    full_syn_queue_without_cookies_drops();
+    full_accept_queue_holds_back_handshake();
+    abandoned_half_open_connections_expire();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_demux.hh"
+#include "tcp_over_ip.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint16_t SERVER_PORT = 80;
+
+InternetDatagram make_datagram( uint32_t src_ip,
+                                uint16_t src_port,
+                                const TCPSenderMessage& sender,
+                                const TCPReceiverMessage& receiver )
+{
+  const TCPMessage msg { .sender = borrow( sender ), .receiver = borrow( receiver ) };
+  const InternetDatagram dgram
+    = TCPOverIPv4Adapter::wrap_tcp_in_ip( msg, src_ip, src_port, SERVER_IP, SERVER_PORT );
+  InternetDatagram ret;
+  if ( not parse( ret, vector<string> { concat( serialize( dgram ) ) } ) ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return ret;
+}
+
+struct FloodResult
+{
+  size_t accepted;
+  size_t connections_with_state;
+  double seconds;
+};
+
+// Complete `legit_count` handshakes while `flood_ratio` spoofed SYNs (never followed by an ACK)
+// arrive before each legitimate one
+FloodResult run_flood( bool syn_cookies, size_t legit_count, size_t flood_ratio )
+{
+  auto rd = get_random_engine();
+
+  optional<Wrap32> syn_ack_seqno;
+  TCPDemultiplexer server { {}, [&]( const InternetDatagram& dgram ) {
+                             TCPSegment seg;
+                             const uint32_t pseudo_checksum = dgram.header.pseudo_checksum();
+                             if ( parse( seg, vector<string> { concat( dgram.payload ) }, pseudo_checksum )
+                                  and seg.message.sender->SYN ) {
+                               syn_ack_seqno = seg.message.sender->seqno;
+                             }
+                           } };
+  server.listen( SERVER_PORT, { .syn_backlog = 256, .accept_backlog = 128, .syn_cookies = syn_cookies } );
+
+  // prepare the flood ahead of time, so that only the server's work is timed
+  vector<InternetDatagram> flood;
+  flood.reserve( legit_count * flood_ratio );
+  for ( size_t i = 0; i < legit_count * flood_ratio; i++ ) {
+    flood.push_back( make_datagram( 0xc0000000 | static_cast<uint32_t>( rd() ),
+                                    static_cast<uint16_t>( rd() ),
+                                    { .seqno = Wrap32 { static_cast<uint32_t>( rd() ) }, .SYN = true },
+                                    { .window_size = 65535 } ) );
+  }
+  vector<InternetDatagram> syns;
+  syns.reserve( legit_count );
+  for ( size_t i = 0; i < legit_count; i++ ) {
+    syns.push_back( make_datagram( 0x0b000000 + static_cast<uint32_t>( i / 1000 ),
+                                   static_cast<uint16_t>( 10000 + i % 1000 ),
+                                   { .seqno = Wrap32 { static_cast<uint32_t>( i ) }, .SYN = true },
+                                   { .window_size = 65535 } ) );
+  }
+
+  size_t accepted = 0;
+  const auto start = steady_clock::now();
+  for ( size_t i = 0; i < legit_count; i++ ) {
+    for ( size_t j = 0; j < flood_ratio; j++ ) {
+      server.receive( move( flood[i * flood_ratio + j] ) );
+    }
+
+    syn_ack_seqno.reset();
+    server.receive( move( syns[i] ) );
+    if ( syn_ack_seqno.has_value() ) {
+      server.receive( make_datagram( 0x0b000000 + static_cast<uint32_t>( i / 1000 ),
+                                     static_cast<uint16_t>( 10000 + i % 1000 ),
+                                     { .seqno = Wrap32 { static_cast<uint32_t>( i + 1 ) } },
+                                     { .ackno = syn_ack_seqno.value() + 1, .window_size = 65535 } ) );
+    }
+
+    while ( server.accept().has_value() ) {
+      accepted++;
+    }
+  }
+  const auto stop = steady_clock::now();
+
+  return { .accepted = accepted,
+           .connections_with_state = server.connection_count(),
+           .seconds = duration_cast<duration<double>>( stop - start ).count() };
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  constexpr size_t legit_count = 10000;
+  constexpr size_t flood_ratio = 16;
+
+  for ( const bool syn_cookies : { true, false } ) {
+    const auto result = run_flood( syn_cookies, legit_count, flood_ratio );
+    const double accepts_per_second = static_cast<double>( result.accepted ) / result.seconds;
+    const double syns_per_second = static_cast<double>( legit_count * ( flood_ratio + 1 ) ) / result.seconds;
+
+    cout << "Listener under a " << flood_ratio << ":1 SYN flood, SYN cookies " << ( syn_cookies ? "on: " : "off:" )
+         << " accepted " << result.accepted << "/" << legit_count << " at " << fixed << setprecision( 1 )
+         << accepts_per_second / 1e3 << " K/s (" << syns_per_second / 1e6 << " M SYN/s), "
+         << result.connections_with_state << " connections with state\n";
+    debug_output << "        Listener SYN flood, cookies " << ( syn_cookies ? "on: " : "off:" ) << fixed
+                 << setprecision( 1 ) << setw( 8 ) << accepts_per_second / 1e3 << " K accepts/s ("
+                 << result.accepted * 100 / legit_count << "% of clients)\n";
+
+    // memory stays bounded by the SYN queue either way
+    if ( result.connections_with_state > 256 + result.accepted ) {
+      throw runtime_error( "the SYN flood created more state than the SYN queue allows" );
+    }
+    if ( syn_cookies and result.accepted != legit_count ) {
+      throw runtime_error( "with SYN cookies, every legitimate client should have been accepted" );
+    }
+    if ( syn_cookies and accepts_per_second < 1e4 ) {
+      throw runtime_error( "listener did not meet minimum speed of 10 K accepts/s under a SYN flood" );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
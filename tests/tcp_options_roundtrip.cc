@@ -0,0 +1,151 @@
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_options.hh"
+#include "tcp_segment.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// Options as they will look after a round trip (SACK blocks that don't fit are dropped)
+TCPOptions canonical( TCPOptions opts )
+{
+  opts.sack_block_count = opts.serialized_sack_block_count();
+  for ( size_t i = opts.sack_block_count; i < TCPOptions::MAX_SACK_BLOCKS; i++ ) {
+    opts.sack_blocks.at( i ) = {};
+  }
+  return opts;
+}
+
+TCPOptions random_options( default_random_engine& rd )
+{
+  auto coin = [&] { return bernoulli_distribution { 0.5 }( rd ); };
+  TCPOptions opts;
+  if ( coin() ) {
+    opts.mss = static_cast<uint16_t>( rd() );
+  }
+  if ( coin() ) {
+    opts.window_scale = static_cast<uint8_t>( rd() % ( TCPOptions::MAX_WINDOW_SCALE + 1 ) );
+  }
+  opts.sack_permitted = coin();
+  const auto blocks = uniform_int_distribution<size_t> { 0, TCPOptions::MAX_SACK_BLOCKS }( rd );
+  for ( size_t i = 0; i < blocks; i++ ) {
+    opts.add_sack_block( { .left = static_cast<uint32_t>( rd() ), .right = static_cast<uint32_t>( rd() ) } );
+  }
+  if ( coin() ) {
+    opts.timestamps = { .tsval = static_cast<uint32_t>( rd() ), .tsecr = static_cast<uint32_t>( rd() ) };
+  }
+  return opts;
+}
+
+void check_options( const TCPOptions& actual, const TCPOptions& expected, const string& context )
+{
+  if ( actual != expected ) {
+    throw runtime_error( context + ": parsed {" + actual.to_string() + " } but expected {" + expected.to_string()
+                         + " }" );
+  }
+}
+
+// Structured options survive serialize -> parse, always aligned to 4 bytes and within 40 bytes.
+void options_roundtrip( default_random_engine& rd )
+{
+  const TCPOptions opts = random_options( rd );
+  const string bytes = concat( serialize( opts ) );
+  if ( bytes.size() != opts.serialized_length() or bytes.size() % 4 or bytes.size() > TCPOptions::MAX_LENGTH ) {
+    throw runtime_error( "options {" + opts.to_string() + " } serialized to " + to_string( bytes.size() )
+                         + " bytes" );
+  }
+
+  TCPOptions parsed;
+  if ( not parse( parsed, vector<string> { bytes }, bytes.size() ) ) {
+    throw runtime_error( "failed to parse serialized options {" + opts.to_string() + " }" );
+  }
+  check_options( parsed, canonical( opts ), "options roundtrip" );
+}
+
+// Arbitrary bytes must never crash the parser, and whatever it accepts must be stable on re-serialization.
+void options_garbage( default_random_engine& rd )
+{
+  const auto len = 4 * uniform_int_distribution<size_t> { 0, TCPOptions::MAX_LENGTH / 4 }( rd );
+  string bytes( len, 0 );
+  for ( auto& ch : bytes ) {
+    // bias towards small values so that option kinds and lengths are often plausible
+    ch = static_cast<char>( bernoulli_distribution { 0.5 }( rd ) ? rd() % 12 : rd() );
+  }
+
+  TCPOptions parsed;
+  if ( not parse( parsed, vector<string> { bytes }, bytes.size() ) ) {
+    return;
+  }
+
+  const string reserialized = concat( serialize( parsed ) );
+  TCPOptions reparsed;
+  if ( not parse( reparsed, vector<string> { reserialized }, reserialized.size() ) ) {
+    throw runtime_error( "failed to re-parse options {" + parsed.to_string() + " }" );
+  }
+  check_options( reparsed, canonical( parsed ), "garbage roundtrip" );
+}
+
+// A whole segment (header, options, timestamps and payload) survives serialize -> parse.
+void segment_roundtrip( default_random_engine& rd )
+{
+  TCPSegment seg;
+  seg.udinfo.src_port = static_cast<uint16_t>( rd() );
+  seg.udinfo.dst_port = static_cast<uint16_t>( rd() );
+  seg.message.sender->seqno = Wrap32 { static_cast<uint32_t>( rd() ) };
+  seg.message.sender->SYN = rd() % 2;
+  seg.message.sender->payload = string( rd() % 100, 'x' );
+  seg.message.receiver->ackno = Wrap32 { static_cast<uint32_t>( rd() ) };
+  seg.message.receiver->window_size = static_cast<uint16_t>( rd() );
+  seg.options = random_options( rd );
+  seg.options.timestamps.reset();
+  if ( rd() % 2 ) {
+    seg.message.sender->tsval = static_cast<uint32_t>( rd() );
+    seg.message.receiver->tsecr = static_cast<uint32_t>( rd() );
+  }
+
+  const uint32_t pseudo_checksum = rd() % 65536;
+  seg.compute_checksum( pseudo_checksum );
+  const string bytes = concat( serialize( seg ) );
+  if ( bytes.size() != seg.header_length() + seg.message.sender->payload.size() ) {
+    throw runtime_error( "segment " + seg.to_string() + " has wrong serialized length" );
+  }
+
+  TCPSegment parsed;
+  if ( not parse( parsed, vector<string> { bytes }, pseudo_checksum ) ) {
+    throw runtime_error( "failed to parse serialized segment " + seg.to_string() );
+  }
+  if ( parsed.message.sender->tsval != seg.message.sender->tsval
+       or parsed.message.receiver->tsecr != seg.message.receiver->tsecr
+       or parsed.message.sender->payload != seg.message.sender->payload ) {
+    throw runtime_error( "segment roundtrip: parsed " + parsed.to_string() + " but expected " + seg.to_string() );
+  }
+  TCPOptions expected = canonical( seg.options_to_send() );
+  check_options( parsed.options, expected, "segment roundtrip" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+    for ( size_t i = 0; i < 20000; i++ ) {
+      options_roundtrip( rd );
+      options_garbage( rd );
+      segment_roundtrip( rd );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include "helpers.hh"
+#include "tcp_options.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void speed_test( const TCPOptions& opts, const size_t count, string_view scenario )
+{
+  // Serialize the options many times back-to-back, as they would appear in a stream of headers
+  const string one = concat( serialize( opts ) );
+  string data;
+  data.reserve( one.size() * count );
+  for ( size_t i = 0; i < count; ++i ) {
+    data.append( one );
+  }
+
+  Parser parser { vector<string> { move( data ) } };
+  TCPOptions parsed;
+  size_t mismatches = 0;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < count; ++i ) {
+    parsed.parse( parser, one.size() );
+    mismatches += ( parsed != opts );
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( parser.has_error() or mismatches ) {
+    throw runtime_error( "TCPOptions did not parse back to the serialized options" );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto parses_per_second = static_cast<double>( count ) / test_duration.count();
+  auto ns_per_parse = 1e9 / parses_per_second;
+
+  cout << "TCPOptions parse (" << one.size() << " bytes," << opts.to_string() << " ) reached " << fixed
+       << setprecision( 2 ) << parses_per_second / 1e6 << " M/s (" << setprecision( 1 ) << ns_per_parse
+       << " ns/parse).\n";
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+  debug_output << "        TCPOptions parse throughput " << scenario << fixed << setprecision( 2 ) << setw( 6 )
+               << parses_per_second / 1e6 << " M/s\n";
+
+  if ( parses_per_second < 1e5 ) {
+    throw runtime_error( "TCPOptions parsing did not meet minimum speed of 0.1 M/s" );
+  }
+}
+
+void program_body()
+{
+  TCPOptions syn;
+  syn.mss = 1460;
+  syn.window_scale = 7;
+  syn.sack_permitted = true;
+  syn.timestamps = { .tsval = 123456, .tsecr = 0 };
+
+  TCPOptions ack;
+  ack.timestamps = { .tsval = 123456, .tsecr = 654321 };
+
+  TCPOptions sack = ack;
+  sack.add_sack_block( { .left = 1000, .right = 2000 } );
+  sack.add_sack_block( { .left = 3000, .right = 4000 } );
+  sack.add_sack_block( { .left = 5000, .right = 6000 } );
+
+  speed_test( syn, 1000000, "(SYN):         " );
+  speed_test( ack, 1000000, "(timestamps):  " );
+  speed_test( sack, 1000000, "(TS + 3 SACK): " );
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
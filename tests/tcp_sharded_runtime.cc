@@ -0,0 +1,181 @@
+#include "helpers.hh"
+#include "spsc_queue.hh"
+#include "tcp_sharded_runtime.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint32_t CLIENT_IP = 0x0a000002; // 10.0.0.2
+constexpr uint16_t SERVER_PORT = 7;
+
+InternetDatagram wire( const InternetDatagram& dgram )
+{
+  InternetDatagram ret;
+  if ( not parse( ret, vector<string> { concat( serialize( dgram ) ) } ) ) {
+    throw runtime_error( "datagram did not survive the wire" );
+  }
+  return ret;
+}
+
+void spsc_queue_preserves_order()
+{
+  constexpr uint64_t count = 1000000;
+  SPSCQueue<uint64_t> queue { 1024 };
+
+  thread producer { [&] {
+    for ( uint64_t i = 0; i < count; i++ ) {
+      uint64_t item = i;
+      while ( not queue.push( move( item ) ) ) {
+        this_thread::yield();
+      }
+    }
+  } };
+
+  uint64_t expected = 0;
+  while ( expected < count ) {
+    if ( auto item = queue.pop() ) {
+      if ( *item != expected ) {
+        producer.join();
+        throw runtime_error( "SPSCQueue delivered " + to_string( *item ) + " instead of " + to_string( expected ) );
+      }
+      expected++;
+    } else {
+      this_thread::yield();
+    }
+  }
+  producer.join();
+
+  if ( not queue.empty() or queue.pop().has_value() ) {
+    throw runtime_error( "SPSCQueue should be empty" );
+  }
+}
+
+void echo_server_across_shards()
+{
+  constexpr size_t worker_count = 4;
+  constexpr uint16_t connection_count = 200;
+
+  // server -> client datagrams, sent from the worker threads
+  mutex to_client_mutex;
+  vector<InternetDatagram> to_client;
+
+  TCPShardedRuntime server { {}, worker_count, [&]( size_t, const InternetDatagram& dgram ) {
+                              auto copy = wire( dgram );
+                              const lock_guard lock { to_client_mutex };
+                              to_client.push_back( move( copy ) );
+                            } };
+  server.listen( SERVER_PORT, { .syn_backlog = connection_count, .accept_backlog = connection_count } );
+
+  // each worker only touches its own entry
+  vector<vector<TCPFourTuple>> accepted( worker_count );
+  vector<size_t> misplaced( worker_count );
+
+  server.start( [&]( size_t shard, TCPDemultiplexer& demux ) {
+    while ( auto tuple = demux.accept() ) {
+      misplaced[shard] += server.shard_of( *tuple ) != shard;
+      accepted[shard].push_back( *tuple );
+    }
+    for ( const auto& tuple : accepted[shard] ) {
+      TCPPeer* peer = demux.find( tuple );
+      if ( peer and peer->inbound_reader().bytes_buffered() ) {
+        string data;
+        read( peer->inbound_reader(), peer->inbound_reader().bytes_buffered(), data );
+        peer->outbound_writer().push( data );
+        demux.push( tuple );
+      }
+    }
+  } );
+
+  vector<InternetDatagram> to_server;
+  TCPDemultiplexer client { {}, [&]( const InternetDatagram& dgram ) { to_server.push_back( wire( dgram ) ); } };
+  vector<TCPFourTuple> tuples;
+  for ( uint16_t i = 0; i < connection_count; i++ ) {
+    tuples.push_back( { .local_ip = CLIENT_IP,
+                        .remote_ip = SERVER_IP,
+                        .local_port = static_cast<uint16_t>( 20000 + i ),
+                        .remote_port = SERVER_PORT } );
+    client.connect( tuples.back() ).outbound_writer().push( "ping " + to_string( i ) );
+  }
+
+  vector<string> echoes( connection_count );
+  size_t complete = 0;
+  const auto deadline = steady_clock::now() + seconds { 10 };
+  auto last_tick = steady_clock::now();
+  while ( complete < connection_count and steady_clock::now() < deadline ) {
+    for ( auto& dgram : to_server ) {
+      server.dispatch( move( dgram ) );
+    }
+    to_server.clear();
+
+    vector<InternetDatagram> arrived;
+    {
+      const lock_guard lock { to_client_mutex };
+      swap( arrived, to_client );
+    }
+    for ( auto& dgram : arrived ) {
+      client.receive( move( dgram ) );
+    }
+
+    const auto now = steady_clock::now();
+    if ( now - last_tick >= milliseconds { 1 } ) {
+      client.tick( duration_cast<milliseconds>( now - last_tick ).count() );
+      last_tick = now;
+    }
+
+    complete = 0;
+    for ( uint16_t i = 0; i < connection_count; i++ ) {
+      Reader& reader = client.find( tuples[i] )->inbound_reader();
+      string data;
+      read( reader, reader.bytes_buffered(), data );
+      echoes[i] += data;
+      complete += echoes[i] == "ping " + to_string( i );
+    }
+    this_thread::yield();
+  }
+  server.stop();
+
+  if ( complete != connection_count ) {
+    throw runtime_error( "only " + to_string( complete ) + " of " + to_string( connection_count )
+                         + " connections got their echo" );
+  }
+
+  size_t total = 0;
+  for ( size_t shard = 0; shard < worker_count; shard++ ) {
+    if ( misplaced[shard] ) {
+      throw runtime_error( "shard " + to_string( shard ) + " accepted connections it does not own" );
+    }
+    if ( accepted[shard].empty() ) {
+      throw runtime_error( "shard " + to_string( shard ) + " got no connections" );
+    }
+    total += accepted[shard].size();
+  }
+  if ( total != connection_count ) {
+    throw runtime_error( "shards accepted " + to_string( total ) + " connections in total" );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    spsc_queue_preserves_order();
+    echo_server_across_shards();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
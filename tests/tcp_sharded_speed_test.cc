@@ -0,0 +1,182 @@
+#include "helpers.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_sharded_runtime.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr uint32_t SERVER_IP = 0x0a000001; // 10.0.0.1
+constexpr uint16_t SERVER_PORT = 80;
+constexpr size_t FLOW_COUNT = 1024;
+constexpr size_t SEGMENTS_PER_FLOW = 100;
+constexpr size_t PAYLOAD_SIZE = 200;
+
+struct Flow
+{
+  uint32_t ip {};
+  uint16_t port {};
+  Wrap32 server_isn { 0 };
+};
+
+InternetDatagram make_datagram( const Flow& flow,
+                                const TCPSenderMessage& sender,
+                                const TCPReceiverMessage& receiver )
+{
+  const TCPMessage msg { .sender = borrow( sender ), .receiver = borrow( receiver ) };
+  const InternetDatagram dgram
+    = TCPOverIPv4Adapter::wrap_tcp_in_ip( msg, flow.ip, flow.port, SERVER_IP, SERVER_PORT );
+  InternetDatagram ret;
+  if ( not parse( ret, vector<string> { concat( serialize( dgram ) ) } ) ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return ret;
+}
+
+// Dispatch everything, spinning while a shard's queue is full
+void dispatch_all( TCPShardedRuntime& runtime, vector<InternetDatagram>& dgrams )
+{
+  for ( auto& dgram : dgrams ) {
+    while ( not runtime.dispatch( move( dgram ) ) ) {
+      this_thread::yield();
+    }
+  }
+}
+
+void wait_for( const atomic<size_t>& counter, size_t target )
+{
+  const auto deadline = steady_clock::now() + seconds { 10 };
+  while ( counter.load( memory_order_acquire ) < target ) {
+    if ( steady_clock::now() > deadline ) {
+      throw runtime_error( "timed out waiting for the workers" );
+    }
+    this_thread::yield();
+  }
+}
+
+// Returns segments per second through a runtime with `worker_count` shards
+double run( size_t worker_count )
+{
+  vector<Flow> flows( FLOW_COUNT );
+  for ( size_t i = 0; i < FLOW_COUNT; i++ ) {
+    flows[i] = { .ip = 0x0b000000 + static_cast<uint32_t>( i / 256 ), .port = static_cast<uint16_t>( 1024 + i ) };
+  }
+
+  // During the handshakes, workers report the server's ISNs; afterwards they only count their ACKs
+  atomic<bool> handshaking { true };
+  mutex isns_mutex;
+  vector<pair<uint16_t, Wrap32>> isns;
+  atomic<size_t> syn_acks { 0 };
+  atomic<size_t> acks { 0 };
+
+  TCPShardedRuntime runtime { {}, worker_count, [&]( size_t, const InternetDatagram& dgram ) {
+                               if ( not handshaking.load( memory_order_relaxed ) ) {
+                                 acks.fetch_add( 1, memory_order_release );
+                                 return;
+                               }
+                               TCPSegment seg;
+                               const uint32_t pseudo_checksum = dgram.header.pseudo_checksum();
+                               if ( parse( seg, vector<string> { concat( dgram.payload ) }, pseudo_checksum )
+                                    and seg.message.sender->SYN ) {
+                                 const lock_guard lock { isns_mutex };
+                                 isns.emplace_back( seg.udinfo.dst_port, seg.message.sender->seqno );
+                                 syn_acks.fetch_add( 1, memory_order_release );
+                               }
+                             } };
+  runtime.listen( SERVER_PORT, { .syn_backlog = FLOW_COUNT, .accept_backlog = FLOW_COUNT } );
+  runtime.start( []( size_t, TCPDemultiplexer& demux ) {
+    while ( demux.accept().has_value() ) {}
+  } );
+
+  // Open every flow
+  vector<InternetDatagram> dgrams;
+  for ( size_t i = 0; i < FLOW_COUNT; i++ ) {
+    dgrams.push_back(
+      make_datagram( flows[i], { .seqno = Wrap32 { 0 }, .SYN = true }, { .window_size = UINT16_MAX } ) );
+  }
+  dispatch_all( runtime, dgrams );
+  wait_for( syn_acks, FLOW_COUNT );
+  {
+    const lock_guard lock { isns_mutex };
+    for ( const auto& [port, isn] : isns ) {
+      flows.at( port - 1024 ).server_isn = isn;
+    }
+  }
+  dgrams.clear();
+  for ( const auto& flow : flows ) {
+    dgrams.push_back( make_datagram(
+      flow, { .seqno = Wrap32 { 1 } }, { .ackno = flow.server_isn + 1, .window_size = UINT16_MAX } ) );
+  }
+  dispatch_all( runtime, dgrams );
+
+  // Prepare the data segments, interleaving the flows
+  dgrams.clear();
+  const string payload( PAYLOAD_SIZE, 'x' );
+  for ( size_t segment = 0; segment < SEGMENTS_PER_FLOW; segment++ ) {
+    for ( const auto& flow : flows ) {
+      const Wrap32 seqno = Wrap32 { 1 } + static_cast<uint32_t>( segment * PAYLOAD_SIZE );
+      const TCPReceiverMessage ack { .ackno = flow.server_isn + 1, .window_size = UINT16_MAX };
+      dgrams.push_back( make_datagram( flow, { .seqno = seqno, .payload = payload }, ack ) );
+    }
+  }
+  // (let the final ACKs of the handshakes drain before switching the transmit function over)
+  this_thread::sleep_for( milliseconds { 50 } );
+  handshaking = false;
+
+  const auto start = steady_clock::now();
+  dispatch_all( runtime, dgrams );
+  wait_for( acks, FLOW_COUNT * SEGMENTS_PER_FLOW );
+  const auto stop = steady_clock::now();
+  runtime.stop();
+
+  return FLOW_COUNT * SEGMENTS_PER_FLOW / duration_cast<duration<double>>( stop - start ).count();
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const size_t cores = max( 1U, thread::hardware_concurrency() );
+  double single = 0;
+  for ( const size_t workers : { 1, 2, 4 } ) {
+    const double segments_per_second = run( workers );
+    if ( workers == 1 ) {
+      single = segments_per_second;
+    }
+    cout << "TCPShardedRuntime with " << workers << " worker(s) on " << cores << " core(s): " << FLOW_COUNT
+         << " flows, " << fixed << setprecision( 2 ) << segments_per_second / 1e6 << " M segments/s ("
+         << setprecision( 2 ) << segments_per_second / single << "x)\n";
+    debug_output << "        TCPShardedRuntime " << workers << " worker(s): " << fixed << setprecision( 2 )
+                 << setw( 6 ) << segments_per_second / 1e6 << " M segments/s\n";
+
+    if ( segments_per_second < 1e4 ) {
+      throw runtime_error( "TCPShardedRuntime did not meet minimum speed of 10 K segments/s" );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+#include "network_test_helpers.hh"
+#include "router.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+size_t allocations = 0; // by operator new, in this whole program
+}
+
+void* operator new( size_t size )
+{
+  allocations++;
+  if ( void* p = malloc( size == 0 ? 1 : size ) ) {
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+  free( p );
+}
+
+namespace {
+constexpr size_t DATAGRAMS = 1000;
+
+// Remembers where the last frame's pieces were, without copying them (or allocating)
+class PiecesOut : public NetworkInterface::OutputPort
+{
+public:
+  void transmit( const NetworkInterface&, const EthernetFrame& frame ) override
+  {
+    if ( frame.header.type == EthernetHeader::TYPE_IPv4 ) {
+      datagrams++;
+      pieces = frame.payload.size();
+      header_size = frame.payload.front()->size();
+      payload_data = frame.payload.back()->data();
+    }
+  }
+  size_t datagrams {};
+  size_t pieces {};
+  size_t header_size {};
+  const char* payload_data {};
+};
+
+// Teach an interface a neighbour's Ethernet address
+void learn( NetworkInterface& iface, uint32_t neighbour )
+{
+  iface.recv_frame( arp_reply_to( iface, { 2, 0, 0, 0, 0, 9 }, neighbour ) );
+}
+
+// The payload's own buffer reaches the port, behind a header serialized on its own
+void payload_is_not_copied()
+{
+  const auto port = make_shared<PiecesOut>();
+  NetworkInterface iface { "eth0", port, { 2, 0, 0, 0, 0, 1 }, Address { "10.0.0.1" } };
+
+  // once the next hop is known
+  learn( iface, ip( "10.0.0.2" ) );
+  InternetDatagram dgram = make_datagram( ip( "10.0.0.1" ), ip( "192.0.2.1" ) );
+  const char* data = dgram.payload.front()->data();
+  iface.send_datagram( move( dgram ), Address { "10.0.0.2" } );
+  expect( port->datagrams == 1 and port->pieces == 2 and port->header_size == IPv4Header::LENGTH,
+          "the frame was the header and the payload" );
+  expect( port->payload_data == data, "the payload was copied" );
+
+  // and while it is being resolved
+  dgram = make_datagram( ip( "10.0.0.1" ), ip( "192.0.2.1" ) );
+  data = dgram.payload.front()->data();
+  iface.send_datagram( move( dgram ), Address { "10.0.0.3" } );
+  expect( port->datagrams == 1, "a datagram was sent before its next hop was known" );
+  learn( iface, ip( "10.0.0.3" ) );
+  expect( port->datagrams == 2 and port->payload_data == data, "a queued payload was copied" );
+}
+
+// Once warmed up, sending (and forwarding) allocates nothing
+void no_allocations()
+{
+  const auto port = make_shared<PiecesOut>();
+  NetworkInterface iface { "eth0", port, { 2, 0, 0, 0, 0, 1 }, Address { "10.0.0.1" } };
+  learn( iface, ip( "10.0.0.2" ) );
+  vector<InternetDatagram> datagrams;
+  for ( size_t i = 0; i < DATAGRAMS; i++ ) {
+    datagrams.push_back( make_datagram( ip( "10.0.0.1" ), ip( "192.0.2.1" ) ) );
+  }
+  const Address next_hop { "10.0.0.2" };
+  iface.send_datagram( make_datagram( ip( "10.0.0.1" ), ip( "192.0.2.1" ) ), next_hop );
+
+  size_t before = allocations;
+  for ( auto& dgram : datagrams ) {
+    iface.send_datagram( move( dgram ), next_hop );
+  }
+  const size_t sending = allocations - before;
+  expect( sending == 0, "send_datagram allocated " + to_string( sending ) + " times" );
+
+  Router router;
+  const auto lan = make_shared<PiecesOut>();
+  const auto wan = make_shared<PiecesOut>();
+  const EthernetAddress lan_ethernet { 2, 0, 0, 0, 1, 1 };
+  const EthernetAddress wan_ethernet { 2, 0, 0, 0, 1, 2 };
+  router.add_interface( make_shared<NetworkInterface>( "lan", lan, lan_ethernet, Address { "10.0.0.1" } ) );
+  router.add_interface( make_shared<NetworkInterface>( "wan", wan, wan_ethernet, Address { "192.0.2.1" } ) );
+  router.add_route( ip( "10.0.0.0" ), 24, {}, 0 );
+  router.add_route( 0, 0, Address { "192.0.2.254" }, 1 );
+  learn( *router.interface( 1 ), ip( "192.0.2.254" ) );
+
+  auto& received = router.interface( 0 )->datagrams_received();
+  const auto forward = [&] {
+    for ( size_t i = 0; i < DATAGRAMS; i++ ) {
+      received.push( make_datagram( ip( "10.0.0.5" ), ip( "198.51.100.7" ) ) );
+    }
+    before = allocations;
+    router.route();
+    return allocations - before;
+  };
+  forward(); // warm up
+  const size_t forwarding = forward();
+  expect( wan->datagrams == 2 * DATAGRAMS, "the router did not forward everything" );
+  expect( forwarding == 0, "forwarding allocated " + to_string( forwarding ) + " times" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    payload_is_not_copied();
+    no_allocations();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+// A block of counters that one thread updates and any thread may read.
+//
+// A thread that counts packets keeps a block of its own, and a reader adds up the blocks of all the threads.
+// The owner updates a counter with a relaxed load and store, not an atomic read-modify-write, so counting
+// costs about as much as incrementing a plain integer: no locked instruction, and no cache line bouncing
+// between threads. The counters are allocated in chunks aligned to cache lines (so two blocks never share a
+// line), as the owner first touches them, and a chunk is only freed with its block, so a reader never sees
+// one go away.
+class CounterBlock
+{
+public:
+  // Counters are allocated 4096 at a time (32 KiB), up to 16 M in all
+  static constexpr size_t CHUNK_SIZE = 4096;
+  static constexpr size_t MAX_CHUNKS = 4096;
+  static constexpr size_t CAPACITY = CHUNK_SIZE * MAX_CHUNKS;
+
+  CounterBlock() = default;
+  ~CounterBlock()
+  {
+    for ( auto& chunk : chunks_ ) {
+      delete chunk.load();
+    }
+  }
+  CounterBlock( const CounterBlock& ) = delete;
+  CounterBlock& operator=( const CounterBlock& ) = delete;
+  CounterBlock( CounterBlock&& ) = delete;
+  CounterBlock& operator=( CounterBlock&& ) = delete;
+
+  // Add to a counter (by the owning thread only)
+  void add( size_t index, uint64_t n = 1 )
+  {
+    std::atomic<uint64_t>& counter = slot( index );
+    counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+  }
+
+  // Set a counter (by the owning thread only)
+  void set( size_t index, uint64_t value ) { slot( index ).store( value, std::memory_order_relaxed ); }
+
+  // Read a counter (by any thread); 0 if it was never written
+  uint64_t get( size_t index ) const
+  {
+    if ( index >= CAPACITY ) {
+      return 0;
+    }
+    const Chunk* chunk = chunks_[index / CHUNK_SIZE].load( std::memory_order_acquire );
+    return chunk == nullptr ? 0 : chunk->counters[index % CHUNK_SIZE].load( std::memory_order_relaxed );
+  }
+
+private:
+  struct alignas( 64 ) Chunk
+  {
+    std::array<std::atomic<uint64_t>, CHUNK_SIZE> counters {};
+  };
+
+  std::array<std::atomic<Chunk*>, MAX_CHUNKS> chunks_ {};
+
+  std::atomic<uint64_t>& slot( size_t index )
+  {
+    if ( index >= CAPACITY ) {
+      throw std::out_of_range( "CounterBlock: counter index out of range" );
+    }
+    std::atomic<Chunk*>& entry = chunks_[index / CHUNK_SIZE];
+    Chunk* chunk = entry.load( std::memory_order_relaxed );
+    if ( chunk == nullptr ) {
+      chunk = new Chunk; // zeroed, and published so that readers see the zeroes
+      entry.store( chunk, std::memory_order_release );
+    }
+    return chunk->counters[index % CHUNK_SIZE];
+  }
+};
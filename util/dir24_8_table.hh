@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A DIR-24-8 forwarding table: longest-prefix match in one or two memory reads.
+//
+// The first level has one entry for every /24 (16M entries, 64 MiB). A prefix of length up to 24 is
+// expanded into all of the /24 entries it covers. A /24 that holds longer prefixes instead points
+// to a 256-entry second-level group with one entry per address in it. Every entry remembers the
+// length of the prefix it came from, so prefixes can be inserted in any order: an insertion only
+// overwrites entries whose current prefix is no longer than its own.
+//
+// Values are small integers (e.g. an index into a routing table), less than MAX_VALUE.
+class DIR24_8Table
+{
+public:
+  static constexpr uint32_t MAX_VALUE = 1U << 24U;
+
+  DIR24_8Table() : tbl24_( TBL24_SIZE ) {}
+
+  // Add a prefix, or replace the value stored for it (bits past `length` are ignored)
+  void insert( uint32_t prefix, uint8_t length, uint32_t value )
+  {
+    if ( length > 32 ) {
+      throw std::runtime_error( "DIR24_8Table: prefix length " + std::to_string( length ) + " is longer than 32" );
+    }
+    if ( value >= MAX_VALUE ) {
+      throw std::runtime_error( "DIR24_8Table: value " + std::to_string( value ) + " is too large" );
+    }
+    prefix &= length == 0 ? 0 : UINT32_MAX << ( 32U - length );
+    const uint32_t entry = VALID | ( uint32_t { length } << DEPTH_SHIFT ) | value;
+
+    if ( length <= 24 ) {
+      const size_t first = prefix >> 8U;
+      const size_t count = size_t { 1 } << ( 24U - length );
+      for ( size_t i = first; i < first + count; i++ ) {
+        if ( tbl24_[i] & EXTENDED ) {
+          fill( std::span( tbl8_ ).subspan( group_start( tbl24_[i] ), GROUP_SIZE ), length, entry );
+        } else {
+          fill( std::span( tbl24_ ).subspan( i, 1 ), length, entry );
+        }
+      }
+      return;
+    }
+
+    uint32_t& slot = tbl24_[prefix >> 8U];
+    if ( not( slot & EXTENDED ) ) {
+      // push the /24's current entry down into a new group, which the longer prefix then refines
+      const uint32_t group = allocate_group( slot );
+      slot = EXTENDED | group;
+    }
+    const size_t first = group_start( slot ) + ( prefix & 0xffU );
+    fill( std::span( tbl8_ ).subspan( first, size_t { 1 } << ( 32U - length ) ), length, entry );
+  }
+
+  // Remove a prefix that no other prefix covers: its addresses are left without a route
+  void erase( uint32_t prefix, uint8_t length ) { reassign( prefix, length, 0 ); }
+
+  // Remove a prefix, handing its addresses over to the longest shorter prefix that covers it. The table
+  // does not remember how it was built, so the caller has to say which prefix that is.
+  void erase( uint32_t prefix, uint8_t length, uint8_t covering_length, uint32_t covering_value )
+  {
+    if ( covering_length >= length or covering_value >= MAX_VALUE ) {
+      throw std::runtime_error( "DIR24_8Table: invalid covering prefix" );
+    }
+    reassign( prefix, length, VALID | ( uint32_t { covering_length } << DEPTH_SHIFT ) | covering_value );
+  }
+
+  // The value of the longest prefix that contains `address`
+  std::optional<uint32_t> lookup( uint32_t address ) const
+  {
+    uint32_t entry = tbl24_[address >> 8U];
+    if ( entry & EXTENDED ) {
+      entry = tbl8_[group_start( entry ) + ( address & 0xffU )];
+    }
+    if ( not( entry & VALID ) ) {
+      return {};
+    }
+    return entry & VALUE_MASK;
+  }
+
+  // Look up many addresses at once: results[i] is lookup( addresses[i] ). All of the first-level
+  // entries are prefetched before any is read, then all of the second-level ones, so the misses overlap.
+  void lookup_batch( std::span<const uint32_t> addresses, std::span<std::optional<uint32_t>> results ) const
+  {
+    if ( results.size() < addresses.size() ) {
+      throw std::runtime_error( "DIR24_8Table::lookup_batch: results is shorter than addresses" );
+    }
+    for ( const uint32_t address : addresses ) {
+      __builtin_prefetch( &tbl24_[address >> 8U] );
+    }
+    for ( size_t i = 0; i < addresses.size(); i++ ) {
+      const uint32_t entry = tbl24_[addresses[i] >> 8U];
+      if ( entry & EXTENDED ) {
+        __builtin_prefetch( &tbl8_[group_start( entry ) + ( addresses[i] & 0xffU )] );
+      }
+    }
+    for ( size_t i = 0; i < addresses.size(); i++ ) {
+      results[i] = lookup( addresses[i] );
+    }
+  }
+
+  void clear()
+  {
+    std::fill( tbl24_.begin(), tbl24_.end(), 0 );
+    tbl8_.clear();
+    free_groups_.clear();
+  }
+
+  // Second-level groups in use (each is 1 KiB)
+  size_t group_count() const { return tbl8_.size() / GROUP_SIZE - free_groups_.size(); }
+
+private:
+  // An entry is either EXTENDED | group number (first level only),
+  // or VALID | prefix length << DEPTH_SHIFT | value. Zero means "no route".
+  static constexpr uint32_t EXTENDED = 1U << 31U;
+  static constexpr uint32_t VALID = 1U << 30U;
+  static constexpr unsigned DEPTH_SHIFT = 24;
+  static constexpr uint32_t DEPTH_MASK = 0x3fU << DEPTH_SHIFT;
+  static constexpr uint32_t VALUE_MASK = MAX_VALUE - 1;
+  static constexpr uint32_t GROUP_MASK = EXTENDED - 1;
+
+  static constexpr size_t TBL24_SIZE = size_t { 1 } << 24U;
+  static constexpr size_t GROUP_SIZE = 256;
+
+  std::vector<uint32_t> tbl24_;
+  std::vector<uint32_t> tbl8_ {};
+  std::vector<uint32_t> free_groups_ {}; // groups that erase() emptied, to be reused
+
+  static size_t group_start( uint32_t extended_entry ) { return ( extended_entry & GROUP_MASK ) * GROUP_SIZE; }
+
+  static uint32_t depth( uint32_t entry ) { return ( entry & DEPTH_MASK ) >> DEPTH_SHIFT; }
+
+  // Overwrite the entries that are empty or come from a prefix no longer than `length`
+  static void fill( std::span<uint32_t> entries, uint8_t length, uint32_t entry )
+  {
+    for ( uint32_t& slot : entries ) {
+      if ( not( slot & VALID ) or depth( slot ) <= length ) {
+        slot = entry;
+      }
+    }
+  }
+
+  uint32_t allocate_group( uint32_t initial_entry )
+  {
+    if ( not free_groups_.empty() ) {
+      const uint32_t group = free_groups_.back();
+      free_groups_.pop_back();
+      std::fill_n( tbl8_.begin() + static_cast<std::ptrdiff_t>( group * GROUP_SIZE ), GROUP_SIZE, initial_entry );
+      return group;
+    }
+    const auto group = static_cast<uint32_t>( tbl8_.size() / GROUP_SIZE );
+    tbl8_.resize( tbl8_.size() + GROUP_SIZE, initial_entry );
+    return group;
+  }
+
+  // Give the entries that came from the erased prefix (those of its length) to `replacement`
+  void reassign( uint32_t prefix, uint8_t length, uint32_t replacement )
+  {
+    if ( length > 32 ) {
+      throw std::runtime_error( "DIR24_8Table: prefix length " + std::to_string( length ) + " is longer than 32" );
+    }
+    prefix &= length == 0 ? 0 : UINT32_MAX << ( 32U - length );
+    const auto unfill = [&]( std::span<uint32_t> entries ) {
+      for ( uint32_t& slot : entries ) {
+        if ( ( slot & VALID ) and depth( slot ) == length ) {
+          slot = replacement;
+        }
+      }
+    };
+
+    const size_t first = prefix >> 8U;
+    const size_t count = length <= 24 ? size_t { 1 } << ( 24U - length ) : 1;
+    for ( size_t i = first; i < first + count; i++ ) {
+      if ( not( tbl24_[i] & EXTENDED ) ) {
+        unfill( std::span( tbl24_ ).subspan( i, 1 ) );
+        continue;
+      }
+      const std::span group = std::span( tbl8_ ).subspan( group_start( tbl24_[i] ), GROUP_SIZE );
+      if ( length <= 24 ) {
+        unfill( group );
+      } else {
+        unfill( group.subspan( prefix & 0xffU, size_t { 1 } << ( 32U - length ) ) );
+      }
+      // a group whose entries have become all the same is no longer needed
+      if ( std::ranges::all_of( group, [&]( uint32_t entry ) { return entry == group.front(); } ) ) {
+        free_groups_.push_back( tbl24_[i] & GROUP_MASK );
+        tbl24_[i] = group.front();
+      }
+    }
+  }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "hash_mix.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// A hash table stored in one flat array, using open addressing with linear probing.
+//
+// Lookups touch one or two cache lines instead of chasing a bucket list, which makes this a good fit
+// for small keys looked up on every packet (connection 4-tuples, IP addresses). Erasure uses
+// backward-shift deletion, so there are no tombstones and probe sequences stay short under churn.
+// The table is kept at most half full.
+//
+// Insertion and erasure may move other entries: pointers returned by find() are only valid until the
+// next modification of the table.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatHashMap
+{
+public:
+  explicit FlatHashMap( size_t initial_capacity = 16 ) { slots_.resize( round_up_capacity( initial_capacity ) ); }
+
+  // Returns a pointer to the value stored for `key`, or nullptr if there is none
+  Value* find( const Key& key )
+  {
+    const size_t index = find_index( key );
+    return index == NOT_FOUND ? nullptr : &slots_[index]->second;
+  }
+
+  const Value* find( const Key& key ) const
+  {
+    const size_t index = find_index( key );
+    return index == NOT_FOUND ? nullptr : &slots_[index]->second;
+  }
+
+  bool contains( const Key& key ) const { return find_index( key ) != NOT_FOUND; }
+
+  // Construct a value for `key` if none is present. Returns the (new or existing) value,
+  // and whether it was inserted.
+  template<typename... Args>
+  std::pair<Value*, bool> try_emplace( const Key& key, Args&&... args )
+  {
+    if ( Value* existing = find( key ) ) {
+      return { existing, false };
+    }
+    if ( ( size_ + 1 ) * 2 > slots_.size() ) {
+      rehash( slots_.size() * 2 );
+    }
+    size_t index = bucket( key );
+    while ( slots_[index].has_value() ) {
+      index = ( index + 1 ) & mask();
+    }
+    slots_[index].emplace( std::piecewise_construct,
+                           std::forward_as_tuple( key ),
+                           std::forward_as_tuple( std::forward<Args>( args )... ) );
+    ++size_;
+    return { &slots_[index]->second, true };
+  }
+
+  Value& operator[]( const Key& key ) { return *try_emplace( key ).first; }
+
+  // Remove the entry for `key`. Returns whether there was one.
+  bool erase( const Key& key )
+  {
+    const size_t index = find_index( key );
+    if ( index == NOT_FOUND ) {
+      return false;
+    }
+    erase_at( index );
+    return true;
+  }
+
+  // Remove every entry for which `pred( key, value )` is true. Returns the number removed.
+  template<typename Pred>
+  size_t erase_if( Pred&& pred )
+  {
+    size_t removed = 0;
+    for ( size_t index = 0; index < slots_.size(); ) {
+      if ( slots_[index].has_value() and pred( std::as_const( slots_[index]->first ), slots_[index]->second ) ) {
+        // a later entry may have been shifted into this slot, so look at it again
+        erase_at( index );
+        ++removed;
+      } else {
+        ++index;
+      }
+    }
+    return removed;
+  }
+
+  // Call `f( key, value )` for every entry (in no particular order). `f` must not modify the table.
+  template<typename F>
+  void for_each( F&& f )
+  {
+    for ( auto& slot : slots_ ) {
+      if ( slot.has_value() ) {
+        f( std::as_const( slot->first ), slot->second );
+      }
+    }
+  }
+
+  template<typename F>
+  void for_each( F&& f ) const
+  {
+    for ( const auto& slot : slots_ ) {
+      if ( slot.has_value() ) {
+        f( slot->first, slot->second );
+      }
+    }
+  }
+
+  // Make room for `count` entries without growing
+  void reserve( size_t count )
+  {
+    if ( count * 2 > slots_.size() ) {
+      rehash( round_up_capacity( count * 2 ) );
+    }
+  }
+
+  void clear()
+  {
+    for ( auto& slot : slots_ ) {
+      slot.reset();
+    }
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return slots_.size(); }
+
+private:
+  static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+  std::vector<std::optional<std::pair<Key, Value>>> slots_ {};
+  size_t size_ {};
+
+  static size_t round_up_capacity( size_t n )
+  {
+    size_t capacity = 16;
+    while ( capacity < n ) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  size_t mask() const { return slots_.size() - 1; }
+  size_t bucket( const Key& key ) const { return hash_mix( Hash {}( key ) ) & mask(); }
+
+  size_t find_index( const Key& key ) const
+  {
+    for ( size_t index = bucket( key ); slots_[index].has_value(); index = ( index + 1 ) & mask() ) {
+      if ( slots_[index]->first == key ) {
+        return index;
+      }
+    }
+    return NOT_FOUND;
+  }
+
+  // Backward-shift deletion: pull later entries of the probe run back into the hole, so every
+  // remaining entry is still reachable from its home bucket without passing an empty slot.
+  void erase_at( size_t hole )
+  {
+    slots_[hole].reset();
+    --size_;
+    for ( size_t index = ( hole + 1 ) & mask(); slots_[index].has_value(); index = ( index + 1 ) & mask() ) {
+      const size_t home = bucket( slots_[index]->first );
+      // may the entry at `index` move to `hole`? only if its home is not cyclically in (hole, index]
+      const bool home_after_hole = ( ( index - home ) & mask() ) < ( ( index - hole ) & mask() );
+      if ( not home_after_hole ) {
+        slots_[hole] = std::move( slots_[index] );
+        slots_[index].reset();
+        hole = index;
+      }
+    }
+  }
+
+  void rehash( size_t new_capacity )
+  {
+    std::vector<std::optional<std::pair<Key, Value>>> old_slots( new_capacity );
+    std::swap( old_slots, slots_ );
+    for ( auto& slot : old_slots ) {
+      if ( slot.has_value() ) {
+        size_t index = bucket( slot->first );
+        while ( slots_[index].has_value() ) {
+          index = ( index + 1 ) & mask();
+        }
+        slots_[index] = std::move( slot );
+      }
+    }
+  }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "hash_mix.hh"
+#include "ipv4_datagram.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+// The 5-tuple that identifies a flow: the addresses, the protocol, and (for TCP and UDP) the ports.
+//
+// Every datagram of a flow hashes to the same value, so spreading datagrams over equal-cost paths by
+// this hash keeps each flow on one path (and in order), while different flows spread out.
+struct FlowKey
+{
+  uint32_t src {};
+  uint32_t dst {};
+  uint16_t src_port {};
+  uint16_t dst_port {};
+  uint8_t proto {};
+
+  // The ports come from the first four bytes of the TCP or UDP header. Fragments leave them out (only
+  // the first fragment carries them), so that all the fragments of a datagram take the same path.
+  static FlowKey of( const InternetDatagram& dgram )
+  {
+    FlowKey key { dgram.header.src, dgram.header.dst, 0, 0, dgram.header.proto };
+    if ( not dgram.header.mf ) {
+      if ( const auto found = ports( dgram ) ) {
+        std::tie( key.src_port, key.dst_port ) = *found;
+      }
+    }
+    return key;
+  }
+
+  // The (source, destination) ports of a TCP or UDP datagram, or of the first fragment of one. Empty for
+  // other protocols, for later fragments, and if the payload is too short to hold them.
+  static std::optional<std::pair<uint16_t, uint16_t>> ports( const InternetDatagram& dgram )
+  {
+    const uint8_t proto = dgram.header.proto;
+    if ( ( proto != IPv4Header::PROTO_TCP and proto != IPv4Header::PROTO_UDP ) or dgram.header.offset != 0 ) {
+      return {};
+    }
+
+    // the ports may straddle the pieces of the payload
+    std::array<uint8_t, 4> bytes {};
+    size_t copied = 0;
+    for ( const auto& piece : dgram.payload ) {
+      const std::string& data = piece.get();
+      const size_t count = std::min( data.size(), bytes.size() - copied );
+      std::copy_n( data.begin(), count, bytes.begin() + copied );
+      copied += count;
+      if ( copied == bytes.size() ) {
+        return std::pair { static_cast<uint16_t>( bytes[0] << 8U | bytes[1] ),
+                           static_cast<uint16_t>( bytes[2] << 8U | bytes[3] ) };
+      }
+    }
+    return {};
+  }
+
+  // A well-mixed 32-bit hash. Routers that share paths should use different seeds, or they would all split
+  // traffic the same way and a downstream router would see only part of the hash space ("polarisation").
+  uint32_t hash( uint32_t seed ) const
+  {
+    uint64_t h = ( uint64_t { src } << 32U | dst ) ^ ( uint64_t { seed } * 0x9e3779b97f4a7c15U );
+    h = hash_mix( h ) ^ ( uint64_t { src_port } << 24U | uint64_t { dst_port } << 8U | proto );
+    return static_cast<uint32_t>( hash_mix( h ) >> 32U );
+  }
+
+  // One of `count` choices, in proportion, by multiplying rather than dividing
+  static size_t pick( uint32_t hash, size_t count )
+  {
+    return static_cast<size_t>( ( uint64_t { hash } * count ) >> 32U );
+  }
+
+  bool operator==( const FlowKey& other ) const = default;
+};
@@ -0,0 +1,162 @@
+#include "flow_sampler.hh"
+
+#include "random.hh"
+
+#include <algorithm>
+#include <bit>
+#include <random>
+#include <stdexcept>
+
+using namespace std;
+
+FlowSampler::FlowSampler( size_t top_flows, size_t sketch_width )
+  : width_mask_( bit_ceil( max<size_t>( sketch_width, 1 ) ) - 1 )
+  , sketch_( DEPTH * ( width_mask_ + 1 ) )
+  , seed_( [] {
+    auto rd = get_random_engine();
+    return uniform_int_distribution<uint64_t> {}( rd );
+  }() )
+  , capacity_( top_flows )
+  , slots_( top_flows * 4 )
+{
+  if ( top_flows == 0 or top_flows > UINT32_MAX ) {
+    throw invalid_argument( "FlowSampler: the table of top flows needs between 1 and 2^32 - 1 entries" );
+  }
+  entries_.reserve( capacity_ );
+  heap_.reserve( capacity_ );
+  heap_position_.reserve( capacity_ );
+}
+
+// A 64-bit hash of the whole 5-tuple. The table finds flows by it, to hash each datagram only once; two flows
+// would share an entry only if their fingerprints matched, which among even millions of flows is vanishingly
+// unlikely.
+uint64_t FlowSampler::fingerprint( const FlowKey& key ) const
+{
+  const uint64_t h = hash_mix( ( uint64_t { key.src } << 32U | key.dst ) ^ seed_ );
+  return hash_mix( h ^ ( uint64_t { key.src_port } << 24U | uint64_t { key.dst_port } << 8U | key.proto ) );
+}
+
+// One counter per row. The rows' indices come from two halves of the fingerprint (Kirsch and Mitzenmacher,
+// "Less Hashing, Same Performance"), which is as good as DEPTH independent hashes for this purpose.
+array<size_t, FlowSampler::DEPTH> FlowSampler::counters( const uint64_t fingerprint ) const
+{
+  const size_t h1 = fingerprint & UINT32_MAX;
+  const size_t h2 = ( fingerprint >> 32U ) | 1U;
+  const size_t width = width_mask_ + 1;
+  array<size_t, DEPTH> indices {};
+  for ( size_t row = 0; row < DEPTH; row++ ) {
+    indices[row] = row * width + ( ( h1 + row * h2 ) & width_mask_ );
+  }
+  return indices;
+}
+
+uint64_t FlowSampler::estimate( const FlowKey& key ) const
+{
+  uint64_t least = UINT64_MAX;
+  for ( const size_t index : counters( fingerprint( key ) ) ) {
+    least = min( least, sketch_[index] );
+  }
+  return least;
+}
+
+void FlowSampler::add( const FlowKey& key, uint64_t bytes )
+{
+  total_packets_++;
+  total_bytes_ += bytes;
+
+  // The sketch, with conservative update: no counter needs to go past the flow's new estimate
+  const uint64_t print = fingerprint( key );
+  const auto indices = counters( print );
+  uint64_t least = UINT64_MAX;
+  for ( const size_t index : indices ) {
+    least = min( least, sketch_[index] );
+  }
+  const uint64_t estimate = least + bytes;
+  for ( const size_t index : indices ) {
+    sketch_[index] = max( sketch_[index], estimate );
+  }
+
+  // The table of top flows
+  if ( const uint32_t* slot = slots_.find( print ) ) {
+    Flow& flow = entries_[*slot];
+    flow.bytes += bytes;
+    flow.packets++;
+    sift_down( heap_position_[*slot] );
+    return;
+  }
+
+  if ( entries_.size() < capacity_ ) {
+    const auto slot = static_cast<uint32_t>( entries_.size() );
+    entries_.push_back( { key, estimate, estimate - bytes, 1 } );
+    heap_.push_back( slot );
+    heap_position_.push_back( slot );
+    slots_.try_emplace( print, slot );
+    sift_up( heap_.size() - 1 );
+    return;
+  }
+
+  // Most datagrams belong to small flows, which stop here
+  const uint32_t slot = heap_.front();
+  Flow& flow = entries_[slot];
+  if ( estimate <= flow.bytes ) {
+    return;
+  }
+  slots_.erase( fingerprint( flow.key ) );
+  flow = { key, estimate, estimate - bytes, 1 };
+  slots_.try_emplace( print, slot );
+  sift_down( 0 );
+}
+
+vector<FlowSampler::Flow> FlowSampler::top() const
+{
+  vector<Flow> flows = entries_;
+  ranges::sort( flows, []( const Flow& a, const Flow& b ) { return a.bytes > b.bytes; } );
+  return flows;
+}
+
+void FlowSampler::clear()
+{
+  ranges::fill( sketch_, 0 );
+  entries_.clear();
+  heap_.clear();
+  heap_position_.clear();
+  slots_.clear();
+  total_packets_ = 0;
+  total_bytes_ = 0;
+}
+
+void FlowSampler::swap_heap( size_t a, size_t b )
+{
+  swap( heap_[a], heap_[b] );
+  heap_position_[heap_[a]] = static_cast<uint32_t>( a );
+  heap_position_[heap_[b]] = static_cast<uint32_t>( b );
+}
+
+void FlowSampler::sift_down( size_t position )
+{
+  while ( true ) {
+    size_t smallest = position;
+    for ( const size_t child : { 2 * position + 1, 2 * position + 2 } ) {
+      if ( child < heap_.size() and entries_[heap_[child]].bytes < entries_[heap_[smallest]].bytes ) {
+        smallest = child;
+      }
+    }
+    if ( smallest == position ) {
+      return;
+    }
+    swap_heap( position, smallest );
+    position = smallest;
+  }
+}
+
+void FlowSampler::sift_up( size_t position )
+{
+  while ( position > 0 ) {
+    const size_t parent = ( position - 1 ) / 2;
+    if ( entries_[heap_[parent]].bytes <= entries_[heap_[position]].bytes ) {
+      return;
+    }
+    swap_heap( position, parent );
+    position = parent;
+  }
+}
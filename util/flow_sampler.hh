@@ -0,0 +1,81 @@
+#pragma once
+
+#include "flat_hash_map.hh"
+#include "flow_hash.hh"
+#include "ipv4_datagram.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Flow telemetry in bounded memory: how many bytes each flow (5-tuple) sent, and which flows sent the most.
+//
+// Every datagram updates two summaries, and neither allocates once the sampler is built:
+//
+// - A count-min sketch (Cormode and Muthukrishnan, 2005): DEPTH rows of counters, each indexed by a different
+//   hash of the 5-tuple. A flow's estimate is the least of its counters, which is never below its true count
+//   and is above it by at most a small fraction of all the traffic (2/width of it, with high probability).
+//   Counters are raised "conservatively", only as far as the new estimate, which keeps estimates closer.
+//
+// - A Space-Saving table of the top flows (Metwally, Agrawal and El Abbadi, 2005), kept as a min-heap. A flow
+//   in the table has its count raised. A flow that is not takes the place of the table's smallest entry, but
+//   only once the sketch estimates it above that entry's count (so the many small flows never touch the
+//   table), and it starts from that estimate. So every count is an upper bound, a flow that sent more than
+//   the smallest count is always in the table, and each entry also records how far over its count may be.
+class FlowSampler
+{
+public:
+  static constexpr size_t DEPTH = 4;
+  static constexpr size_t DEFAULT_TOP_FLOWS = 64;
+  static constexpr size_t DEFAULT_SKETCH_WIDTH = 4096;
+
+  // `sketch_width` is rounded up to a power of two
+  explicit FlowSampler( size_t top_flows = DEFAULT_TOP_FLOWS, size_t sketch_width = DEFAULT_SKETCH_WIDTH );
+
+  // Count a datagram (its total length) against its flow
+  void add( const InternetDatagram& dgram ) { add( FlowKey::of( dgram ), dgram.header.len ); }
+  void add( const FlowKey& key, uint64_t bytes );
+
+  // The sketch's estimate of a flow's bytes: never less than the truth
+  uint64_t estimate( const FlowKey& key ) const;
+
+  // One of the top flows. The flow sent at most `bytes`, and at least `bytes - error`; `packets` counts its
+  // datagrams since it last entered the table.
+  struct Flow
+  {
+    FlowKey key;
+    uint64_t bytes;
+    uint64_t error;
+    uint64_t packets;
+  };
+
+  // The top flows, heaviest first
+  std::vector<Flow> top() const;
+
+  uint64_t total_packets() const { return total_packets_; }
+  uint64_t total_bytes() const { return total_bytes_; }
+
+  // Forget everything (to start a new measurement interval)
+  void clear();
+
+private:
+  size_t width_mask_;
+  std::vector<uint64_t> sketch_; // DEPTH rows of counters, one after another
+  uint64_t seed_; // random, so that nobody can pick flows that collide
+
+  size_t capacity_;
+  std::vector<Flow> entries_ {};           // the table's flows; an entry stays in its slot until replaced
+  std::vector<uint32_t> heap_ {};          // slots of entries_, as a min-heap by bytes
+  std::vector<uint32_t> heap_position_ {}; // where each slot is in heap_
+  FlatHashMap<uint64_t, uint32_t> slots_;  // by fingerprint
+
+  uint64_t total_packets_ {};
+  uint64_t total_bytes_ {};
+
+  uint64_t fingerprint( const FlowKey& key ) const;
+  std::array<size_t, DEPTH> counters( uint64_t fingerprint ) const;
+  void sift_down( size_t position );
+  void sift_up( size_t position );
+  void swap_heap( size_t a, size_t b );
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+// Mix the bits of a 64-bit value (the MurmurHash3 finalizer), so that nearby keys land in unrelated buckets
+constexpr uint64_t hash_mix( uint64_t x )
+{
+  x ^= x >> 33U;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33U;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33U;
+  return x;
+}
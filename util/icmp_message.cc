@@ -0,0 +1,111 @@
+#include "icmp_message.hh"
+#include "checksum.hh"
+#include "helpers.hh"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+ICMPMessage ICMPMessage::error( const uint8_t type,
+                                const uint8_t code,
+                                const InternetDatagram& original,
+                                const uint16_t next_hop_mtu )
+{
+  ICMPMessage msg;
+  msg.type = type;
+  msg.code = code;
+  msg.rest_of_header = next_hop_mtu;
+
+  // the original header (options and all), then the first 8 bytes of its payload: enough for the sender to
+  // find the ports, and so the connection, that the error is about
+  msg.payload = concat( ::serialize( original.header ) );
+  for ( const auto& piece : original.payload ) {
+    const size_t wanted = IPv4Header::LENGTH + QUOTED_PAYLOAD_LENGTH - msg.payload.size();
+    msg.payload.append( piece->substr( 0, wanted ) );
+    if ( msg.payload.size() == IPv4Header::LENGTH + QUOTED_PAYLOAD_LENGTH ) {
+      break;
+    }
+  }
+  msg.compute_checksum();
+  return msg;
+}
+
+bool ICMPMessage::is_error( const uint8_t type )
+{
+  return type == TYPE_DESTINATION_UNREACHABLE or type == TYPE_SOURCE_QUENCH or type == TYPE_REDIRECT
+         or type == TYPE_TIME_EXCEEDED or type == TYPE_PARAMETER_PROBLEM;
+}
+
+bool ICMPMessage::carries_error( const InternetDatagram& dgram )
+{
+  if ( dgram.header.proto != IPv4Header::PROTO_ICMP or dgram.header.offset != 0 ) {
+    return false;
+  }
+  // only the type (the first byte) matters
+  const auto first = ranges::find_if( dgram.payload, []( const auto& piece ) { return not piece->empty(); } );
+  if ( first == dgram.payload.end() ) {
+    return false;
+  }
+  return is_error( static_cast<uint8_t>( first->get().front() ) );
+}
+
+void ICMPMessage::compute_checksum()
+{
+  cksum = 0;
+  Serializer s;
+  serialize( s );
+
+  InternetChecksum check;
+  check.add( s.finish() );
+  cksum = check.value();
+}
+
+InternetDatagram ICMPMessage::to_datagram( const uint32_t src, const uint32_t dst ) const
+{
+  InternetDatagram dgram;
+  dgram.header.proto = IPv4Header::PROTO_ICMP;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.len = static_cast<uint16_t>( dgram.header.hlen * 4 + HEADER_LENGTH + payload.size() );
+  dgram.header.compute_checksum();
+  dgram.payload = ::serialize( *this );
+  return dgram;
+}
+
+string ICMPMessage::to_string() const
+{
+  stringstream ss {};
+  ss << "ICMP type=" << +type << " code=" << +code;
+  if ( type == TYPE_DESTINATION_UNREACHABLE and code == CODE_FRAGMENTATION_NEEDED ) {
+    ss << " mtu=" << next_hop_mtu();
+  }
+  ss << " payload=" << payload.size() << " bytes";
+  return ss.str();
+}
+
+void ICMPMessage::parse( Parser& parser )
+{
+  // verify checksum (taken over the whole message)
+  InternetChecksum check;
+  check.add( parser.buffer() );
+  if ( check.value() ) {
+    parser.set_error();
+    return;
+  }
+
+  parser.integer( type );
+  parser.integer( code );
+  parser.integer( cksum );
+  parser.integer( rest_of_header );
+  parser.concatenate_all_remaining( payload );
+}
+
+void ICMPMessage::serialize( Serializer& serializer ) const
+{
+  serializer.integer( type );
+  serializer.integer( code );
+  serializer.integer( cksum );
+  serializer.integer( rest_of_header );
+  serializer.buffer( payload );
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// [ICMP](\ref rfc::rfc792) message: the error (and query) messages that travel in IPv4 datagrams
+struct ICMPMessage
+{
+  static constexpr size_t HEADER_LENGTH = 8; // type, code, checksum and the 4-byte "rest of header"
+
+  static constexpr uint8_t TYPE_ECHO_REPLY = 0;
+  static constexpr uint8_t TYPE_DESTINATION_UNREACHABLE = 3;
+  static constexpr uint8_t TYPE_SOURCE_QUENCH = 4;
+  static constexpr uint8_t TYPE_REDIRECT = 5;
+  static constexpr uint8_t TYPE_ECHO_REQUEST = 8;
+  static constexpr uint8_t TYPE_TIME_EXCEEDED = 11;
+  static constexpr uint8_t TYPE_PARAMETER_PROBLEM = 12;
+
+  // Codes of Destination Unreachable
+  static constexpr uint8_t CODE_NET_UNREACHABLE = 0;
+  static constexpr uint8_t CODE_HOST_UNREACHABLE = 1;
+  static constexpr uint8_t CODE_FRAGMENTATION_NEEDED = 4; // the datagram was too big and had DF set
+
+  // Codes of Time Exceeded
+  static constexpr uint8_t CODE_TTL_EXCEEDED = 0;
+  static constexpr uint8_t CODE_REASSEMBLY_TIME_EXCEEDED = 1;
+
+  // How much of the offending datagram's payload an error message quotes (after its header)
+  static constexpr size_t QUOTED_PAYLOAD_LENGTH = 8;
+
+  uint8_t type {};
+  uint8_t code {};
+  uint16_t cksum {};
+  uint32_t rest_of_header {}; // unused by most errors; Fragmentation Needed puts the next-hop MTU in the low half
+  std::string payload {};     // for errors, the offending datagram's header and the start of its payload
+
+  // The error message about `original`. Fragmentation Needed also reports the MTU that was exceeded
+  // ([RFC 1191](\ref rfc::rfc1191)).
+  static ICMPMessage error( uint8_t type,
+                            uint8_t code,
+                            const InternetDatagram& original,
+                            uint16_t next_hop_mtu = 0 );
+
+  // Is this type of message an error (rather than a query, like an echo request)?
+  static bool is_error( uint8_t type );
+
+  // Does the datagram carry an ICMP error message? Errors are never sent about errors, lest two hosts
+  // trade them forever.
+  static bool carries_error( const InternetDatagram& dgram );
+
+  // The next-hop MTU of a Fragmentation Needed message
+  uint16_t next_hop_mtu() const { return static_cast<uint16_t>( rest_of_header ); }
+
+  // Set checksum to correct value
+  void compute_checksum();
+
+  // The message (with a correct checksum) in a datagram from `src` to `dst`
+  InternetDatagram to_datagram( uint32_t src, uint32_t dst ) const;
+
+  // Return a string containing the ICMP message in human-readable format
+  std::string to_string() const;
+
+  void parse( Parser& parser );
+  void serialize( Serializer& serializer ) const;
+};
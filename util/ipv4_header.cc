@@ -114,6 +114,22 @@ void IPv4Header::compute_checksum()
   cksum = check.value();
 }
 
+//! \details RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'). Unlike the older HC' = HC - ~m - m' (RFC 1141), this
+//! never turns a checksum into 0xffff (negative zero) where a full recomputation would give 0x0000.
+void IPv4Header::update_checksum( const uint16_t old_word, const uint16_t new_word )
+{
+  const InternetChecksum check { static_cast<uint32_t>( static_cast<uint16_t>( ~cksum ) )
+                                 + static_cast<uint16_t>( ~old_word ) + new_word };
+  cksum = check.value();
+}
+
+void IPv4Header::decrement_ttl()
+{
+  const auto old_word = static_cast<uint16_t>( ttl << 8U | proto );
+  ttl--;
+  update_checksum( old_word, static_cast<uint16_t>( ttl << 8U | proto ) );
+}
+
 string IPv4Header::to_string() const
 {
   stringstream ss {};
@@ -11,7 +11,9 @@ struct IPv4Header
 {
   static constexpr uint8_t LENGTH = 20;       // IPv4 header length, not including options
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
+  static constexpr uint8_t PROTO_ICMP = 1;    // Protocol number for ICMP
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
+  static constexpr uint8_t PROTO_UDP = 17;    // Protocol number for UDP
 
   static constexpr uint64_t serialized_length() { return LENGTH; }
 
@@ -57,6 +59,13 @@ struct IPv4Header
   // Set checksum to correct value
   void compute_checksum();
 
+  // Adjust the checksum after one 16-bit word of the header changed from `old_word` to `new_word`, without
+  // re-summing the header (RFC 1624). The result is the same as compute_checksum()'s.
+  void update_checksum( uint16_t old_word, uint16_t new_word );
+
+  // Decrement the TTL and adjust the checksum to match (the TTL shares its 16-bit word with the protocol)
+  void decrement_ttl();
+
   // Return a string containing a header in human-readable format
   std::string to_string() const;
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "rcu.hh"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+
+// Two copies of a data structure, so that readers never wait for writers (the "left-right" flavour of
+// read-copy-update).
+//
+// Readers use whichever copy is published. A writer applies its update to the other copy, publishes
+// that one, waits out a grace period (after which no reader can still be using the old copy), and then
+// applies the same update to the old copy as well. Compared with copying the structure on every
+// update, this costs twice the memory but only twice the work of the update itself. The update must
+// therefore be deterministic: applied to two equal copies, it must leave them equal. Writers are
+// serialised with each other by a mutex that readers never touch.
+template<typename T>
+class LeftRight
+{
+public:
+  size_t register_reader() { return rcu_.register_reader(); }
+
+  // Keeps a copy from being updated for as long as the guard lives. Must be used by one thread at a time
+  // per reader slot.
+  class ReadGuard
+  {
+  public:
+    ReadGuard( LeftRight& owner, size_t reader )
+      : guard_( owner.rcu_, reader ), copy_( owner.published_.load() )
+    {}
+    const T& operator*() const { return *copy_; }
+    const T* operator->() const { return copy_; }
+    ReadGuard( const ReadGuard& ) = delete;
+    ReadGuard& operator=( const ReadGuard& ) = delete;
+
+  private:
+    RcuDomain::ReadGuard guard_;
+    const T* copy_;
+  };
+
+  ReadGuard read( size_t reader ) { return { *this, reader }; }
+
+  // Apply `update` (a function of T&) to both copies, and return what it returned the first time. If it
+  // throws the first time, nothing is published, so it should check its arguments before changing anything.
+  template<typename Update>
+  auto modify( Update&& update )
+  {
+    const std::scoped_lock lock { writer_mutex_ };
+    T* const hidden = &copies_[published_.load() == &copies_[0] ? 1 : 0];
+    T* const visible = &copies_[hidden == &copies_[0] ? 1 : 0];
+    if constexpr ( std::is_void_v<decltype( update( *hidden ) )> ) {
+      update( *hidden );
+      publish( hidden );
+      update( *visible );
+    } else {
+      auto result = update( *hidden );
+      publish( hidden );
+      update( *visible );
+      return result;
+    }
+  }
+
+private:
+  std::array<T, 2> copies_ {};
+  std::atomic<T*> published_ { &copies_[0] };
+  RcuDomain rcu_ {};
+  std::mutex writer_mutex_ {};
+
+  // Switch readers over to `copy`, and wait until none of them can still be using the other one
+  void publish( T* copy )
+  {
+    published_.store( copy );
+    rcu_.synchronize();
+  }
+};
@@ -0,0 +1,489 @@
+#include "nat_table.hh"
+#include "checksum.hh"
+#include "icmp_message.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+constexpr size_t TCP_FLAGS = 13;
+constexpr uint8_t TCP_FIN = 0x01;
+constexpr uint8_t TCP_SYN = 0x02;
+constexpr uint8_t TCP_RST = 0x04;
+constexpr uint8_t TCP_ACK = 0x10;
+constexpr size_t SRC_PORT = 0;
+constexpr size_t DST_PORT = 2;
+constexpr size_t ICMP_ID = 4;
+
+// Where the checksum is in a TCP, UDP or ICMP header, and how much of the header holds everything NAT reads
+struct Layout
+{
+  size_t checksum;
+  size_t length;
+};
+
+optional<Layout> layout( const uint8_t proto )
+{
+  switch ( proto ) {
+    case IPv4Header::PROTO_TCP:
+      return Layout { 16, 18 };
+    case IPv4Header::PROTO_UDP:
+      return Layout { 6, 8 };
+    case IPv4Header::PROTO_ICMP:
+      return Layout { 2, ICMPMessage::HEADER_LENGTH };
+    default:
+      return {};
+  }
+}
+
+// The flags of a TCP header (and nothing for other protocols)
+optional<uint8_t> tcp_flags( const IPv4Header& header, const string& bytes )
+{
+  if ( header.proto != IPv4Header::PROTO_TCP ) {
+    return {};
+  }
+  return static_cast<uint8_t>( bytes[TCP_FLAGS] );
+}
+
+size_t protocol_index( const uint8_t proto )
+{
+  return proto == IPv4Header::PROTO_TCP ? 0 : proto == IPv4Header::PROTO_UDP ? 1 : 2;
+}
+
+uint16_t get16( const string& bytes, const size_t offset )
+{
+  return static_cast<uint16_t>( static_cast<uint8_t>( bytes[offset] ) << 8U
+                                | static_cast<uint8_t>( bytes[offset + 1] ) );
+}
+
+uint32_t get32( const string& bytes, const size_t offset )
+{
+  return uint32_t { get16( bytes, offset ) } << 16U | get16( bytes, offset + 2 );
+}
+
+void put16( string& bytes, const size_t offset, const uint16_t value )
+{
+  bytes[offset] = static_cast<char>( value >> 8U );
+  bytes[offset + 1] = static_cast<char>( value & 0xffU );
+}
+
+// RFC 1624, eqn. 3: the checksum after one 16-bit word it covers changed
+uint16_t adjusted( const uint16_t cksum, const uint16_t old_word, const uint16_t new_word )
+{
+  const InternetChecksum check { static_cast<uint32_t>( static_cast<uint16_t>( ~cksum ) )
+                                 + static_cast<uint16_t>( ~old_word ) + new_word };
+  return check.value();
+}
+
+// Adjust the checksum at `offset` of `bytes` for a changed word. A UDP checksum of 0 means that there is none
+// (and one that works out to 0 is sent as 0xffff instead).
+void adjust_checksum( string& bytes,
+                      const size_t offset,
+                      const uint16_t old_word,
+                      const uint16_t new_word,
+                      const bool udp )
+{
+  const uint16_t cksum = get16( bytes, offset );
+  if ( udp and cksum == 0 ) {
+    return;
+  }
+  const uint16_t result = adjusted( cksum, old_word, new_word );
+  put16( bytes, offset, udp and result == 0 ? 0xffff : result );
+}
+
+// The start of the payload, at least `length` bytes of it, in a piece of its own that may be modified (the
+// payload is copied if it was borrowed, and its pieces joined if the first is too short). Null if the payload
+// is shorter than that.
+string* writable_prefix( InternetDatagram& dgram, const size_t length )
+{
+  auto& payload = dgram.payload;
+  if ( not payload.empty() and payload.front()->size() >= length ) {
+    if ( payload.front().is_borrowed() ) {
+      payload.front() = string { payload.front().get() };
+    }
+    return &payload.front().get_mut();
+  }
+  string joined;
+  for ( const auto& piece : payload ) {
+    joined += piece.get();
+  }
+  if ( joined.size() < length ) {
+    return nullptr;
+  }
+  payload.clear();
+  payload.emplace_back( std::move( joined ) );
+  return &payload.front().get_mut();
+}
+
+// Replace an address of the IP header (`address` is its source or destination) and the port (or ICMP
+// identifier) at `port_offset` of the TCP, UDP or ICMP header in `bytes`, adjusting the checksums. TCP's and
+// UDP's checksums cover the addresses too (in the "pseudo-header"); ICMP's does not.
+void rewrite( IPv4Header& header,
+              uint32_t& address,
+              const uint32_t new_address,
+              string& bytes,
+              const size_t port_offset,
+              const uint16_t new_port )
+{
+  const size_t checksum = layout( header.proto )->checksum;
+  const bool udp = header.proto == IPv4Header::PROTO_UDP;
+  const uint32_t old_address = address;
+  address = new_address;
+  for ( const unsigned shift : { 16U, 0U } ) {
+    const auto old_word = static_cast<uint16_t>( old_address >> shift );
+    const auto new_word = static_cast<uint16_t>( new_address >> shift );
+    header.update_checksum( old_word, new_word );
+    if ( header.proto != IPv4Header::PROTO_ICMP ) {
+      adjust_checksum( bytes, checksum, old_word, new_word, udp );
+    }
+  }
+  adjust_checksum( bytes, checksum, get16( bytes, port_offset ), new_port, udp );
+  put16( bytes, port_offset, new_port );
+}
+} // namespace
+
+NatTable::NatTable( const uint32_t outside_address,
+                    const NatTimeouts timeouts,
+                    const uint16_t port_min,
+                    const uint16_t port_max )
+  : outside_address_( outside_address ), timeouts_( timeouts ), port_min_( port_min ), port_max_( port_max )
+{
+  if ( port_min > port_max ) {
+    throw runtime_error( "NatTable: empty port range" );
+  }
+  wheel_.fill( NONE );
+
+  // start each protocol's port search somewhere unpredictable (RFC 6056)
+  auto rd = get_random_engine();
+  uniform_int_distribution<uint16_t> offset { 0, static_cast<uint16_t>( port_max - port_min ) };
+  for ( auto& cursor : cursor_ ) {
+    cursor = offset( rd );
+  }
+}
+
+uint64_t NatTable::inside_key( const uint8_t proto, const uint32_t address, const uint16_t port )
+{
+  return uint64_t { proto } << 48U | uint64_t { address } << 16U | port;
+}
+
+uint32_t NatTable::outside_key( const uint8_t proto, const uint16_t port )
+{
+  return uint32_t { proto } << 16U | port;
+}
+
+optional<uint16_t> NatTable::outside_port( const uint8_t proto,
+                                           const uint32_t inside_address,
+                                           const uint16_t inside_port ) const
+{
+  const uint32_t* index = inside_.find( inside_key( proto, inside_address, inside_port ) );
+  if ( index == nullptr ) {
+    return {};
+  }
+  return static_cast<uint16_t>( mappings_[*index].outside_key );
+}
+
+bool NatTable::translate_outbound( InternetDatagram& dgram )
+{
+  IPv4Header& header = dgram.header;
+  const optional<Layout> transport = layout( header.proto );
+  if ( not transport.has_value() or header.mf or header.offset != 0 ) {
+    return false;
+  }
+  string* bytes = writable_prefix( dgram, transport->length );
+  if ( bytes == nullptr ) {
+    return false;
+  }
+
+  size_t port_offset = SRC_PORT;
+  if ( header.proto == IPv4Header::PROTO_ICMP ) {
+    if ( static_cast<uint8_t>( ( *bytes )[0] ) != ICMPMessage::TYPE_ECHO_REQUEST ) {
+      return false;
+    }
+    port_offset = ICMP_ID;
+  }
+
+  const uint16_t inside_port = get16( *bytes, port_offset );
+  const uint64_t key = inside_key( header.proto, header.src, inside_port );
+  uint32_t index = 0;
+  if ( const uint32_t* found = inside_.find( key ) ) {
+    index = *found;
+  } else if ( const optional<uint32_t> created = create( key, header.proto, inside_port ) ) {
+    index = *created;
+  } else {
+    return false;
+  }
+
+  use( index, header.proto, tcp_flags( header, *bytes ) );
+  rewrite( header,
+           header.src,
+           outside_address_,
+           *bytes,
+           port_offset,
+           static_cast<uint16_t>( mappings_[index].outside_key ) );
+  return true;
+}
+
+bool NatTable::translate_inbound( InternetDatagram& dgram )
+{
+  IPv4Header& header = dgram.header;
+  const optional<Layout> transport = layout( header.proto );
+  if ( header.dst != outside_address_ or not transport.has_value() or header.mf or header.offset != 0 ) {
+    return false;
+  }
+  string* bytes = writable_prefix( dgram, transport->length );
+  if ( bytes == nullptr ) {
+    return false;
+  }
+
+  size_t port_offset = DST_PORT;
+  if ( header.proto == IPv4Header::PROTO_ICMP ) {
+    const auto type = static_cast<uint8_t>( ( *bytes )[0] );
+    if ( ICMPMessage::is_error( type ) ) {
+      return translate_icmp_error( dgram );
+    }
+    if ( type != ICMPMessage::TYPE_ECHO_REPLY ) {
+      return false;
+    }
+    port_offset = ICMP_ID;
+  }
+
+  const uint32_t* found = outside_.find( outside_key( header.proto, get16( *bytes, port_offset ) ) );
+  if ( found == nullptr ) {
+    return false;
+  }
+  const uint32_t index = *found;
+  use( index, header.proto, tcp_flags( header, *bytes ) );
+  const uint64_t inside = mappings_[index].inside_key;
+  rewrite( header,
+           header.dst,
+           static_cast<uint32_t>( inside >> 16U ),
+           *bytes,
+           port_offset,
+           static_cast<uint16_t>( inside ) );
+  return true;
+}
+
+void NatTable::restore_inbound( InternetDatagram& dgram ) const
+{
+  IPv4Header& header = dgram.header;
+  const optional<Layout> transport = layout( header.proto );
+  string* bytes = transport.has_value() ? writable_prefix( dgram, transport->length ) : nullptr;
+  if ( bytes == nullptr ) {
+    return;
+  }
+  const size_t port_offset = header.proto == IPv4Header::PROTO_ICMP ? ICMP_ID : DST_PORT;
+  if ( const optional<uint16_t> port = outside_port( header.proto, header.dst, get16( *bytes, port_offset ) ) ) {
+    rewrite( header, header.dst, outside_address_, *bytes, port_offset, *port );
+  }
+}
+
+// An ICMP error quotes the header and the first 8 bytes of the datagram it is about: one that went out
+// translated, from the outside address and port. Both are put back to the inside ones, and so is the error's
+// destination. Every word changed in the quote also changes the error's own checksum (which covers it), and
+// the quoted header's checksum; the quoted TCP or UDP checksum is adjusted if it was quoted. The mapping is
+// not refreshed: errors say nothing about whether it is still in use.
+bool NatTable::translate_icmp_error( InternetDatagram& dgram )
+{
+  constexpr size_t QUOTE = ICMPMessage::HEADER_LENGTH;
+  constexpr size_t ICMP_CHECKSUM = 2;
+  string* bytes = writable_prefix( dgram, QUOTE + IPv4Header::LENGTH );
+  if ( bytes == nullptr ) {
+    return false;
+  }
+  const size_t quoted_header_length = ( static_cast<uint8_t>( ( *bytes )[QUOTE] ) & 0xfU ) * 4U;
+  const auto quoted_proto = static_cast<uint8_t>( ( *bytes )[QUOTE + 9] );
+  const size_t transport = QUOTE + quoted_header_length;
+  bytes = writable_prefix( dgram, transport + ICMPMessage::QUOTED_PAYLOAD_LENGTH );
+  const optional<Layout> quoted_layout = layout( quoted_proto );
+  if ( bytes == nullptr or quoted_header_length < IPv4Header::LENGTH or not quoted_layout.has_value()
+       or get32( *bytes, QUOTE + 12 ) != outside_address_ ) {
+    return false;
+  }
+
+  size_t port_offset = SRC_PORT;
+  if ( quoted_proto == IPv4Header::PROTO_ICMP ) {
+    if ( static_cast<uint8_t>( ( *bytes )[transport] ) != ICMPMessage::TYPE_ECHO_REQUEST ) {
+      return false;
+    }
+    port_offset = ICMP_ID;
+  }
+  const uint32_t* found = outside_.find( outside_key( quoted_proto, get16( *bytes, transport + port_offset ) ) );
+  if ( found == nullptr ) {
+    return false;
+  }
+  const uint64_t inside = mappings_[*found].inside_key;
+  const auto inside_address = static_cast<uint32_t>( inside >> 16U );
+
+  // change a word of the quote, keeping the error's checksum right
+  const auto change = [&]( size_t offset, uint16_t new_word ) {
+    adjust_checksum( *bytes, ICMP_CHECKSUM, get16( *bytes, offset ), new_word, false );
+    put16( *bytes, offset, new_word );
+  };
+  // adjust a quoted checksum (if it was quoted) for a word of the quote that is about to change
+  const auto cover = [&]( size_t checksum, size_t offset, uint16_t new_word, bool udp ) {
+    if ( checksum + 2 > bytes->size() or ( udp and get16( *bytes, checksum ) == 0 ) ) {
+      return;
+    }
+    const uint16_t result = adjusted( get16( *bytes, checksum ), get16( *bytes, offset ), new_word );
+    change( checksum, udp and result == 0 ? 0xffff : result );
+  };
+
+  const size_t quoted_checksum = transport + quoted_layout->checksum;
+  const bool udp = quoted_proto == IPv4Header::PROTO_UDP;
+  for ( const size_t word : { size_t { 12 }, size_t { 14 } } ) { // the quoted source address
+    const auto new_word = static_cast<uint16_t>( inside_address >> ( word == 12 ? 16U : 0U ) );
+    cover( QUOTE + 10, QUOTE + word, new_word, false );
+    if ( quoted_proto != IPv4Header::PROTO_ICMP ) {
+      cover( quoted_checksum, QUOTE + word, new_word, udp ); // in the TCP or UDP pseudo-header
+    }
+    change( QUOTE + word, new_word );
+  }
+  cover( quoted_checksum, transport + port_offset, static_cast<uint16_t>( inside ), udp );
+  change( transport + port_offset, static_cast<uint16_t>( inside ) );
+
+  const uint32_t old_dst = dgram.header.dst;
+  dgram.header.dst = inside_address;
+  dgram.header.update_checksum( static_cast<uint16_t>( old_dst >> 16U ),
+                                static_cast<uint16_t>( inside_address >> 16U ) );
+  dgram.header.update_checksum( static_cast<uint16_t>( old_dst ), static_cast<uint16_t>( inside_address ) );
+  return true;
+}
+
+optional<uint32_t> NatTable::create( const uint64_t key, const uint8_t proto, const uint16_t inside_port )
+{
+  const optional<uint16_t> port = allocate_port( proto, inside_port );
+  if ( not port.has_value() ) {
+    return {};
+  }
+  uint32_t index = free_;
+  if ( index != NONE ) {
+    free_ = mappings_[index].next;
+  } else {
+    index = static_cast<uint32_t>( mappings_.size() );
+    mappings_.emplace_back();
+  }
+  mappings_[index] = { key, outside_key( proto, *port ), now_, false, 0, NONE, NONE };
+  inside_.try_emplace( key, index );
+  outside_.try_emplace( outside_key( proto, *port ), index );
+  schedule( index );
+  return index;
+}
+
+optional<uint16_t> NatTable::allocate_port( const uint8_t proto, const uint16_t preferred )
+{
+  const auto taken = [&]( uint16_t port ) { return outside_.contains( outside_key( proto, port ) ); };
+  if ( preferred >= port_min_ and preferred <= port_max_ and not taken( preferred ) ) {
+    return preferred;
+  }
+  uint16_t& cursor = cursor_[protocol_index( proto )];
+  const uint32_t range = uint32_t { port_max_ } - port_min_ + 1;
+  for ( uint32_t tried = 0; tried < range; tried++ ) {
+    const auto port = static_cast<uint16_t>( port_min_ + cursor );
+    cursor = static_cast<uint16_t>( ( cursor + 1U ) % range );
+    if ( not taken( port ) ) {
+      return port;
+    }
+  }
+  return {};
+}
+
+// A datagram used the mapping. A TCP mapping's timeout shortens once its connection is closing (and the
+// mapping moves to an earlier slot), and lengthens again if a new connection starts from the same endpoint.
+void NatTable::use( const uint32_t index, const uint8_t proto, const optional<uint8_t> tcp_flags )
+{
+  Mapping& mapping = mappings_[index];
+  mapping.last_used = now_;
+  if ( proto != IPv4Header::PROTO_TCP or not tcp_flags.has_value() ) {
+    return;
+  }
+  if ( ( *tcp_flags & ( TCP_FIN | TCP_RST ) ) != 0 and not mapping.closing ) {
+    mapping.closing = true;
+    unlink( index );
+    schedule( index );
+  } else if ( ( *tcp_flags & ( TCP_SYN | TCP_ACK ) ) == TCP_SYN ) {
+    mapping.closing = false;
+  }
+}
+
+uint64_t NatTable::deadline( const uint32_t index ) const
+{
+  const Mapping& mapping = mappings_[index];
+  const auto proto = static_cast<uint8_t>( mapping.inside_key >> 48U );
+  uint64_t timeout = timeouts_.icmp;
+  if ( proto == IPv4Header::PROTO_TCP ) {
+    timeout = mapping.closing ? timeouts_.tcp_transitory : timeouts_.tcp;
+  } else if ( proto == IPv4Header::PROTO_UDP ) {
+    timeout = timeouts_.udp;
+  }
+  return mapping.last_used + timeout;
+}
+
+// Put a mapping on the slot of its deadline (rounded up to a whole slot), or on the last slot the wheel
+// reaches if the deadline is further away than that
+void NatTable::schedule( const uint32_t index )
+{
+  const uint64_t slot
+    = clamp( ( deadline( index ) + SLOT_MS - 1 ) / SLOT_MS, next_slot_, next_slot_ + WHEEL_SLOTS - 1 );
+  Mapping& mapping = mappings_[index];
+  mapping.slot = static_cast<uint32_t>( slot % WHEEL_SLOTS );
+  mapping.prev = NONE;
+  mapping.next = wheel_[mapping.slot];
+  if ( mapping.next != NONE ) {
+    mappings_[mapping.next].prev = index;
+  }
+  wheel_[mapping.slot] = index;
+}
+
+void NatTable::unlink( const uint32_t index )
+{
+  const Mapping& mapping = mappings_[index];
+  if ( mapping.prev != NONE ) {
+    mappings_[mapping.prev].next = mapping.next;
+  } else {
+    wheel_[mapping.slot] = mapping.next;
+  }
+  if ( mapping.next != NONE ) {
+    mappings_[mapping.next].prev = mapping.prev;
+  }
+}
+
+void NatTable::remove( const uint32_t index )
+{
+  Mapping& mapping = mappings_[index];
+  inside_.erase( mapping.inside_key );
+  outside_.erase( mapping.outside_key );
+  mapping.next = free_;
+  free_ = index;
+}
+
+void NatTable::tick( const uint64_t ms_since_last_tick )
+{
+  now_ += ms_since_last_tick;
+  while ( next_slot_ * SLOT_MS <= now_ ) {
+    const size_t slot = next_slot_ % WHEEL_SLOTS;
+    next_slot_++;
+    expire_slot( slot );
+  }
+}
+
+// Remove the mappings on a slot that have lapsed, and put the ones used since they were scheduled back on
+// the wheel
+void NatTable::expire_slot( const size_t slot )
+{
+  uint32_t index = exchange( wheel_[slot], NONE );
+  while ( index != NONE ) {
+    const uint32_t next = mappings_[index].next;
+    if ( deadline( index ) <= now_ ) {
+      remove( index );
+    } else {
+      schedule( index );
+    }
+    index = next;
+  }
+}
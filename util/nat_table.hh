@@ -0,0 +1,119 @@
+#pragma once
+
+#include "flat_hash_map.hh"
+#include "ipv4_datagram.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// How long (in ms) a NatTable's mapping may stay idle
+struct NatTimeouts
+{
+  uint64_t tcp { 7440 * 1000 };           // an established connection: 2 hours 4 minutes (RFC 5382)
+  uint64_t tcp_transitory { 240 * 1000 }; // once either side has sent FIN or RST: 4 minutes
+  uint64_t udp { 300 * 1000 };            // 5 minutes (RFC 4787)
+  uint64_t icmp { 60 * 1000 };            // 60 seconds (RFC 5508)
+};
+
+// Source NAT ("masquerading"): datagrams from inside hosts leave with one outside address as their source,
+// and the replies to them find their way back.
+//
+// Each inside endpoint (protocol, address and port; for ICMP, the echo identifier) is mapped to a port of
+// the outside address, the same port whoever it talks to ("endpoint-independent mapping", RFC 4787), and
+// keeps it while it is in use. Two hash tables find a mapping from either side in one lookup. The inside
+// port is kept if it is free, and otherwise the next free port after a randomly started cursor is taken.
+//
+// A mapping lapses once it has been idle for its protocol's timeout. The mappings wait on a timing wheel
+// (one slot a second) in lists threaded through them, so neither adding nor removing one costs more than a
+// few pointer updates; a mapping that is used again is not moved, but checked when its slot comes round and
+// then put back in the slot of its new deadline.
+//
+// Rewriting an address or port adjusts the IP header checksum and the TCP, UDP or ICMP checksum by the
+// difference alone (RFC 1624), without summing the datagram again. Inbound ICMP errors about a translated
+// datagram are translated too (the header they quote as well as their own), so that traceroute and path MTU
+// discovery work from inside.
+//
+// Fragments are not translated: later fragments do not carry the ports. Datagrams addressed to the outside
+// address are reassembled before they get here (by the NetworkInterface, or in the Router's parallel mode by
+// the receiving thread), so only outbound fragments are refused.
+class NatTable
+{
+public:
+  explicit NatTable( uint32_t outside_address,
+                     NatTimeouts timeouts = {},
+                     uint16_t port_min = 1024,
+                     uint16_t port_max = UINT16_MAX );
+
+  uint32_t outside_address() const { return outside_address_; }
+
+  // Translate the source of a datagram on its way out, creating a mapping if there is none. Returns false
+  // (and leaves the datagram alone) if it cannot be translated: it is not TCP, UDP or an ICMP echo request,
+  // it is a fragment, it is too short, or every port is taken.
+  bool translate_outbound( InternetDatagram& dgram );
+
+  // Translate the destination of a datagram addressed to the outside address back to the inside endpoint.
+  // Returns false (and leaves the datagram alone) if it does not belong to a mapping.
+  bool translate_inbound( InternetDatagram& dgram );
+
+  // Put a datagram that translate_inbound translated (other than an ICMP error) back the way it arrived, to
+  // the outside address and port: an ICMP error about it must quote what its sender sent.
+  void restore_inbound( InternetDatagram& dgram ) const;
+
+  // Called periodically when time elapses; lapsed mappings are removed
+  void tick( uint64_t ms_since_last_tick );
+
+  // The outside port mapped to an inside endpoint, if any
+  std::optional<uint16_t> outside_port( uint8_t proto, uint32_t inside_address, uint16_t inside_port ) const;
+
+  size_t size() const { return inside_.size(); }
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+  static constexpr size_t WHEEL_SLOTS = 1024;
+  static constexpr uint64_t SLOT_MS = 1000;
+
+  struct Mapping
+  {
+    uint64_t inside_key;  // protocol, inside address and inside port
+    uint32_t outside_key; // protocol and outside port
+    uint64_t last_used;
+    bool closing;         // a TCP mapping whose connection has sent FIN or RST
+    uint32_t slot;        // the wheel slot it waits on
+    uint32_t prev, next;  // its neighbours on the slot's list (or, once removed, on the free list)
+  };
+
+  uint32_t outside_address_;
+  NatTimeouts timeouts_;
+  uint16_t port_min_;
+  uint16_t port_max_;
+
+  std::vector<Mapping> mappings_ {};
+  uint32_t free_ { NONE };
+  FlatHashMap<uint64_t, uint32_t> inside_ {};
+  FlatHashMap<uint32_t, uint32_t> outside_ {};
+
+  // where the port search resumes, for TCP, UDP and ICMP
+  std::array<uint16_t, 3> cursor_ {};
+
+  uint64_t now_ {};
+  uint64_t next_slot_ {}; // the first slot (counted from time 0) that has not come round yet
+  std::array<uint32_t, WHEEL_SLOTS> wheel_ {};
+
+  static uint64_t inside_key( uint8_t proto, uint32_t address, uint16_t port );
+  static uint32_t outside_key( uint8_t proto, uint16_t port );
+
+  std::optional<uint32_t> create( uint64_t key, uint8_t proto, uint16_t inside_port );
+  std::optional<uint16_t> allocate_port( uint8_t proto, uint16_t preferred );
+  void use( uint32_t index, uint8_t proto, std::optional<uint8_t> tcp_flags );
+  uint64_t deadline( uint32_t index ) const;
+
+  void schedule( uint32_t index );
+  void unlink( uint32_t index );
+  void remove( uint32_t index );
+  void expire_slot( size_t slot );
+
+  bool translate_icmp_error( InternetDatagram& dgram );
+};
@@ -0,0 +1,178 @@
+#include "packet_classifier.hh"
+#include "address.hh"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace {
+uint32_t prefix_mask( uint8_t length )
+{
+  return length == 0 ? 0 : UINT32_MAX << ( 32U - length );
+}
+
+// How a rule restricts a port
+enum class PortKind : uint8_t
+{
+  Any,
+  Exact,
+  Range,
+};
+
+PortKind port_kind( uint16_t min, uint16_t max )
+{
+  if ( min == 0 and max == UINT16_MAX ) {
+    return PortKind::Any;
+  }
+  return min == max ? PortKind::Exact : PortKind::Range;
+}
+} // namespace
+
+bool AclRule::matches( const FlowKey& key, bool ports ) const
+{
+  const bool any_port = src_port_min == 0 and src_port_max == UINT16_MAX and dst_port_min == 0
+                        and dst_port_max == UINT16_MAX;
+  return ( ( key.src ^ src_prefix ) & prefix_mask( src_length ) ) == 0
+         and ( ( key.dst ^ dst_prefix ) & prefix_mask( dst_length ) ) == 0
+         and ( not proto.has_value() or *proto == key.proto )
+         and ( any_port
+               or ( ports and key.src_port >= src_port_min and key.src_port <= src_port_max
+                    and key.dst_port >= dst_port_min and key.dst_port <= dst_port_max ) );
+}
+
+string AclRule::to_string() const
+{
+  string ret = action == Action::Permit ? "permit " : "deny ";
+  ret += Address::from_ipv4_numeric( src_prefix ).ip() + "/" + std::to_string( src_length ) + " -> ";
+  ret += Address::from_ipv4_numeric( dst_prefix ).ip() + "/" + std::to_string( dst_length );
+  if ( proto.has_value() ) {
+    ret += " proto " + std::to_string( *proto );
+  }
+  const auto range = [&]( const string& name, uint16_t min, uint16_t max ) {
+    if ( min != 0 or max != UINT16_MAX ) {
+      ret += " " + name + " " + std::to_string( min ) + "-" + std::to_string( max );
+    }
+  };
+  range( "sport", src_port_min, src_port_max );
+  range( "dport", dst_port_min, dst_port_max );
+  return ret;
+}
+
+PacketClassifier::PacketClassifier( vector<AclRule> rules, AclRule::Action default_action )
+  : rules_( move( rules ) ), default_action_( default_action )
+{
+  map<uint32_t, size_t> tuple_of_shape; // (prefix lengths, protocol or not, port kinds) -> index in tuples_
+  for ( size_t i = 0; i < rules_.size(); i++ ) {
+    const AclRule& rule = rules_[i];
+    if ( rule.src_length > 32 or rule.dst_length > 32 ) {
+      throw runtime_error( "ACL rule prefix length is longer than 32: " + rule.to_string() );
+    }
+    if ( rule.src_port_min > rule.src_port_max or rule.dst_port_min > rule.dst_port_max ) {
+      throw runtime_error( "ACL rule has an empty port range: " + rule.to_string() );
+    }
+
+    const PortKind src_kind = port_kind( rule.src_port_min, rule.src_port_max );
+    const PortKind dst_kind = port_kind( rule.dst_port_min, rule.dst_port_max );
+    const uint32_t shape = uint32_t { rule.src_length } << 24U | uint32_t { rule.dst_length } << 16U
+                           | static_cast<uint32_t>( rule.proto.has_value() ) << 8U
+                           | static_cast<uint32_t>( src_kind ) << 4U | static_cast<uint32_t>( dst_kind );
+    auto [found, inserted] = tuple_of_shape.try_emplace( shape, tuples_.size() );
+    if ( inserted ) {
+      const uint64_t address_mask
+        = uint64_t { prefix_mask( rule.src_length ) } << 32U | prefix_mask( rule.dst_length );
+      const uint64_t rest_mask = ( rule.proto.has_value() ? 0xffULL << 32U : 0 )
+                                 | ( src_kind == PortKind::Exact ? 0xffffULL << 16U : 0 )
+                                 | ( dst_kind == PortKind::Exact ? 0xffffULL : 0 );
+      tuples_.push_back( { address_mask,
+                           rest_mask,
+                           src_kind != PortKind::Any or dst_kind != PortKind::Any,
+                           src_kind == PortKind::Range or dst_kind == PortKind::Range,
+                           i,
+                           Table {} } );
+    }
+
+    // rules go in in order; without ranges to check, the first rule for a key hides the later ones
+    Tuple& tuple = tuples_[found->second];
+    const FlowKey key {
+      rule.src_prefix, rule.dst_prefix, rule.src_port_min, rule.dst_port_min, rule.proto.value_or( 0 ) };
+    const Key masked = key_of( key );
+    vector<size_t>& candidates
+      = *tuple.rules.try_emplace( { masked.addresses & tuple.address_mask, masked.rest & tuple.rest_mask } ).first;
+    if ( tuple.checks_ranges or candidates.empty() ) {
+      candidates.push_back( i );
+    }
+  }
+
+  ranges::sort( tuples_, {}, &Tuple::first_rule );
+
+  // the Bloom filter: 16 bits per key (a power of two, at least one word), one hash function
+  size_t keys = 0;
+  for ( const Tuple& tuple : tuples_ ) {
+    keys += tuple.rules.size();
+  }
+  const size_t bits = bit_ceil( max<size_t>( keys * 16, 64 ) );
+  filter_.assign( bits / 64, 0 );
+  filter_mask_ = bits - 1;
+  for ( size_t j = 0; j < tuples_.size(); j++ ) {
+    tuples_[j].rules.for_each( [&]( const Key& masked, const vector<size_t>& ) {
+      const uint64_t bit = filter_bit( masked, j );
+      filter_[bit / 64] |= 1ULL << ( bit % 64 );
+    } );
+  }
+}
+
+PacketClassifier::Key PacketClassifier::key_of( const FlowKey& key )
+{
+  return { uint64_t { key.src } << 32U | key.dst,
+           uint64_t { key.proto } << 32U | uint64_t { key.src_port } << 16U | key.dst_port };
+}
+
+size_t PacketClassifier::match( const FlowKey& key, bool ports ) const
+{
+  const Key unmasked = key_of( key );
+  size_t best = NO_MATCH;
+  for ( size_t j = 0; j < tuples_.size(); j++ ) {
+    const Tuple& tuple = tuples_[j];
+    if ( tuple.first_rule >= best ) {
+      break; // neither this tuple nor any later one has a rule before the best match
+    }
+    if ( tuple.needs_ports and not ports ) {
+      continue;
+    }
+    const Key masked { unmasked.addresses & tuple.address_mask, unmasked.rest & tuple.rest_mask };
+    const uint64_t bit = filter_bit( masked, j );
+    if ( ( filter_[bit / 64] >> ( bit % 64 ) & 1U ) == 0 ) {
+      continue;
+    }
+    const vector<size_t>* candidates = tuple.rules.find( masked );
+    if ( candidates == nullptr ) {
+      continue;
+    }
+    for ( const size_t rule : *candidates ) {
+      if ( rule >= best ) {
+        break;
+      }
+      if ( not tuple.checks_ranges or rules_[rule].matches( key, ports ) ) {
+        best = rule;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+AclRule::Action PacketClassifier::classify( const InternetDatagram& dgram ) const
+{
+  if ( rules_.empty() ) {
+    return default_action_;
+  }
+  const auto ports = FlowKey::ports( dgram );
+  const auto [src_port, dst_port] = ports.value_or( pair<uint16_t, uint16_t> {} );
+  const size_t rule
+    = match( { dgram.header.src, dgram.header.dst, src_port, dst_port, dgram.header.proto }, ports.has_value() );
+  return rule == NO_MATCH ? default_action_ : rules_[rule].action;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "flat_hash_map.hh"
+#include "flow_hash.hh"
+#include "ipv4_datagram.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// One rule of an access-control list: what to do with datagrams whose source and destination addresses fall
+// in the given prefixes, whose protocol matches (if one is given) and whose ports fall in the given ranges.
+// A rule that restricts the ports only matches datagrams that carry them: TCP and UDP, and only their first
+// fragment.
+struct AclRule
+{
+  enum class Action : uint8_t
+  {
+    Permit,
+    Deny,
+  };
+
+  Action action { Action::Permit };
+  uint32_t src_prefix {};
+  uint8_t src_length {};
+  uint32_t dst_prefix {};
+  uint8_t dst_length {};
+  std::optional<uint8_t> proto {}; // any protocol if empty
+  uint16_t src_port_min { 0 };
+  uint16_t src_port_max { UINT16_MAX };
+  uint16_t dst_port_min { 0 };
+  uint16_t dst_port_max { UINT16_MAX };
+
+  // Whether the rule matches a datagram with this 5-tuple (`ports` says whether it has ports at all)
+  bool matches( const FlowKey& key, bool ports ) const;
+
+  std::string to_string() const;
+};
+
+// A packet classifier for an access-control list, by tuple-space search (Srinivasan, Suri and Varghese,
+// "Packet Classification using Tuple Space Search", SIGCOMM 1999).
+//
+// The rules are grouped by their "tuple": the lengths of their source and destination prefixes, whether they
+// name a protocol, and whether each port is any port, one port, or a range. All the rules of a tuple mask a
+// datagram's 5-tuple the same way, so each tuple is one hash table from masked 5-tuples to the rules that may
+// match them, and classifying a datagram takes one hash lookup per tuple rather than a test per rule. A range
+// is left out of the hash key, and the few rules that share an entry are then checked in order (splitting
+// ranges into prefixes, as the paper does, multiplies the number of tuples instead). Real rule sets use a few
+// dozen tuples however many rules they have. The tuples are searched in order of their first rule, and the
+// search stops at the first tuple whose rules all come after the best match found so far.
+//
+// Most tuples hold no rule for a given 5-tuple, so a Bloom filter over all the tuples' keys (16 bits per key,
+// small enough to stay in cache) answers most probes before they reach a hash table.
+class PacketClassifier
+{
+public:
+  static constexpr size_t NO_MATCH = SIZE_MAX;
+
+  PacketClassifier() = default;
+
+  // Rules are tried in order, and the first that matches decides; a datagram that matches none gets
+  // `default_action`. Throws if a rule's prefix length is over 32, or a port range is empty.
+  explicit PacketClassifier( std::vector<AclRule> rules,
+                             AclRule::Action default_action = AclRule::Action::Permit );
+
+  // What to do with a datagram
+  AclRule::Action classify( const InternetDatagram& dgram ) const;
+
+  // The index of the first rule that matches a 5-tuple, or NO_MATCH
+  size_t match( const FlowKey& key, bool ports ) const;
+
+  const std::vector<AclRule>& rules() const { return rules_; }
+  AclRule::Action default_action() const { return default_action_; }
+  size_t tuple_count() const { return tuples_.size(); }
+  bool empty() const { return rules_.empty(); }
+
+private:
+  // A 5-tuple (masked by a tuple's masks): the two addresses, then the protocol and the two ports
+  struct Key
+  {
+    uint64_t addresses;
+    uint64_t rest;
+    bool operator==( const Key& other ) const = default;
+  };
+  struct KeyHash
+  {
+    size_t operator()( const Key& key ) const { return hash_mix( key.addresses ) ^ key.rest; }
+  };
+  using Table = FlatHashMap<Key, std::vector<size_t>, KeyHash>;
+
+  // The rules of one tuple: its masks, and a table from masked 5-tuples to the rules that may match them
+  // (in order; only the first, unless the tuple has port ranges to check)
+  struct Tuple
+  {
+    uint64_t address_mask;
+    uint64_t rest_mask;
+    bool needs_ports;   // its rules restrict the ports
+    bool checks_ranges; // and some of them to a range, which the hash key leaves out
+    size_t first_rule;  // the earliest of its rules
+    Table rules;
+  };
+
+  static Key key_of( const FlowKey& key );
+
+  // Where the Bloom filter keeps a masked key of tuple number `tuple`
+  uint64_t filter_bit( const Key& masked, size_t tuple ) const
+  {
+    return hash_mix( ( masked.addresses ^ tuple << 56U ) * 0x9e3779b97f4a7c15ULL + masked.rest ) & filter_mask_;
+  }
+
+  std::vector<AclRule> rules_ {};
+  AclRule::Action default_action_ { AclRule::Action::Permit };
+  std::vector<Tuple> tuples_ {}; // in order of first_rule
+  std::vector<uint64_t> filter_ {};
+  uint64_t filter_mask_ {};
+};
@@ -167,3 +167,16 @@ vector<Ref<string>> Serializer::finish()
   flush();
   return move( output_ );
 }
+
+void Serializer::finish( vector<Ref<string>>& out )
+{
+  // output_ stays empty (and unallocated) unless buffers were added, as headers add none
+  for ( auto& piece : output_ ) {
+    out.push_back( move( piece ) );
+  }
+  output_.clear();
+  if ( not buffer_.empty() ) {
+    out.emplace_back( move( buffer_ ) );
+    buffer_.clear();
+  }
+}
@@ -10,6 +10,7 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 class Parser
@@ -100,6 +101,11 @@ class Serializer
   void flush();
 
 public:
+  Serializer() = default;
+
+  // Start from a recycled buffer: its contents are discarded, and its capacity is reused
+  explicit Serializer( std::string recycled ) : buffer_( std::move( recycled ) ) { buffer_.clear(); }
+
   template<std::unsigned_integral T>
   void integer( const T val )
   {
@@ -115,4 +121,7 @@ public:
   void buffer( Ref<std::string> buf );
   void buffer( const std::vector<Ref<std::string>>& bufs );
   std::vector<Ref<std::string>> finish();
+
+  // Append the output to `out` (which may have recycled capacity) instead of returning a list of its own
+  void finish( std::vector<Ref<std::string>>& out );
 };
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A path-compressed binary (PATRICIA) trie of IPv4 prefixes, for longest-prefix matching.
+//
+// Every node stores the whole prefix it stands for, so a chain of single-child nodes collapses into
+// one edge: a table of N prefixes needs fewer than 2N nodes, and a lookup visits at most one node per
+// prefix length (33), checking each with one mask-and-compare. The nodes live in a single vector and
+// refer to each other by index, and the values are kept in a parallel vector, so that a lookup's walk
+// only touches 16-byte nodes (four to a cache line); erased nodes are recycled.
+template<typename Value>
+class PrefixTrie
+{
+public:
+  static constexpr uint8_t MAX_LENGTH = 32;
+
+  // Lookups that lookup_batch() interleaves at a time
+  static constexpr size_t MAX_BATCH = 64;
+
+  // The netmask for a prefix length (0 for the default route)
+  static constexpr uint32_t mask( uint8_t length )
+  {
+    return length == 0 ? 0 : std::numeric_limits<uint32_t>::max() << ( MAX_LENGTH - length );
+  }
+
+  // Add a prefix, or replace the value stored for it. Bits of `prefix` past `length` are ignored.
+  // Returns true if the prefix is new.
+  bool insert( uint32_t prefix, uint8_t length, Value value )
+  {
+    check_length( length );
+    prefix &= mask( length );
+
+    uint32_t parent = NONE;
+    unsigned side = 0;
+    while ( true ) {
+      const uint32_t current = link( parent, side );
+      if ( current == NONE ) {
+        const uint32_t leaf = allocate( prefix, length );
+        store( leaf, std::move( value ) );
+        link( parent, side ) = leaf;
+        return true;
+      }
+
+      const uint8_t node_length = nodes_[current].length;
+      const uint32_t node_prefix = nodes_[current].prefix;
+      const uint8_t common = common_length( prefix, node_prefix, std::min( length, node_length ) );
+      if ( common == node_length ) {
+        if ( length == node_length ) {
+          const bool added = not nodes_[current].has_value;
+          store( current, std::move( value ) );
+          return added;
+        }
+        parent = current;
+        side = bit( prefix, node_length );
+        continue;
+      }
+
+      // The new prefix leaves the path somewhere along the edge into `current`: either it sits on
+      // the edge itself (it is shorter than, and covers, the node), or a new branch is needed there.
+      const unsigned node_side = bit( node_prefix, common );
+      const uint32_t branch = allocate( prefix & mask( common ), common );
+      if ( common == length ) {
+        store( branch, std::move( value ) );
+      } else {
+        const uint32_t leaf = allocate( prefix, length );
+        store( leaf, std::move( value ) );
+        nodes_[branch].child[node_side ^ 1U] = leaf;
+      }
+      nodes_[branch].child[node_side] = current;
+      link( parent, side ) = branch;
+      return true;
+    }
+  }
+
+  // Remove a prefix. Returns whether it was present.
+  bool erase( uint32_t prefix, uint8_t length )
+  {
+    check_length( length );
+    prefix &= mask( length );
+
+    uint32_t grandparent = NONE;
+    uint32_t parent = NONE;
+    unsigned parent_side = 0;
+    unsigned side = 0;
+    uint32_t current = root_;
+    while ( current != NONE and nodes_[current].length < length ) {
+      if ( not matches( prefix, current ) ) {
+        return false;
+      }
+      grandparent = parent;
+      parent_side = side;
+      parent = current;
+      side = bit( prefix, nodes_[current].length );
+      current = nodes_[current].child[side];
+    }
+    if ( current == NONE or nodes_[current].length != length or nodes_[current].prefix != prefix
+         or not nodes_[current].has_value ) {
+      return false;
+    }
+
+    nodes_[current].has_value = false;
+    values_[current] = {};
+    --size_;
+
+    // A valueless node is only worth keeping while it branches two ways
+    const auto children = nodes_[current].child;
+    if ( children[0] != NONE and children[1] != NONE ) {
+      return true;
+    }
+    const uint32_t only_child = children[0] != NONE ? children[0] : children[1];
+    link( parent, side ) = only_child;
+    release( current );
+
+    // Removing a leaf may leave its parent as a valueless node with one child
+    if ( only_child == NONE and parent != NONE and not nodes_[parent].has_value ) {
+      link( grandparent, parent_side ) = nodes_[parent].child[side ^ 1U];
+      release( parent );
+    }
+    return true;
+  }
+
+  // The value of the longest prefix that contains `address`, or nullptr if none does
+  const Value* lookup( uint32_t address ) const { return lookup( address, MAX_LENGTH ); }
+
+  // The same, among the prefixes no longer than `max_length` (e.g. the route that a longer one refines)
+  const Value* lookup( uint32_t address, uint8_t max_length ) const
+  {
+    uint32_t best = NONE;
+    uint32_t current = root_;
+    while ( current != NONE and nodes_[current].length <= max_length and matches( address, current ) ) {
+      const Node& node = nodes_[current];
+      if ( node.has_value ) {
+        best = current;
+      }
+      if ( node.length == MAX_LENGTH ) {
+        break;
+      }
+      current = node.child[bit( address, node.length )];
+    }
+    return best == NONE ? nullptr : &values_[best];
+  }
+
+  // Look up many addresses at once: results[i] is lookup( addresses[i] ). The walks are interleaved,
+  // advancing each unfinished lookup by one node per round and prefetching the node it moves to,
+  // so the cache misses of different lookups overlap instead of being paid one after another.
+  void lookup_batch( std::span<const uint32_t> addresses, std::span<const Value*> results ) const
+  {
+    if ( results.size() < addresses.size() ) {
+      throw std::runtime_error( "PrefixTrie::lookup_batch: results is shorter than addresses" );
+    }
+    for ( size_t start = 0; start < addresses.size(); start += MAX_BATCH ) {
+      const size_t count = std::min( MAX_BATCH, addresses.size() - start );
+      std::array<uint32_t, MAX_BATCH> current {};
+      std::array<uint32_t, MAX_BATCH> best {};
+      std::array<uint8_t, MAX_BATCH> active {}; // lanes still walking, compacted as they finish
+      for ( size_t lane = 0; lane < count; lane++ ) {
+        current[lane] = root_;
+        best[lane] = NONE;
+        active[lane] = static_cast<uint8_t>( lane );
+      }
+      size_t active_count = root_ == NONE ? 0 : count;
+
+      while ( active_count > 0 ) {
+        for ( size_t i = 0; i < active_count; ) {
+          const uint8_t lane = active[i];
+          const uint32_t address = addresses[start + lane];
+          const Node& node = nodes_[current[lane]];
+          uint32_t next = NONE;
+          if ( matches( address, current[lane] ) ) {
+            if ( node.has_value ) {
+              best[lane] = current[lane];
+            }
+            if ( node.length < MAX_LENGTH ) {
+              next = node.child[bit( address, node.length )];
+            }
+          }
+          if ( next == NONE ) {
+            active[i] = active[--active_count];
+            continue;
+          }
+          __builtin_prefetch( &nodes_[next] );
+          current[lane] = next;
+          i++;
+        }
+      }
+
+      for ( size_t lane = 0; lane < count; lane++ ) {
+        results[start + lane] = best[lane] == NONE ? nullptr : &values_[best[lane]];
+      }
+    }
+  }
+
+  // The value stored for exactly this prefix, or nullptr
+  const Value* find( uint32_t prefix, uint8_t length ) const
+  {
+    check_length( length );
+    prefix &= mask( length );
+    uint32_t current = root_;
+    while ( current != NONE and nodes_[current].length < length and matches( prefix, current ) ) {
+      current = nodes_[current].child[bit( prefix, nodes_[current].length )];
+    }
+    if ( current == NONE or nodes_[current].length != length or nodes_[current].prefix != prefix
+         or not nodes_[current].has_value ) {
+      return nullptr;
+    }
+    return &values_[current];
+  }
+
+  // Make room for `count` prefixes without reallocating
+  void reserve( size_t count )
+  {
+    nodes_.reserve( count * 2 );
+    values_.reserve( count * 2 );
+  }
+
+  void clear()
+  {
+    nodes_.clear();
+    values_.clear();
+    free_.clear();
+    root_ = NONE;
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Nodes in use, including the valueless branch nodes
+  size_t node_count() const { return nodes_.size() - free_.size(); }
+
+private:
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  struct Node
+  {
+    uint32_t prefix {}; // masked to `length` bits
+    uint8_t length {};
+    bool has_value {};
+    std::array<uint32_t, 2> child { NONE, NONE };
+  };
+
+  std::vector<Node> nodes_ {};
+  std::vector<Value> values_ {}; // values_[i] belongs to nodes_[i]
+  std::vector<uint32_t> free_ {};
+  uint32_t root_ { NONE };
+  size_t size_ {};
+
+  static void check_length( uint8_t length )
+  {
+    if ( length > MAX_LENGTH ) {
+      throw std::runtime_error( "PrefixTrie: prefix length " + std::to_string( length ) + " is longer than 32" );
+    }
+  }
+
+  // Bit `position` of `address`, counting from the most significant bit
+  static unsigned bit( uint32_t address, uint8_t position ) { return ( address >> ( 31U - position ) ) & 1U; }
+
+  // Number of leading bits that `a` and `b` share, capped at `limit`
+  static uint8_t common_length( uint32_t a, uint32_t b, uint8_t limit )
+  {
+    return std::min( static_cast<uint8_t>( std::countl_zero( a ^ b ) ), limit );
+  }
+
+  bool matches( uint32_t address, uint32_t index ) const
+  {
+    return ( ( address ^ nodes_[index].prefix ) & mask( nodes_[index].length ) ) == 0;
+  }
+
+  // The slot that points to a child of `parent` (or the root, if there is no parent)
+  uint32_t& link( uint32_t parent, unsigned side ) { return parent == NONE ? root_ : nodes_[parent].child[side]; }
+
+  // Allocating may reallocate `nodes_`: no references into it may be held across these calls
+  uint32_t allocate( uint32_t prefix, uint8_t length )
+  {
+    uint32_t index {};
+    if ( free_.empty() ) {
+      index = static_cast<uint32_t>( nodes_.size() );
+      nodes_.emplace_back();
+      values_.emplace_back();
+    } else {
+      index = free_.back();
+      free_.pop_back();
+    }
+    nodes_[index].prefix = prefix;
+    nodes_[index].length = length;
+    return index;
+  }
+
+  void release( uint32_t index )
+  {
+    nodes_[index] = {};
+    values_[index] = {};
+    free_.push_back( index );
+  }
+
+  void store( uint32_t index, Value&& value )
+  {
+    size_ += not nodes_[index].has_value;
+    nodes_[index].has_value = true;
+    values_[index] = std::move( value );
+  }
+};
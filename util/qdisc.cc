@@ -0,0 +1,280 @@
+#include "qdisc.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+size_t Qdisc::frame_size( const EthernetFrame& frame )
+{
+  size_t size = EthernetHeader::LENGTH;
+  for ( const auto& piece : frame.payload ) {
+    size += piece->size();
+  }
+  return size;
+}
+
+void Qdisc::added( const Entry& entry )
+{
+  packets_++;
+  bytes_ += entry.size;
+}
+
+void Qdisc::removed( const Entry& entry )
+{
+  packets_--;
+  bytes_ -= entry.size;
+}
+
+void Qdisc::dropped( const Entry& entry )
+{
+  removed( entry );
+  drops_++;
+}
+
+void FIFOQdisc::enqueue( EthernetFrame frame, uint32_t flow [[maybe_unused]], uint64_t now )
+{
+  if ( queue_.size() >= limit_ ) {
+    dropped_on_arrival();
+    return;
+  }
+  const size_t size = frame_size( frame );
+  queue_.push_back( { move( frame ), size, now } );
+  added( queue_.back() );
+}
+
+optional<EthernetFrame> FIFOQdisc::dequeue( uint64_t now [[maybe_unused]] )
+{
+  if ( queue_.empty() ) {
+    return {};
+  }
+  Entry entry = move( queue_.front() );
+  queue_.pop_front();
+  removed( entry );
+  return move( entry.frame );
+}
+
+REDQdisc::REDQdisc( size_t limit,
+                    double min_threshold,
+                    double max_threshold,
+                    double max_probability,
+                    double weight )
+  : limit_( limit )
+  , min_threshold_( min_threshold )
+  , max_threshold_( max_threshold )
+  , max_probability_( max_probability )
+  , weight_( weight )
+{
+  if ( min_threshold >= max_threshold or max_probability <= 0 or max_probability > 1 or weight <= 0
+       or weight > 1 ) {
+    throw runtime_error( "REDQdisc: invalid parameters" );
+  }
+}
+
+bool REDQdisc::early_drop( uint64_t now )
+{
+  // While the queue sits idle, the average decays as if an arrival had found it empty every millisecond
+  if ( queue_.empty() ) {
+    average_ *= pow( 1 - weight_, static_cast<double>( now - idle_since_ ) + 1 );
+    idle_since_ = now;
+  } else {
+    average_ += weight_ * ( static_cast<double>( queue_.size() ) - average_ );
+  }
+
+  if ( average_ < min_threshold_ ) {
+    count_ = -1;
+    return false;
+  }
+  if ( average_ >= max_threshold_ ) {
+    count_ = 0;
+    return true;
+  }
+
+  // Between the thresholds, scale the probability by the arrivals since the last drop, spacing drops evenly
+  count_++;
+  const double base = max_probability_ * ( average_ - min_threshold_ ) / ( max_threshold_ - min_threshold_ );
+  const double spread = 1 - static_cast<double>( count_ ) * base;
+  if ( spread <= 0 or uniform_real_distribution<double> {}( random_ ) < base / spread ) {
+    count_ = 0;
+    return true;
+  }
+  return false;
+}
+
+void REDQdisc::enqueue( EthernetFrame frame, uint32_t flow [[maybe_unused]], uint64_t now )
+{
+  if ( early_drop( now ) or queue_.size() >= limit_ ) {
+    dropped_on_arrival();
+    return;
+  }
+  const size_t size = frame_size( frame );
+  queue_.push_back( { move( frame ), size, now } );
+  added( queue_.back() );
+}
+
+optional<EthernetFrame> REDQdisc::dequeue( uint64_t now )
+{
+  if ( queue_.empty() ) {
+    return {};
+  }
+  Entry entry = move( queue_.front() );
+  queue_.pop_front();
+  removed( entry );
+  if ( queue_.empty() ) {
+    idle_since_ = now;
+  }
+  return move( entry.frame );
+}
+
+FQCoDelQdisc::FQCoDelQdisc( size_t limit, size_t flows, uint64_t target, uint64_t interval, size_t quantum )
+  : limit_( limit ), target_( target ), interval_( interval ), quantum_( quantum ), flows_( flows )
+{
+  if ( limit == 0 or flows == 0 or interval == 0 or quantum == 0 ) {
+    throw runtime_error( "FQCoDelQdisc: invalid parameters" );
+  }
+}
+
+void FQCoDelQdisc::enqueue( EthernetFrame frame, uint32_t flow, uint64_t now )
+{
+  const size_t index = static_cast<size_t>( ( uint64_t { flow } * flows_.size() ) >> 32U );
+  Flow& f = flows_[index];
+  const size_t size = frame_size( frame );
+  f.queue.push_back( { move( frame ), size, now } );
+  f.bytes += size;
+  added( f.queue.back() );
+
+  // a flow that was idle joins new_flows_, which are served first
+  if ( not f.listed ) {
+    f.listed = true;
+    f.deficit = static_cast<int64_t>( quantum_ );
+    new_flows_.push_back( index );
+  }
+
+  if ( packets() > limit_ ) {
+    drop_from_fattest_flow();
+  }
+}
+
+// Over the limit, drop from the head of the flow with the largest backlog. Like Linux, drop half of its backlog
+// (up to 64 frames) at once, rather than scanning every flow on each arrival.
+void FQCoDelQdisc::drop_from_fattest_flow()
+{
+  const auto fattest = ranges::max_element( flows_, {}, &Flow::bytes );
+  const size_t to_drop = min<size_t>( 64, ( fattest->queue.size() + 1 ) / 2 );
+  for ( size_t i = 0; i < to_drop; i++ ) {
+    fattest->bytes -= fattest->queue.front().size;
+    dropped( fattest->queue.front() );
+    fattest->queue.pop_front();
+  }
+}
+
+uint64_t FQCoDelQdisc::control_law( uint64_t t, uint32_t count ) const
+{
+  // time is in milliseconds, so keep drops at least 1 ms apart (or a whole queue could go in one millisecond)
+  const double gap = static_cast<double>( interval_ ) / sqrt( static_cast<double>( count ) );
+  return t + max<uint64_t>( static_cast<uint64_t>( gap ), 1 );
+}
+
+optional<Qdisc::Entry> FQCoDelQdisc::codel_pop( Flow& flow, uint64_t now, bool& ok_to_drop )
+{
+  ok_to_drop = false;
+  if ( flow.queue.empty() ) {
+    flow.first_above_time = 0;
+    return {};
+  }
+  Entry entry = move( flow.queue.front() );
+  flow.queue.pop_front();
+  flow.bytes -= entry.size;
+
+  // not congested if the frame waited less than the target, or less than a full frame is left
+  const uint64_t sojourn = now - entry.arrival;
+  if ( sojourn < target_ or flow.bytes <= quantum_ ) {
+    flow.first_above_time = 0;
+  } else if ( flow.first_above_time == 0 ) {
+    flow.first_above_time = now + interval_;
+  } else if ( now >= flow.first_above_time ) {
+    ok_to_drop = true;
+  }
+  return entry;
+}
+
+optional<Qdisc::Entry> FQCoDelQdisc::codel_dequeue( Flow& flow, uint64_t now )
+{
+  bool ok_to_drop = false;
+  optional<Entry> entry = codel_pop( flow, now, ok_to_drop );
+  if ( not entry ) {
+    flow.dropping = false;
+    return {};
+  }
+
+  const auto drop = [&] {
+    dropped( *entry );
+    entry = codel_pop( flow, now, ok_to_drop );
+  };
+
+  if ( flow.dropping ) {
+    if ( not ok_to_drop ) {
+      flow.dropping = false;
+    }
+    while ( entry and flow.dropping and now >= flow.drop_next ) {
+      drop();
+      flow.count++;
+      if ( not ok_to_drop ) {
+        flow.dropping = false;
+      } else {
+        flow.drop_next = control_law( flow.drop_next, flow.count );
+      }
+    }
+  } else if ( ok_to_drop ) {
+    drop();
+    flow.dropping = true;
+    // if the flow left the dropping state recently, resume near the drop rate it had reached. It usually left
+    // before drop_next came, so compare as signed (as Linux's codel_time_before does) rather than let now -
+    // drop_next wrap around
+    const uint32_t delta = flow.count - flow.last_count;
+    const bool recently = static_cast<int64_t>( now - flow.drop_next ) < static_cast<int64_t>( 16 * interval_ );
+    flow.count = ( delta > 1 and recently ) ? delta : 1;
+    flow.drop_next = control_law( now, flow.count );
+    flow.last_count = flow.count;
+  }
+  return entry;
+}
+
+optional<EthernetFrame> FQCoDelQdisc::dequeue( uint64_t now )
+{
+  while ( true ) {
+    const bool from_new = not new_flows_.empty();
+    deque<size_t>& list = from_new ? new_flows_ : old_flows_;
+    if ( list.empty() ) {
+      return {};
+    }
+    const size_t index = list.front();
+    Flow& flow = flows_[index];
+
+    // a flow that has used up its deficit gets another quantum and goes to the back of old_flows_
+    if ( flow.deficit <= 0 ) {
+      flow.deficit += static_cast<int64_t>( quantum_ );
+      list.pop_front();
+      old_flows_.push_back( index );
+      continue;
+    }
+
+    optional<Entry> entry = codel_dequeue( flow, now );
+    if ( not entry ) {
+      // an empty new flow makes one pass through old_flows_ (so that old flows cannot starve); an empty old
+      // flow leaves the schedule
+      list.pop_front();
+      if ( from_new and not old_flows_.empty() ) {
+        old_flows_.push_back( index );
+      } else {
+        flow.listed = false;
+      }
+      continue;
+    }
+
+    removed( *entry );
+    flow.deficit -= static_cast<int64_t>( entry->size );
+    return move( entry->frame );
+  }
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <vector>
+
+// An egress queueing discipline ("qdisc"). The frames that a NetworkInterface sends wait here until the
+// link has room for them; the discipline decides which frames to drop, and which frame goes next.
+// Time is in milliseconds, as counted by the interface's tick().
+class Qdisc
+{
+public:
+  // Offer a frame to the queue at time `now`. `flow` is a hash of the frame's flow (see FlowKey), for
+  // disciplines that keep flows apart. The frame (or another one) may be dropped.
+  virtual void enqueue( EthernetFrame frame, uint32_t flow, uint64_t now ) = 0;
+
+  // The next frame to send, if any
+  virtual std::optional<EthernetFrame> dequeue( uint64_t now ) = 0;
+
+  size_t packets() const { return packets_; }
+  size_t bytes() const { return bytes_; }
+  uint64_t drops() const { return drops_; }
+
+  // How many bytes a frame takes on the wire
+  static size_t frame_size( const EthernetFrame& frame );
+
+  Qdisc() = default;
+  Qdisc( const Qdisc& other ) = delete;
+  Qdisc& operator=( const Qdisc& other ) = delete;
+  virtual ~Qdisc() = default;
+
+protected:
+  // A queued frame, and when it arrived
+  struct Entry
+  {
+    EthernetFrame frame;
+    size_t size;
+    uint64_t arrival;
+  };
+
+  void added( const Entry& entry );
+  void removed( const Entry& entry );
+  void dropped( const Entry& entry );
+  void dropped_on_arrival() { drops_++; }
+
+private:
+  size_t packets_ {};
+  size_t bytes_ {};
+  uint64_t drops_ {};
+};
+
+// First in, first out, dropping arrivals once `limit` frames are waiting ("tail drop")
+class FIFOQdisc : public Qdisc
+{
+public:
+  explicit FIFOQdisc( size_t limit ) : limit_( limit ) {}
+
+  void enqueue( EthernetFrame frame, uint32_t flow, uint64_t now ) override;
+  std::optional<EthernetFrame> dequeue( uint64_t now ) override;
+
+private:
+  size_t limit_;
+  std::deque<Entry> queue_ {};
+};
+
+// Random Early Detection (Floyd and Jacobson, 1993): a FIFO that drops arrivals with a probability that
+// rises with the average queue length, so that senders back off before the queue is full.
+class REDQdisc : public Qdisc
+{
+public:
+  // Thresholds are in frames. Below `min_threshold` nothing is dropped early; between the thresholds the
+  // drop probability rises to `max_probability`; above `max_threshold` every arrival is dropped. `weight` is
+  // how quickly the average follows the instantaneous queue length.
+  REDQdisc( size_t limit,
+            double min_threshold,
+            double max_threshold,
+            double max_probability = 0.1,
+            double weight = 0.002 );
+
+  void enqueue( EthernetFrame frame, uint32_t flow, uint64_t now ) override;
+  std::optional<EthernetFrame> dequeue( uint64_t now ) override;
+
+  double average() const { return average_; }
+
+private:
+  bool early_drop( uint64_t now );
+
+  size_t limit_;
+  double min_threshold_;
+  double max_threshold_;
+  double max_probability_;
+  double weight_;
+
+  double average_ {};
+  int count_ { -1 };      // arrivals since the last early drop (-1 while the average is below min_threshold)
+  uint64_t idle_since_ {}; // when the queue last went empty
+  std::deque<Entry> queue_ {};
+  std::minstd_rand random_ {};
+};
+
+// Flow queueing with CoDel ([RFC 8290](\ref rfc::rfc8290)): flows hash to separate queues, served
+// round-robin by deficit (new flows first), and each queue runs CoDel ([RFC 8289](\ref rfc::rfc8289)),
+// dropping from its head while frames have waited longer than `target` for at least an `interval`.
+class FQCoDelQdisc : public Qdisc
+{
+public:
+  static constexpr size_t DEFAULT_LIMIT = 10240;
+  static constexpr size_t DEFAULT_FLOWS = 1024;
+  static constexpr uint64_t DEFAULT_TARGET = 5;    // ms
+  static constexpr uint64_t DEFAULT_INTERVAL = 100; // ms
+  static constexpr size_t DEFAULT_QUANTUM = 1514;  // bytes: a full-sized Ethernet frame
+
+  explicit FQCoDelQdisc( size_t limit = DEFAULT_LIMIT,
+                         size_t flows = DEFAULT_FLOWS,
+                         uint64_t target = DEFAULT_TARGET,
+                         uint64_t interval = DEFAULT_INTERVAL,
+                         size_t quantum = DEFAULT_QUANTUM );
+
+  void enqueue( EthernetFrame frame, uint32_t flow, uint64_t now ) override;
+  std::optional<EthernetFrame> dequeue( uint64_t now ) override;
+
+private:
+  struct Flow
+  {
+    std::deque<Entry> queue {};
+    size_t bytes {};
+    int64_t deficit {};
+    bool listed {}; // on new_flows_ or old_flows_
+
+    // CoDel's state
+    uint64_t first_above_time {};
+    uint64_t drop_next {};
+    uint32_t count {};
+    uint32_t last_count {};
+    bool dropping {};
+  };
+
+  // Remove the head of a flow's queue, and whether CoDel considers it to have waited too long
+  std::optional<Entry> codel_pop( Flow& flow, uint64_t now, bool& ok_to_drop );
+  std::optional<Entry> codel_dequeue( Flow& flow, uint64_t now );
+  uint64_t control_law( uint64_t t, uint32_t count ) const;
+  void drop_from_fattest_flow();
+
+  size_t limit_;
+  uint64_t target_;
+  uint64_t interval_;
+  size_t quantum_;
+  std::vector<Flow> flows_;
+  std::deque<size_t> new_flows_ {};
+  std::deque<size_t> old_flows_ {};
+};
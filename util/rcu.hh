@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+// Grace periods for read-copy-update: readers never block, and a writer that has unpublished some
+// data can wait until no reader can still be looking at it.
+//
+// Each reader thread registers once and gets its own slot (on its own cache line). Entering a read-side
+// section stores the current epoch in the slot, and leaving it stores 0. synchronize() advances the
+// epoch and then waits for every slot that holds an older epoch, i.e. for every section that may have
+// started before the call. Sections that start later see whatever the writer published beforehand.
+class RcuDomain
+{
+public:
+  static constexpr size_t MAX_READERS = 64;
+
+  // Reserve a slot for a reader thread (a slot must only be used by one thread at a time)
+  size_t register_reader()
+  {
+    const size_t reader = reader_count_.fetch_add( 1 );
+    if ( reader >= MAX_READERS ) {
+      reader_count_.fetch_sub( 1 );
+      throw std::runtime_error( "RcuDomain: too many readers" );
+    }
+    return reader;
+  }
+
+  void read_lock( size_t reader ) { slots_.at( reader ).epoch.store( epoch_.load() ); }
+  void read_unlock( size_t reader ) { slots_.at( reader ).epoch.store( 0, std::memory_order_release ); }
+
+  // Wait until every read-side section that began before this call has ended. Must not be called
+  // from inside a read-side section.
+  void synchronize()
+  {
+    const uint64_t target = epoch_.fetch_add( 1 ) + 1;
+    const size_t readers = std::min( reader_count_.load(), MAX_READERS );
+    for ( size_t reader = 0; reader < readers; reader++ ) {
+      while ( true ) {
+        const uint64_t epoch = slots_[reader].epoch.load( std::memory_order_acquire );
+        if ( epoch == 0 or epoch >= target ) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Marks a read-side section for the lifetime of the guard
+  class ReadGuard
+  {
+  public:
+    ReadGuard( RcuDomain& domain, size_t reader ) : domain_( domain ), reader_( reader )
+    {
+      domain_.read_lock( reader_ );
+    }
+    ~ReadGuard() { domain_.read_unlock( reader_ ); }
+    ReadGuard( const ReadGuard& ) = delete;
+    ReadGuard& operator=( const ReadGuard& ) = delete;
+
+  private:
+    RcuDomain& domain_;
+    size_t reader_;
+  };
+
+private:
+  struct alignas( 64 ) Slot
+  {
+    std::atomic<uint64_t> epoch {}; // 0 outside of read-side sections
+  };
+
+  std::array<Slot, MAX_READERS> slots_ {};
+  std::atomic<uint64_t> epoch_ { 1 };
+  std::atomic<size_t> reader_count_ {};
+};
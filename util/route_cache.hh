@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+// A small two-way set-associative cache of recent route lookups: destination address -> value
+// (e.g. the index of the matching route).
+//
+// Every entry is stamped with the generation it was filled in. invalidate() just bumps the
+// current generation, which makes every older entry a miss, so flushing the cache after a
+// routing change costs O(1) instead of a pass over the whole cache.
+class RouteCache
+{
+public:
+  // `sets` is rounded up to a power of two; 0 disables the cache. Resizing empties the cache and
+  // resets its counters.
+  explicit RouteCache( size_t sets = 0 ) { resize( sets ); }
+
+  std::optional<uint32_t> find( uint32_t address )
+  {
+    if ( sets_.empty() ) {
+      return {};
+    }
+    Set& set = sets_[index( address )];
+    for ( size_t way = 0; way < WAYS; way++ ) {
+      if ( set.ways[way].generation == generation_ and set.ways[way].address == address ) {
+        set.recent = static_cast<uint8_t>( way );
+        hits_++;
+        return set.ways[way].value;
+      }
+    }
+    misses_++;
+    return {};
+  }
+
+  // Remember a lookup result, evicting the less recently used way of its set
+  void insert( uint32_t address, uint32_t value )
+  {
+    if ( sets_.empty() ) {
+      return;
+    }
+    Set& set = sets_[index( address )];
+    size_t victim = set.recent ^ 1U;
+    for ( size_t way = 0; way < WAYS; way++ ) {
+      if ( set.ways[way].generation != generation_ or set.ways[way].address == address ) {
+        victim = way;
+        break;
+      }
+    }
+    set.ways[victim] = { address, generation_, value };
+    set.recent = static_cast<uint8_t>( victim );
+  }
+
+  // Forget everything (called whenever the routes change)
+  void invalidate()
+  {
+    if ( ++generation_ == 0 ) {
+      // the stamps wrapped around: old entries could look current again, so really clear them
+      for ( auto& set : sets_ ) {
+        set = {};
+      }
+      generation_ = 1;
+    }
+  }
+
+  void resize( size_t sets )
+  {
+    if ( sets > ( size_t { 1 } << 24U ) ) {
+      throw std::runtime_error( "RouteCache: too many sets" );
+    }
+    size_t rounded = sets == 0 ? 0 : 1;
+    while ( rounded < sets ) {
+      rounded *= 2;
+    }
+    sets_.assign( rounded, {} );
+    mask_ = rounded == 0 ? 0 : rounded - 1;
+    generation_ = 1;
+    reset_counters();
+  }
+
+  size_t sets() const { return sets_.size(); }
+  size_t capacity() const { return sets_.size() * WAYS; }
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+  double hit_rate() const
+  {
+    const uint64_t lookups = hits_ + misses_;
+    return lookups == 0 ? 0 : static_cast<double>( hits_ ) / static_cast<double>( lookups );
+  }
+  void reset_counters() { hits_ = misses_ = 0; }
+
+private:
+  static constexpr size_t WAYS = 2;
+
+  struct Way
+  {
+    uint32_t address {};
+    uint32_t generation {}; // 0 never matches: generations start at 1
+    uint32_t value {};
+  };
+
+  struct Set
+  {
+    std::array<Way, WAYS> ways {};
+    uint8_t recent {}; // the way hit or filled last
+  };
+
+  std::vector<Set> sets_ {};
+  size_t mask_ {};
+  uint32_t generation_ { 1 };
+  uint64_t hits_ {};
+  uint64_t misses_ {};
+
+  // Multiplicative hashing, so that consecutive addresses spread over the sets
+  size_t index( uint32_t address ) const { return ( ( address * 0x9e3779b1U ) >> 8U ) & mask_; }
+};
@@ -0,0 +1,213 @@
+#include "small_route_table.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define MINNOW_X86 1
+#endif
+
+using namespace std;
+
+namespace {
+uint32_t mask_for( uint8_t length )
+{
+  return length == 0 ? 0 : UINT32_MAX << ( 32U - length );
+}
+} // namespace
+
+bool SmallRouteTable::supported( Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return true;
+#ifdef MINNOW_X86
+    case Kernel::SSE41:
+      return __builtin_cpu_supports( "sse4.1" );
+    case Kernel::AVX2:
+      return __builtin_cpu_supports( "avx2" );
+#endif
+    default:
+      return false;
+  }
+}
+
+SmallRouteTable::Kernel SmallRouteTable::best_kernel()
+{
+  static const Kernel best = [] {
+    for ( const Kernel kernel : { Kernel::AVX2, Kernel::SSE41 } ) {
+      if ( supported( kernel ) ) {
+        return kernel;
+      }
+    }
+    return Kernel::Scalar;
+  }();
+  return best;
+}
+
+string_view SmallRouteTable::name( Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::SSE41:
+      return "SSE4.1";
+    case Kernel::AVX2:
+      return "AVX2";
+  }
+  return "unknown";
+}
+
+optional<size_t> SmallRouteTable::find_slot( uint32_t prefix, uint8_t length ) const
+{
+  for ( size_t slot = 0; slot < CAPACITY; slot++ ) {
+    if ( keys_[slot] != 0 and prefixes_[slot] == prefix and masks_[slot] == mask_for( length ) ) {
+      return slot;
+    }
+  }
+  return {};
+}
+
+bool SmallRouteTable::insert( uint32_t prefix, uint8_t length, uint32_t value )
+{
+  if ( length > 32 ) {
+    throw runtime_error( "SmallRouteTable: prefix length " + to_string( length ) + " is longer than 32" );
+  }
+  prefix &= mask_for( length );
+  optional<size_t> slot = find_slot( prefix, length );
+  if ( not slot.has_value() ) {
+    const auto free_slot = ranges::find( keys_, 0 );
+    if ( free_slot == keys_.end() ) {
+      return false;
+    }
+    slot = free_slot - keys_.begin();
+    prefixes_[*slot] = prefix;
+    masks_[*slot] = mask_for( length );
+    keys_[*slot] = static_cast<int32_t>( ( ( length + 1U ) << SLOT_BITS ) | *slot );
+    size_++;
+    update_scan_end();
+  }
+  values_[*slot] = value;
+  return true;
+}
+
+bool SmallRouteTable::erase( uint32_t prefix, uint8_t length )
+{
+  if ( length > 32 ) {
+    return false;
+  }
+  const optional<size_t> slot = find_slot( prefix & mask_for( length ), length );
+  if ( not slot.has_value() ) {
+    return false;
+  }
+  prefixes_[*slot] = 0;
+  masks_[*slot] = 0;
+  keys_[*slot] = 0;
+  values_[*slot] = 0;
+  size_--;
+  update_scan_end();
+  return true;
+}
+
+void SmallRouteTable::clear()
+{
+  prefixes_ = {};
+  masks_ = {};
+  keys_ = {};
+  values_ = {};
+  size_ = 0;
+  scan_end_ = 0;
+}
+
+void SmallRouteTable::update_scan_end()
+{
+  size_t end = CAPACITY;
+  while ( end > 0 and keys_[end - 1] == 0 ) {
+    end--;
+  }
+  scan_end_ = ( end + 7 ) / 8 * 8;
+}
+
+optional<uint32_t> SmallRouteTable::value_for( int32_t best_key ) const
+{
+  if ( best_key == 0 ) {
+    return {};
+  }
+  return values_[static_cast<uint32_t>( best_key ) & ( ( 1U << SLOT_BITS ) - 1 )];
+}
+
+optional<uint32_t> SmallRouteTable::lookup( Kernel kernel, uint32_t address ) const
+{
+  switch ( kernel ) {
+#ifdef MINNOW_X86
+    case Kernel::AVX2:
+      return value_for( best_key_avx2( address ) );
+    case Kernel::SSE41:
+      return value_for( best_key_sse41( address ) );
+#endif
+    default:
+      return value_for( best_key_scalar( address ) );
+  }
+}
+
+int32_t SmallRouteTable::best_key_scalar( uint32_t address ) const
+{
+  int32_t best = 0;
+  for ( size_t i = 0; i < scan_end_; i++ ) {
+    if ( ( address & masks_[i] ) == prefixes_[i] ) {
+      best = max( best, keys_[i] );
+    }
+  }
+  return best;
+}
+
+#ifdef MINNOW_X86
+// Four routes per instruction: keep each matching lane's key, then take the lane-wise maximum
+__attribute__( ( target( "sse4.1" ) ) ) int32_t SmallRouteTable::best_key_sse41( uint32_t address ) const
+{
+  const __m128i dst = _mm_set1_epi32( static_cast<int32_t>( address ) );
+  __m128i best = _mm_setzero_si128();
+  for ( size_t i = 0; i < scan_end_; i += 4 ) {
+    const __m128i mask = _mm_load_si128( reinterpret_cast<const __m128i*>( &masks_[i] ) );
+    const __m128i prefix = _mm_load_si128( reinterpret_cast<const __m128i*>( &prefixes_[i] ) );
+    const __m128i key = _mm_load_si128( reinterpret_cast<const __m128i*>( &keys_[i] ) );
+    const __m128i match = _mm_cmpeq_epi32( _mm_and_si128( dst, mask ), prefix );
+    best = _mm_max_epi32( best, _mm_and_si128( match, key ) );
+  }
+  // reduce the four lanes
+  best = _mm_max_epi32( best, _mm_shuffle_epi32( best, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+  best = _mm_max_epi32( best, _mm_shuffle_epi32( best, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+  return _mm_cvtsi128_si32( best );
+}
+
+// Eight routes per instruction
+__attribute__( ( target( "avx2" ) ) ) int32_t SmallRouteTable::best_key_avx2( uint32_t address ) const
+{
+  const __m256i dst = _mm256_set1_epi32( static_cast<int32_t>( address ) );
+  __m256i best = _mm256_setzero_si256();
+  for ( size_t i = 0; i < scan_end_; i += 8 ) {
+    const __m256i mask = _mm256_load_si256( reinterpret_cast<const __m256i*>( &masks_[i] ) );
+    const __m256i prefix = _mm256_load_si256( reinterpret_cast<const __m256i*>( &prefixes_[i] ) );
+    const __m256i key = _mm256_load_si256( reinterpret_cast<const __m256i*>( &keys_[i] ) );
+    const __m256i match = _mm256_cmpeq_epi32( _mm256_and_si256( dst, mask ), prefix );
+    best = _mm256_max_epi32( best, _mm256_and_si256( match, key ) );
+  }
+  // fold the two halves, then reduce the remaining four lanes
+  __m128i half = _mm_max_epi32( _mm256_castsi256_si128( best ), _mm256_extracti128_si256( best, 1 ) );
+  half = _mm_max_epi32( half, _mm_shuffle_epi32( half, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+  half = _mm_max_epi32( half, _mm_shuffle_epi32( half, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+  return _mm_cvtsi128_si32( half );
+}
+#else
+int32_t SmallRouteTable::best_key_sse41( uint32_t address ) const
+{
+  return best_key_scalar( address );
+}
+
+int32_t SmallRouteTable::best_key_avx2( uint32_t address ) const
+{
+  return best_key_scalar( address );
+}
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Longest-prefix match over a handful of routes (at most CAPACITY), with SIMD.
+//
+// The prefixes, masks and values are stored as separate arrays (structure-of-arrays), so one vector
+// instruction can test a destination against 8 routes (AVX2) or 4 (SSE4.1). Each matching lane yields
+// a key made of the route's prefix length and its slot, and a vector max over the keys picks the longest
+// match. For a table this small, scanning all of it this way beats walking a trie. The kernel is picked
+// once, at run time, from what the CPU supports, with a plain loop as the fallback.
+class SmallRouteTable
+{
+public:
+  static constexpr size_t CAPACITY = 64;
+
+  enum class Kernel : uint8_t
+  {
+    Scalar,
+    SSE41,
+    AVX2,
+  };
+
+  // The fastest kernel this CPU can run
+  static Kernel best_kernel();
+  static bool supported( Kernel kernel );
+  static std::string_view name( Kernel kernel );
+
+  SmallRouteTable() : kernel_( best_kernel() ) {}
+
+  // Add a prefix, or replace the value stored for it. Returns false (and changes nothing) if the
+  // prefix is new and the table is full.
+  bool insert( uint32_t prefix, uint8_t length, uint32_t value );
+
+  // Remove a prefix. Returns whether it was present.
+  bool erase( uint32_t prefix, uint8_t length );
+
+  // The value of the longest prefix that contains `address`
+  std::optional<uint32_t> lookup( uint32_t address ) const { return lookup( kernel_, address ); }
+
+  // The same, with a particular kernel (which must be supported)
+  std::optional<uint32_t> lookup( Kernel kernel, uint32_t address ) const;
+
+  void clear();
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == CAPACITY; }
+
+private:
+  // keys_[i] is ( prefix length + 1 ) << 8 | i for a slot in use, and 0 for a free one, so the largest
+  // key among the matching slots belongs to the longest match (and 0 means no match)
+  static constexpr unsigned SLOT_BITS = 8;
+
+  alignas( 32 ) std::array<uint32_t, CAPACITY> prefixes_ {};
+  alignas( 32 ) std::array<uint32_t, CAPACITY> masks_ {};
+  alignas( 32 ) std::array<int32_t, CAPACITY> keys_ {};
+  std::array<uint32_t, CAPACITY> values_ {};
+  size_t size_ {};
+  size_t scan_end_ {}; // slots past this are all free (a multiple of 8, so every kernel can stop there)
+  Kernel kernel_;
+
+  std::optional<size_t> find_slot( uint32_t prefix, uint8_t length ) const;
+  std::optional<uint32_t> value_for( int32_t best_key ) const;
+  void update_scan_end();
+
+  int32_t best_key_scalar( uint32_t address ) const;
+  int32_t best_key_sse41( uint32_t address ) const;
+  int32_t best_key_avx2( uint32_t address ) const;
+};
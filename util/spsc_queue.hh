@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// A bounded, lock-free queue for exactly one producer thread and one consumer thread.
+//
+// The ring has a power-of-two number of slots. The producer only writes `tail_` and the consumer only
+// writes `head_`, each on its own cache line; each side also keeps a private copy of the other's
+// index, so it only has to read the shared one (and take a cache miss) when the ring looks full or empty.
+template<typename T>
+  requires std::default_initializable<T> and std::movable<T>
+class SPSCQueue
+{
+public:
+  explicit SPSCQueue( size_t capacity ) : slots_( round_up_capacity( capacity ) ), mask_( slots_.size() - 1 ) {}
+
+  // Producer: enqueue `item`, unless the queue is full (in which case `item` is left untouched)
+  bool push( T&& item )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - cached_head_ == slots_.size() ) {
+      cached_head_ = head_.load( std::memory_order_acquire );
+      if ( tail - cached_head_ == slots_.size() ) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = std::move( item );
+    tail_.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  // Consumer: dequeue the oldest item, if any
+  std::optional<T> pop()
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == cached_tail_ ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head == cached_tail_ ) {
+        return {};
+      }
+    }
+    std::optional<T> ret { std::move( slots_[head & mask_] ) };
+    head_.store( head + 1, std::memory_order_release );
+    return ret;
+  }
+
+  // Approximate number of queued items (exact when called by the producer or consumer while the other is idle)
+  size_t size() const { return tail_.load( std::memory_order_acquire ) - head_.load( std::memory_order_acquire ); }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return slots_.size(); }
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  static size_t round_up_capacity( size_t n )
+  {
+    size_t capacity = 2;
+    while ( capacity < n ) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  std::vector<T> slots_;
+  size_t mask_;
+
+  alignas( CACHE_LINE ) std::atomic<size_t> head_ { 0 }; // next slot to read (written by the consumer)
+  size_t cached_tail_ { 0 };                             // the consumer's last view of `tail_`
+
+  alignas( CACHE_LINE ) std::atomic<size_t> tail_ { 0 }; // next slot to write (written by the producer)
+  size_t cached_head_ { 0 };                             // the producer's last view of `head_`
+};
@@ -13,12 +13,15 @@ public:
   static constexpr size_t DEFAULT_CAPACITY = 64000; //!< Default capacity
   static constexpr size_t MAX_PAYLOAD_SIZE = 1000;  //!< Conservative max payload size for real Internet
   static constexpr uint16_t TIMEOUT_DFLT = 1000;    //!< Default re-transmit timeout is 1 second
+  static constexpr uint16_t TIMEOUT_MIN = 200;      //!< Lower bound on a measured (RTT-derived) timeout
+  static constexpr uint16_t TIMEOUT_MAX = 60000;    //!< Upper bound on a measured (RTT-derived) timeout
   static constexpr unsigned MAX_RETX_ATTEMPTS = 8;  //!< Maximum re-transmit attempts before giving up
 
   uint16_t rt_timeout = TIMEOUT_DFLT;      //!< Initial value of the retransmission timeout, in milliseconds
   size_t recv_capacity = DEFAULT_CAPACITY; //!< Receive capacity, in bytes
   size_t send_capacity = DEFAULT_CAPACITY; //!< Sender capacity, in bytes
   Wrap32 isn { 137 };                      //!< Default initial sequence number
+  bool timestamps = true;                  //!< Use RFC 7323 timestamps (RTTM and PAWS)
 };
 
 //! Config for classes derived from FdAdapter
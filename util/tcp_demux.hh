@@ -0,0 +1,177 @@
+#pragma once
+
+#include "flat_hash_map.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tun.hh"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+// The 4-tuple that identifies a TCP connection, from the point of view of the local endpoint
+struct TCPFourTuple
+{
+  uint32_t local_ip {};
+  uint32_t remote_ip {};
+  uint16_t local_port {};
+  uint16_t remote_port {};
+
+  bool operator==( const TCPFourTuple& other ) const = default;
+
+  // Return a string containing the tuple in human-readable format
+  std::string to_string() const;
+};
+
+struct TCPFourTupleHash
+{
+  size_t operator()( const TCPFourTuple& t ) const
+  {
+    const uint64_t ips = ( uint64_t { t.local_ip } << 32U ) | t.remote_ip;
+    const uint64_t ports = ( uint64_t { t.local_port } << 16U ) | t.remote_port;
+    return hash_mix( ips ) ^ ports;
+  }
+};
+
+// Serves many TCP connections over one stream of IPv4 datagrams (e.g. a single TUN device).
+//
+// Incoming datagrams are parsed and dispatched by 4-tuple to a per-connection TCPPeer, found in a
+// flat open-addressing hash table. A SYN addressed to a listening port spawns a new peer; once its
+// handshake completes, the connection can be retrieved with accept(). Outgoing segments are wrapped
+// in IPv4 and handed to the `transmit` function.
+//
+// Each listening port bounds its half-open connections (the SYN queue) and its completed but not yet
+// accepted connections (the accept queue). When the SYN queue is full, the listener answers with a
+// SYN cookie instead of keeping state: the ISN of its SYN-ACK encodes a keyed hash of the 4-tuple,
+// the client's ISN and a coarse timestamp, and the connection is only created when an ACK arrives
+// that acknowledges a valid cookie.
+class TCPDemultiplexer
+{
+public:
+  struct ListenOptions
+  {
+    size_t syn_backlog = 256;    // maximum number of half-open connections
+    size_t accept_backlog = 128; // maximum number of established connections waiting for accept()
+    bool syn_cookies = true;     // answer SYNs statelessly when the SYN queue is full (otherwise drop them)
+  };
+
+  struct ListenerCounters
+  {
+    uint64_t syns_received {};          // SYNs that could open a connection
+    uint64_t syns_dropped {};           // SYNs dropped because the SYN queue was full (and cookies are off)
+    uint64_t syn_cookies_sent {};       // SYN-ACKs sent with a cookie instead of a half-open connection
+    uint64_t syn_cookies_accepted {};   // connections created from a valid cookie
+    uint64_t syn_cookies_rejected {};   // ACKs to the listening port with no connection and no valid cookie
+    uint64_t accept_queue_overflows {}; // handshake-completing segments dropped because the accept queue was full
+  };
+
+  // Cookies are stamped with the time in units of this many milliseconds, and expire after
+  // MAX_COOKIE_AGE units (so a cookie stays valid for two to three periods)
+  static constexpr uint64_t COOKIE_PERIOD_MS = 64000;
+  static constexpr uint32_t MAX_COOKIE_AGE = 2;
+
+  // The datagram's payload may borrow from the connection, so it must be serialized (or copied) before returning
+  using TransmitFunction = std::function<void( const InternetDatagram& )>;
+
+  TCPDemultiplexer( const TCPConfig& cfg, TransmitFunction transmit );
+
+  // Accept connections to this local TCP port (on any local address)
+  void listen( uint16_t port, const ListenOptions& options );
+  void listen( uint16_t port ) { listen( port, {} ); }
+
+  // Open a connection from `tuple.local_*` to `tuple.remote_*` (sends a SYN).
+  // Throws if a connection with this 4-tuple already exists.
+  TCPPeer& connect( const TCPFourTuple& tuple );
+
+  // Dispatch an incoming datagram to its connection. Datagrams that are not TCP, fail to parse,
+  // or belong to no connection (and are not a SYN to a listening port) are dropped.
+  void receive( InternetDatagram dgram );
+
+  // Time has passed: tick every connection, and forget connections that are no longer active
+  void tick( uint64_t ms_since_last_tick );
+
+  // Send any bytes the application has written to the connection's outbound stream
+  void push( const TCPFourTuple& tuple );
+
+  // The next passive connection whose handshake has completed, if any (from any listening port)
+  std::optional<TCPFourTuple> accept();
+
+  // Statistics for a listening port (throws if nothing is listening on it)
+  const ListenerCounters& counters( uint16_t port ) const;
+
+  // The peer for a connection, or nullptr if there is none (or it has finished and been forgotten).
+  // The reference stays valid until the connection is forgotten by tick().
+  TCPPeer* find( const TCPFourTuple& tuple );
+
+  size_t connection_count() const { return connections_.size(); }
+
+private:
+  struct Connection
+  {
+    TCPPeer peer;
+    bool passive {};     // spawned by a listening port (and not yet handed to accept())
+    bool established {}; // our SYN has been acknowledged
+    TCPPeer::TransmitFunction transmit {}; // built once: it is too big to construct per segment without allocating
+  };
+
+  struct Listener
+  {
+    uint16_t port {};
+    ListenOptions options {};
+    size_t half_open {}; // passive connections that are not yet established
+    std::queue<TCPFourTuple> accept_queue {};
+    ListenerCounters counters {};
+  };
+
+  TCPConfig cfg_;
+  TransmitFunction transmit_;
+  std::default_random_engine isn_generator_;
+  uint64_t cookie_secret_;
+  uint64_t clock_ms_ {};
+  std::vector<Listener> listeners_ {};
+
+  // Connections are boxed so that peers do not move when the table grows
+  FlatHashMap<TCPFourTuple, std::unique_ptr<Connection>, TCPFourTupleHash> connections_ {};
+
+  Listener* find_listener( uint16_t port );
+  Connection& add_connection( const TCPFourTuple& tuple, bool passive, Wrap32 isn );
+  TCPPeer::TransmitFunction make_transmit( const TCPFourTuple& tuple ) const;
+  void check_established( const TCPFourTuple& tuple, Connection& connection );
+  void forget( const TCPFourTuple& tuple, const Connection& connection );
+
+  void receive_on_listener( Listener& listener, const TCPFourTuple& tuple, TCPMessage&& msg );
+  Wrap32 syn_cookie( const TCPFourTuple& tuple, Wrap32 client_isn, uint32_t time ) const;
+  bool check_syn_cookie( const TCPFourTuple& tuple, Wrap32 client_isn, Wrap32 cookie ) const;
+};
+
+// A TCPDemultiplexer that reads and writes IPv4 datagrams on a TUN device
+class TCPDemultiplexerOverTun
+{
+public:
+  TCPDemultiplexerOverTun( TunFD&& tun, const TCPConfig& cfg );
+
+  // Read one datagram from the TUN device (e.g. when it is readable) and dispatch it
+  void read();
+
+  TCPDemultiplexer& demux() { return demux_; }
+
+  // Access underlying file descriptor (e.g. to add to an EventLoop)
+  FileDescriptor& fd() { return tun_; }
+
+  // The transmit function refers to this object, so it cannot be moved
+  TCPDemultiplexerOverTun( const TCPDemultiplexerOverTun& other ) = delete;
+  TCPDemultiplexerOverTun& operator=( const TCPDemultiplexerOverTun& other ) = delete;
+  TCPDemultiplexerOverTun( TCPDemultiplexerOverTun&& other ) = delete;
+  TCPDemultiplexerOverTun& operator=( TCPDemultiplexerOverTun&& other ) = delete;
+  ~TCPDemultiplexerOverTun() = default;
+
+private:
+  TunFD tun_;
+  TCPDemultiplexer demux_;
+};
@@ -0,0 +1,186 @@
+#include "tcp_options.hh"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+constexpr uint8_t MSS_LENGTH = 4;
+constexpr uint8_t WINDOW_SCALE_LENGTH = 3;
+constexpr uint8_t SACK_PERMITTED_LENGTH = 2;
+constexpr uint8_t TIMESTAMPS_LENGTH = 10;
+constexpr uint8_t SACK_BLOCK_LENGTH = 8;
+} // namespace
+
+void TCPOptions::add_sack_block( const SACKBlock block )
+{
+  if ( sack_block_count < MAX_SACK_BLOCKS ) {
+    sack_blocks.at( sack_block_count++ ) = block;
+  }
+}
+
+//! \details Every option is padded with NOPs to a 4-byte boundary:
+//! MSS (4 bytes), NOP + window scale (4), SACK-permitted + timestamps (12, or 4 or 12 with NOPs
+//! if only one is present) and NOP + NOP + SACK blocks (4 + 8 per block).
+//! SACK blocks that don't fit in the 40 bytes left by the other options are dropped from the end.
+uint8_t TCPOptions::serialized_sack_block_count() const
+{
+  uint8_t other = ( mss.has_value() ? MSS_LENGTH : 0 ) + ( window_scale.has_value() ? 4 : 0 );
+  if ( timestamps.has_value() ) {
+    other += 12;
+  } else if ( sack_permitted ) {
+    other += 4;
+  }
+  if ( other + 4 + SACK_BLOCK_LENGTH > MAX_LENGTH ) {
+    return 0;
+  }
+  return min<uint8_t>( sack_block_count, ( MAX_LENGTH - other - 4 ) / SACK_BLOCK_LENGTH );
+}
+
+uint8_t TCPOptions::serialized_length() const
+{
+  uint8_t len = ( mss.has_value() ? MSS_LENGTH : 0 ) + ( window_scale.has_value() ? 4 : 0 );
+  if ( timestamps.has_value() ) {
+    len += 12;
+  } else if ( sack_permitted ) {
+    len += 4;
+  }
+  const uint8_t blocks = serialized_sack_block_count();
+  if ( blocks ) {
+    len += 4 + ( blocks * SACK_BLOCK_LENGTH );
+  }
+  return len;
+}
+
+void TCPOptions::parse( Parser& parser, size_t length )
+{
+  *this = {};
+
+  while ( length > 0 and not parser.has_error() ) {
+    uint8_t kind {};
+    parser.integer( kind );
+    length--;
+    if ( kind == KIND_EOL ) {
+      break;
+    }
+    if ( kind == KIND_NOP ) {
+      continue;
+    }
+
+    uint8_t option_length {};
+    if ( length == 0 ) {
+      parser.set_error();
+      return;
+    }
+    parser.integer( option_length );
+    length--;
+    if ( option_length < 2 or option_length - 2U > length ) {
+      parser.set_error();
+      return;
+    }
+    const uint8_t body_length = option_length - 2;
+    length -= body_length;
+
+    // options with an unexpected length are skipped, as are options we don't understand
+    if ( kind == KIND_MSS and option_length == MSS_LENGTH ) {
+      uint16_t value {};
+      parser.integer( value );
+      mss = value;
+    } else if ( kind == KIND_WINDOW_SCALE and option_length == WINDOW_SCALE_LENGTH ) {
+      uint8_t value {};
+      parser.integer( value );
+      window_scale = min( value, MAX_WINDOW_SCALE );
+    } else if ( kind == KIND_SACK_PERMITTED and option_length == SACK_PERMITTED_LENGTH ) {
+      sack_permitted = true;
+    } else if ( kind == KIND_SACK and body_length > 0 and body_length % SACK_BLOCK_LENGTH == 0
+                and body_length / SACK_BLOCK_LENGTH <= MAX_SACK_BLOCKS ) {
+      sack_block_count = 0;
+      for ( uint8_t i = 0; i < body_length / SACK_BLOCK_LENGTH; i++ ) {
+        SACKBlock block;
+        parser.integer( block.left );
+        parser.integer( block.right );
+        add_sack_block( block );
+      }
+    } else if ( kind == KIND_TIMESTAMPS and option_length == TIMESTAMPS_LENGTH ) {
+      Timestamps value;
+      parser.integer( value.tsval );
+      parser.integer( value.tsecr );
+      timestamps = value;
+    } else {
+      parser.remove_prefix( body_length );
+    }
+  }
+
+  // skip anything after the end of the option list
+  parser.remove_prefix( length );
+}
+
+void TCPOptions::serialize( Serializer& serializer ) const
+{
+  if ( mss.has_value() ) {
+    serializer.integer( KIND_MSS );
+    serializer.integer( MSS_LENGTH );
+    serializer.integer( mss.value() );
+  }
+
+  if ( window_scale.has_value() ) {
+    serializer.integer( KIND_NOP );
+    serializer.integer( KIND_WINDOW_SCALE );
+    serializer.integer( WINDOW_SCALE_LENGTH );
+    serializer.integer( window_scale.value() );
+  }
+
+  if ( sack_permitted ) {
+    if ( not timestamps.has_value() ) {
+      serializer.integer( KIND_NOP );
+      serializer.integer( KIND_NOP );
+    }
+    serializer.integer( KIND_SACK_PERMITTED );
+    serializer.integer( SACK_PERMITTED_LENGTH );
+  }
+
+  if ( timestamps.has_value() ) {
+    if ( not sack_permitted ) {
+      serializer.integer( KIND_NOP );
+      serializer.integer( KIND_NOP );
+    }
+    serializer.integer( KIND_TIMESTAMPS );
+    serializer.integer( TIMESTAMPS_LENGTH );
+    serializer.integer( timestamps->tsval );
+    serializer.integer( timestamps->tsecr );
+  }
+
+  const uint8_t blocks = serialized_sack_block_count();
+  if ( blocks ) {
+    serializer.integer( KIND_NOP );
+    serializer.integer( KIND_NOP );
+    serializer.integer( KIND_SACK );
+    serializer.integer( static_cast<uint8_t>( 2 + ( blocks * SACK_BLOCK_LENGTH ) ) );
+    for ( uint8_t i = 0; i < blocks; i++ ) {
+      serializer.integer( sack_blocks.at( i ).left );
+      serializer.integer( sack_blocks.at( i ).right );
+    }
+  }
+}
+
+string TCPOptions::to_string() const
+{
+  stringstream ss {};
+  if ( mss.has_value() ) {
+    ss << " mss=" << mss.value();
+  }
+  if ( window_scale.has_value() ) {
+    ss << " wscale=" << +window_scale.value();
+  }
+  if ( sack_permitted ) {
+    ss << " sackOK";
+  }
+  for ( uint8_t i = 0; i < sack_block_count; i++ ) {
+    ss << " sack<" << sack_blocks.at( i ).left << "-" << sack_blocks.at( i ).right << ">";
+  }
+  if ( timestamps.has_value() ) {
+    ss << " TS<" << timestamps->tsval << "," << timestamps->tsecr << ">";
+  }
+  return ss.str();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "parser.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// The options carried in a TCP header ([RFC 9293](\ref rfc::rfc9293) section 3.1), parsed into a
+// compact fixed-size form (no heap allocation). Unknown options are skipped when parsing.
+struct TCPOptions
+{
+  static constexpr uint8_t KIND_EOL = 0;            // End of option list
+  static constexpr uint8_t KIND_NOP = 1;            // No-operation (padding)
+  static constexpr uint8_t KIND_MSS = 2;            // Maximum segment size (RFC 9293)
+  static constexpr uint8_t KIND_WINDOW_SCALE = 3;   // Window scale (RFC 7323)
+  static constexpr uint8_t KIND_SACK_PERMITTED = 4; // SACK permitted (RFC 2018)
+  static constexpr uint8_t KIND_SACK = 5;           // SACK blocks (RFC 2018)
+  static constexpr uint8_t KIND_TIMESTAMPS = 8;     // Timestamps (RFC 7323)
+
+  static constexpr uint8_t MAX_LENGTH = 40;       // Options can use at most 40 bytes of the header
+  static constexpr uint8_t MAX_WINDOW_SCALE = 14; // Larger shift counts are treated as 14 (RFC 7323)
+  static constexpr size_t MAX_SACK_BLOCKS = 4;    // At most four blocks fit in the option space
+
+  // One SACK block: the (raw, wrapped) sequence numbers of the first and one-past-last bytes received
+  struct SACKBlock
+  {
+    uint32_t left {};
+    uint32_t right {};
+    bool operator==( const SACKBlock& other ) const = default;
+  };
+
+  // The two values carried by the timestamps option
+  struct Timestamps
+  {
+    uint32_t tsval {};
+    uint32_t tsecr {};
+    bool operator==( const Timestamps& other ) const = default;
+  };
+
+  std::optional<uint16_t> mss {};
+  std::optional<uint8_t> window_scale {};
+  bool sack_permitted {};
+  std::array<SACKBlock, MAX_SACK_BLOCKS> sack_blocks {};
+  uint8_t sack_block_count {};
+  std::optional<Timestamps> timestamps {};
+
+  bool operator==( const TCPOptions& other ) const = default;
+
+  // Append a SACK block (ignored if all four slots are in use)
+  void add_sack_block( SACKBlock block );
+
+  // Number of SACK blocks that will fit alongside the other options
+  uint8_t serialized_sack_block_count() const;
+
+  // Length of the serialized options, including padding (always a multiple of four)
+  uint8_t serialized_length() const;
+
+  // Return a string containing the options in human-readable format
+  std::string to_string() const;
+
+  // Parse `length` bytes of options (the part of the header after the fixed 20 bytes)
+  void parse( Parser& parser, size_t length );
+  void serialize( Serializer& serializer ) const;
+};
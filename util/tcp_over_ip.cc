@@ -75,17 +75,29 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_d
 //! \param[in] seg is the TCP segment to convert
 InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
 {
-  const size_t payload_size = msg.sender->payload.size();
+  return wrap_tcp_in_ip( msg,
+                         config().source.ipv4_numeric(),
+                         config().source.port(),
+                         config().destination.ipv4_numeric(),
+                         config().destination.port() );
+}
+
+InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg,
+                                                     uint32_t src_ip,
+                                                     uint16_t src_port,
+                                                     uint32_t dst_ip,
+                                                     uint16_t dst_port )
+{
   TCPSegment seg { .message = { .sender = msg.sender.borrow(), .receiver = msg.receiver.borrow() } };
   // set the port numbers in the TCP segment
-  seg.udinfo.src_port = config().source.port();
-  seg.udinfo.dst_port = config().destination.port();
+  seg.udinfo.src_port = src_port;
+  seg.udinfo.dst_port = dst_port;
 
   // create an Internet Datagram and set its addresses and length
   InternetDatagram ip_dgram;
-  ip_dgram.header.src = config().source.ipv4_numeric();
-  ip_dgram.header.dst = config().destination.ipv4_numeric();
-  ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + payload_size;
+  ip_dgram.header.src = src_ip;
+  ip_dgram.header.dst = dst_ip;
+  ip_dgram.header.len = ip_dgram.header.hlen * 4 + seg.header_length() + msg.sender->payload.size();
 
   // set payload, calculating TCP checksum using information from IP header
   seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
@@ -13,4 +13,11 @@ public:
   std::optional<TCPMessage> unwrap_tcp_in_ip( InternetDatagram ip_dgram );
 
   InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+
+  //! Wrap a TCP message in an IPv4 datagram with the given (numeric) addresses and ports
+  static InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg,
+                                          uint32_t src_ip,
+                                          uint16_t src_port,
+                                          uint32_t dst_ip,
+                                          uint16_t dst_port );
 };
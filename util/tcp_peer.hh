@@ -56,6 +56,11 @@ public:
     // Record time in case this peer has to linger after streams finish.
     time_of_last_receipt_ = cumulative_time_;
 
+    // Timestamps are only used if both SYNs carry them (RFC 7323 section 3.2).
+    if ( msg.sender->SYN and not msg.sender->tsval.has_value() ) {
+      sender_.disable_timestamps();
+    }
+
     // If SenderMessage occupies a sequence number, make sure to reply.
     need_send_ |= ( msg.sender->sequence_length() > 0 );
 
@@ -88,7 +93,7 @@ public:
 
 private:
   TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout, cfg_.timestamps };
   TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
 
   bool need_send_ {};
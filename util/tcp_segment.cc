@@ -48,12 +48,18 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
   parser.integer( udinfo.cksum );
   parser.integer( raw16 ); // urgent pointer
 
-  // skip any options or anything extra in the header
   if ( data_offset < ( HEADER_LENGTH >> 2 ) ) {
     parser.set_error();
     return;
   }
-  parser.remove_prefix( ( data_offset * 4 ) - HEADER_LENGTH );
+
+  options.parse( parser, ( data_offset * 4 ) - HEADER_LENGTH );
+  if ( options.timestamps.has_value() ) {
+    message.sender->tsval = options.timestamps->tsval;
+    if ( message.receiver->ackno.has_value() ) {
+      message.receiver->tsecr = options.timestamps->tsecr; // TSecr is only valid if the ACK bit is set
+    }
+  }
 
   parser.concatenate_all_remaining( message.sender->payload );
 }
@@ -64,13 +70,25 @@ public:
   uint32_t raw_value() const { return raw_value_; }
 };
 
+TCPOptions TCPSegment::options_to_send() const
+{
+  TCPOptions ret = options;
+  ret.timestamps.reset();
+  if ( message.sender->tsval.has_value() ) {
+    ret.timestamps = { .tsval = message.sender->tsval.value(), .tsecr = message.receiver->tsecr.value_or( 0 ) };
+  }
+  return ret;
+}
+
 void TCPSegment::serialize( Serializer& serializer ) const
 {
+  const TCPOptions to_send = options_to_send();
   serializer.integer( udinfo.src_port );
   serializer.integer( udinfo.dst_port );
   serializer.integer( Wrap32Serializable { message.sender->seqno }.raw_value() );
   serializer.integer( Wrap32Serializable { message.receiver->ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
-  serializer.integer( uint8_t { ( HEADER_LENGTH >> 2 ) << 4 } ); // data offset
+  const uint8_t data_offset = ( HEADER_LENGTH + to_send.serialized_length() ) >> 2;
+  serializer.integer( static_cast<uint8_t>( data_offset << 4 ) ); // data offset
   const bool reset = message.sender->RST or message.receiver->RST;
   const uint8_t flags = ( message.receiver->ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
                         | ( message.sender->SYN ? 0b0000'0010U : 0 ) | ( message.sender->FIN ? 0b0000'0001U : 0 );
@@ -78,6 +96,7 @@ void TCPSegment::serialize( Serializer& serializer ) const
   serializer.integer( message.receiver->window_size );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
+  to_send.serialize( serializer );
   serializer.buffer( message.sender->payload );
 }
 
@@ -114,6 +133,7 @@ string TCPSegment::to_string() const
     ss << " ACK<" << Wrap32Serializable { *ackno }.raw_value() << ">";
   }
   ss << " winsize=" << message.receiver->window_size;
+  ss << options_to_send().to_string();
   ss << " src=" << udinfo.src_port << " dst=" << udinfo.dst_port;
   return ss.str();
 }
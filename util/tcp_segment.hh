@@ -2,6 +2,7 @@
 
 #include "parser.hh"
 #include "ref.hh"
+#include "tcp_options.hh"
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 #include "udinfo.hh"
@@ -16,11 +17,13 @@ struct TCPMessage
 };
 
 // A TCPSegment represents a complete (STD 7 / RFC 9293) TCP segment.
-// It includes a TCPMessage plus the UDP-like information included in the TCP header.
+// It includes a TCPMessage plus the UDP-like information included in the TCP header, and the header options.
+// (The timestamps option is carried in the TCPMessage as TSval/TSecr and takes precedence over `options`.)
 struct TCPSegment
 {
   TCPMessage message {};
   UserDatagramInfo udinfo {};
+  TCPOptions options {};
 
   void parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum );
   void serialize( Serializer& serializer ) const;
@@ -29,6 +32,15 @@ struct TCPSegment
 
   static constexpr uint8_t HEADER_LENGTH = 20; // TCP header length, not including options
 
+  // The options that serialize() will emit (`options`, with the timestamps taken from the message)
+  TCPOptions options_to_send() const;
+
+  // Length of the options (including padding) that serialize() will emit
+  uint8_t options_length() const { return options_to_send().serialized_length(); }
+
+  // Length of the full TCP header, including options
+  uint8_t header_length() const { return HEADER_LENGTH + options_length(); }
+
   // Return a string containing a summary in human-readable format
   std::string to_string() const;
 };
@@ -2,12 +2,14 @@
 
 #include "wrapping_integers.hh"
 
+#include <cstdint>
+#include <optional>
 #include <string>
 
 /*
  * The TCPSenderMessage structure contains the information sent from a TCP sender to its receiver.
  *
- * It contains five fields:
+ * It contains six fields:
  *
  * 1) The sequence number (seqno) of the beginning of the segment. If the SYN flag is set, this is the
  *    sequence number of the SYN flag. Otherwise, it's the sequence number of the beginning of the payload.
@@ -20,6 +22,9 @@
  * 4) The FIN flag. If set, the payload represents the ending of the byte stream.
  *
  * 5) The RST (reset) flag. If set, the stream has suffered an error and the connection should be aborted.
+ *
+ * 6) The timestamp value (TSval): the sender's clock when the segment was (re)transmitted, carried in the
+ *    [RFC 7323](\ref rfc::rfc7323) timestamps option. Empty if the sender does not use timestamps.
  */
 
 struct TCPSenderMessage
@@ -32,6 +37,8 @@ struct TCPSenderMessage
 
   bool RST {};
 
+  std::optional<uint32_t> tsval {};
+
   // How many sequence numbers does this segment use?
   size_t sequence_length() const { return SYN + payload.size() + FIN; }
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+#include "spsc_queue.hh"
+#include "tcp_config.hh"
+#include "tcp_demux.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a TCP stack on N worker threads, each owning a shard of the connections.
+//
+// A connection belongs to the shard selected by a hash of its 4-tuple (like receive-side scaling on a
+// NIC), so a connection's state is only ever touched by one thread and the shards need no locks.
+// The receiving thread calls dispatch() for every incoming datagram; it looks at the addresses and
+// ports (without parsing the segment) and steers the datagram to the owning worker through that
+// worker's lock-free single-producer/single-consumer queue. Each worker runs its own TCPDemultiplexer.
+//
+// Application code that uses a connection must run on the connection's worker: either in the service
+// callback, or in a task handed to post().
+class TCPShardedRuntime
+{
+public:
+  // Called from worker threads (concurrently, on different shards) with datagrams to send
+  using TransmitFunction = std::function<void( size_t shard, const InternetDatagram& dgram )>;
+
+  // Called on each worker thread about once per millisecond, after the shard's timers have run
+  using ServiceFunction = std::function<void( size_t shard, TCPDemultiplexer& demux )>;
+
+  using Task = std::function<void( TCPDemultiplexer& demux )>;
+
+  static constexpr size_t DEFAULT_QUEUE_CAPACITY = 4096;
+
+  TCPShardedRuntime( const TCPConfig& cfg,
+                     size_t worker_count,
+                     TransmitFunction transmit,
+                     size_t queue_capacity = DEFAULT_QUEUE_CAPACITY );
+
+  // Listen on a port in every shard (must be called before start())
+  void listen( uint16_t port, const TCPDemultiplexer::ListenOptions& options = {} );
+
+  // Start the worker threads
+  void start( ServiceFunction service = {} );
+
+  // Stop and join the worker threads (queued datagrams are discarded)
+  void stop();
+
+  // Steer an incoming datagram to its shard. Must only be called from one thread at a time.
+  // Returns false if the datagram is not TCP, or if the shard's queue is full; `dgram` is then
+  // left untouched, and the caller may retry or drop it.
+  bool dispatch( InternetDatagram&& dgram );
+
+  // Run `task` on the worker that owns `tuple` (e.g. to connect()). This is the control path: it takes a lock.
+  void post( const TCPFourTuple& tuple, Task task );
+
+  // Which shard owns a connection
+  size_t shard_of( const TCPFourTuple& tuple ) const;
+
+  size_t worker_count() const { return shards_.size(); }
+
+  // Datagrams steered to a shard, and datagrams dropped because its queue was full (read by the dispatching thread)
+  uint64_t dispatched( size_t shard ) const { return shards_.at( shard )->dispatched; }
+  uint64_t dropped( size_t shard ) const { return shards_.at( shard )->dropped; }
+
+  ~TCPShardedRuntime();
+  TCPShardedRuntime( const TCPShardedRuntime& other ) = delete;
+  TCPShardedRuntime& operator=( const TCPShardedRuntime& other ) = delete;
+  TCPShardedRuntime( TCPShardedRuntime&& other ) = delete;
+  TCPShardedRuntime& operator=( TCPShardedRuntime&& other ) = delete;
+
+private:
+  struct Shard
+  {
+    Shard( const TCPConfig& cfg, TCPDemultiplexer::TransmitFunction transmit, size_t queue_capacity );
+
+    SPSCQueue<InternetDatagram> queue;
+    TCPDemultiplexer demux;
+
+    std::mutex tasks_mutex {};
+    std::vector<Task> tasks {};
+    std::atomic<bool> has_tasks { false };
+
+    uint64_t dispatched {}; // written by the dispatching thread only
+    uint64_t dropped {};
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_ {};
+  std::vector<std::thread> workers_ {};
+  std::atomic<bool> running_ { false };
+
+  void run_worker( size_t index, const ServiceFunction& service );
+};
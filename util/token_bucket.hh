@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// A token bucket rate limiter: tokens accrue at `rate` a second, up to `burst` of them, and each event that
+// is let through spends one. Time passes by tick(), like minnow's other timers.
+class TokenBucket
+{
+public:
+  // The bucket starts out full
+  TokenBucket( uint64_t rate, uint64_t burst ) : rate_( rate ), capacity_( burst * 1000 ), millitokens_( capacity_ )
+  {}
+
+  void tick( uint64_t ms_since_last_tick )
+  {
+    // a token is 1000 millitokens, and `rate` tokens a second are `rate` millitokens a millisecond
+    // (comparing before multiplying, so that a long gap cannot overflow)
+    const uint64_t room = capacity_ - millitokens_;
+    if ( rate_ != 0 and ms_since_last_tick > room / rate_ ) {
+      millitokens_ = capacity_;
+    } else {
+      millitokens_ += rate_ * ms_since_last_tick;
+    }
+  }
+
+  // Spend a token if there is one
+  bool consume()
+  {
+    if ( millitokens_ < 1000 ) {
+      return false;
+    }
+    millitokens_ -= 1000;
+    return true;
+  }
+
+  uint64_t tokens() const { return millitokens_ / 1000; }
+
+private:
+  uint64_t rate_;
+  uint64_t capacity_;
+  uint64_t millitokens_;
+};